@@ -15,6 +15,7 @@
 #include "string-list.h"
 #include "dir.h"
 #include "parse-options.h"
+#include "thread-utils.h"
 
 /*
  *  --check turns on checking that the working tree matches the
@@ -74,6 +75,29 @@ static const char *root;
 static int root_len;
 static int read_stdin = 1;
 static int options;
+static int apply_threads = 1;
+
+#ifndef NO_PTHREADS
+static pthread_key_t trial_key;
+static int trials_running;
+
+/*
+ * Patches tried in worker threads (see try_patches()) must not say
+ * anything.  Whatever they would say marks the try as failed instead,
+ * and the patch is applied again in order, saying it then.
+ */
+static int trial_says_something(void)
+{
+	int *noisy;
+
+	if (!trials_running || !(noisy = pthread_getspecific(trial_key)))
+		return 0;
+	*noisy = 1;
+	return 1;
+}
+#else
+#define trial_says_something() 0
+#endif
 
 static void parse_whitespace_option(const char *option)
 {
@@ -187,9 +211,13 @@ struct patch {
 	unsigned int is_copy:1;
 	unsigned int is_rename:1;
 	unsigned int recount:1;
+	unsigned int shares_path:1;
+	unsigned int applied_early:1;
+	unsigned int has_result_sha1:1;
 	struct fragment *fragments;
 	char *result;
 	size_t resultsize;
+	unsigned char result_sha1[20];
 	char old_sha1_prefix[41];
 	char new_sha1_prefix[41];
 	struct patch *next;
@@ -208,6 +236,28 @@ struct line {
 #define LINE_PATCHED	2
 };
 
+/*
+ * The lines of an image chained by their hash, so that find_pos()
+ * can go straight to the places a hunk may match.  Line numbers are
+ * those of the image when the index was built; the hunks applied
+ * since then are recorded in "edit", to tell where those lines are
+ * now.
+ */
+struct line_edit {
+	int at, removed, added;
+	size_t removed_len, added_len;
+};
+
+struct line_index {
+	unsigned int mask;
+	int *bucket;		/* the first line in each bucket, or -1 */
+	int *next;		/* the next line in the same bucket, or -1 */
+	unsigned int *hash;
+	size_t *offset;		/* where each line began in the buffer */
+	struct line_edit *edit;
+	int edit_nr, edit_alloc;
+};
+
 /*
  * This represents a "file", which is an array of "lines".
  */
@@ -218,6 +268,7 @@ struct image {
 	size_t alloc;
 	struct line *line_allocated;
 	struct line *line;
+	struct line_index *index;
 };
 
 /*
@@ -2276,6 +2327,232 @@ static int match_fragment(struct image *img,
 	return 0;
 }
 
+static unsigned int line_bucket(struct line_index *index, unsigned int hash)
+{
+	return (hash ^ (hash >> 11)) & index->mask;
+}
+
+static struct line_index *index_lines(struct image *img)
+{
+	struct line_index *index = xcalloc(1, sizeof(*index));
+	unsigned int size = 1;
+	size_t offset = 0;
+	int i;
+
+	while (size < img->nr)
+		size <<= 1;
+	index->mask = size - 1;
+	index->bucket = xmalloc(size * sizeof(*index->bucket));
+	for (i = 0; i < size; i++)
+		index->bucket[i] = -1;
+	index->next = xmalloc(img->nr * sizeof(*index->next));
+	index->hash = xmalloc(img->nr * sizeof(*index->hash));
+	index->offset = xmalloc(img->nr * sizeof(*index->offset));
+	for (i = 0; i < img->nr; i++) {
+		index->hash[i] = img->line[i].hash;
+		index->offset[i] = offset;
+		offset += img->line[i].len;
+	}
+
+	/* chain from the end, so that each chain is in line order */
+	for (i = img->nr - 1; 0 <= i; i--) {
+		unsigned int b = line_bucket(index, index->hash[i]);
+		index->next[i] = index->bucket[b];
+		index->bucket[b] = i;
+	}
+	return index;
+}
+
+static void free_line_index(struct image *img)
+{
+	if (!img->index)
+		return;
+	free(img->index->bucket);
+	free(img->index->next);
+	free(img->index->hash);
+	free(img->index->offset);
+	free(img->index->edit);
+	free(img->index);
+	img->index = NULL;
+}
+
+/*
+ * Called by update_image(), after it replaced "removed" lines
+ * (removed_len bytes) at line "at" with "added" lines.
+ */
+static void line_index_edit(struct image *img, int at,
+			    int removed, size_t removed_len,
+			    int added, size_t added_len)
+{
+	struct line_index *index = img->index;
+	struct line_edit *edit;
+
+	if (!index)
+		return;
+	/*
+	 * With --allow-overlap a hunk may match the lines another one
+	 * added, which the index does not know about.
+	 */
+	if (allow_overlap) {
+		free_line_index(img);
+		return;
+	}
+	ALLOC_GROW(index->edit, index->edit_nr + 1, index->edit_alloc);
+	edit = &index->edit[index->edit_nr++];
+	edit->at = at;
+	edit->removed = removed;
+	edit->removed_len = removed_len;
+	edit->added = added;
+	edit->added_len = added_len;
+}
+
+/*
+ * Where the indexed line lno is now, and where it begins in the
+ * buffer, or -1 if a hunk has replaced it.
+ */
+static int indexed_line(struct line_index *index, int lno, size_t *offset)
+{
+	size_t ofs = index->offset[lno];
+	int i;
+
+	for (i = 0; i < index->edit_nr; i++) {
+		struct line_edit *edit = &index->edit[i];
+
+		if (lno < edit->at)
+			continue;
+		if (lno < edit->at + edit->removed)
+			return -1;
+		lno += edit->added - edit->removed;
+		ofs += edit->added_len - edit->removed_len;
+	}
+	*offset = ofs;
+	return lno;
+}
+
+struct find_pos_candidate {
+	int lno;
+	size_t offset;
+};
+
+/*
+ * Try the positions outside backwards_lno..forwards_lno, which
+ * find_pos() has already tried, in the order find_pos() would:
+ * nearest to the line first, and forwards before backwards.
+ *
+ * match_fragment() only matches where every line of the preimage
+ * hashes the same as the line of img it would be compared with, so
+ * the only places worth trying are where the preimage line that
+ * occurs the least in img lines up with one of its occurrences.
+ * The lines earlier hunks added are not indexed, but they are marked
+ * LINE_PATCHED and cannot be matched anyway.  When match_fragment()
+ * allows the preimage to extend beyond the end of img, the places
+ * where that line would fall beyond the end are tried as well.
+ */
+static int find_pos_indexed(struct image *img,
+			    struct image *preimage,
+			    struct image *postimage,
+			    int line, int backwards_lno, int forwards_lno,
+			    unsigned ws_rule,
+			    int match_beginning, int match_end)
+{
+	struct line_index *index;
+	struct find_pos_candidate *pos = NULL;
+	int nr = 0, alloc = 0;
+	int anchor = 0, anchor_count = -1;
+	unsigned int hash;
+	int i, j, forwards, backwards, found = -1;
+
+	if (!img->index)
+		img->index = index_lines(img);
+	index = img->index;
+
+	for (i = 0; i < preimage->nr && anchor_count; i++) {
+		int count = 0;
+
+		hash = preimage->line[i].hash;
+		for (j = index->bucket[line_bucket(index, hash)];
+		     0 <= j && (anchor_count < 0 || count < anchor_count);
+		     j = index->next[j])
+			if (index->hash[j] == hash)
+				count++;
+		if (anchor_count < 0 || count < anchor_count) {
+			anchor = i;
+			anchor_count = count;
+		}
+	}
+
+	hash = preimage->line[anchor].hash;
+	for (j = index->bucket[line_bucket(index, hash)]; 0 <= j; j = index->next[j]) {
+		size_t offset;
+		int lno;
+
+		if (index->hash[j] != hash)
+			continue;
+		lno = indexed_line(index, j, &offset);
+		if (lno < anchor)
+			continue;
+		lno -= anchor;
+		if (backwards_lno <= lno && lno <= forwards_lno)
+			continue;
+		for (i = 0; i < anchor; i++)
+			offset -= img->line[lno + i].len;
+		ALLOC_GROW(pos, nr + 1, alloc);
+		pos[nr].lno = lno;
+		pos[nr].offset = offset;
+		nr++;
+	}
+	if (ws_error_action == correct_ws_error && (ws_rule & WS_BLANK_AT_EOF)) {
+		size_t offset = img->len;
+		int lno = img->nr;
+		int first = nr;
+
+		for (; (int)img->nr - anchor <= lno && 0 <= lno; lno--) {
+			if (lno < img->nr)
+				offset -= img->line[lno].len;
+			if (backwards_lno <= lno && lno <= forwards_lno)
+				continue;
+			ALLOC_GROW(pos, nr + 1, alloc);
+			pos[nr].lno = lno;
+			pos[nr].offset = offset;
+			nr++;
+		}
+		/* these were collected backwards */
+		for (i = first, j = nr - 1; i < j; i++, j--) {
+			struct find_pos_candidate tmp = pos[i];
+			pos[i] = pos[j];
+			pos[j] = tmp;
+		}
+	}
+
+	for (forwards = 0; forwards < nr && pos[forwards].lno < line; forwards++)
+		;
+	backwards = forwards - 1;
+	while (0 <= backwards || forwards < nr) {
+		struct find_pos_candidate *try;
+
+		if (forwards < nr &&
+		    (backwards < 0 ||
+		     pos[forwards].lno - line <= line - pos[backwards].lno))
+			try = &pos[forwards++];
+		else
+			try = &pos[backwards--];
+		if (match_fragment(img, preimage, postimage,
+				   try->offset, try->lno, ws_rule,
+				   match_beginning, match_end)) {
+			found = try->lno;
+			break;
+		}
+	}
+	free(pos);
+	return found;
+}
+
+/*
+ * How many positions find_pos() tries one by one around the expected
+ * line before it indexes the lines of img to find the others.
+ */
+#define FIND_POS_SCAN 64
+
 static int find_pos(struct image *img,
 		    struct image *preimage,
 		    struct image *postimage,
@@ -2325,6 +2602,12 @@ static int find_pos(struct image *img,
 				   match_beginning, match_end))
 			return try_lno;
 
+		if (FIND_POS_SCAN <= i && preimage->nr)
+			return find_pos_indexed(img, preimage, postimage, line,
+						backwards_lno, forwards_lno,
+						ws_rule, match_beginning,
+						match_end);
+
 	again:
 		if (backwards_lno == 0 && forwards_lno == img->nr)
 			break;
@@ -2434,6 +2717,8 @@ static void update_image(struct image *img,
 	if (!allow_overlap)
 		for (i = 0; i < postimage->nr; i++)
 			img->line[applied_pos + i].flag |= LINE_PATCHED;
+	line_index_edit(img, applied_pos, preimage_limit, remove_count,
+			postimage->nr, insert_count);
 	img->nr = nr;
 }
 
@@ -2628,7 +2913,8 @@ static int apply_one_fragment(struct image *img, struct fragment *frag,
 		if (new_blank_lines_at_end &&
 		    preimage.nr + applied_pos >= img->nr &&
 		    (ws_rule & WS_BLANK_AT_EOF) &&
-		    ws_error_action != nowarn_ws_error) {
+		    ws_error_action != nowarn_ws_error &&
+		    !trial_says_something()) {
 			record_ws_error(WS_BLANK_AT_EOF, "+", 1, frag->linenr);
 			if (ws_error_action == correct_ws_error) {
 				while (new_blank_lines_at_end--)
@@ -2658,8 +2944,9 @@ static int apply_one_fragment(struct image *img, struct fragment *frag,
 		 * Warn if it was necessary to reduce the number
 		 * of context lines.
 		 */
-		if ((leading != frag->leading) ||
-		    (trailing != frag->trailing))
+		if (((leading != frag->leading) ||
+		     (trailing != frag->trailing)) &&
+		    !trial_says_something())
 			fprintf(stderr, "Context reduced to (%ld/%ld)"
 				" to apply fragment at %d\n",
 				leading, trailing, applied_pos+1);
@@ -2810,12 +3097,15 @@ static int apply_fragments(struct image *img, struct patch *patch)
 		nth++;
 		if (apply_one_fragment(img, frag, inaccurate_eof, ws_rule, nth)) {
 			error("patch failed: %s:%ld", name, frag->oldpos);
-			if (!apply_with_reject)
+			if (!apply_with_reject) {
+				free_line_index(img);
 				return -1;
+			}
 			frag->rejected = 1;
 		}
 		frag = frag->next;
 	}
+	free_line_index(img);
 	return 0;
 }
 
@@ -2921,6 +3211,9 @@ static int apply_data(struct patch *patch, struct stat *st, struct cache_entry *
 	char *img;
 	struct patch *tpatch;
 
+	if (patch->applied_early)
+		goto applied;
+
 	if (!(patch->is_copy || patch->is_rename) &&
 	    (tpatch = in_fn_table(patch->old_name)) != NULL && !to_be_deleted(tpatch)) {
 		if (was_deleted(tpatch)) {
@@ -2956,9 +3249,10 @@ static int apply_data(struct patch *patch, struct stat *st, struct cache_entry *
 		return -1; /* note with --reject this succeeds. */
 	patch->result = image.buf;
 	patch->resultsize = image.len;
-	add_to_fn_table(patch);
 	free(image.line_allocated);
 
+ applied:
+	add_to_fn_table(patch);
 	if (0 < patch->is_delete && patch->resultsize)
 		return error("removal patch leaves file contents");
 
@@ -3148,11 +3442,196 @@ static int check_patch(struct patch *patch)
 	return 0;
 }
 
+#ifndef NO_PTHREADS
+static pthread_mutex_t trial_mutex;
+static struct patch **trial_list;
+static int trial_nr, trial_next;
+static void (*saved_error_routine)(const char *err, va_list params);
+static void (*saved_warn_routine)(const char *warn, va_list params);
+
+static void trial_error(const char *err, va_list params)
+{
+	if (!trial_says_something())
+		saved_error_routine(err, params);
+}
+
+static void trial_warning(const char *warn, va_list params)
+{
+	if (!trial_says_something())
+		saved_warn_routine(warn, params);
+}
+
+/*
+ * Read the preimage of a patch that no other patch touches, the same
+ * way check_preimage() and apply_data() will, and apply the patch to
+ * it.  Anything unusual is left to the serial code.
+ */
+static void try_patch(struct patch *patch, int *noisy)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct fragment *frag;
+	struct image image;
+	size_t len;
+	char *img;
+
+	if (patch->old_name && cached) {
+		int pos = cache_name_pos(patch->old_name, strlen(patch->old_name));
+		int ret;
+
+		if (pos < 0)
+			return;
+		pthread_mutex_lock(&trial_mutex);
+		ret = read_file_or_gitlink(active_cache[pos], &buf);
+		pthread_mutex_unlock(&trial_mutex);
+		if (ret)
+			return;
+	} else if (patch->old_name) {
+		struct stat st;
+
+		if (lstat(patch->old_name, &st))
+			return;
+		if (S_ISREG(st.st_mode)) {
+			if (strbuf_read_file(&buf, patch->old_name, st.st_size) != st.st_size) {
+				strbuf_release(&buf);
+				return;
+			}
+			/* attributes are not thread-safe */
+			pthread_mutex_lock(&trial_mutex);
+			convert_to_git(patch->old_name, buf.buf, buf.len, &buf, 0);
+			pthread_mutex_unlock(&trial_mutex);
+		} else if (!S_ISLNK(st.st_mode) ||
+			   strbuf_readlink(&buf, patch->old_name, st.st_size) < 0) {
+			strbuf_release(&buf);
+			return;
+		}
+	}
+
+	img = strbuf_detach(&buf, &len);
+	prepare_image(&image, img, len, 1);
+	if (apply_fragments(&image, patch) < 0 || *noisy) {
+		for (frag = patch->fragments; frag; frag = frag->next)
+			frag->rejected = 0;
+		free(image.buf);
+		free(image.line_allocated);
+		*noisy = 0;
+		return;
+	}
+	free(image.line_allocated);
+
+	if (update_index && patch->new_name && !(0 < patch->is_delete)) {
+		pthread_mutex_lock(&trial_mutex);
+		if (!write_sha1_file(image.buf, image.len, blob_type,
+				     patch->result_sha1))
+			patch->has_result_sha1 = 1;
+		pthread_mutex_unlock(&trial_mutex);
+	}
+	patch->result = image.buf;
+	patch->resultsize = image.len;
+	patch->applied_early = 1;
+}
+
+static void *run_trials(void *data)
+{
+	int noisy = 0;
+
+	pthread_setspecific(trial_key, &noisy);
+	for (;;) {
+		struct patch *patch = NULL;
+
+		pthread_mutex_lock(&trial_mutex);
+		if (trial_next < trial_nr)
+			patch = trial_list[trial_next++];
+		pthread_mutex_unlock(&trial_mutex);
+		if (!patch)
+			break;
+		try_patch(patch, &noisy);
+	}
+	return NULL;
+}
+
+/*
+ * Apply the patches that touch paths no other patch touches in worker
+ * threads, before check_patch_list() goes through the list in order
+ * and picks up their results.  Index and working tree updates, and all
+ * the messages, are left to the serial code.
+ */
+static void try_patches(struct patch *list)
+{
+	struct string_list names = STRING_LIST_INIT_NODUP;
+	struct patch *patch;
+	pthread_t *threads;
+	int i, nr;
+
+	if (apply_threads <= 1 || apply_verbosely ||
+	    ws_error_action == correct_ws_error ||
+	    safe_crlf == SAFE_CRLF_FAIL)
+		return;
+
+	for (patch = list; patch; patch = patch->next) {
+		if (patch->old_name)
+			string_list_append(&names, patch->old_name)->util = patch;
+		if (patch->new_name &&
+		    (!patch->old_name || strcmp(patch->old_name, patch->new_name)))
+			string_list_append(&names, patch->new_name)->util = patch;
+	}
+	sort_string_list(&names);
+	for (i = 1; i < names.nr; i++) {
+		if (strcmp(names.items[i - 1].string, names.items[i].string))
+			continue;
+		((struct patch *)names.items[i - 1].util)->shares_path = 1;
+		((struct patch *)names.items[i].util)->shares_path = 1;
+	}
+	string_list_clear(&names, 0);
+
+	trial_nr = trial_next = 0;
+	for (patch = list; patch; patch = patch->next)
+		trial_nr++;
+	trial_list = xmalloc(trial_nr * sizeof(*trial_list));
+	trial_nr = 0;
+	for (patch = list; patch; patch = patch->next)
+		if (!patch->shares_path && !patch->is_binary &&
+		    !S_ISGITLINK(patch->old_mode) &&
+		    !S_ISGITLINK(patch->new_mode))
+			trial_list[trial_nr++] = patch;
+
+	nr = apply_threads < trial_nr ? apply_threads : trial_nr;
+	if (nr > 1) {
+		pthread_mutex_init(&trial_mutex, NULL);
+		pthread_key_create(&trial_key, NULL);
+		saved_error_routine = get_error_routine();
+		saved_warn_routine = get_warn_routine();
+		set_error_routine(trial_error);
+		set_warn_routine(trial_warning);
+		trials_running = 1;
+
+		threads = xcalloc(nr, sizeof(*threads));
+		for (i = 0; i < nr; i++)
+			if (pthread_create(&threads[i], NULL, run_trials, NULL))
+				die("unable to create thread");
+		for (i = 0; i < nr; i++)
+			pthread_join(threads[i], NULL);
+		free(threads);
+
+		trials_running = 0;
+		set_error_routine(saved_error_routine);
+		set_warn_routine(saved_warn_routine);
+		pthread_key_delete(trial_key);
+		pthread_mutex_destroy(&trial_mutex);
+	}
+	free(trial_list);
+}
+#else
+static void try_patches(struct patch *list)
+{
+}
+#endif
+
 static int check_patch_list(struct patch *patch)
 {
 	int err = 0;
 
 	prepare_fn_table(patch);
+	try_patches(patch);
 	while (patch) {
 		if (apply_verbosely)
 			say_patch_name(stderr,
@@ -3209,7 +3688,7 @@ static void build_fake_ancestor(struct patch *list, const char *filename)
 		else
 			sha1_ptr = sha1;
 
-		ce = make_cache_entry(patch->old_mode, sha1_ptr, name, 0, 0);
+		ce = make_cache_entry(&result, patch->old_mode, sha1_ptr, name, 0, 0);
 		if (!ce)
 			die("make_cache_entry failed for path '%s'", name);
 		if (add_index_entry(&result, ce, ADD_CACHE_OK_TO_ADD))
@@ -3363,17 +3842,17 @@ static void remove_file(struct patch *patch, int rmdir_empty)
 	}
 }
 
-static void add_index_file(const char *path, unsigned mode, void *buf, unsigned long size)
+static void add_index_file(const char *path, unsigned mode, void *buf,
+			   unsigned long size, const unsigned char *sha1)
 {
 	struct stat st;
 	struct cache_entry *ce;
 	int namelen = strlen(path);
-	unsigned ce_size = cache_entry_size(namelen);
 
 	if (!update_index)
 		return;
 
-	ce = xcalloc(1, ce_size);
+	ce = make_empty_cache_entry(&the_index, namelen);
 	memcpy(ce->name, path, namelen);
 	ce->ce_mode = create_ce_mode(mode);
 	ce->ce_flags = namelen;
@@ -3389,7 +3868,9 @@ static void add_index_file(const char *path, unsigned mode, void *buf, unsigned
 					  path);
 			fill_stat_cache_info(ce, &st);
 		}
-		if (write_sha1_file(buf, size, blob_type, ce->sha1) < 0)
+		if (sha1)
+			hashcpy(ce->sha1, sha1);
+		else if (write_sha1_file(buf, size, blob_type, ce->sha1) < 0)
 			die("unable to create backing store for newly created file %s", path);
 	}
 	if (add_cache_entry(ce, ADD_CACHE_OK_TO_ADD) < 0)
@@ -3488,7 +3969,8 @@ static void create_file(struct patch *patch)
 	if (!mode)
 		mode = S_IFREG | 0644;
 	create_one_file(path, mode, buf, size);
-	add_index_file(path, mode, buf, size);
+	add_index_file(path, mode, buf, size,
+		       patch->has_result_sha1 ? patch->result_sha1 : NULL);
 }
 
 /* phase zero is to remove, phase one is to create */
@@ -3756,6 +4238,10 @@ static int git_apply_config(const char *var, const char *value, void *cb)
 		return git_config_string(&apply_default_whitespace, var, value);
 	else if (!strcmp(var, "apply.ignorewhitespace"))
 		return git_config_string(&apply_default_ignorewhitespace, var, value);
+	else if (!strcmp(var, "apply.threads")) {
+		apply_threads = git_config_int(var, value);
+		return 0;
+	}
 	return git_default_config(var, value, cb);
 }
 
@@ -3896,6 +4382,8 @@ int cmd_apply(int argc, const char **argv, const char *prefix_)
 		OPT_BIT(0, "inaccurate-eof", &options,
 			"tolerate incorrectly detected missing new-line at the end of file",
 			INACCURATE_EOF),
+		OPT_INTEGER(0, "threads", &apply_threads,
+			"apply independent patches in <n> threads"),
 		OPT_BIT(0, "recount", &options,
 			"do not trust the line counts in the hunk headers",
 			RECOUNT),
@@ -3918,6 +4406,12 @@ int cmd_apply(int argc, const char **argv, const char *prefix_)
 
 	if (apply_with_reject)
 		apply = apply_verbosely = 1;
+	if (!apply_threads)
+		apply_threads = online_cpus();
+#ifdef NO_PTHREADS
+	if (apply_threads != 1)
+		warning("no threads support, ignoring --threads");
+#endif
 	if (!force_apply && (diffstat || numstat || summary || check || fake_ancestor))
 		apply = 0;
 	if (check_index && is_not_gitdir)
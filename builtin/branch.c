@@ -241,6 +241,7 @@ struct ref_list {
 	int index, alloc, maxwidth, verbose, abbrev;
 	struct ref_item *list;
 	struct commit_list *with_commit;
+	struct contains_cache contains;
 	int kinds;
 };
 
@@ -322,7 +323,8 @@ static int append_ref(const char *refname, const unsigned char *sha1, int flags,
 		}
 
 		/* Filter with with_commit if specified */
-		if (!is_descendant_of(commit, ref_list->with_commit))
+		if (!commit_contains(commit, ref_list->with_commit,
+				     &ref_list->contains))
 			return 0;
 
 		if (merge_filter != NO_FILTER)
@@ -494,7 +496,8 @@ static void show_detached(struct ref_list *ref_list)
 {
 	struct commit *head_commit = lookup_commit_reference_gently(head_sha1, 1);
 
-	if (head_commit && is_descendant_of(head_commit, ref_list->with_commit)) {
+	if (head_commit &&
+	    commit_contains(head_commit, ref_list->with_commit, &ref_list->contains)) {
 		struct ref_item item;
 		item.name = xstrdup(_("(no branch)"));
 		item.len = strlen(item.name);
@@ -555,6 +558,7 @@ static int print_ref_list(int kinds, int detached, int verbose, int abbrev, stru
 	}
 
 	free_ref_list(&ref_list);
+	clear_contains_cache(&ref_list.contains);
 
 	if (cb.ret)
 		error(_("some refs could not be read"));
@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "commit.h"
+#include "prio-queue.h"
 #include "tag.h"
 #include "refs.h"
 #include "builtin.h"
@@ -7,6 +8,7 @@
 #include "parse-options.h"
 #include "diff.h"
 #include "hash.h"
+#include "string-list.h"
 
 #define SEEN		(1u<<0)
 #define MAX_TAGS	(FLAG_BITS - 1)
@@ -28,6 +30,7 @@ static int have_util;
 static const char *pattern;
 static int always;
 static const char *dirty;
+static int use_index;
 
 /* diff-index command arguments to check if working tree is dirty. */
 static const char *diff_index_args[] = {
@@ -135,6 +138,308 @@ static void add_to_known_names(const char *path,
 	}
 }
 
+/*
+ * The describe index remembers the answers of earlier runs: for a
+ * commit, the commit the chosen tag points at and the depth.  Answers
+ * depend on the options, so each set of options has an index of its
+ * own in $GIT_DIR/describe-index/, named after the SHA-1 of the key
+ * that spells them out.  It also records the tags that were known when the
+ * answers were made, so that answers can be kept when tags come and
+ * go: an answer only depends on the tags that can be reached from the
+ * commit described, so it stays valid as long as none of the tags
+ * that were added, removed or changed since is reachable from it.
+ */
+struct index_tag {
+	unsigned char sha1[20];
+	unsigned char peeled[20];
+};
+
+struct index_answer {
+	struct index_answer *next;
+	unsigned char commit[20];
+	unsigned char peeled[20];
+	int depth;
+	int valid; /* -1: not checked yet */
+};
+
+static struct string_list index_tags = STRING_LIST_INIT_DUP;
+static struct string_list current_tags = STRING_LIST_INIT_DUP;
+static struct hash_table index_answers;
+static struct commit_list *changed_tags;
+static struct contains_cache changed_tags_reach;
+static int index_changed;
+
+static void add_index_tag(struct string_list *list, const char *refname,
+			  const unsigned char *sha1, const unsigned char *peeled)
+{
+	struct string_list_item *item = string_list_insert(list, refname);
+	struct index_tag *t = item->util;
+
+	if (!t)
+		item->util = t = xmalloc(sizeof(*t));
+	hashcpy(t->sha1, sha1);
+	hashcpy(t->peeled, peeled);
+}
+
+static struct index_answer *find_index_answer(const unsigned char *commit)
+{
+	struct index_answer *a = lookup_hash(hash_sha1(commit), &index_answers);
+	while (a && hashcmp(commit, a->commit))
+		a = a->next;
+	return a;
+}
+
+static struct index_answer *add_index_answer(const unsigned char *commit)
+{
+	struct index_answer *a = find_index_answer(commit);
+	void **pos;
+
+	if (a)
+		return a;
+	a = xcalloc(1, sizeof(*a));
+	hashcpy(a->commit, commit);
+	pos = insert_hash(hash_sha1(commit), a, &index_answers);
+	if (pos) {
+		a->next = *pos;
+		*pos = a;
+	}
+	return a;
+}
+
+static int free_index_answer(void *chain, void *data)
+{
+	struct index_answer *a = chain;
+
+	while (a) {
+		struct index_answer *next = a->next;
+		free(a);
+		a = next;
+	}
+	return 0;
+}
+
+static const char *index_key(void)
+{
+	static struct strbuf key = STRBUF_INIT;
+
+	if (!key.len)
+		strbuf_addf(&key, "all=%d tags=%d candidates=%d match=%s",
+			    all, tags, max_candidates, pattern ? pattern : "");
+	return key.buf;
+}
+
+static const char *describe_index_path(void)
+{
+	static char *path;
+
+	if (!path) {
+		const char *key = index_key();
+		unsigned char sha1[20];
+		git_SHA_CTX ctx;
+
+		git_SHA1_Init(&ctx);
+		git_SHA1_Update(&ctx, key, strlen(key));
+		git_SHA1_Final(sha1, &ctx);
+		path = xstrdup(git_path("describe-index/%s", sha1_to_hex(sha1)));
+	}
+	return path;
+}
+
+static void read_describe_index(void)
+{
+	struct strbuf line = STRBUF_INIT;
+	FILE *fp = fopen(describe_index_path(), "r");
+	int key_ok = 0;
+
+	if (!fp)
+		return;
+	while (strbuf_getline(&line, fp, '\n') != EOF) {
+		unsigned char sha1[20], peeled[20];
+		const char *p = line.buf;
+
+		if (!prefixcmp(p, "key ")) {
+			key_ok = !strcmp(p + 4, index_key());
+			if (!key_ok)
+				break;
+		} else if (!key_ok) {
+			break;
+		} else if (!prefixcmp(p, "tag ") && line.len > 86 &&
+			   !get_sha1_hex(p + 4, sha1) &&
+			   !get_sha1_hex(p + 45, peeled)) {
+			add_index_tag(&index_tags, p + 86, sha1, peeled);
+		} else if (!prefixcmp(p, "commit ") && line.len > 89 &&
+			   !get_sha1_hex(p + 7, sha1) &&
+			   !get_sha1_hex(p + 48, peeled)) {
+			struct index_answer *a = add_index_answer(sha1);
+			hashcpy(a->peeled, peeled);
+			a->depth = atoi(p + 89);
+			a->valid = -1;
+		}
+	}
+	fclose(fp);
+	strbuf_release(&line);
+}
+
+static int add_changed_tag(const unsigned char *peeled)
+{
+	struct commit *commit = lookup_commit_reference_gently(peeled, 1);
+
+	if (!commit)
+		return -1;
+	commit_list_insert(commit, &changed_tags);
+	return 0;
+}
+
+/*
+ * Compare the tags the index was made with to the ones we have now,
+ * and collect the commits of those that differ.
+ */
+static void load_describe_index(void)
+{
+	int i, j, broken = 0;
+
+	init_hash(&index_answers);
+	read_describe_index();
+
+	for (i = j = 0; i < index_tags.nr || j < current_tags.nr; ) {
+		struct index_tag *old = NULL, *new = NULL;
+		int cmp;
+
+		if (i >= index_tags.nr)
+			cmp = 1;
+		else if (j >= current_tags.nr)
+			cmp = -1;
+		else
+			cmp = strcmp(index_tags.items[i].string,
+				     current_tags.items[j].string);
+		if (cmp <= 0)
+			old = index_tags.items[i++].util;
+		if (cmp >= 0)
+			new = current_tags.items[j++].util;
+		if (old && new && !hashcmp(old->sha1, new->sha1))
+			continue;
+		if (old && add_changed_tag(old->peeled))
+			broken = 1;
+		if (new && add_changed_tag(new->peeled))
+			broken = 1;
+	}
+	if (changed_tags)
+		index_changed = 1;
+	if (broken) {
+		/* a tag we can no longer look at went away; start over */
+		for_each_hash(&index_answers, free_index_answer, NULL);
+		free_hash(&index_answers);
+		init_hash(&index_answers);
+	}
+}
+
+static int index_answer_is_valid(struct index_answer *a)
+{
+	struct commit *commit;
+
+	if (a->valid < 0) {
+		commit = lookup_commit_reference_gently(a->commit, 1);
+		a->valid = commit &&
+			(!changed_tags ||
+			 !commit_contains(commit, changed_tags,
+					  &changed_tags_reach));
+	}
+	return a->valid;
+}
+
+static int write_index_answer(void *chain, void *data)
+{
+	FILE *fp = data;
+	struct index_answer *a;
+
+	for (a = chain; a; a = a->next) {
+		if (!index_answer_is_valid(a))
+			continue;
+		fprintf(fp, "commit %s", sha1_to_hex(a->commit));
+		fprintf(fp, " %s %d\n", sha1_to_hex(a->peeled), a->depth);
+	}
+	return 0;
+}
+
+static void write_describe_index(void)
+{
+	static struct lock_file lock;
+	FILE *fp;
+	int fd, i;
+
+	if (!index_changed)
+		return;
+	if (safe_create_leading_directories_const(describe_index_path()))
+		return;
+	fd = hold_lock_file_for_update(&lock, describe_index_path(), 0);
+	if (fd < 0)
+		return;
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		rollback_lock_file(&lock);
+		return;
+	}
+	fprintf(fp, "# describe-index v1\n");
+	fprintf(fp, "key %s\n", index_key());
+	for (i = 0; i < current_tags.nr; i++) {
+		struct index_tag *t = current_tags.items[i].util;
+		fprintf(fp, "tag %s", sha1_to_hex(t->sha1));
+		fprintf(fp, " %s %s\n", sha1_to_hex(t->peeled),
+			current_tags.items[i].string);
+	}
+	for_each_hash(&index_answers, write_index_answer, fp);
+	if (fclose(fp)) {
+		lock.fd = -1;
+		rollback_lock_file(&lock);
+		return;
+	}
+	lock.fd = -1;
+	commit_lock_file(&lock);
+}
+
+/*
+ * Describe "cmit" from the index, if it or the first commit with a
+ * usable tag or more than one parent that we come to by following its
+ * parents has a valid answer there: each commit on the way adds one
+ * to the depth.
+ */
+static int describe_from_index(struct commit *cmit,
+			       struct commit_name **name, int *depth)
+{
+	struct commit *c = cmit;
+	int skipped = 0;
+
+	for (;;) {
+		struct index_answer *a = find_index_answer(c->object.sha1);
+		struct commit_name *n;
+
+		if (a && index_answer_is_valid(a)) {
+			*name = find_commit_name(a->peeled);
+			*depth = a->depth + skipped;
+			return !!*name;
+		}
+		n = find_commit_name(c->object.sha1);
+		if (skipped && n && (tags || all || n->prio == 2))
+			return 0;
+		if (parse_commit(c) || !c->parents || c->parents->next)
+			return 0;
+		c = c->parents->item;
+		skipped++;
+	}
+}
+
+static void remember_answer(struct commit *cmit, struct commit_name *n, int depth)
+{
+	struct index_answer *a = add_index_answer(cmit->object.sha1);
+
+	if (a->valid > 0 && !hashcmp(a->peeled, n->peeled) && a->depth == depth)
+		return;
+	hashcpy(a->peeled, n->peeled);
+	a->depth = depth;
+	a->valid = 1;
+	index_changed = 1;
+}
+
 static int get_name(const char *path, const unsigned char *sha1, int flag, void *cb_data)
 {
 	int might_be_tag = !prefixcmp(path, "refs/tags/");
@@ -172,6 +477,8 @@ static int get_name(const char *path, const unsigned char *sha1, int flag, void
 			return 0;
 	}
 	add_to_known_names(all ? path + 5 : path + 10, peeled, prio, sha1);
+	if (use_index)
+		add_index_tag(&current_tags, path, sha1, peeled);
 	return 0;
 }
 
@@ -194,23 +501,22 @@ static int compare_pt(const void *a_, const void *b_)
 }
 
 static unsigned long finish_depth_computation(
-	struct commit_list **list,
+	struct prio_queue *queue,
 	struct possible_tag *best)
 {
 	unsigned long seen_commits = 0;
-	while (*list) {
-		struct commit *c = pop_commit(list);
+	while (queue->nr) {
+		struct commit *c = prio_queue_get(queue);
 		struct commit_list *parents = c->parents;
 		seen_commits++;
 		if (c->object.flags & best->flag_within) {
-			struct commit_list *a = *list;
-			while (a) {
-				struct commit *i = a->item;
-				if (!(i->object.flags & best->flag_within))
+			int i;
+			for (i = 0; i < queue->nr; i++) {
+				struct commit *commit = queue->array[i].data;
+				if (!(commit->object.flags & best->flag_within))
 					break;
-				a = a->next;
 			}
-			if (!a)
+			if (i == queue->nr)
 				break;
 		} else
 			best->depth++;
@@ -218,7 +524,7 @@ static unsigned long finish_depth_computation(
 			struct commit *p = parents->item;
 			parse_commit(p);
 			if (!(p->object.flags & SEEN))
-				commit_list_insert_by_date(p, list);
+				prio_queue_put(queue, p);
 			p->object.flags |= c->object.flags;
 			parents = parents->next;
 		}
@@ -252,11 +558,21 @@ static void show_suffix(int depth, const unsigned char *sha1)
 	printf("-%d-g%s", depth, find_unique_abbrev(sha1, abbrev));
 }
 
+static void show_described(struct commit *cmit, struct commit_name *n, int depth)
+{
+	display_name(n);
+	if (abbrev)
+		show_suffix(depth, cmit->object.sha1);
+	if (dirty)
+		printf("%s", dirty);
+	printf("\n");
+}
+
 static void describe(const char *arg, int last_one)
 {
 	unsigned char sha1[20];
 	struct commit *cmit, *gave_up_on = NULL;
-	struct commit_list *list;
+	struct prio_queue queue = { compare_commits_by_commit_date };
 	struct commit_name *n;
 	struct possible_tag all_matches[MAX_TAGS];
 	unsigned int match_cnt = 0, annotated_cnt = 0, cur_match;
@@ -288,16 +604,24 @@ static void describe(const char *arg, int last_one)
 	if (debug)
 		fprintf(stderr, _("searching to describe %s\n"), arg);
 
+	if (use_index) {
+		int depth;
+		if (describe_from_index(cmit, &n, &depth)) {
+			remember_answer(cmit, n, depth);
+			show_described(cmit, n, depth);
+			return;
+		}
+	}
+
 	if (!have_util) {
 		for_each_hash(&names, set_util, NULL);
 		have_util = 1;
 	}
 
-	list = NULL;
 	cmit->object.flags = SEEN;
-	commit_list_insert(cmit, &list);
-	while (list) {
-		struct commit *c = pop_commit(&list);
+	prio_queue_put(&queue, cmit);
+	while (queue.nr) {
+		struct commit *c = prio_queue_get(&queue);
 		struct commit_list *parents = c->parents;
 		seen_commits++;
 		n = c->util;
@@ -324,7 +648,7 @@ static void describe(const char *arg, int last_one)
 			if (!(c->object.flags & t->flag_within))
 				t->depth++;
 		}
-		if (annotated_cnt && !list) {
+		if (annotated_cnt && !queue.nr) {
 			if (debug)
 				fprintf(stderr, _("finished search at %s\n"),
 					sha1_to_hex(c->object.sha1));
@@ -334,7 +658,7 @@ static void describe(const char *arg, int last_one)
 			struct commit *p = parents->item;
 			parse_commit(p);
 			if (!(p->object.flags & SEEN))
-				commit_list_insert_by_date(p, &list);
+				prio_queue_put(&queue, p);
 			p->object.flags |= c->object.flags;
 			parents = parents->next;
 		}
@@ -362,11 +686,11 @@ static void describe(const char *arg, int last_one)
 	qsort(all_matches, match_cnt, sizeof(all_matches[0]), compare_pt);
 
 	if (gave_up_on) {
-		commit_list_insert_by_date(gave_up_on, &list);
+		prio_queue_put(&queue, gave_up_on);
 		seen_commits--;
 	}
-	seen_commits += finish_depth_computation(&list, &all_matches[0]);
-	free_commit_list(list);
+	seen_commits += finish_depth_computation(&queue, &all_matches[0]);
+	clear_prio_queue(&queue);
 
 	if (debug) {
 		for (cur_match = 0; cur_match < match_cnt; cur_match++) {
@@ -385,17 +709,23 @@ static void describe(const char *arg, int last_one)
 		}
 	}
 
-	display_name(all_matches[0].name);
-	if (abbrev)
-		show_suffix(all_matches[0].depth, cmit->object.sha1);
-	if (dirty)
-		printf("%s", dirty);
-	printf("\n");
+	if (use_index)
+		remember_answer(cmit, all_matches[0].name, all_matches[0].depth);
+	show_described(cmit, all_matches[0].name, all_matches[0].depth);
 
 	if (!last_one)
 		clear_commit_marks(cmit, -1);
 }
 
+static int git_describe_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "describe.index")) {
+		use_index = git_config_bool(var, value);
+		return 0;
+	}
+	return git_default_config(var, value, cb);
+}
+
 int cmd_describe(int argc, const char **argv, const char *prefix)
 {
 	int contains = 0;
@@ -420,7 +750,7 @@ int cmd_describe(int argc, const char **argv, const char *prefix)
 		OPT_END(),
 	};
 
-	git_config(git_default_config, NULL);
+	git_config(git_describe_config, NULL);
 	argc = parse_options(argc, argv, prefix, options, describe_usage, 0);
 	if (abbrev < 0)
 		abbrev = DEFAULT_ABBREV;
@@ -456,10 +786,15 @@ int cmd_describe(int argc, const char **argv, const char *prefix)
 		return cmd_name_rev(i + argc, args, prefix);
 	}
 
+	if (debug || !max_candidates)
+		use_index = 0;
+
 	init_hash(&names);
 	for_each_rawref(get_name, NULL);
 	if (!names.nr && !always)
 		die(_("No names found, cannot describe anything."));
+	if (use_index)
+		load_describe_index();
 
 	if (argc == 0) {
 		if (dirty) {
@@ -485,5 +820,7 @@ int cmd_describe(int argc, const char **argv, const char *prefix)
 			describe(*argv++, argc == 0);
 		}
 	}
+	if (use_index)
+		write_describe_index();
 	return 0;
 }
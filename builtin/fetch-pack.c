@@ -2,6 +2,7 @@
 #include "refs.h"
 #include "pkt-line.h"
 #include "commit.h"
+#include "prio-queue.h"
 #include "tag.h"
 #include "exec_cmd.h"
 #include "pack.h"
@@ -491,7 +492,7 @@ done:
 	return count ? retval : 0;
 }
 
-static struct commit_list *complete;
+static struct prio_queue complete = { compare_commits_by_commit_date };
 
 static int mark_complete(const char *path, const unsigned char *sha1, int flag, void *cb_data)
 {
@@ -508,7 +509,7 @@ static int mark_complete(const char *path, const unsigned char *sha1, int flag,
 		struct commit *commit = (struct commit *)o;
 		if (!(commit->object.flags & COMPLETE)) {
 			commit->object.flags |= COMPLETE;
-			commit_list_insert_by_date(commit, &complete);
+			prio_queue_put(&complete, commit);
 		}
 	}
 	return 0;
@@ -516,10 +517,13 @@ static int mark_complete(const char *path, const unsigned char *sha1, int flag,
 
 static void mark_recent_complete_commits(unsigned long cutoff)
 {
-	while (complete && cutoff <= complete->item->date) {
+	while (complete.nr) {
+		struct commit *item = prio_queue_peek(&complete);
+		if (item->date < cutoff)
+			break;
 		if (args.verbose)
 			fprintf(stderr, "Marking %s as complete\n",
-				sha1_to_hex(complete->item->object.sha1));
+				sha1_to_hex(item->object.sha1));
 		pop_most_recent_commit(&complete, COMPLETE);
 	}
 }
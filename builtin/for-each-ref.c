@@ -772,6 +772,8 @@ struct grab_ref_cbdata {
 	struct refinfo **grab_array;
 	const char **grab_pattern;
 	int grab_cnt;
+	struct commit_list *with_commit;
+	struct contains_cache contains;
 };
 
 /*
@@ -804,6 +806,13 @@ static int grab_single_ref(const char *refname, const unsigned char *sha1, int f
 			return 0;
 	}
 
+	if (cb->with_commit) {
+		struct commit *commit = lookup_commit_reference_gently(sha1, 1);
+		if (!commit || !commit_contains(commit, cb->with_commit,
+						&cb->contains))
+			return 0;
+	}
+
 	/*
 	 * We do not open the object yet; sort may only need refname
 	 * to do its job and the resulting list may yet to be pruned
@@ -989,6 +998,7 @@ int cmd_for_each_ref(int argc, const char **argv, const char *prefix)
 	int maxcount = 0, quote_style = 0;
 	struct refinfo **refs;
 	struct grab_ref_cbdata cbdata;
+	struct commit_list *with_commit = NULL;
 
 	struct option opts[] = {
 		OPT_BIT('s', "shell", &quote_style,
@@ -1005,6 +1015,12 @@ int cmd_for_each_ref(int argc, const char **argv, const char *prefix)
 		OPT_STRING(  0 , "format", &format, "format", "format to use for the output"),
 		OPT_CALLBACK(0 , "sort", sort_tail, "key",
 		            "field name to sort on", &opt_parse_sort),
+		{
+			OPTION_CALLBACK, 0, "contains", &with_commit, "commit",
+			"print only refs which contain the commit",
+			PARSE_OPT_LASTARG_DEFAULT,
+			parse_opt_with_commit, (intptr_t)"HEAD",
+		},
 		OPT_END(),
 	};
 
@@ -1029,7 +1045,9 @@ int cmd_for_each_ref(int argc, const char **argv, const char *prefix)
 
 	memset(&cbdata, 0, sizeof(cbdata));
 	cbdata.grab_pattern = argv;
+	cbdata.with_commit = with_commit;
 	for_each_rawref(grab_single_ref, &cbdata);
+	clear_contains_cache(&cbdata.contains);
 	refs = cbdata.grab_array;
 	num_refs = cbdata.grab_cnt;
 
@@ -61,6 +61,7 @@ static int nr_resolved_deltas;
 static int from_stdin;
 static int strict;
 static int verbose;
+static int detect_collisions;
 
 static struct progress *progress;
 
@@ -446,10 +447,9 @@ static void find_delta_children(const union delta_base *base,
 	*last_index = last;
 }
 
-static void sha1_object(const void *data, unsigned long size,
-			enum object_type type, unsigned char *sha1)
+static void check_new_object(const void *data, unsigned long size,
+			     enum object_type type, const unsigned char *sha1)
 {
-	hash_sha1_file(data, size, typename(type), sha1);
 	if (has_sha1_file(sha1)) {
 		void *has_data;
 		enum object_type has_type;
@@ -499,6 +499,53 @@ static void sha1_object(const void *data, unsigned long size,
 	}
 }
 
+static void sha1_object(const void *data, unsigned long size,
+			enum object_type type, unsigned char *sha1)
+{
+	hash_sha1_file(data, size, typename(type), sha1);
+	check_new_object(data, size, type, sha1);
+}
+
+/*
+ * Non-delta objects seen in the first pass are hashed in batches;
+ * their inflated data is held until the batch is flushed.
+ */
+#define HASH_BATCH_BYTES (8 * 1024 * 1024)
+
+struct hash_batch {
+	struct sha1_batch_entry entry[SHA1_BATCH_MAX];
+	struct object_entry *obj[SHA1_BATCH_MAX];
+	int nr;
+	unsigned long size;
+};
+
+static void flush_hash_batch(struct hash_batch *b)
+{
+	int i;
+
+	git_SHA1_Batch(b->entry, b->nr);
+	for (i = 0; i < b->nr; i++) {
+		struct object_entry *obj = b->obj[i];
+		hashcpy(obj->idx.sha1, b->entry[i].sha1);
+		check_new_object(b->entry[i].buf, obj->size, obj->type,
+				 obj->idx.sha1);
+		free((void *)b->entry[i].buf);
+	}
+	b->nr = 0;
+	b->size = 0;
+}
+
+static void queue_hash_batch(struct hash_batch *b, struct object_entry *obj,
+			     void *data)
+{
+	prepare_sha1_batch_entry(&b->entry[b->nr], data, obj->size,
+				 typename(obj->type));
+	b->obj[b->nr++] = obj;
+	b->size += obj->size;
+	if (b->nr == SHA1_BATCH_MAX || b->size >= HASH_BATCH_BYTES)
+		flush_hash_batch(b);
+}
+
 static int is_delta_type(enum object_type type)
 {
 	return (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA);
@@ -623,6 +670,7 @@ static void parse_pack_objects(unsigned char *sha1)
 {
 	int i;
 	struct delta_entry *delta = deltas;
+	struct hash_batch batch;
 	struct stat st;
 
 	/*
@@ -635,6 +683,8 @@ static void parse_pack_objects(unsigned char *sha1)
 		progress = start_progress(
 				from_stdin ? "Receiving objects" : "Indexing objects",
 				nr_objects);
+	batch.nr = 0;
+	batch.size = 0;
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 		void *data = unpack_raw_entry(obj, &delta->base);
@@ -643,11 +693,13 @@ static void parse_pack_objects(unsigned char *sha1)
 			nr_deltas++;
 			delta->obj_no = i;
 			delta++;
+			free(data);
 		} else
-			sha1_object(data, obj->size, obj->type, obj->idx.sha1);
-		free(data);
+			queue_hash_batch(&batch, obj, data);
 		display_progress(progress, i+1);
 	}
+	if (batch.nr)
+		flush_hash_batch(&batch);
 	objects[i].idx.offset = consumed_bytes;
 	stop_progress(&progress);
 
@@ -898,6 +950,10 @@ static int git_index_pack_config(const char *k, const char *v, void *cb)
 			die("bad pack.indexversion=%"PRIu32, opts->version);
 		return 0;
 	}
+	if (!strcmp(k, "transfer.detectcollisions")) {
+		detect_collisions = git_config_bool(k, v);
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -1098,6 +1154,9 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 		usage(index_pack_usage);
 	if (fix_thin_pack && !from_stdin)
 		die("--fix-thin cannot be used without --stdin");
+	/* A pack read from stdin was sent to us by someone else */
+	if (from_stdin)
+		detect_sha1_collisions = detect_collisions;
 	if (!index_name && pack_name) {
 		int len = strlen(pack_name);
 		if (!has_extension(pack_name, ".pack"))
@@ -29,6 +29,7 @@ static int decoration_style;
 static int decoration_given;
 static const char *fmt_patch_subject_prefix = "PATCH";
 static const char *fmt_pretty;
+static int log_threads = 1;
 
 static const char * const builtin_log_usage[] = {
 	"git log [<options>] [<since>..<until>] [[--] <path>...]\n"
@@ -98,6 +99,8 @@ static void cmd_log_init_finish(int argc, const char **argv, const char *prefix,
 		OPT_BOOLEAN(0, "source", &source, "show source"),
 		{ OPTION_CALLBACK, 0, "decorate", NULL, NULL, "decorate options",
 		  PARSE_OPT_OPTARG, decorate_callback},
+		OPT_INTEGER(0, "threads", &log_threads,
+			    "generate patches in <n> threads"),
 		OPT_END()
 	};
 
@@ -289,12 +292,15 @@ static int cmd_log_walk(struct rev_info *rev)
 	if (rev->early_output)
 		finish_early_output(rev);
 
+	log_tree_start_threads(rev, log_threads);
+
 	/*
 	 * For --check and --exit-code, the exit code is based on CHECK_FAILED
 	 * and HAS_CHANGES being accumulated in rev->diffopt, so be careful to
 	 * retain that state information if replacing rev->diffopt in this loop
 	 */
 	while ((commit = get_revision(rev)) != NULL) {
+		log_tree_begin_commit(rev);
 		if (!log_tree_commit(rev, commit) &&
 		    rev->max_count >= 0)
 			/*
@@ -302,6 +308,7 @@ static int cmd_log_walk(struct rev_info *rev)
 			 * but we didn't actually show the commit.
 			 */
 			rev->max_count++;
+		log_tree_end_commit(rev, 0);
 		if (!rev->reflog_info) {
 			/* we allow cycles in reflog ancestry */
 			free(commit->buffer);
@@ -314,6 +321,7 @@ static int cmd_log_walk(struct rev_info *rev)
 		if (rev->diffopt.degraded_cc_to_c)
 			saved_dcctc = 1;
 	}
+	log_tree_finish_threads(rev);
 	rev->diffopt.degraded_cc_to_c = saved_dcctc;
 	rev->diffopt.needed_rename_limit = saved_nrl;
 
@@ -654,10 +662,16 @@ static FILE *realstdout = NULL;
 static const char *output_directory = NULL;
 static int outdir_offset;
 
-static int reopen_stdout(struct commit *commit, struct rev_info *rev, int quiet)
+/*
+ * Open the file for the next patch, as *file, or in place of the
+ * standard output if file is NULL.
+ */
+static int open_next_file(struct commit *commit, struct rev_info *rev,
+			  int quiet, FILE **file)
 {
 	struct strbuf filename = STRBUF_INIT;
 	int suffix_len = strlen(fmt_patch_suffix) + 1;
+	FILE *out;
 
 	if (output_directory) {
 		strbuf_addstr(&filename, output_directory);
@@ -673,8 +687,14 @@ static int reopen_stdout(struct commit *commit, struct rev_info *rev, int quiet)
 	if (!quiet)
 		fprintf(realstdout, "%s\n", filename.buf + outdir_offset);
 
-	if (freopen(filename.buf, "w", stdout) == NULL)
+	if (file)
+		out = fopen(filename.buf, "w");
+	else
+		out = freopen(filename.buf, "w", stdout);
+	if (!out)
 		return error(_("Cannot open patch file %s"), filename.buf);
+	if (file)
+		*file = out;
 
 	strbuf_release(&filename);
 	return 0;
@@ -740,10 +760,10 @@ static void gen_message_id(struct rev_info *info, char *base)
 	info->message_id = strbuf_detach(&buf, NULL);
 }
 
-static void print_signature(void)
+static void print_signature(FILE *file)
 {
 	if (signature && *signature)
-		printf("-- \n%s\n\n", signature);
+		fprintf(file, "-- \n%s\n\n", signature);
 }
 
 static void make_cover_letter(struct rev_info *rev, int use_stdout,
@@ -785,7 +805,7 @@ static void make_cover_letter(struct rev_info *rev, int use_stdout,
 			sha1_to_hex(head->object.sha1), committer, committer);
 	}
 
-	if (!use_stdout && reopen_stdout(commit, rev, quiet))
+	if (!use_stdout && open_next_file(commit, rev, quiet, NULL))
 		return;
 
 	if (commit) {
@@ -839,7 +859,7 @@ static void make_cover_letter(struct rev_info *rev, int use_stdout,
 	diff_flush(&opts);
 
 	printf("\n");
-	print_signature();
+	print_signature(stdout);
 }
 
 static const char *clean_message_id(const char *msg_id)
@@ -1084,6 +1104,8 @@ int cmd_format_patch(int argc, const char **argv, const char *prefix)
 			    "add a signature"),
 		OPT_BOOLEAN(0, "quiet", &quiet,
 			    "don't print the patch filenames"),
+		OPT_INTEGER(0, "threads", &log_threads,
+			    "generate patches in <n> threads"),
 		OPT_END()
 	};
 
@@ -1299,6 +1321,7 @@ int cmd_format_patch(int argc, const char **argv, const char *prefix)
 		start_number--;
 	}
 	rev.add_signoff = add_signoff;
+	log_tree_start_threads(&rev, log_threads);
 	while (0 <= --nr) {
 		int shown;
 		commit = list[nr];
@@ -1339,9 +1362,10 @@ int cmd_format_patch(int argc, const char **argv, const char *prefix)
 			gen_message_id(&rev, sha1_to_hex(commit->object.sha1));
 		}
 
-		if (!use_stdout && reopen_stdout(numbered_files ? NULL : commit,
-						 &rev, quiet))
+		if (!use_stdout && open_next_file(numbered_files ? NULL : commit,
+						  &rev, quiet, &rev.diffopt.file))
 			die(_("Failed to create output files"));
+		log_tree_begin_commit(&rev);
 		shown = log_tree_commit(&rev, commit);
 		free(commit->buffer);
 		commit->buffer = NULL;
@@ -1356,15 +1380,15 @@ int cmd_format_patch(int argc, const char **argv, const char *prefix)
 			rev.shown_one = 0;
 		if (shown) {
 			if (rev.mime_boundary)
-				printf("\n--%s%s--\n\n\n",
-				       mime_boundary_leader,
-				       rev.mime_boundary);
+				fprintf(rev.diffopt.file, "\n--%s%s--\n\n\n",
+					mime_boundary_leader,
+					rev.mime_boundary);
 			else
-				print_signature();
+				print_signature(rev.diffopt.file);
 		}
-		if (!use_stdout)
-			fclose(stdout);
+		log_tree_end_commit(&rev, !use_stdout);
 	}
+	log_tree_finish_threads(&rev);
 	free(list);
 	string_list_clear(&extra_to, 0);
 	string_list_clear(&extra_cc, 0);
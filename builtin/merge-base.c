@@ -2,6 +2,7 @@
 #include "cache.h"
 #include "commit.h"
 #include "parse-options.h"
+#include "prio-queue.h"
 
 static int show_merge_base(struct commit **rev, int rev_nr, int show_all)
 {
@@ -26,6 +27,7 @@ static const char * const merge_base_usage[] = {
 	"git merge-base [-a|--all] <commit> <commit>...",
 	"git merge-base [-a|--all] --octopus <commit>...",
 	"git merge-base --independent <commit>...",
+	"git merge-base [-a|--all] --batch",
 	NULL
 };
 
@@ -70,6 +72,212 @@ static int handle_octopus(int count, const char **args, int reduce, int show_all
 	return 0;
 }
 
+/*
+ * In --batch mode, all pairs are handled by a single walk over the
+ * union of their histories.  Each commit we reach carries three bitmaps
+ * in its util field, with one bit per pair: reachable from the base,
+ * reachable from the tip, and reachable from a commit that is reachable
+ * from both (i.e. "stale", not a merge base candidate).
+ */
+struct batch_pair {
+	struct commit *base, *tip;
+	unsigned long ahead, behind;
+	struct commit_list *merge_bases;
+};
+
+static int batch_words;
+
+#define BATCH_BASE(m) ((m))
+#define BATCH_TIP(m) ((m) + batch_words)
+#define BATCH_STALE(m) ((m) + 2 * batch_words)
+
+#define BATCH_SLOP 5
+
+static uint32_t *batch_marks(struct commit *commit,
+			     struct commit **visited, int *visited_nr)
+{
+	if (!commit->util) {
+		commit->util = xcalloc(3 * batch_words, sizeof(uint32_t));
+		visited[(*visited_nr)++] = commit;
+	}
+	return commit->util;
+}
+
+static int batch_interesting(struct prio_queue *queue)
+{
+	int i, w;
+
+	for (i = 0; i < queue->nr; i++) {
+		struct commit *commit = queue->array[i].data;
+		uint32_t *m = commit->util;
+		for (w = 0; w < batch_words; w++)
+			if ((BATCH_BASE(m)[w] | BATCH_TIP(m)[w]) & ~BATCH_STALE(m)[w])
+				return 1;
+	}
+	return 0;
+}
+
+static void batch_walk(struct batch_pair *pair, int nr,
+		       struct commit ***visited_p, int *visited_nr)
+{
+	struct prio_queue queue = { compare_commits_by_commit_date };
+	struct commit **visited = NULL;
+	int visited_alloc = 0;
+	unsigned long oldest_uncommon = ULONG_MAX;
+	int i, w, slop = BATCH_SLOP;
+
+	*visited_nr = 0;
+	batch_words = (nr + 31) / 32;
+
+	for (i = 0; i < nr; i++) {
+		uint32_t bit = (uint32_t)1 << (i % 32);
+		ALLOC_GROW(visited, *visited_nr + 2, visited_alloc);
+		BATCH_BASE(batch_marks(pair[i].base, visited, visited_nr))[i / 32] |= bit;
+		BATCH_TIP(batch_marks(pair[i].tip, visited, visited_nr))[i / 32] |= bit;
+		prio_queue_put(&queue, pair[i].base);
+		prio_queue_put(&queue, pair[i].tip);
+	}
+
+	while (queue.nr) {
+		struct commit *commit;
+		struct commit_list *parents;
+		uint32_t *m;
+
+		if (!batch_interesting(&queue) &&
+		    ((struct commit *)prio_queue_peek(&queue))->date < oldest_uncommon) {
+			if (!--slop)
+				break;
+		} else
+			slop = BATCH_SLOP;
+
+		commit = prio_queue_get(&queue);
+		m = commit->util;
+		for (w = 0; w < batch_words; w++)
+			if (BATCH_BASE(m)[w] ^ BATCH_TIP(m)[w])
+				break;
+		if (w < batch_words && commit->date < oldest_uncommon)
+			oldest_uncommon = commit->date;
+
+		for (parents = commit->parents; parents; parents = parents->next) {
+			struct commit *p = parents->item;
+			uint32_t *pm;
+			int changed = 0;
+
+			if (parse_commit(p))
+				die("unable to parse commit %s",
+				    sha1_to_hex(p->object.sha1));
+			ALLOC_GROW(visited, *visited_nr + 1, visited_alloc);
+			pm = batch_marks(p, visited, visited_nr);
+			for (w = 0; w < batch_words; w++) {
+				uint32_t base = BATCH_BASE(pm)[w] | BATCH_BASE(m)[w];
+				uint32_t tip = BATCH_TIP(pm)[w] | BATCH_TIP(m)[w];
+				uint32_t stale = BATCH_STALE(pm)[w] | BATCH_STALE(m)[w] |
+					(BATCH_BASE(m)[w] & BATCH_TIP(m)[w]);
+
+				if (base == BATCH_BASE(pm)[w] &&
+				    tip == BATCH_TIP(pm)[w] &&
+				    stale == BATCH_STALE(pm)[w])
+					continue;
+				BATCH_BASE(pm)[w] = base;
+				BATCH_TIP(pm)[w] = tip;
+				BATCH_STALE(pm)[w] = stale;
+				changed = 1;
+			}
+			if (changed)
+				prio_queue_put(&queue, p);
+		}
+	}
+	clear_prio_queue(&queue);
+	*visited_p = visited;
+}
+
+static void batch_collect(struct batch_pair *pair, int nr,
+			  struct commit **visited, int visited_nr)
+{
+	int i, w;
+
+	for (i = 0; i < visited_nr; i++) {
+		struct commit *commit = visited[i];
+		uint32_t *m = commit->util;
+
+		for (w = 0; w < batch_words; w++) {
+			uint32_t one_side = BATCH_BASE(m)[w] ^ BATCH_TIP(m)[w];
+			uint32_t merge_base = BATCH_BASE(m)[w] & BATCH_TIP(m)[w] &
+				~BATCH_STALE(m)[w];
+			int bit;
+
+			for (bit = 0; bit < 32; bit++) {
+				struct batch_pair *p = &pair[w * 32 + bit];
+				uint32_t mask = (uint32_t)1 << bit;
+
+				if (!((one_side | merge_base) & mask))
+					continue;
+
+				if (one_side & mask) {
+					if (BATCH_BASE(m)[w] & mask)
+						p->ahead++;
+					else
+						p->behind++;
+				}
+				if (merge_base & mask)
+					commit_list_insert_by_date(commit, &p->merge_bases);
+			}
+		}
+		free(commit->util);
+		commit->util = NULL;
+	}
+
+	for (i = 0; i < nr; i++)
+		if (pair[i].merge_bases && pair[i].merge_bases->next)
+			pair[i].merge_bases = reduce_heads(pair[i].merge_bases);
+}
+
+static int handle_batch(int show_all)
+{
+	struct strbuf line = STRBUF_INIT;
+	struct batch_pair *pair = NULL;
+	struct commit **visited;
+	int nr = 0, alloc = 0, visited_nr, i;
+
+	while (strbuf_getline(&line, stdin, '\n') != EOF) {
+		char *tip = strchr(line.buf, ' ');
+
+		if (!tip)
+			die("expected '<base> <tip>', got '%s'", line.buf);
+		*tip++ = '\0';
+		ALLOC_GROW(pair, nr + 1, alloc);
+		memset(&pair[nr], 0, sizeof(*pair));
+		pair[nr].base = get_commit_reference(line.buf);
+		pair[nr].tip = get_commit_reference(tip);
+		if (parse_commit(pair[nr].base) || parse_commit(pair[nr].tip))
+			die("unable to parse commits in line %d", nr + 1);
+		nr++;
+	}
+	strbuf_release(&line);
+	if (!nr)
+		return 0;
+
+	batch_walk(pair, nr, &visited, &visited_nr);
+	batch_collect(pair, nr, visited, visited_nr);
+	free(visited);
+
+	for (i = 0; i < nr; i++) {
+		struct commit_list *mb;
+
+		printf("%lu\t%lu\t", pair[i].ahead, pair[i].behind);
+		for (mb = pair[i].merge_bases; mb; mb = mb->next) {
+			printf("%s%s", mb == pair[i].merge_bases ? "" : " ",
+			       sha1_to_hex(mb->item->object.sha1));
+			if (!show_all)
+				break;
+		}
+		putchar('\n');
+		free_commit_list(pair[i].merge_bases);
+	}
+	free(pair);
+	return 0;
+}
+
 int cmd_merge_base(int argc, const char **argv, const char *prefix)
 {
 	struct commit **rev;
@@ -77,16 +285,23 @@ int cmd_merge_base(int argc, const char **argv, const char *prefix)
 	int show_all = 0;
 	int octopus = 0;
 	int reduce = 0;
+	int batch = 0;
 
 	struct option options[] = {
 		OPT_BOOLEAN('a', "all", &show_all, "output all common ancestors"),
 		OPT_BOOLEAN(0, "octopus", &octopus, "find ancestors for a single n-way merge"),
 		OPT_BOOLEAN(0, "independent", &reduce, "list revs not reachable from others"),
+		OPT_BOOLEAN(0, "batch", &batch, "read <base> <tip> pairs from stdin"),
 		OPT_END()
 	};
 
 	git_config(git_default_config, NULL);
 	argc = parse_options(argc, argv, prefix, options, merge_base_usage, 0);
+	if (batch) {
+		if (argc || octopus || reduce)
+			usage_with_options(merge_base_usage, options);
+		return handle_batch(show_all);
+	}
 	if (!octopus && !reduce && argc < 2)
 		usage_with_options(merge_base_usage, options);
 	if (reduce && (show_all || octopus))
@@ -80,6 +80,10 @@ int cmd_merge_file(int argc, const char **argv, const char *prefix)
 					argv[i]);
 	}
 
+	if (xdiff_large_input(mmfs + 1, mmfs + 0) ||
+	    xdiff_large_input(mmfs + 1, mmfs + 2))
+		xmp.xpp.flags |= XDF_LARGE_INPUT;
+
 	xmp.ancestor = names[1];
 	xmp.file1 = names[0];
 	xmp.file2 = names[2];
@@ -4,8 +4,13 @@
 #include "blob.h"
 #include "exec_cmd.h"
 #include "merge-file.h"
+#include "merge-recursive.h"
+#include "quote.h"
 
-static const char merge_tree_usage[] = "git merge-tree <base-tree> <branch1> <branch2>";
+static const char merge_tree_usage[] =
+"git merge-tree <base-tree> <branch1> <branch2>\n"
+"   or: git merge-tree --write-tree [--[no-]messages] [--merge-base=<commit>]\n"
+"                      <branch1> <branch2>";
 static int resolve_directories = 1;
 
 struct merge_list {
@@ -27,7 +32,7 @@ static void add_merge_entry(struct merge_list *entry)
 	merge_result_end = &entry->next;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base);
+static void trivial_merge_trees(struct tree_desc t[3], const char *base);
 
 static const char *explanation(struct merge_list *entry)
 {
@@ -213,7 +218,7 @@ static int unresolved_directory(const struct traverse_info *info, struct name_en
 	buf0 = fill_tree_descriptor(t+0, n[0].sha1);
 	buf1 = fill_tree_descriptor(t+1, n[1].sha1);
 	buf2 = fill_tree_descriptor(t+2, n[2].sha1);
-	merge_trees(t, newbase);
+	trivial_merge_trees(t, newbase);
 
 	free(buf0);
 	free(buf1);
@@ -315,7 +320,7 @@ static int threeway_callback(int n, unsigned long mask, unsigned long dirmask, s
 	return mask;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base)
+static void trivial_merge_trees(struct tree_desc t[3], const char *base)
 {
 	struct traverse_info info;
 
@@ -337,18 +342,88 @@ static void *get_tree_descriptor(struct tree_desc *desc, const char *rev)
 	return buf;
 }
 
+static struct commit *get_commit(const char *rev)
+{
+	struct commit *commit = lookup_commit_reference_by_name(rev);
+	if (!commit)
+		die("not a valid commit: %s", rev);
+	return commit;
+}
+
+/*
+ * Do a real merge of two commits, like "git merge" would, but without
+ * an index or a working tree: write the merged tree and print its
+ * name, followed by the unmerged entries the way "ls-files -u" shows
+ * them, and the messages of the merge.
+ */
+static int write_merged_tree(int argc, const char **argv)
+{
+	struct merge_options o;
+	struct commit_list *ca = NULL, **ca_tail = &ca;
+	struct commit *h1, *h2;
+	struct tree *result;
+	int i, clean, show_messages = -1;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		const char *arg = argv[i];
+		if (!strcmp(arg, "--messages"))
+			show_messages = 1;
+		else if (!strcmp(arg, "--no-messages"))
+			show_messages = 0;
+		else if (!prefixcmp(arg, "--merge-base="))
+			ca_tail = &commit_list_insert(get_commit(arg + 13),
+						      ca_tail)->next;
+		else
+			usage(merge_tree_usage);
+	}
+	if (argc - i != 2)
+		usage(merge_tree_usage);
+	h1 = get_commit(argv[i]);
+	h2 = get_commit(argv[i + 1]);
+
+	init_merge_options(&o);
+	o.branch1 = argv[i];
+	o.branch2 = argv[i + 1];
+	o.buffer_output = 2;
+
+	clean = merge_recursive_in_core(&o, h1, h2, ca, &result);
+	if (clean < 0)
+		die("merge of %s and %s failed", argv[i], argv[i + 1]);
+
+	printf("%s\n", sha1_to_hex(result->object.sha1));
+	for (i = 0; i < active_nr; i++) {
+		struct cache_entry *ce = active_cache[i];
+		if (!ce_stage(ce))
+			continue;
+		printf("%06o %s %d\t", ce->ce_mode, sha1_to_hex(ce->sha1),
+		       ce_stage(ce));
+		write_name_quoted(ce->name, stdout, '\n');
+	}
+	if (show_messages < 0)
+		show_messages = !clean;
+	if (show_messages && o.obuf.len) {
+		putchar('\n');
+		fputs(o.obuf.buf, stdout);
+	}
+	strbuf_release(&o.obuf);
+	return !clean;
+}
+
 int cmd_merge_tree(int argc, const char **argv, const char *prefix)
 {
 	struct tree_desc t[3];
 	void *buf1, *buf2, *buf3;
 
+	if (argc > 1 && !strcmp(argv[1], "--write-tree"))
+		return write_merged_tree(argc - 1, argv + 1);
+
 	if (argc != 4)
 		usage(merge_tree_usage);
 
 	buf1 = get_tree_descriptor(t+0, argv[1]);
 	buf2 = get_tree_descriptor(t+1, argv[2]);
 	buf3 = get_tree_descriptor(t+2, argv[3]);
-	merge_trees(t, "");
+	trivial_merge_trees(t, "");
 	free(buf1);
 	free(buf2);
 	free(buf3);
@@ -17,6 +17,7 @@
 #include "progress.h"
 #include "refs.h"
 #include "thread-utils.h"
+#include "delta-islands.h"
 
 static const char pack_usage[] =
   "git pack-objects [ -q | --progress | --all-progress ]\n"
@@ -27,6 +28,7 @@ static const char pack_usage[] =
   "        [--threads=<n>] [--non-empty] [--revs [--unpacked | --all]]\n"
   "        [--reflog] [--stdout | base-name] [--include-tag]\n"
   "        [--keep-unreachable | --unpack-unreachable]\n"
+  "        [--delta-islands]\n"
   "        [< ref-list | < object-list]";
 
 struct object_entry {
@@ -53,6 +55,8 @@ struct object_entry {
 	unsigned char no_try_delta;
 	unsigned char tagged; /* near the very tip of refs */
 	unsigned char filled; /* assigned write-order */
+	unsigned char delta_boundary; /* in the window of two search threads */
+	unsigned tree_depth; /* depth of a tree below its commit */
 };
 
 /*
@@ -72,6 +76,7 @@ static int local;
 static int incremental;
 static int ignore_packed_keep;
 static int allow_ofs_delta;
+static int use_delta_islands;
 static struct pack_idx_option pack_idx_opts;
 static const char *base_name;
 static int progress = 1;
@@ -1200,11 +1205,15 @@ static void check_object(struct object_entry *entry)
 			break;
 		}
 
-		if (base_ref && (base_entry = locate_object_entry(base_ref))) {
+		if (base_ref && (base_entry = locate_object_entry(base_ref)) &&
+		    (!use_delta_islands ||
+		     in_same_island(entry->idx.sha1, base_entry->idx.sha1))) {
 			/*
 			 * If base_ref was set above that means we wish to
 			 * reuse delta data, and we even found that base
 			 * in the list of objects we want to pack. Goodie!
+			 * Unless islands are in use and the base would not
+			 * be available to every island the object is in.
 			 *
 			 * Depth value does not matter - find_deltas() will
 			 * never consider reused delta as the base object to
@@ -1315,6 +1324,11 @@ static int type_size_sort(const void *_a, const void *_b)
 		return -1;
 	if (a->preferred_base < b->preferred_base)
 		return 1;
+	if (use_delta_islands) {
+		int cmp = island_delta_cmp(a->idx.sha1, b->idx.sha1);
+		if (cmp)
+			return cmp;
+	}
 	if (a->size > b->size)
 		return -1;
 	if (a->size < b->size)
@@ -1326,7 +1340,9 @@ struct unpacked {
 	struct object_entry *entry;
 	void *data;
 	struct delta_index *index;
+	struct shared_index *shared;
 	unsigned depth;
+	int boundary;	/* entry->delta_boundary, read under progress_lock */
 };
 
 static int delta_cacheable(unsigned long src_size, unsigned long trg_size,
@@ -1370,6 +1386,128 @@ static pthread_mutex_t progress_mutex;
 
 #endif
 
+/*
+ * A search thread that starts in the middle of the sorted list primes
+ * its window with the objects just before its share, which are at the
+ * tail of the share of another thread.  Both threads then need the
+ * data and delta index of these "boundary" objects; whichever builds
+ * the index first hands it over to the other through this cache.
+ * Entries are reference counted and dropped once both windows are done
+ * with them, and the whole cache is bounded in size.
+ */
+struct shared_index {
+	struct shared_index *next;
+	struct object_entry *entry;
+	void *data;
+	struct delta_index *index;
+	unsigned long mem;
+	unsigned refcount;
+	unsigned users;
+};
+
+#define SHARED_INDEX_HASH 256
+static struct shared_index *shared_index_hash[SHARED_INDEX_HASH];
+static unsigned long shared_index_mem;
+static unsigned long max_shared_index_mem = 64 * 1024 * 1024;
+
+static int shared_index_ix(struct object_entry *entry)
+{
+	return (entry - objects) % SHARED_INDEX_HASH;
+}
+
+static void free_shared_index(struct shared_index *s)
+{
+	struct shared_index **pp = &shared_index_hash[shared_index_ix(s->entry)];
+
+	while (*pp != s)
+		pp = &(*pp)->next;
+	*pp = s->next;
+	shared_index_mem -= s->mem;
+	free_delta_index(s->index);
+	free(s->data);
+	free(s);
+}
+
+/*
+ * Evict the entries no window is using any more until "mem" more
+ * bytes fit.  Called with the cache lock held.
+ */
+static int make_room_for_shared_index(unsigned long mem)
+{
+	int i;
+
+	for (i = 0; i < SHARED_INDEX_HASH; i++) {
+		struct shared_index *s = shared_index_hash[i], *next;
+		for (; s; s = next) {
+			if (shared_index_mem + mem <= max_shared_index_mem)
+				return 1;
+			next = s->next;
+			if (!s->refcount)
+				free_shared_index(s);
+		}
+	}
+	return shared_index_mem + mem <= max_shared_index_mem;
+}
+
+static void use_shared_index(struct unpacked *n, unsigned long *mem_usage)
+{
+	struct shared_index *s;
+
+	cache_lock();
+	for (s = shared_index_hash[shared_index_ix(n->entry)]; s; s = s->next)
+		if (s->entry == n->entry) {
+			s->refcount++;
+			s->users++;
+			break;
+		}
+	cache_unlock();
+	if (!s)
+		return;
+
+	n->shared = s;
+	n->data = s->data;
+	n->index = s->index;
+	*mem_usage += s->mem;
+}
+
+static void share_index(struct unpacked *n)
+{
+	struct shared_index *s;
+	unsigned long mem = n->entry->size + sizeof_delta_index(n->index);
+	int ix = shared_index_ix(n->entry);
+
+	cache_lock();
+	for (s = shared_index_hash[ix]; s; s = s->next)
+		if (s->entry == n->entry)
+			break;
+	if (s || !make_room_for_shared_index(mem)) {
+		/* keep our own copy */
+		cache_unlock();
+		return;
+	}
+	s = xmalloc(sizeof(*s));
+	s->entry = n->entry;
+	s->data = n->data;
+	s->index = n->index;
+	s->mem = mem;
+	s->refcount = 1;
+	s->users = 1;
+	s->next = shared_index_hash[ix];
+	shared_index_hash[ix] = s;
+	shared_index_mem += mem;
+	cache_unlock();
+
+	n->shared = s;
+}
+
+static void release_shared_index(struct shared_index *s)
+{
+	cache_lock();
+	if (!--s->refcount && s->users >= 2)
+		free_shared_index(s);
+	cache_unlock();
+}
+
 static int try_delta(struct unpacked *trg, struct unpacked *src,
 		     unsigned max_depth, unsigned long *mem_usage)
 {
@@ -1384,6 +1522,14 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	if (trg_entry->type != src_entry->type)
 		return -1;
 
+	/*
+	 * Do not deltify against a base that some island of the
+	 * target cannot reach.
+	 */
+	if (use_delta_islands &&
+	    !in_same_island(trg_entry->idx.sha1, src_entry->idx.sha1))
+		return 0;
+
 	/*
 	 * We do not bother to try a delta that we discarded
 	 * on an earlier try, but only when reusing delta data.
@@ -1419,6 +1565,8 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 		return 0;
 
 	/* Load data if not already done */
+	if (!trg->data && trg->boundary)
+		use_shared_index(trg, mem_usage);
 	if (!trg->data) {
 		read_lock();
 		trg->data = read_sha1_file(trg_entry->idx.sha1, &type, &sz);
@@ -1431,6 +1579,8 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 			    sha1_to_hex(trg_entry->idx.sha1), sz, trg_size);
 		*mem_usage += sz;
 	}
+	if (!src->data && src->boundary)
+		use_shared_index(src, mem_usage);
 	if (!src->data) {
 		read_lock();
 		src->data = read_sha1_file(src_entry->idx.sha1, &type, &sz);
@@ -1466,6 +1616,8 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 			return 0;
 		}
 		*mem_usage += sizeof_delta_index(src->index);
+		if (src->boundary)
+			share_index(src);
 	}
 
 	delta_buf = create_delta(src->index, trg->data, trg_size, &delta_size, max_size);
@@ -1523,7 +1675,21 @@ static unsigned int check_delta_limit(struct object_entry *me, unsigned int n)
 
 static unsigned long free_unpacked(struct unpacked *n)
 {
-	unsigned long freed_mem = sizeof_delta_index(n->index);
+	unsigned long freed_mem;
+
+	if (n->shared) {
+		freed_mem = n->shared->mem;
+		release_shared_index(n->shared);
+		n->shared = NULL;
+		n->index = NULL;
+		n->data = NULL;
+		n->entry = NULL;
+		n->depth = 0;
+		n->boundary = 0;
+		return freed_mem;
+	}
+
+	freed_mem = sizeof_delta_index(n->index);
 	free_delta_index(n->index);
 	n->index = NULL;
 	if (n->data) {
@@ -1533,11 +1699,18 @@ static unsigned long free_unpacked(struct unpacked *n)
 	}
 	n->entry = NULL;
 	n->depth = 0;
+	n->boundary = 0;
 	return freed_mem;
 }
 
+/*
+ * Search deltas for the *list_size objects at list.  The nr_seeds
+ * objects before list are only put into the window as bases to try,
+ * as they are handled by another thread.
+ */
 static void find_deltas(struct object_entry **list, unsigned *list_size,
-			int window, int depth, unsigned *processed)
+			unsigned nr_seeds, int window, int depth,
+			unsigned *processed)
 {
 	uint32_t i, idx = 0, count = 0;
 	struct unpacked *array;
@@ -1545,10 +1718,23 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 
 	array = xcalloc(window, sizeof(struct unpacked));
 
+	/*
+	 * The main thread marks boundary objects while handing out work
+	 * under the progress lock, so only look at the flag under it too.
+	 */
+	progress_lock();
+	for (i = nr_seeds; i > 0; i--) {
+		array[idx].entry = list[-(int)i];
+		array[idx].boundary = array[idx].entry->delta_boundary;
+		idx++;
+		count++;
+	}
+	progress_unlock();
+
 	for (;;) {
 		struct object_entry *entry;
 		struct unpacked *n = array + idx;
-		int j, max_depth, best_base = -1;
+		int j, max_depth, best_base = -1, boundary;
 
 		progress_lock();
 		if (!*list_size) {
@@ -1557,6 +1743,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		}
 		entry = *list++;
 		(*list_size)--;
+		boundary = entry->delta_boundary;
 		if (!entry->preferred_base) {
 			(*processed)++;
 			display_progress(progress_state, *processed);
@@ -1565,6 +1752,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 
 		mem_usage -= free_unpacked(n);
 		n->entry = entry;
+		n->boundary = boundary;
 
 		while (window_memory_limit &&
 		       mem_usage > window_memory_limit &&
@@ -1664,10 +1852,8 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 			idx = 0;
 	}
 
-	for (i = 0; i < window; ++i) {
-		free_delta_index(array[i].index);
-		free(array[i].data);
-	}
+	for (i = 0; i < window; ++i)
+		free_unpacked(array + i);
 	free(array);
 }
 
@@ -1696,6 +1882,7 @@ struct thread_params {
 	struct object_entry **list;
 	unsigned list_size;
 	unsigned remaining;
+	unsigned nr_seeds;
 	int window;
 	int depth;
 	int working;
@@ -1719,9 +1906,19 @@ static void init_threaded_search(void)
 	old_try_to_free_routine = set_try_to_free_routine(try_to_free_from_threads);
 }
 
+static void clear_shared_index_cache(void)
+{
+	int i;
+
+	for (i = 0; i < SHARED_INDEX_HASH; i++)
+		while (shared_index_hash[i])
+			free_shared_index(shared_index_hash[i]);
+}
+
 static void cleanup_threaded_search(void)
 {
 	set_try_to_free_routine(old_try_to_free_routine);
+	clear_shared_index_cache();
 	pthread_cond_destroy(&progress_cond);
 	pthread_mutex_destroy(&read_mutex);
 	pthread_mutex_destroy(&cache_mutex);
@@ -1733,7 +1930,7 @@ static void *threaded_find_deltas(void *arg)
 	struct thread_params *me = arg;
 
 	while (me->remaining) {
-		find_deltas(me->list, &me->remaining,
+		find_deltas(me->list, &me->remaining, me->nr_seeds,
 			    me->window, me->depth, me->processed);
 
 		progress_lock();
@@ -1759,10 +1956,120 @@ static void *threaded_find_deltas(void *arg)
 	return NULL;
 }
 
+/*
+ * The work is split into shares of roughly equal total object size
+ * rather than object count, so that a run of huge blobs does not leave
+ * one thread busy long after the others are done.  Shares are only cut
+ * between two groups of objects with different name hashes, i.e. from
+ * different paths, where deltas are least likely to be lost.
+ */
+static int is_group_boundary(struct object_entry **list, unsigned pos)
+{
+	return !list[pos]->hash || list[pos]->hash != list[pos - 1]->hash;
+}
+
+/*
+ * Find a position in (from, to) to cut the list at, close to where
+ * the cumulative weight reaches "goal".  Returns "to" when the range
+ * is too short to be worth cutting.
+ */
+static unsigned find_split(struct object_entry **list, uint64_t *weights,
+			   unsigned from, unsigned to, uint64_t goal,
+			   int window)
+{
+	unsigned lo = from + window, hi = to, mid, pos;
+
+	if (to - from < 2 * window)
+		return to;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (weights[mid] < goal)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo >= to)
+		lo = to - 1;
+
+	for (pos = lo; pos < to; pos++)
+		if (is_group_boundary(list, pos))
+			return pos;
+	for (pos = lo; pos > from + window; pos--)
+		if (is_group_boundary(list, pos))
+			return pos;
+	/*
+	 * It is possible for some "paths" to have so many objects that
+	 * no group boundary can be found.  Just cut at the goal then.
+	 */
+	return lo;
+}
+
+/*
+ * Hand the objects from "start" on to a thread, letting it try them
+ * against the window - 1 objects before "start" as well.
+ */
+static void assign_share(struct thread_params *p, struct object_entry **list,
+			 unsigned start, unsigned size)
+{
+	unsigned i;
+
+	p->list = list + start;
+	p->list_size = size;
+	p->remaining = size;
+	p->nr_seeds = size ? start : 0;
+	if (p->nr_seeds >= p->window)
+		p->nr_seeds = p->window - 1;
+	for (i = 1; i <= p->nr_seeds; i++)
+		list[start - i]->delta_boundary = 1;
+}
+
+/*
+ * A thread that starts in the middle of the list has no idea yet how
+ * deep the deltas of its seed objects will end up, and may have built
+ * deltas on top of them that are too deep.  The list is sorted so that
+ * bases come before the objects deltified against them; cut any chain
+ * that exceeds the allowed depth.
+ */
+static void break_delta_chains(struct object_entry **list, unsigned list_size,
+			       int depth)
+{
+	unsigned *chain_depth = xcalloc(nr_objects, sizeof(*chain_depth));
+	unsigned i;
+
+	for (i = 0; i < list_size; i++) {
+		struct object_entry *entry = list[i];
+		int max_depth = depth;
+		unsigned d;
+
+		if (!entry->delta)
+			continue;
+		if (entry->delta_child)
+			max_depth -= check_delta_limit(entry, 0);
+		d = chain_depth[entry->delta - objects] + 1;
+		if ((int)d <= max_depth) {
+			chain_depth[entry - objects] = d;
+			continue;
+		}
+
+		if (entry->delta_data) {
+			delta_cache_size -= entry->z_delta_size ?
+				entry->z_delta_size : entry->delta_size;
+			free(entry->delta_data);
+			entry->delta_data = NULL;
+		}
+		entry->delta = NULL;
+		entry->delta_size = 0;
+		entry->z_delta_size = 0;
+	}
+	free(chain_depth);
+}
+
 static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 			   int window, int depth, unsigned *processed)
 {
 	struct thread_params *p;
+	uint64_t *weights;
+	unsigned start;
 	int i, ret, active_threads = 0;
 
 	init_threaded_search();
@@ -1770,7 +2077,7 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 	if (!delta_search_threads)	/* --threads=0 means autodetect */
 		delta_search_threads = online_cpus();
 	if (delta_search_threads <= 1) {
-		find_deltas(list, &list_size, window, depth, processed);
+		find_deltas(list, &list_size, 0, window, depth, processed);
 		cleanup_threaded_search();
 		return;
 	}
@@ -1779,32 +2086,32 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 				delta_search_threads);
 	p = xcalloc(delta_search_threads, sizeof(*p));
 
-	/* Partition the work amongst work threads. */
-	for (i = 0; i < delta_search_threads; i++) {
-		unsigned sub_size = list_size / (delta_search_threads - i);
+	weights = xmalloc((list_size + 1) * sizeof(*weights));
+	weights[0] = 0;
+	for (start = 0; start < list_size; start++)
+		weights[start + 1] = weights[start] + list[start]->size;
 
+	/* Partition the work amongst work threads. */
+	for (i = 0, start = 0; i < delta_search_threads; i++) {
+		int left = delta_search_threads - i;
+		uint64_t goal = weights[start] +
+			(weights[list_size] - weights[start]) / left;
+		unsigned end = list_size;
+
+		if (left > 1)
+			end = find_split(list, weights, start, list_size,
+					 goal, window);
 		/* don't use too small segments or no deltas will be found */
-		if (sub_size < 2*window && i+1 < delta_search_threads)
-			sub_size = 0;
+		if (left > 1 && end - start < 2 * window)
+			end = start;
 
 		p[i].window = window;
 		p[i].depth = depth;
 		p[i].processed = processed;
 		p[i].working = 1;
 		p[i].data_ready = 0;
-
-		/* try to split chunks on "path" boundaries */
-		while (sub_size && sub_size < list_size &&
-		       list[sub_size]->hash &&
-		       list[sub_size]->hash == list[sub_size-1]->hash)
-			sub_size++;
-
-		p[i].list = list;
-		p[i].list_size = sub_size;
-		p[i].remaining = sub_size;
-
-		list += sub_size;
-		list_size -= sub_size;
+		assign_share(&p[i], list, start, end - start);
+		start = end;
 	}
 
 	/* Start work threads. */
@@ -1822,15 +2129,16 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 
 	/*
 	 * Now let's wait for work completion.  Each time a thread is done
-	 * with its work, we steal half of the remaining work from the
-	 * thread with the largest number of unprocessed objects and give
-	 * it to that newly idle thread.  This ensure good load balancing
-	 * until the remaining object list segments are simply too short
-	 * to be worth splitting anymore.
+	 * with its work, we steal half of the remaining work, by weight,
+	 * from the thread with the most of it left and give it to that
+	 * newly idle thread.  This ensure good load balancing until the
+	 * remaining object list segments are simply too short to be worth
+	 * splitting anymore.
 	 */
 	while (active_threads) {
 		struct thread_params *target = NULL;
 		struct thread_params *victim = NULL;
+		uint64_t victim_weight = 0;
 		unsigned sub_size = 0;
 
 		progress_lock();
@@ -1843,34 +2151,29 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 			pthread_cond_wait(&progress_cond, &progress_mutex);
 		}
 
-		for (i = 0; i < delta_search_threads; i++)
+		for (i = 0; i < delta_search_threads; i++) {
+			unsigned end = p[i].list - list + p[i].list_size;
+			uint64_t w = weights[end] - weights[end - p[i].remaining];
 			if (p[i].remaining > 2*window &&
-			    (!victim || victim->remaining < p[i].remaining))
+			    (!victim || victim_weight < w)) {
 				victim = &p[i];
-		if (victim) {
-			sub_size = victim->remaining / 2;
-			list = victim->list + victim->list_size - sub_size;
-			while (sub_size && list[0]->hash &&
-			       list[0]->hash == list[-1]->hash) {
-				list++;
-				sub_size--;
-			}
-			if (!sub_size) {
-				/*
-				 * It is possible for some "paths" to have
-				 * so many objects that no hash boundary
-				 * might be found.  Let's just steal the
-				 * exact half in that case.
-				 */
-				sub_size = victim->remaining / 2;
-				list -= sub_size;
+				victim_weight = w;
 			}
-			target->list = list;
+		}
+		if (victim) {
+			unsigned end = victim->list - list + victim->list_size;
+			unsigned from = end - victim->remaining;
+			unsigned split;
+
+			split = find_split(list, weights, from, end,
+					   weights[end] - victim_weight / 2,
+					   window);
+			sub_size = end - split;
 			victim->list_size -= sub_size;
 			victim->remaining -= sub_size;
-		}
-		target->list_size = sub_size;
-		target->remaining = sub_size;
+			assign_share(target, list, split, sub_size);
+		} else
+			assign_share(target, list, 0, 0);
 		target->working = 1;
 		progress_unlock();
 
@@ -1887,11 +2190,13 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 		}
 	}
 	cleanup_threaded_search();
+	break_delta_chains(list, list_size, depth);
+	free(weights);
 	free(p);
 }
 
 #else
-#define ll_find_deltas(l, s, w, d, p)	find_deltas(l, &s, w, d, p)
+#define ll_find_deltas(l, s, w, d, p)	find_deltas(l, &s, 0, w, d, p)
 #endif
 
 static int add_ref_tag(const char *path, const unsigned char *sha1, int flag, void *cb_data)
@@ -2031,6 +2336,8 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		pack_size_limit_cfg = git_config_ulong(k, v);
 		return 0;
 	}
+	if (!strcmp(k, "pack.island"))
+		return island_config(k, v, cb);
 	return git_default_config(k, v, cb);
 }
 
@@ -2071,6 +2378,9 @@ static void show_commit(struct commit *commit, void *data)
 {
 	add_object_entry(commit->object.sha1, OBJ_COMMIT, NULL, 0);
 	commit->object.flags |= OBJECT_ADDED;
+
+	if (use_delta_islands)
+		propagate_island_marks(commit);
 }
 
 static void show_object(struct object *obj,
@@ -2083,6 +2393,18 @@ static void show_object(struct object *obj,
 	add_object_entry(obj->sha1, obj->type, name, 0);
 	obj->flags |= OBJECT_ADDED;
 
+	if (use_delta_islands && obj->type == OBJ_TREE) {
+		struct object_entry *entry = locate_object_entry(obj->sha1);
+		const char *p;
+		unsigned depth = *name ? 1 : 0;
+
+		/* the empty string is a root tree, which is depth 0 */
+		for (p = strchr(name, '/'); p; p = strchr(p + 1, '/'))
+			depth++;
+		if (entry && depth > entry->tree_depth)
+			entry->tree_depth = depth;
+	}
+
 	/*
 	 * We will have generated the hash from the name,
 	 * but not saved a pointer to it - we can free it
@@ -2217,6 +2539,36 @@ static void loosen_unused_packed_objects(struct rev_info *revs)
 	}
 }
 
+static int tree_depth_compare(const void *a_, const void *b_)
+{
+	const struct object_entry *a = *(const struct object_entry **)a_;
+	const struct object_entry *b = *(const struct object_entry **)b_;
+
+	return a->tree_depth < b->tree_depth ? -1 :
+		(a->tree_depth > b->tree_depth);
+}
+
+/*
+ * The commit walk has handed the islands down to the root trees;
+ * now push them further down to the subtrees and blobs, processing
+ * each tree before anything that is below it.
+ */
+static void resolve_tree_islands(void)
+{
+	struct object_entry **todo;
+	uint32_t i, nr = 0;
+
+	todo = xmalloc(nr_objects * sizeof(*todo));
+	for (i = 0; i < nr_objects; i++)
+		if (objects[i].type == OBJ_TREE)
+			todo[nr++] = objects + i;
+	qsort(todo, nr, sizeof(*todo), tree_depth_compare);
+
+	for (i = 0; i < nr; i++)
+		propagate_tree_island_marks(todo[i]->idx.sha1);
+	free(todo);
+}
+
 static void get_object_list(int ac, const char **av)
 {
 	struct rev_info revs;
@@ -2244,11 +2596,17 @@ static void get_object_list(int ac, const char **av)
 			die("bad revision '%s'", line);
 	}
 
+	if (use_delta_islands)
+		load_delta_islands(progress);
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(revs.commits, &revs, show_edge);
 	traverse_commit_list(&revs, show_commit, show_object, NULL);
 
+	if (use_delta_islands)
+		resolve_tree_islands();
+
 	if (keep_unreachable)
 		add_objects_in_unpacked_packs(&revs);
 	if (unpack_unreachable)
@@ -2427,6 +2785,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 				die("bad %s", arg);
 			continue;
 		}
+		if (!strcmp("--delta-islands", arg)) {
+			use_delta_islands = 1;
+			continue;
+		}
 		if (!strcmp(arg, "--keep-true-parents")) {
 			grafts_replace_parents = 0;
 			continue;
@@ -2471,6 +2833,17 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (progress && all_progress_implied)
 		progress = 2;
 
+	/* islands are handed down from children to parents */
+	if (use_delta_islands) {
+		if (!use_internal_rev_list)
+			die("--delta-islands needs an internal revision walk (--revs).");
+		if (rp_ac >= rp_ac_alloc - 1) {
+			rp_ac_alloc = alloc_nr(rp_ac_alloc);
+			rp_av = xrealloc(rp_av, rp_ac_alloc * sizeof(*rp_av));
+		}
+		rp_av[rp_ac++] = "--topo-order";
+	}
+
 	prepare_packed_git();
 
 	if (progress)
@@ -145,8 +145,8 @@ static void update_index_from_diff(struct diff_queue_struct *q,
 		struct diff_filespec *one = q->queue[i]->one;
 		if (one->mode && !is_null_sha1(one->sha1)) {
 			struct cache_entry *ce;
-			ce = make_cache_entry(one->mode, one->sha1, one->path,
-				0, 0);
+			ce = make_cache_entry(&the_index, one->mode, one->sha1,
+				one->path, 0, 0);
 			if (!ce)
 				die(_("make_cache_entry failed for path '%s'"),
 				    one->path);
@@ -29,6 +29,7 @@ struct tag_filter {
 	const char **patterns;
 	int lines;
 	struct commit_list *with_commit;
+	struct contains_cache contains;
 };
 
 static int match_pattern(const char **patterns, const char *ref)
@@ -42,48 +43,6 @@ static int match_pattern(const char **patterns, const char *ref)
 	return 0;
 }
 
-static int in_commit_list(const struct commit_list *want, struct commit *c)
-{
-	for (; want; want = want->next)
-		if (!hashcmp(want->item->object.sha1, c->object.sha1))
-			return 1;
-	return 0;
-}
-
-static int contains_recurse(struct commit *candidate,
-			    const struct commit_list *want)
-{
-	struct commit_list *p;
-
-	/* was it previously marked as containing a want commit? */
-	if (candidate->object.flags & TMP_MARK)
-		return 1;
-	/* or marked as not possibly containing a want commit? */
-	if (candidate->object.flags & UNINTERESTING)
-		return 0;
-	/* or are we it? */
-	if (in_commit_list(want, candidate))
-		return 1;
-
-	if (parse_commit(candidate) < 0)
-		return 0;
-
-	/* Otherwise recurse and mark ourselves for future traversals. */
-	for (p = candidate->parents; p; p = p->next) {
-		if (contains_recurse(p->item, want)) {
-			candidate->object.flags |= TMP_MARK;
-			return 1;
-		}
-	}
-	candidate->object.flags |= UNINTERESTING;
-	return 0;
-}
-
-static int contains(struct commit *candidate, const struct commit_list *want)
-{
-	return contains_recurse(candidate, want);
-}
-
 static int show_reference(const char *refname, const unsigned char *sha1,
 			  int flag, void *cb_data)
 {
@@ -102,7 +61,8 @@ static int show_reference(const char *refname, const unsigned char *sha1,
 			commit = lookup_commit_reference_gently(sha1, 1);
 			if (!commit)
 				return 0;
-			if (!contains(commit, filter->with_commit))
+			if (!commit_contains(commit, filter->with_commit,
+					     &filter->contains))
 				return 0;
 		}
 
@@ -151,8 +111,10 @@ static int list_tags(const char **patterns, int lines,
 	filter.patterns = patterns;
 	filter.lines = lines;
 	filter.with_commit = with_commit;
+	memset(&filter.contains, 0, sizeof(filter.contains));
 
 	for_each_tag_ref(show_reference, (void *) &filter);
+	clear_contains_cache(&filter.contains);
 
 	return 0;
 }
@@ -13,6 +13,7 @@
 #include "fsck.h"
 
 static int dry_run, quiet, recover, has_errors, strict;
+static int detect_collisions;
 static const char unpack_usage[] = "git unpack-objects [-n] [-q] [-r] [--strict] < pack-file";
 
 /* We always read in 4kB chunks. */
@@ -492,6 +493,15 @@ static void unpack_all(void)
 		die("unresolved deltas left after unpacking");
 }
 
+static int unpack_objects_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "transfer.detectcollisions")) {
+		detect_collisions = git_config_bool(var, value);
+		return 0;
+	}
+	return git_default_config(var, value, cb);
+}
+
 int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 {
 	int i;
@@ -499,7 +509,7 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 
 	read_replace_refs = 0;
 
-	git_config(git_default_config, NULL);
+	git_config(unpack_objects_config, NULL);
 
 	quiet = !isatty(2);
 
@@ -544,6 +554,8 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 		/* We don't take any non-flag arguments now.. Maybe some day */
 		usage(unpack_usage);
 	}
+	/* The pack was sent to us by someone else */
+	detect_sha1_collisions = detect_collisions;
 	git_SHA1_Init(&ctx);
 	unpack_all();
 	git_SHA1_Update(&ctx, buffer, offset);
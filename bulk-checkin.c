@@ -0,0 +1,259 @@
+#include "bulk-checkin.h"
+#include "csum-file.h"
+#include "pack.h"
+
+static struct bulk_checkin_state {
+	unsigned plugged:1;
+
+	char *pack_tmp_name;
+	struct sha1file *f;
+	off_t offset;
+	struct pack_idx_option pack_idx_opts;
+
+	struct pack_idx_entry **written;
+	uint32_t alloc_written;
+	uint32_t nr_written;
+} state;
+
+static int bulk_checkin_compression_level(void)
+{
+	return core_compression_seen ? core_compression_level
+				     : Z_DEFAULT_COMPRESSION;
+}
+
+static void finish_bulk_checkin(struct bulk_checkin_state *state)
+{
+	unsigned char sha1[20];
+	char packname[PATH_MAX];
+	const char *idx_tmp_name;
+	uint32_t i;
+
+	if (!state->f)
+		return;
+
+	if (state->nr_written == 0) {
+		close(state->f->fd);
+		free(state->f);
+		unlink_or_warn(state->pack_tmp_name);
+		goto clear_exit;
+	} else if (state->nr_written == 1) {
+		sha1close(state->f, sha1, CSUM_FSYNC);
+	} else {
+		/* the header claims a single object; fix it up */
+		int fd = sha1close(state->f, sha1, 0);
+		fixup_pack_header_footer(fd, sha1, state->pack_tmp_name,
+					 state->nr_written, sha1,
+					 state->offset);
+		close(fd);
+	}
+
+	idx_tmp_name = write_idx_file(NULL, state->written, state->nr_written,
+				      &state->pack_idx_opts, sha1);
+
+	snprintf(packname, sizeof(packname), "%s/pack/pack-%s.pack",
+		 get_object_directory(), sha1_to_hex(sha1));
+	if (adjust_shared_perm(state->pack_tmp_name))
+		die_errno("unable to make temporary pack file readable");
+	if (rename(state->pack_tmp_name, packname))
+		die_errno("unable to rename temporary pack file");
+
+	snprintf(packname, sizeof(packname), "%s/pack/pack-%s.idx",
+		 get_object_directory(), sha1_to_hex(sha1));
+	if (adjust_shared_perm(idx_tmp_name))
+		die_errno("unable to make temporary index file readable");
+	if (rename(idx_tmp_name, packname))
+		die_errno("unable to rename temporary index file");
+
+	free((void *)idx_tmp_name);
+	for (i = 0; i < state->nr_written; i++)
+		free(state->written[i]);
+
+clear_exit:
+	free(state->written);
+	free(state->pack_tmp_name);
+	memset(state, 0, sizeof(*state));
+
+	/* Make objects we just wrote available to ourselves */
+	reprepare_packed_git();
+}
+
+static int already_written(struct bulk_checkin_state *state, unsigned char sha1[])
+{
+	uint32_t i;
+
+	/* The object may already exist in the repository */
+	if (has_sha1_file(sha1))
+		return 1;
+
+	/* Might want to keep the list sorted */
+	for (i = 0; i < state->nr_written; i++)
+		if (!hashcmp(state->written[i]->sha1, sha1))
+			return 1;
+
+	/* This is a new object we need to keep */
+	return 0;
+}
+
+static void hash_stream(git_SHA_CTX *ctx, int fd, size_t size,
+			const char *path)
+{
+	unsigned char ibuf[16384];
+
+	while (size) {
+		ssize_t rsize = size < sizeof(ibuf) ? size : sizeof(ibuf);
+		if (read_in_full(fd, ibuf, rsize) != rsize)
+			die("failed to read %d bytes from '%s'",
+			    (int)rsize, path);
+		git_SHA1_Update(ctx, ibuf, rsize);
+		size -= rsize;
+	}
+}
+
+/*
+ * Read the contents from fd for size bytes, hashing them into ctx
+ * and deflating them into the packfile in state as we go.
+ */
+static void stream_to_pack(struct bulk_checkin_state *state,
+			   git_SHA_CTX *ctx, int fd, size_t size,
+			   enum object_type type, const char *path)
+{
+	git_zstream s;
+	unsigned char obuf[16384];
+	unsigned hdrlen;
+	int status = Z_OK;
+
+	memset(&s, 0, sizeof(s));
+	git_deflate_init(&s, bulk_checkin_compression_level());
+
+	hdrlen = encode_in_pack_object_header(type, size, obuf);
+	s.next_out = obuf + hdrlen;
+	s.avail_out = sizeof(obuf) - hdrlen;
+
+	while (status != Z_STREAM_END) {
+		unsigned char ibuf[16384];
+
+		if (size && !s.avail_in) {
+			ssize_t rsize = size < sizeof(ibuf) ? size : sizeof(ibuf);
+			if (read_in_full(fd, ibuf, rsize) != rsize)
+				die("failed to read %d bytes from '%s'",
+				    (int)rsize, path);
+			git_SHA1_Update(ctx, ibuf, rsize);
+			s.next_in = ibuf;
+			s.avail_in = rsize;
+			size -= rsize;
+		}
+
+		status = git_deflate(&s, size ? 0 : Z_FINISH);
+
+		if (!s.avail_out || status == Z_STREAM_END) {
+			size_t written = s.next_out - obuf;
+			sha1write(state->f, obuf, written);
+			state->offset += written;
+			s.next_out = obuf;
+			s.avail_out = sizeof(obuf);
+		}
+
+		switch (status) {
+		case Z_OK:
+		case Z_BUF_ERROR:
+		case Z_STREAM_END:
+			continue;
+		default:
+			die("unexpected deflate failure: %d", status);
+		}
+	}
+	git_deflate_end(&s);
+}
+
+/* Lazily create backing packfile for the state */
+static void prepare_to_stream(struct bulk_checkin_state *state)
+{
+	char tmpname[PATH_MAX];
+	struct pack_header hdr;
+	int fd;
+
+	if (state->f)
+		return;
+
+	fd = odb_mkstemp(tmpname, sizeof(tmpname), "pack/tmp_pack_XXXXXX");
+	state->pack_tmp_name = xstrdup(tmpname);
+	state->f = sha1fd(fd, state->pack_tmp_name);
+	reset_pack_idx_option(&state->pack_idx_opts);
+
+	/* Pretend we are going to write only one object */
+	hdr.hdr_signature = htonl(PACK_SIGNATURE);
+	hdr.hdr_version = htonl(PACK_VERSION);
+	hdr.hdr_entries = htonl(1);
+	sha1write(state->f, &hdr, sizeof(hdr));
+	state->offset = sizeof(hdr);
+}
+
+static int deflate_to_pack(struct bulk_checkin_state *state,
+			   unsigned char result_sha1[],
+			   int fd, size_t size,
+			   enum object_type type, const char *path,
+			   unsigned flags)
+{
+	git_SHA_CTX ctx;
+	char obuf[100];
+	int header_len;
+	struct sha1file_checkpoint checkpoint;
+	struct pack_idx_entry *idx;
+
+	header_len = sprintf(obuf, "%s %" PRIuMAX,
+			     typename(type), (uintmax_t)size) + 1;
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, obuf, header_len);
+
+	if (!(flags & HASH_WRITE_OBJECT)) {
+		hash_stream(&ctx, fd, size, path);
+		git_SHA1_Final(result_sha1, &ctx);
+		return 0;
+	}
+
+	prepare_to_stream(state);
+	idx = xcalloc(1, sizeof(*idx));
+	sha1file_checkpoint(state->f, &checkpoint);
+	idx->offset = state->offset;
+	crc32_begin(state->f);
+	stream_to_pack(state, &ctx, fd, size, type, path);
+	git_SHA1_Final(result_sha1, &ctx);
+
+	idx->crc32 = crc32_end(state->f);
+	if (already_written(state, result_sha1)) {
+		if (sha1file_truncate(state->f, &checkpoint))
+			die_errno("unable to truncate '%s'", state->pack_tmp_name);
+		state->offset = checkpoint.offset;
+		free(idx);
+	} else {
+		hashcpy(idx->sha1, result_sha1);
+		ALLOC_GROW(state->written,
+			   state->nr_written + 1,
+			   state->alloc_written);
+		state->written[state->nr_written++] = idx;
+	}
+	return 0;
+}
+
+int index_bulk_checkin(unsigned char *sha1,
+		       int fd, size_t size, enum object_type type,
+		       const char *path, unsigned flags)
+{
+	int status = deflate_to_pack(&state, sha1, fd, size, type,
+				     path, flags);
+	if (!state.plugged)
+		finish_bulk_checkin(&state);
+	return status;
+}
+
+void plug_bulk_checkin(void)
+{
+	state.plugged = 1;
+}
+
+void unplug_bulk_checkin(void)
+{
+	state.plugged = 0;
+	if (state.f)
+		finish_bulk_checkin(&state);
+}
@@ -0,0 +1,23 @@
+#ifndef BULK_CHECKIN_H
+#define BULK_CHECKIN_H
+
+#include "cache.h"
+
+/*
+ * Hash the contents of a large blob from fd and, with HASH_WRITE_OBJECT,
+ * deflate it straight into a packfile instead of a loose object, in
+ * fixed-size chunks so that memory use does not depend on its size.
+ */
+extern int index_bulk_checkin(unsigned char sha1[],
+			      int fd, size_t size, enum object_type type,
+			      const char *path, unsigned flags);
+
+/*
+ * Between plug_bulk_checkin() and unplug_bulk_checkin(), all objects
+ * given to index_bulk_checkin() go to the same packfile, which only
+ * becomes visible when unplugging.
+ */
+extern void plug_bulk_checkin(void);
+extern void unplug_bulk_checkin(void);
+
+#endif
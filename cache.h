@@ -16,6 +16,37 @@
 #define git_SHA1_Final	SHA1_Final
 #endif
 
+/*
+ * Objects that come from another repository are named with a SHA-1
+ * that also detects the known collision attacks; it is several times
+ * slower, so data we produce ourselves uses the one above.  Final
+ * returns non-zero if the data contained half of a colliding pair.
+ */
+#include "sha1dc/sha1.h"
+#define git_SHA1DC_CTX		SHA1DC_CTX
+#define git_SHA1DC_Init		SHA1DC_Init
+#define git_SHA1DC_Update	SHA1DC_Update
+#define git_SHA1DC_Final	SHA1DC_Final
+
+/*
+ * git_SHA1_Batch() hashes several independent messages, each made of
+ * the hdrlen bytes of hdr followed by the len bytes of buf, into the
+ * sha1 of their entries.  A SHA-1 implementation that can work on
+ * several messages at once provides platform_SHA1_Batch(); it is
+ * most useful to pass it SHA1_BATCH_MAX messages of similar sizes.
+ */
+#define SHA1_BATCH_MAX 8
+
+struct sha1_batch_entry {
+	const void *buf;
+	unsigned long len;
+	char hdr[32];
+	int hdrlen;
+	unsigned char sha1[20];
+};
+
+extern void git_SHA1_Batch(struct sha1_batch_entry *, int nr);
+
 #include <zlib.h>
 typedef struct git_zstream {
 	z_stream z;
@@ -104,6 +135,9 @@ struct cache_header {
 	unsigned int hdr_entries;
 };
 
+#define INDEX_FORMAT_LB 2
+#define INDEX_FORMAT_UB 4
+
 /*
  * The "cache_time" is just the low 32 bits of the
  * time. It doesn't matter if it overflows - we only
@@ -168,6 +202,7 @@ struct cache_entry {
 	unsigned int ce_flags;
 	unsigned char sha1[20];
 	struct cache_entry *next;
+	unsigned int mem_pool_allocated;
 	char name[FLEX_ARRAY]; /* more */
 };
 
@@ -315,10 +350,11 @@ struct index_state {
 	struct string_list *resolve_undo;
 	struct cache_tree *cache_tree;
 	struct cache_time timestamp;
-	void *alloc;
 	unsigned name_hash_initialized : 1,
 		 initialized : 1;
 	struct hash_table name_hash;
+	struct mem_pool *ce_mem_pool;
+	unsigned int version;
 };
 
 extern struct index_state the_index;
@@ -508,7 +544,18 @@ extern int remove_file_from_index(struct index_state *, const char *path);
 #define ADD_CACHE_INTENT 16
 extern int add_to_index(struct index_state *, const char *path, struct stat *, int flags);
 extern int add_file_to_index(struct index_state *, const char *path, int flags);
-extern struct cache_entry *make_cache_entry(unsigned int mode, const unsigned char *sha1, const char *path, int stage, int refresh);
+extern struct cache_entry *make_cache_entry(struct index_state *, unsigned int mode, const unsigned char *sha1, const char *path, int stage, int refresh);
+extern struct cache_entry *make_transient_cache_entry(unsigned int mode, const unsigned char *sha1, const char *path, int stage);
+
+/*
+ * Entries that go into an index are allocated from the memory pool of
+ * that index, and go away with it in discard_index().  Entries that
+ * are not meant for an index are "transient", and are given back
+ * with discard_cache_entry(), which leaves pool entries alone.
+ */
+extern struct cache_entry *make_empty_cache_entry(struct index_state *, size_t name_len);
+extern struct cache_entry *make_empty_transient_cache_entry(size_t name_len);
+extern void discard_cache_entry(struct cache_entry *ce);
 extern int ce_same_name(struct cache_entry *a, struct cache_entry *b);
 extern int index_name_is_other(const struct index_state *, const char *, int);
 
@@ -596,9 +643,14 @@ extern size_t packed_git_window_size;
 extern size_t packed_git_limit;
 extern size_t delta_base_cache_limit;
 extern unsigned long big_file_threshold;
+extern unsigned long big_diff_threshold;
+extern int contains_date_cutoff;
 extern int read_replace_refs;
 extern int fsync_object_files;
 extern int core_preload_index;
+extern int index_threads;
+extern int index_record_offsets;
+extern int detect_sha1_collisions;
 extern int core_apply_sparse_checkout;
 
 enum branch_track {
@@ -767,6 +819,8 @@ static inline const unsigned char *lookup_replace_object(const unsigned char *sh
 /* Read and unpack a sha1 file into memory, write memory to a sha1 file */
 extern int sha1_object_info(const unsigned char *, unsigned long *);
 extern int hash_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *sha1);
+/* Set up a git_SHA1_Batch() entry to compute the name of an object */
+extern void prepare_sha1_batch_entry(struct sha1_batch_entry *, const void *buf, unsigned long len, const char *type);
 extern int write_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *return_sha1);
 extern int pretend_sha1_file(void *, unsigned long, enum object_type, unsigned char *);
 extern int force_object_loose(const unsigned char *sha1, time_t mtime);
@@ -1056,9 +1110,13 @@ extern const unsigned char *nth_packed_object_sha1(struct packed_git *, uint32_t
 extern off_t nth_packed_object_offset(const struct packed_git *, uint32_t);
 extern off_t find_pack_entry_one(const unsigned char *, struct packed_git *);
 extern void *unpack_entry(struct packed_git *, off_t, enum object_type *, unsigned long *);
+extern void *cache_or_unpack_entry(struct packed_git *, off_t, unsigned long *, enum object_type *, int);
+extern void add_delta_base_cache(struct packed_git *, off_t, void *, unsigned long, enum object_type);
 extern unsigned long unpack_object_header_buffer(const unsigned char *buf, unsigned long len, enum object_type *type, unsigned long *sizep);
 extern unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
 extern int unpack_object_header(struct packed_git *, struct pack_window **, off_t *, unsigned long *);
+extern off_t get_delta_base(struct packed_git *, struct pack_window **, off_t *, enum object_type, off_t);
+extern void *unpack_compressed_entry(struct packed_git *, struct pack_window **, off_t, unsigned long);
 
 struct object_info {
 	/* Request */
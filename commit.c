@@ -6,6 +6,7 @@
 #include "diff.h"
 #include "revision.h"
 #include "notes.h"
+#include "prio-queue.h"
 
 int save_commit_buffer = 1;
 
@@ -388,21 +389,29 @@ void commit_list_sort_by_date(struct commit_list **list)
 	*list = ret;
 }
 
-struct commit *pop_most_recent_commit(struct commit_list **list,
+int compare_commits_by_commit_date(const void *a_, const void *b_, void *unused)
+{
+	const struct commit *a = a_, *b = b_;
+
+	/* newer commits with larger date first */
+	if (a->date < b->date)
+		return 1;
+	else if (a->date > b->date)
+		return -1;
+	return 0;
+}
+
+struct commit *pop_most_recent_commit(struct prio_queue *queue,
 				      unsigned int mark)
 {
-	struct commit *ret = (*list)->item;
+	struct commit *ret = prio_queue_get(queue);
 	struct commit_list *parents = ret->parents;
-	struct commit_list *old = *list;
-
-	*list = (*list)->next;
-	free(old);
 
 	while (parents) {
 		struct commit *commit = parents->item;
 		if (!parse_commit(commit) && !(commit->object.flags & mark)) {
 			commit->object.flags |= mark;
-			commit_list_insert_by_date(commit, list);
+			prio_queue_put(queue, commit);
 		}
 		parents = parents->next;
 	}
@@ -542,20 +551,21 @@ void sort_in_topological_order(struct commit_list ** list, int lifo)
 
 static const unsigned all_flags = (PARENT1 | PARENT2 | STALE | RESULT);
 
-static struct commit *interesting(struct commit_list *list)
+static int queue_has_nonstale(struct prio_queue *queue)
 {
-	while (list) {
-		struct commit *commit = list->item;
-		list = list->next;
-		if (commit->object.flags & STALE)
-			continue;
-		return commit;
+	int i;
+
+	for (i = 0; i < queue->nr; i++) {
+		struct commit *commit = queue->array[i].data;
+		if (!(commit->object.flags & STALE))
+			return 1;
 	}
-	return NULL;
+	return 0;
 }
 
 static struct commit_list *merge_bases_many(struct commit *one, int n, struct commit **twos)
 {
+	struct prio_queue queue = { compare_commits_by_commit_date };
 	struct commit_list *list = NULL;
 	struct commit_list *result = NULL;
 	int i;
@@ -577,23 +587,17 @@ static struct commit_list *merge_bases_many(struct commit *one, int n, struct co
 	}
 
 	one->object.flags |= PARENT1;
-	commit_list_insert_by_date(one, &list);
+	prio_queue_put(&queue, one);
 	for (i = 0; i < n; i++) {
 		twos[i]->object.flags |= PARENT2;
-		commit_list_insert_by_date(twos[i], &list);
+		prio_queue_put(&queue, twos[i]);
 	}
 
-	while (interesting(list)) {
-		struct commit *commit;
+	while (queue_has_nonstale(&queue)) {
+		struct commit *commit = prio_queue_get(&queue);
 		struct commit_list *parents;
-		struct commit_list *next;
 		int flags;
 
-		commit = list->item;
-		next = list->next;
-		free(list);
-		list = next;
-
 		flags = commit->object.flags & (PARENT1 | PARENT2 | STALE);
 		if (flags == (PARENT1 | PARENT2)) {
 			if (!(commit->object.flags & RESULT)) {
@@ -609,15 +613,18 @@ static struct commit_list *merge_bases_many(struct commit *one, int n, struct co
 			parents = parents->next;
 			if ((p->object.flags & flags) == flags)
 				continue;
-			if (parse_commit(p))
+			if (parse_commit(p)) {
+				clear_prio_queue(&queue);
+				free_commit_list(result);
 				return NULL;
+			}
 			p->object.flags |= flags;
-			commit_list_insert_by_date(p, &list);
+			prio_queue_put(&queue, p);
 		}
 	}
 
 	/* Clean up the result to remove stale ones */
-	free_commit_list(list);
+	clear_prio_queue(&queue);
 	list = result; result = NULL;
 	while (list) {
 		struct commit_list *next = list->next;
@@ -742,6 +749,135 @@ int is_descendant_of(struct commit *commit, struct commit_list *with_commit)
 	return 0;
 }
 
+/*
+ * With core.containsDateCutoff, commits more than this much older than
+ * the oldest commit we are looking for are assumed not to reach it,
+ * allowing for clocks that were somewhat off when the history was made.
+ */
+#define CONTAINS_DATE_SLOP (24 * 60 * 60)
+
+static int in_commit_list(const struct commit_list *want, struct commit *c)
+{
+	for (; want; want = want->next)
+		if (want->item == c)
+			return 1;
+	return 0;
+}
+
+static void init_contains_cache(struct contains_cache *cache,
+				const struct commit_list *want)
+{
+	unsigned long cutoff = ULONG_MAX;
+
+	cache->initialized = 1;
+	cache->cutoff = 0;
+	if (!contains_date_cutoff)
+		return;
+	for (; want; want = want->next) {
+		if (parse_commit(want->item) < 0) {
+			cutoff = 0;
+			break;
+		}
+		if (want->item->date < cutoff)
+			cutoff = want->item->date;
+	}
+	cache->cutoff = cutoff < CONTAINS_DATE_SLOP ? 0 : cutoff - CONTAINS_DATE_SLOP;
+}
+
+static enum contains_result contains_test(struct commit *candidate,
+					  const struct commit_list *want,
+					  struct contains_cache *cache)
+{
+	enum contains_result result;
+
+	result = (intptr_t)lookup_decoration(&cache->memo, &candidate->object);
+	if (result != CONTAINS_UNKNOWN)
+		return result;
+
+	if (in_commit_list(want, candidate))
+		result = CONTAINS_YES;
+	else if (parse_commit(candidate) < 0 || candidate->date < cache->cutoff)
+		result = CONTAINS_NO;
+	else
+		return CONTAINS_UNKNOWN;
+
+	add_decoration(&cache->memo, &candidate->object, (void *)(intptr_t)result);
+	return result;
+}
+
+struct contains_stack {
+	int nr, alloc;
+	struct contains_stack_entry {
+		struct commit *commit;
+		struct commit_list *parents;
+	} *entries;
+};
+
+static void push_to_contains_stack(struct commit *candidate, struct contains_stack *stack)
+{
+	ALLOC_GROW(stack->entries, stack->nr + 1, stack->alloc);
+	stack->entries[stack->nr].commit = candidate;
+	stack->entries[stack->nr++].parents = candidate->parents;
+}
+
+int commit_contains(struct commit *candidate, const struct commit_list *want,
+		    struct contains_cache *cache)
+{
+	struct contains_stack stack = { 0, 0, NULL };
+	enum contains_result result;
+
+	if (!want)
+		return 1;
+	if (!cache->initialized)
+		init_contains_cache(cache, want);
+
+	result = contains_test(candidate, want, cache);
+	if (result != CONTAINS_UNKNOWN)
+		return result == CONTAINS_YES;
+
+	/*
+	 * Walk depth-first, remembering for every commit we leave
+	 * whether it reaches one of "want", so that no commit is ever
+	 * looked at twice, neither in this walk nor in later ones for
+	 * other candidates.
+	 */
+	push_to_contains_stack(candidate, &stack);
+	while (stack.nr) {
+		struct contains_stack_entry *entry = &stack.entries[stack.nr - 1];
+		struct commit *commit = entry->commit;
+		struct commit_list *parents = entry->parents;
+
+		if (!parents) {
+			add_decoration(&cache->memo, &commit->object,
+				       (void *)(intptr_t)CONTAINS_NO);
+			stack.nr--;
+			continue;
+		}
+
+		switch (contains_test(parents->item, want, cache)) {
+		case CONTAINS_YES:
+			add_decoration(&cache->memo, &commit->object,
+				       (void *)(intptr_t)CONTAINS_YES);
+			stack.nr--;
+			break;
+		case CONTAINS_NO:
+			entry->parents = parents->next;
+			break;
+		case CONTAINS_UNKNOWN:
+			push_to_contains_stack(parents->item, &stack);
+			break;
+		}
+	}
+	free(stack.entries);
+	return contains_test(candidate, want, cache) == CONTAINS_YES;
+}
+
+void clear_contains_cache(struct contains_cache *cache)
+{
+	free(cache->memo.hash);
+	memset(cache, 0, sizeof(*cache));
+}
+
 int in_merge_bases(struct commit *commit, struct commit **reference, int num)
 {
 	struct commit_list *bases, *b;
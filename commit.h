@@ -117,10 +117,15 @@ void pp_remainder(const struct pretty_print_context *pp,
 		  int indent);
 
 
-/** Removes the first commit from a list sorted by date, and adds all
- * of its parents.
+struct prio_queue;
+
+/* For use with a prio_queue, to take the most recent commits out first */
+int compare_commits_by_commit_date(const void *a_, const void *b_, void *unused);
+
+/** Removes the most recent commit from a queue ordered by date, and
+ * adds all of its parents that are not yet marked.
  **/
-struct commit *pop_most_recent_commit(struct commit_list **list,
+struct commit *pop_most_recent_commit(struct prio_queue *queue,
 				      unsigned int mark);
 
 struct commit *pop_commit(struct commit_list **stack);
@@ -160,6 +165,28 @@ extern struct commit_list *get_shallow_commits(struct object_array *heads,
 		int depth, int shallow_flag, int not_shallow_flag);
 
 int is_descendant_of(struct commit *, struct commit_list *);
+
+/*
+ * Answers to "does this commit reach any of these commits?", kept
+ * across calls so that asking it about many refs (as "tag --contains"
+ * and "branch --contains" do) walks each part of the history only
+ * once.  A cache must only ever be used with the same "want" list.
+ */
+enum contains_result {
+	CONTAINS_UNKNOWN = 0,
+	CONTAINS_NO,
+	CONTAINS_YES
+};
+
+struct contains_cache {
+	struct decoration memo;
+	unsigned long cutoff;
+	int initialized;
+};
+
+int commit_contains(struct commit *candidate, const struct commit_list *want,
+		    struct contains_cache *cache);
+void clear_contains_cache(struct contains_cache *cache);
 int in_merge_bases(struct commit *, struct commit **, int);
 
 extern int interactive_add(int argc, const char **argv, const char *prefix, int patch);
@@ -566,6 +566,16 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.bigdiffthreshold")) {
+		big_diff_threshold = git_config_ulong(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.containsdatecutoff")) {
+		contains_date_cutoff = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.packedgitlimit")) {
 		packed_git_limit = git_config_int(var, value);
 		return 0;
@@ -730,6 +740,28 @@ static int git_default_branch_config(const char *var, const char *value)
 	return 0;
 }
 
+static int git_default_index_config(const char *var, const char *value)
+{
+	if (!strcmp(var, "index.threads")) {
+		int is_bool;
+
+		index_threads = git_config_bool_or_int(var, value, &is_bool);
+		if (is_bool)
+			index_threads = index_threads ? 0 : 1;
+		else if (index_threads < 0)
+			return error("%s: negative number of threads", var);
+		return 0;
+	}
+
+	if (!strcmp(var, "index.recordoffsettable")) {
+		index_record_offsets = git_config_bool(var, value);
+		return 0;
+	}
+
+	/* Add other config variables here and to Documentation/config.txt. */
+	return 0;
+}
+
 static int git_default_push_config(const char *var, const char *value)
 {
 	if (!strcmp(var, "push.default")) {
@@ -783,6 +815,9 @@ int git_default_config(const char *var, const char *value, void *dummy)
 	if (!prefixcmp(var, "push."))
 		return git_default_push_config(var, value);
 
+	if (!prefixcmp(var, "index."))
+		return git_default_index_config(var, value);
+
 	if (!prefixcmp(var, "mailmap."))
 		return git_default_mailmap_config(var, value);
 
@@ -0,0 +1,308 @@
+#include "cache.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "refs.h"
+#include "decorate.h"
+#include "string-list.h"
+#include "delta-islands.h"
+
+struct island_bitmap {
+	uint32_t refcount;
+	uint32_t bits[FLEX_ARRAY];
+};
+
+/* The regexes from "pack.island", in the order they were configured */
+static regex_t *island_regexes;
+static int island_regexes_nr, island_regexes_alloc;
+
+/* The island names, with the island index stored in ->util */
+static struct string_list island_names = STRING_LIST_INIT_DUP;
+static uint32_t island_bitmap_size;
+
+static struct decoration island_marks;
+
+static struct island_bitmap *island_bitmap_new(const struct island_bitmap *old)
+{
+	size_t size = sizeof(struct island_bitmap) +
+		island_bitmap_size * sizeof(uint32_t);
+	struct island_bitmap *b = xcalloc(1, size);
+
+	if (old)
+		memcpy(b, old, size);
+	b->refcount = 1;
+	return b;
+}
+
+static void island_bitmap_or(struct island_bitmap *a, const struct island_bitmap *b)
+{
+	uint32_t i;
+
+	for (i = 0; i < island_bitmap_size; i++)
+		a->bits[i] |= b->bits[i];
+}
+
+static int island_bitmap_is_subset(const struct island_bitmap *self,
+				   const struct island_bitmap *super)
+{
+	uint32_t i;
+
+	if (self == super)
+		return 1;
+	for (i = 0; i < island_bitmap_size; i++)
+		if ((self->bits[i] & super->bits[i]) != self->bits[i])
+			return 0;
+	return 1;
+}
+
+static void island_bitmap_set(struct island_bitmap *self, uint32_t i)
+{
+	self->bits[i >> 5] |= (uint32_t)1 << (i & 31);
+}
+
+int island_config(const char *k, const char *v, void *cb)
+{
+	if (!strcmp(k, "pack.island")) {
+		if (!v)
+			return config_error_nonbool(k);
+		ALLOC_GROW(island_regexes, island_regexes_nr + 1,
+			   island_regexes_alloc);
+		if (regcomp(&island_regexes[island_regexes_nr], v, REG_EXTENDED))
+			return error("failed to load island regex for '%s': %s",
+				     k, v);
+		island_regexes_nr++;
+	}
+	return 0;
+}
+
+/*
+ * Find the island a ref belongs to.  The last matching regex wins, so
+ * that later configuration can override earlier; the parenthesized
+ * subexpressions of the match, joined by "-", name the island.
+ */
+static int find_island_for_ref(const char *refname, struct strbuf *name)
+{
+	regmatch_t matches[16];
+	int i, m;
+
+	for (i = island_regexes_nr - 1; i >= 0; i--) {
+		if (!regexec(&island_regexes[i], refname,
+			     ARRAY_SIZE(matches), matches, 0))
+			break;
+	}
+	if (i < 0)
+		return 0;
+
+	strbuf_reset(name);
+	for (m = 1; m < ARRAY_SIZE(matches); m++) {
+		regmatch_t *match = &matches[m];
+
+		if (match->rm_so == -1)
+			continue;
+		if (name->len)
+			strbuf_addch(name, '-');
+		strbuf_add(name, refname + match->rm_so,
+			   match->rm_eo - match->rm_so);
+	}
+	return 1;
+}
+
+struct island_ref {
+	unsigned char sha1[20];
+	uint32_t island;
+};
+
+struct island_ref_list {
+	struct island_ref *refs;
+	int nr, alloc;
+	struct strbuf name;
+};
+
+static int collect_island_ref(const char *refname, const unsigned char *sha1,
+			      int flags, void *data)
+{
+	struct island_ref_list *list = data;
+	struct string_list_item *item;
+	struct island_ref *ref;
+
+	if (!find_island_for_ref(refname, &list->name))
+		return 0;
+
+	item = string_list_lookup(&island_names, list->name.buf);
+	if (!item) {
+		item = string_list_insert(&island_names, list->name.buf);
+		item->util = (void *)(intptr_t)(island_names.nr - 1);
+	}
+
+	ALLOC_GROW(list->refs, list->nr + 1, list->alloc);
+	ref = &list->refs[list->nr++];
+	hashcpy(ref->sha1, sha1);
+	ref->island = (uint32_t)(intptr_t)item->util;
+	return 0;
+}
+
+static void set_island_marks(struct object *obj, struct island_bitmap *marks)
+{
+	struct island_bitmap *b = lookup_decoration(&island_marks, obj);
+
+	if (!b) {
+		marks->refcount++;
+		add_decoration(&island_marks, obj, marks);
+		return;
+	}
+
+	/* If we're already a superset, no need to do anything */
+	if (island_bitmap_is_subset(marks, b))
+		return;
+
+	/* Copy on write */
+	if (b->refcount > 1) {
+		b->refcount--;
+		b = island_bitmap_new(b);
+		add_decoration(&island_marks, obj, b);
+	}
+	island_bitmap_or(b, marks);
+}
+
+static void mark_island_tip(const unsigned char *sha1, uint32_t island)
+{
+	struct object *obj = parse_object(sha1);
+	struct island_bitmap *marks;
+
+	if (!obj)
+		return;
+
+	marks = island_bitmap_new(NULL);
+	island_bitmap_set(marks, island);
+
+	/* Annotated tags carry the island down to what they point at */
+	while (obj) {
+		set_island_marks(obj, marks);
+		if (obj->type != OBJ_TAG)
+			break;
+		obj = ((struct tag *)obj)->tagged;
+		if (obj)
+			obj = parse_object(obj->sha1);
+	}
+
+	if (!--marks->refcount)
+		free(marks);
+}
+
+void load_delta_islands(int progress)
+{
+	struct island_ref_list list;
+	int i;
+
+	memset(&list, 0, sizeof(list));
+	strbuf_init(&list.name, 0);
+	for_each_ref(collect_island_ref, &list);
+	strbuf_release(&list.name);
+
+	island_bitmap_size = (island_names.nr >> 5) + 1;
+	for (i = 0; i < list.nr; i++)
+		mark_island_tip(list.refs[i].sha1, list.refs[i].island);
+	free(list.refs);
+
+	if (progress && island_names.nr)
+		fprintf(stderr, "Marked %d islands, done.\n", island_names.nr);
+}
+
+void propagate_island_marks(struct commit *commit)
+{
+	struct island_bitmap *marks = lookup_decoration(&island_marks,
+							&commit->object);
+	struct commit_list *p;
+
+	if (!marks)
+		return;
+
+	if (commit->tree)
+		set_island_marks(&commit->tree->object, marks);
+	for (p = commit->parents; p; p = p->next)
+		set_island_marks(&p->item->object, marks);
+}
+
+void propagate_tree_island_marks(const unsigned char *sha1)
+{
+	struct object *obj = lookup_object(sha1);
+	struct island_bitmap *marks;
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+
+	if (!obj)
+		return;
+	marks = lookup_decoration(&island_marks, obj);
+	if (!marks)
+		return;
+
+	buf = read_sha1_file(sha1, &type, &size);
+	if (!buf || type != OBJ_TREE)
+		die("unable to read tree %s", sha1_to_hex(sha1));
+
+	init_tree_desc(&desc, buf, size);
+	while (tree_entry(&desc, &entry)) {
+		struct object *child;
+
+		if (S_ISGITLINK(entry.mode))
+			continue;
+		child = lookup_object(entry.sha1);
+		if (!child)
+			continue;
+		set_island_marks(child, marks);
+	}
+	free(buf);
+}
+
+static int island_bitmap_count(const struct island_bitmap *self)
+{
+	uint32_t i, count = 0;
+
+	if (!self)
+		return 0;
+	for (i = 0; i < island_bitmap_size; i++) {
+		uint32_t word = self->bits[i];
+		while (word) {
+			word &= word - 1;
+			count++;
+		}
+	}
+	return count;
+}
+
+static struct island_bitmap *island_marks_for(const unsigned char *sha1)
+{
+	struct object *obj = lookup_object(sha1);
+	return obj ? lookup_decoration(&island_marks, obj) : NULL;
+}
+
+int island_delta_cmp(const unsigned char *a, const unsigned char *b)
+{
+	int a_count = island_bitmap_count(island_marks_for(a));
+	int b_count = island_bitmap_count(island_marks_for(b));
+
+	return a_count > b_count ? -1 : (a_count < b_count);
+}
+
+int in_same_island(const unsigned char *trg, const unsigned char *src)
+{
+	struct island_bitmap *trg_marks, *src_marks;
+
+	/*
+	 * A target that is in no island may use any base, but a base
+	 * that is in no island cannot serve a target that is in one.
+	 */
+	trg_marks = island_marks_for(trg);
+	if (!trg_marks)
+		return 1;
+
+	src_marks = island_marks_for(src);
+	if (!src_marks)
+		return 0;
+
+	return island_bitmap_is_subset(trg_marks, src_marks);
+}
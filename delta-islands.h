@@ -0,0 +1,48 @@
+#ifndef DELTA_ISLANDS_H
+#define DELTA_ISLANDS_H
+
+/*
+ * Delta islands partition the objects of a repository by the refs
+ * they are reachable from.  Each "pack.island" regex names a group of
+ * refs; the parenthesized subexpressions of the match, if any, make up
+ * the name of the island the ref belongs to.  pack-objects uses the
+ * islands to refuse a delta against a base that is missing from any
+ * of the islands the target is reachable from, so that a pack served
+ * for any one island can reuse the on-disk deltas as-is.
+ */
+
+struct commit;
+
+extern int island_config(const char *k, const char *v, void *cb);
+
+/*
+ * Assign islands to the tips of all matching refs.  Must be called
+ * before the revision walk that feeds propagate_island_marks().
+ */
+extern void load_delta_islands(int progress);
+
+/*
+ * Push the islands of a commit down to its parents and root tree.
+ * The commits must be visited children-first, i.e. in --topo-order.
+ */
+extern void propagate_island_marks(struct commit *commit);
+
+/*
+ * Push the islands of a tree down to its entries.  Trees must be
+ * visited from the root downwards.
+ */
+extern void propagate_tree_island_marks(const unsigned char *sha1);
+
+/*
+ * Return true if "src" is usable as a delta base for "trg", i.e. if
+ * "src" belongs to every island "trg" belongs to.
+ */
+extern int in_same_island(const unsigned char *trg, const unsigned char *src);
+
+/*
+ * Order objects that are in more islands first, so that the delta
+ * search window offers them as bases to objects in fewer islands.
+ */
+extern int island_delta_cmp(const unsigned char *a, const unsigned char *b);
+
+#endif /* DELTA_ISLANDS_H */
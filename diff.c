@@ -170,6 +170,31 @@ int git_diff_ui_config(const char *var, const char *value, void *cb)
 	return git_diff_basic_config(var, value, cb);
 }
 
+/*
+ * The knobs for how (not whether) renames are detected; also read by
+ * merge-recursive.  Returns 1 if "var" was one of them, 0 if not, and
+ * -1 on error.
+ */
+int diff_rename_config(const char *var, const char *value)
+{
+	if (!strcmp(var, "diff.renamethreads")) {
+		diff_rename_threads = git_config_int(var, value);
+		if (diff_rename_threads < 0)
+			return error("invalid number of threads specified (%d)",
+				     diff_rename_threads);
+		return 1;
+	}
+	if (!strcmp(var, "diff.renameprefilter")) {
+		diff_rename_prefilter = git_config_bool(var, value);
+		return 1;
+	}
+	if (!strcmp(var, "diff.similaritycache")) {
+		diff_similarity_cache = git_config_bool(var, value);
+		return 1;
+	}
+	return 0;
+}
+
 int git_diff_basic_config(const char *var, const char *value, void *cb)
 {
 	if (!strcmp(var, "diff.renamelimit")) {
@@ -177,6 +202,12 @@ int git_diff_basic_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	switch (diff_rename_config(var, value)) {
+		case 0: break;
+		case -1: return -1;
+		default: return 0;
+	}
+
 	switch (userdiff_config(var, value)) {
 		case 0: break;
 		case -1: return -1;
@@ -1962,6 +1993,18 @@ static void diff_filespec_load_driver(struct diff_filespec *one)
 		one->driver = userdiff_find_by_name("default");
 }
 
+/*
+ * Whether the filespec is known to be binary (1) or text (0) without
+ * looking at its contents, or -1 when only the contents can tell.
+ */
+int diff_filespec_binary_attr(struct diff_filespec *one)
+{
+	if (one->is_binary != -1)
+		return one->is_binary;
+	diff_filespec_load_driver(one);
+	return one->driver->binary;
+}
+
 int diff_filespec_is_binary(struct diff_filespec *one)
 {
 	if (one->is_binary == -1) {
@@ -2010,6 +2053,91 @@ struct userdiff_driver *get_textconv(struct diff_filespec *one)
 	return userdiff_get_textconv(one->driver);
 }
 
+struct diff_deferred_patch {
+	struct diff_options opt;
+	mmfile_t mf[2];
+	unsigned free_mf[2], munmap_mf[2];
+	const char *label[2];
+	struct strbuf header;
+	struct emit_callback ecbdata;
+	xpparam_t xpp;
+	xdemitconf_t xecfg;
+};
+
+/*
+ * The patch keeps the contents it is given: textconv output is its own,
+ * and the blob data is taken away from the filespec, which will read
+ * it again if it is needed later.
+ */
+static void take_mmfile(struct diff_deferred_patch *d, int i, mmfile_t *mf,
+			struct diff_filespec *s, int is_textconv)
+{
+	d->mf[i] = *mf;
+	if (is_textconv) {
+		d->free_mf[i] = 1;
+		return;
+	}
+	if (mf->ptr != s->data)
+		return;
+	d->free_mf[i] = s->should_free;
+	d->munmap_mf[i] = s->should_munmap;
+	s->should_free = s->should_munmap = 0;
+	s->data = NULL;
+}
+
+static void defer_text_patch(struct diff_options *o,
+			     struct diff_filespec *one, mmfile_t *mf1, int textconv_one,
+			     struct diff_filespec *two, mmfile_t *mf2, int textconv_two,
+			     const char **lbl, struct strbuf *header,
+			     struct emit_callback *ecbdata,
+			     xpparam_t *xpp, xdemitconf_t *xecfg)
+{
+	struct diff_deferred_patch *d = xcalloc(1, sizeof(*d));
+
+	d->opt = *o;
+	d->opt.file = NULL;
+	take_mmfile(d, 0, mf1, one, textconv_one);
+	take_mmfile(d, 1, mf2, two, textconv_two);
+	d->label[0] = xstrdup(lbl[0]);
+	d->label[1] = xstrdup(lbl[1]);
+	d->header = *header;
+	strbuf_init(header, 0);
+
+	d->ecbdata = *ecbdata;
+	d->ecbdata.label_path = d->label;
+	d->ecbdata.opt = &d->opt;
+	d->ecbdata.found_changesp = &d->opt.found_changes;
+	d->ecbdata.header = d->header.len ? &d->header : NULL;
+	if (d->ecbdata.diff_words)
+		d->ecbdata.diff_words->opt = &d->opt;
+	d->xpp = *xpp;
+	d->xecfg = *xecfg;
+
+	o->defer_patch(o, d);
+}
+
+void diff_run_deferred_patch(struct diff_deferred_patch *d, FILE *file)
+{
+	int i;
+
+	d->opt.file = file;
+	xdi_diff_outf(&d->mf[0], &d->mf[1], fn_out_consume, &d->ecbdata,
+		      &d->xpp, &d->xecfg);
+	if (d->ecbdata.diff_words)
+		free_diff_words_data(&d->ecbdata);
+	xdiff_clear_find_func(&d->xecfg);
+
+	for (i = 0; i < 2; i++) {
+		if (d->free_mf[i])
+			free(d->mf[i].ptr);
+		else if (d->munmap_mf[i])
+			munmap(d->mf[i].ptr, d->mf[i].size);
+		free((char *)d->label[i]);
+	}
+	strbuf_release(&d->header);
+	free(d);
+}
+
 static void builtin_diff(const char *name_a,
 			 const char *name_b,
 			 struct diff_filespec *one,
@@ -2213,6 +2341,12 @@ static void builtin_diff(const char *name_a,
 				st->ctx.color = diff_get_color_opt(o, DIFF_PLAIN);
 			}
 		}
+		if (o->defer_patch) {
+			defer_text_patch(o, one, &mf1, !!textconv_one,
+					 two, &mf2, !!textconv_two,
+					 lbl, &header, &ecbdata, &xpp, &xecfg);
+			goto free_ab_and_return;
+		}
 		xdi_diff_outf(&mf1, &mf2, fn_out_consume, &ecbdata,
 			      &xpp, &xecfg);
 		if (o->word_diff)
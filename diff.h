@@ -12,6 +12,7 @@ struct diff_queue_struct;
 struct strbuf;
 struct diff_filespec;
 struct userdiff_driver;
+struct diff_deferred_patch;
 
 typedef void (*change_fn_t)(struct diff_options *options,
 		 unsigned old_mode, unsigned new_mode,
@@ -28,6 +29,9 @@ typedef void (*add_remove_fn_t)(struct diff_options *options,
 typedef void (*diff_format_fn_t)(struct diff_queue_struct *q,
 		struct diff_options *options, void *data);
 
+typedef void (*diff_defer_fn_t)(struct diff_options *options,
+		struct diff_deferred_patch *patch);
+
 typedef struct strbuf *(*diff_prefix_fn_t)(struct diff_options *opt, void *data);
 
 #define DIFF_FORMAT_RAW		0x0001
@@ -146,6 +150,14 @@ struct diff_options {
 	void *format_callback_data;
 	diff_prefix_fn_t output_prefix;
 	void *output_prefix_data;
+
+	/*
+	 * When set, the xdiff part of each textual patch is not run
+	 * but handed to this callback, after everything that precedes
+	 * it has been written to "file".
+	 */
+	diff_defer_fn_t defer_patch;
+	void *defer_patch_data;
 };
 
 enum color_diff {
@@ -229,6 +241,7 @@ extern int parse_long_opt(const char *opt, const char **argv,
 			 const char **optarg);
 
 extern int git_diff_basic_config(const char *var, const char *value, void *cb);
+extern int diff_rename_config(const char *var, const char *value);
 extern int git_diff_ui_config(const char *var, const char *value, void *cb);
 extern int diff_use_color_default;
 extern void diff_setup(struct diff_options *);
@@ -277,6 +290,13 @@ extern void diffcore_fix_diff_index(struct diff_options *);
 
 extern int diff_queue_is_empty(void);
 extern void diff_flush(struct diff_options*);
+
+/*
+ * Write the text of a patch given to a defer_patch callback to
+ * "file", and free it.  This only uses memory owned by the patch and
+ * can be called from any thread.
+ */
+extern void diff_run_deferred_patch(struct diff_deferred_patch *, FILE *file);
 extern void diff_warn_rename_limit(const char *varname, int needed, int degraded_cc);
 
 /* diff-raw status letters */
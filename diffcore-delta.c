@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "diff.h"
 #include "diffcore.h"
+#include "xdiff-interface.h"
 
 /*
  * Idea here is very simple.
@@ -120,14 +121,12 @@ static int spanhash_cmp(const void *a_, const void *b_)
 		a->hashval > b->hashval ? 1 : 0;
 }
 
-static struct spanhash_top *hash_chars(struct diff_filespec *one)
+static struct spanhash_top *hash_chars(const unsigned char *buf,
+				       unsigned long sz, int is_text)
 {
 	int i, n;
 	unsigned int accum1, accum2, hashval;
 	struct spanhash_top *hash;
-	unsigned char *buf = one->data;
-	unsigned int sz = one->size;
-	int is_text = !diff_filespec_is_binary(one);
 
 	i = INITIAL_HASH_SIZE;
 	hash = xmalloc(sizeof(*hash) + sizeof(struct spanhash) * (1<<i));
@@ -163,6 +162,107 @@ static struct spanhash_top *hash_chars(struct diff_filespec *one)
 	return hash;
 }
 
+static struct spanhash_top *hash_filespec(struct diff_filespec *one)
+{
+	return hash_chars(one->data, one->size, !diff_filespec_is_binary(one));
+}
+
+/*
+ * Compute the "cnt_data" of a buffer without a filespec around it.
+ * This does not look at anything but its arguments, so it is safe to
+ * call from threads as long as the buffer stays alive.
+ */
+void *diffcore_hash_chars(const void *buf, unsigned long size, int is_text)
+{
+	return hash_chars(buf, size, is_text);
+}
+
+/*
+ * An inverted index over the "cnt_data" of many sources: for each
+ * span hash value, the sources that contain it and how many bytes
+ * they have in it.  Because the hash values are below HASHBASE, a
+ * flat offset table is enough to find the postings.
+ */
+struct span_posting {
+	int src;
+	unsigned int cnt;
+};
+
+struct span_index {
+	unsigned int *start;
+	struct span_posting *posting;
+};
+
+struct span_index *diffcore_span_index(void **count, int nr)
+{
+	struct span_index *index = xmalloc(sizeof(*index));
+	unsigned int total = 0, *fill;
+	int i;
+
+	index->start = xcalloc(HASHBASE + 1, sizeof(*index->start));
+	for (i = 0; i < nr; i++) {
+		struct spanhash_top *top = count[i];
+		struct spanhash *s;
+		if (!top)
+			continue;
+		for (s = top->data; s->cnt; s++) {
+			index->start[s->hashval]++;
+			total++;
+		}
+	}
+	for (i = 0; i < HASHBASE; i++)
+		index->start[i + 1] += index->start[i];
+
+	index->posting = xmalloc(sizeof(*index->posting) * (total ? total : 1));
+	fill = xmalloc(sizeof(*fill) * HASHBASE);
+	fill[0] = 0;
+	memcpy(fill + 1, index->start, sizeof(*fill) * (HASHBASE - 1));
+	for (i = 0; i < nr; i++) {
+		struct spanhash_top *top = count[i];
+		struct spanhash *s;
+		if (!top)
+			continue;
+		for (s = top->data; s->cnt; s++) {
+			struct span_posting *p = &index->posting[fill[s->hashval]++];
+			p->src = i;
+			p->cnt = s->cnt;
+		}
+	}
+	free(fill);
+	return index;
+}
+
+/*
+ * Add, for every source in the index, the number of bytes it shares
+ * with "dst_count" to copied[src].  This is the "src_copied" value
+ * diffcore_count_changes() would compute for the pair, but sources
+ * that share nothing with the destination cost nothing.
+ */
+void diffcore_span_copied(struct span_index *index, void *dst_count,
+			  unsigned long *copied)
+{
+	struct spanhash_top *top = dst_count;
+	struct spanhash *d;
+
+	for (d = top->data; d->cnt; d++) {
+		unsigned int lo = d->hashval ? index->start[d->hashval - 1] : 0;
+		unsigned int hi = index->start[d->hashval];
+		for (; lo < hi; lo++) {
+			struct span_posting *p = &index->posting[lo];
+			copied[p->src] += p->cnt < d->cnt ? p->cnt : d->cnt;
+		}
+	}
+}
+
+void diffcore_free_span_index(struct span_index *index)
+{
+	if (!index)
+		return;
+	free(index->start);
+	free(index->posting);
+	free(index);
+}
+
 int diffcore_count_changes(struct diff_filespec *src,
 			   struct diff_filespec *dst,
 			   void **src_count_p,
@@ -179,14 +279,14 @@ int diffcore_count_changes(struct diff_filespec *src,
 	if (src_count_p)
 		src_count = *src_count_p;
 	if (!src_count) {
-		src_count = hash_chars(src);
+		src_count = hash_filespec(src);
 		if (src_count_p)
 			*src_count_p = src_count;
 	}
 	if (dst_count_p)
 		dst_count = *dst_count_p;
 	if (!dst_count) {
-		dst_count = hash_chars(dst);
+		dst_count = hash_filespec(dst);
 		if (dst_count_p)
 			*dst_count_p = dst_count;
 	}
@@ -231,3 +331,368 @@ int diffcore_count_changes(struct diff_filespec *src,
 	*literal_added = la;
 	return 0;
 }
+
+/*
+ * The similarity cache remembers fingerprints across runs, so that
+ * rename detection does not have to read the blobs of candidates it
+ * has seen before.  $GIT_DIR/similarity-cache is an 8-byte header
+ * (signature and version) followed by records appended by whoever
+ * computed them:
+ *
+ *   20-byte object name
+ *    4-byte flags (SIMILARITY_BINARY, SIMILARITY_CRLF)
+ *    8-byte size of the blob
+ *    4-byte number of spans N
+ *   N * (4-byte span hash value, 4-byte byte count)
+ *
+ * all in network byte order, so every record stays 4-byte aligned in
+ * the mapped file.  The fingerprint is the one computed with is_text
+ * set when the contents do not look binary; when the blob has no CRLF
+ * it does not matter.
+ */
+#define SIMILARITY_CACHE_SIGNATURE 0x53494d43 /* "SIMC" */
+#define SIMILARITY_CACHE_VERSION 1
+#define SIMILARITY_BINARY 01
+#define SIMILARITY_CRLF 02
+#define SIMILARITY_RECORD_HEADER (20 + 4 + 8 + 4)
+
+int diff_similarity_cache;
+
+static struct similarity_cache {
+	int loaded, broken;
+	void *map;
+	size_t mapsz;
+	/* records in the file, sorted by object name once loaded */
+	const unsigned char **record;
+	int nr, alloc;
+	/* records computed by this process, hashed by object name */
+	const unsigned char **added;
+	unsigned int added_nr, added_size;
+	/* records not written out yet */
+	unsigned char **pending;
+	int pending_nr, pending_alloc;
+} sim_cache;
+
+static struct lock_file similarity_cache_lock;
+
+static const char *similarity_cache_path(void)
+{
+	static char *path;
+	if (!path)
+		path = xstrdup(git_path("similarity-cache"));
+	return path;
+}
+
+static void add_similarity_record(const unsigned char *rec)
+{
+	ALLOC_GROW(sim_cache.record, sim_cache.nr + 1, sim_cache.alloc);
+	sim_cache.record[sim_cache.nr++] = rec;
+}
+
+static unsigned int added_record_slot(const unsigned char *sha1)
+{
+	unsigned int hash;
+
+	memcpy(&hash, sha1, sizeof(hash));
+	hash &= sim_cache.added_size - 1;
+	while (sim_cache.added[hash] && hashcmp(sim_cache.added[hash], sha1))
+		hash = (hash + 1) & (sim_cache.added_size - 1);
+	return hash;
+}
+
+static void insert_added_record(const unsigned char *rec)
+{
+	if (sim_cache.added_size <= sim_cache.added_nr * 2) {
+		const unsigned char **old = sim_cache.added;
+		unsigned int i, old_size = sim_cache.added_size;
+
+		sim_cache.added_size = old_size ? old_size * 2 : 64;
+		sim_cache.added = xcalloc(sim_cache.added_size,
+					  sizeof(*sim_cache.added));
+		for (i = 0; i < old_size; i++)
+			if (old[i])
+				sim_cache.added[added_record_slot(old[i])] = old[i];
+		free(old);
+	}
+	sim_cache.added[added_record_slot(rec)] = rec;
+	sim_cache.added_nr++;
+}
+
+/*
+ * Where the records that start at "p" stop being complete; a record
+ * cut short by a writer that died is where the usable part of the
+ * file ends.  Each complete record is passed to fn, if given.
+ */
+static const unsigned char *similarity_records_end(const unsigned char *p,
+		const unsigned char *end,
+		void (*fn)(const unsigned char *))
+{
+	while (end - p >= SIMILARITY_RECORD_HEADER) {
+		uint32_t nr = ntohl(*(uint32_t *)(p + 32));
+		if ((end - p - SIMILARITY_RECORD_HEADER) / 8 < nr)
+			break;
+		if (fn)
+			fn(p);
+		p += SIMILARITY_RECORD_HEADER + (size_t)nr * 8;
+	}
+	return p;
+}
+
+static int similarity_record_cmp(const void *a_, const void *b_)
+{
+	const unsigned char *a = *(const unsigned char **)a_;
+	const unsigned char *b = *(const unsigned char **)b_;
+	return hashcmp(a, b);
+}
+
+static void load_similarity_cache(void)
+{
+	struct stat st;
+	const unsigned char *p, *end;
+	int fd;
+
+	if (sim_cache.loaded)
+		return;
+	sim_cache.loaded = 1;
+
+	fd = open(similarity_cache_path(), O_RDONLY);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) || st.st_size < 8) {
+		close(fd);
+		return;
+	}
+	sim_cache.mapsz = xsize_t(st.st_size);
+	sim_cache.map = xmmap(NULL, sim_cache.mapsz, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	p = sim_cache.map;
+	end = p + sim_cache.mapsz;
+	if (ntohl(*(uint32_t *)p) != SIMILARITY_CACHE_SIGNATURE ||
+	    ntohl(*(uint32_t *)(p + 4)) != SIMILARITY_CACHE_VERSION) {
+		sim_cache.broken = 1;
+		return;
+	}
+	similarity_records_end(p + 8, end, add_similarity_record);
+	qsort(sim_cache.record, sim_cache.nr, sizeof(*sim_cache.record),
+	      similarity_record_cmp);
+}
+
+static const unsigned char *find_similarity_record(const unsigned char *sha1)
+{
+	int lo = 0, hi;
+
+	load_similarity_cache();
+	hi = sim_cache.nr;
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		int cmp = hashcmp(sim_cache.record[mi], sha1);
+		if (!cmp)
+			return sim_cache.record[mi];
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	if (sim_cache.added_nr)
+		return sim_cache.added[added_record_slot(sha1)];
+	return NULL;
+}
+
+/*
+ * Look up the fingerprint of the blob "sha1" as diffcore_count_changes()
+ * would compute it with the given is_text, or with is_text decided by
+ * the contents when it is negative.  On a hit, the size of the blob is
+ * stored in *size.
+ */
+void *diffcore_cached_hash_chars(const unsigned char *sha1, int is_text,
+				 unsigned long *size)
+{
+	const unsigned char *rec = find_similarity_record(sha1);
+	const uint32_t *span;
+	struct spanhash_top *hash;
+	uint32_t flags, nr, i, hashval, cnt;
+	uint64_t sz;
+	int log2;
+
+	if (!rec)
+		return NULL;
+	flags = ntohl(*(uint32_t *)(rec + 20));
+	if (0 <= is_text && !is_text != !!(flags & SIMILARITY_BINARY) &&
+	    (flags & SIMILARITY_CRLF))
+		return NULL;
+	sz = ((uint64_t)ntohl(*(uint32_t *)(rec + 24)) << 32) |
+		ntohl(*(uint32_t *)(rec + 28));
+	if (sz != (unsigned long)sz)
+		return NULL;
+	nr = ntohl(*(uint32_t *)(rec + 32));
+	if (HASHBASE < nr)
+		return NULL;
+
+	/* Leave at least one empty slot to terminate the sorted spans */
+	for (log2 = INITIAL_HASH_SIZE; (1u << log2) <= nr; log2++)
+		;
+	hash = xcalloc(1, sizeof(*hash) + sizeof(struct spanhash) * (1 << log2));
+	hash->alloc_log2 = log2;
+	hash->free = (1 << log2) - nr;
+	span = (const uint32_t *)(rec + SIMILARITY_RECORD_HEADER);
+	for (i = 0; i < nr; i++) {
+		/*
+		 * The file may have been damaged; the spans must be
+		 * what diffcore_count_changes() could have produced.
+		 */
+		hashval = ntohl(span[2 * i]);
+		cnt = ntohl(span[2 * i + 1]);
+		if (HASHBASE <= hashval || !cnt ||
+		    (i && hashval <= hash->data[i - 1].hashval)) {
+			free(hash);
+			return NULL;
+		}
+		hash->data[i].hashval = hashval;
+		hash->data[i].cnt = cnt;
+	}
+	*size = (unsigned long)sz;
+	return hash;
+}
+
+static int has_crlf(const char *buf, unsigned long size)
+{
+	const char *cr;
+
+	while (size && (cr = memchr(buf, '\r', size)) != NULL) {
+		size -= cr + 1 - buf;
+		buf = cr + 1;
+		if (size && *buf == '\n')
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Build the cache record for the fingerprint "count" that was computed
+ * from the contents of the blob "sha1" with the given is_text, or
+ * return NULL if it cannot be cached.  This looks only at its
+ * arguments, so that threads can do it without holding a lock.
+ */
+void *diffcore_similarity_record(const unsigned char *sha1, const void *buf,
+				 unsigned long size, int is_text, void *count)
+{
+	struct spanhash_top *hash = count;
+	unsigned char *rec;
+	uint32_t *span;
+	uint32_t flags = 0, nr = 0, i;
+
+	if (buffer_is_binary(buf, size))
+		flags |= SIMILARITY_BINARY;
+	if (has_crlf(buf, size))
+		flags |= SIMILARITY_CRLF;
+	/* Computed under an attribute that disagrees with the contents */
+	if (!is_text != !!(flags & SIMILARITY_BINARY) &&
+	    (flags & SIMILARITY_CRLF))
+		return NULL;
+
+	while (hash->data[nr].cnt)
+		nr++;
+	rec = xmalloc(SIMILARITY_RECORD_HEADER + (size_t)nr * 8);
+	hashcpy(rec, sha1);
+	*(uint32_t *)(rec + 20) = htonl(flags);
+	*(uint32_t *)(rec + 24) = htonl((uint32_t)((uint64_t)size >> 32));
+	*(uint32_t *)(rec + 28) = htonl((uint32_t)size);
+	*(uint32_t *)(rec + 32) = htonl(nr);
+	span = (uint32_t *)(rec + SIMILARITY_RECORD_HEADER);
+	for (i = 0; i < nr; i++) {
+		span[2 * i] = htonl(hash->data[i].hashval);
+		span[2 * i + 1] = htonl(hash->data[i].cnt);
+	}
+	return rec;
+}
+
+/*
+ * Remember a record from diffcore_similarity_record(), to be written
+ * out by diffcore_flush_similarity_cache().  The cache takes it over.
+ */
+void diffcore_cache_similarity_record(void *record)
+{
+	unsigned char *rec = record;
+
+	if (!rec)
+		return;
+	if (find_similarity_record(rec)) {
+		free(rec);
+		return;
+	}
+	ALLOC_GROW(sim_cache.pending, sim_cache.pending_nr + 1,
+		   sim_cache.pending_alloc);
+	sim_cache.pending[sim_cache.pending_nr++] = rec;
+	insert_added_record(rec);
+}
+
+/*
+ * Append the fingerprints computed since the last call to the cache
+ * file.  The lock only keeps two writers from interleaving; readers
+ * never take it, and simply do not see what is appended after they
+ * mapped the file.  If somebody else holds it, the new records are
+ * not written this time.
+ */
+void diffcore_flush_similarity_cache(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct stat st;
+	off_t end = 0;
+	int i, fd;
+
+	if (!sim_cache.pending_nr)
+		return;
+	if (sim_cache.broken)
+		goto out;
+	if (hold_lock_file_for_update(&similarity_cache_lock,
+				      similarity_cache_path(), 0) < 0)
+		goto out;
+	fd = open(similarity_cache_path(), O_RDWR | O_CREAT, 0666);
+	if (fd < 0 || fstat(fd, &st))
+		goto fail;
+
+	/*
+	 * Appending after a record that a writer which died left cut
+	 * short would make the new records part of it; cut the file
+	 * back to its last complete record first.  A file too short
+	 * to have its header is started over.
+	 */
+	if (8 <= st.st_size) {
+		size_t mapsz = xsize_t(st.st_size);
+		unsigned char *map = xmmap(NULL, mapsz, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (ntohl(*(uint32_t *)map) != SIMILARITY_CACHE_SIGNATURE ||
+		    ntohl(*(uint32_t *)(map + 4)) != SIMILARITY_CACHE_VERSION) {
+			munmap(map, mapsz);
+			goto fail;
+		}
+		end = similarity_records_end(map + 8, map + mapsz, NULL) - map;
+		munmap(map, mapsz);
+	}
+	if ((end != st.st_size && ftruncate(fd, end)) ||
+	    lseek(fd, end, SEEK_SET) != end)
+		goto fail;
+
+	if (!end) {
+		uint32_t hdr[2];
+		hdr[0] = htonl(SIMILARITY_CACHE_SIGNATURE);
+		hdr[1] = htonl(SIMILARITY_CACHE_VERSION);
+		strbuf_add(&buf, hdr, sizeof(hdr));
+	}
+	for (i = 0; i < sim_cache.pending_nr; i++) {
+		const unsigned char *rec = sim_cache.pending[i];
+		uint32_t nr = ntohl(*(uint32_t *)(rec + 32));
+		strbuf_add(&buf, rec, SIMILARITY_RECORD_HEADER + (size_t)nr * 8);
+	}
+	if (write_in_full(fd, buf.buf, buf.len) != buf.len)
+		error("unable to write %s", similarity_cache_path());
+	strbuf_release(&buf);
+fail:
+	if (0 <= fd)
+		close(fd);
+	rollback_lock_file(&similarity_cache_lock);
+out:
+	/* The records stay around for lookups from this process */
+	sim_cache.pending_nr = 0;
+}
@@ -6,6 +6,10 @@
 #include "diffcore.h"
 #include "hash.h"
 #include "progress.h"
+#include "thread-utils.h"
+
+int diff_rename_threads;
+int diff_rename_prefilter;
 
 /* Table of rename/copy destinations */
 
@@ -118,6 +122,60 @@ struct diff_score {
 	short name_score;
 };
 
+/*
+ * We would not consider edits that change the file size so
+ * drastically.  delta_size must be smaller than
+ * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
+ *
+ * Note that base_size == 0 case is handled here already
+ * and the final score computation in similarity_score() would not
+ * have a divide-by-zero issue.
+ */
+static int sizes_compatible(unsigned long a, unsigned long b, int minimum_score)
+{
+	unsigned long max_size = a > b ? a : b;
+	unsigned long delta_size = max_size - (a > b ? b : a);
+
+	return max_size * (MAX_SCORE-minimum_score) >= delta_size * MAX_SCORE;
+}
+
+static int similarity_candidate(struct diff_filespec *src,
+				struct diff_filespec *dst,
+				int minimum_score)
+{
+	/* We deal only with regular files.  Symlink renames are handled
+	 * only when they are exact matches --- in other words, no edits
+	 * after renaming.
+	 */
+	if (!S_ISREG(src->mode) || !S_ISREG(dst->mode))
+		return 0;
+
+	/*
+	 * The fingerprints ("cnt_data") of all the candidates that
+	 * could possibly pair up are computed by fingerprint_filespecs()
+	 * before the matrix is filled, so a filespec without one
+	 * either could not be read or has no partner of a usable size.
+	 */
+	if (!src->cnt_data || !dst->cnt_data)
+		return 0;
+
+	return sizes_compatible(src->size, dst->size, minimum_score);
+}
+
+static int similarity_score(struct diff_filespec *src,
+			    struct diff_filespec *dst,
+			    unsigned long src_copied)
+{
+	unsigned long max_size = ((src->size > dst->size) ? src->size : dst->size);
+
+	/* How similar are they?
+	 * what percentage of material in dst are from source?
+	 */
+	if (!dst->size)
+		return 0; /* should not happen */
+	return (int)(src_copied * MAX_SCORE / max_size);
+}
+
 static int estimate_similarity(struct diff_filespec *src,
 			       struct diff_filespec *dst,
 			       int minimum_score)
@@ -134,52 +192,16 @@ static int estimate_similarity(struct diff_filespec *src,
 	 * When there is an exact match, it is considered a better
 	 * match than anything else; the destination does not even
 	 * call into this function in that case.
-	 */
-	unsigned long max_size, delta_size, base_size, src_copied, literal_added;
-	unsigned long delta_limit;
-	int score;
-
-	/* We deal only with regular files.  Symlink renames are handled
-	 * only when they are exact matches --- in other words, no edits
-	 * after renaming.
-	 */
-	if (!S_ISREG(src->mode) || !S_ISREG(dst->mode))
-		return 0;
-
-	/*
-	 * Need to check that source and destination sizes are
-	 * filled in before comparing them.
-	 *
-	 * If we already have "cnt_data" filled in, we know it's
-	 * all good (avoid checking the size for zero, as that
-	 * is a possible size - we really should have a flag to
-	 * say whether the size is valid or not!)
-	 */
-	if (!src->cnt_data && diff_populate_filespec(src, 1))
-		return 0;
-	if (!dst->cnt_data && diff_populate_filespec(dst, 1))
-		return 0;
-
-	max_size = ((src->size > dst->size) ? src->size : dst->size);
-	base_size = ((src->size < dst->size) ? src->size : dst->size);
-	delta_size = max_size - base_size;
-
-	/* We would not consider edits that change the file size so
-	 * drastically.  delta_size must be smaller than
-	 * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
 	 *
-	 * Note that base_size == 0 case is handled here already
-	 * and the final score computation below would not have a
-	 * divide-by-zero issue.
+	 * This only looks at the sizes and the fingerprints, so it is
+	 * safe to call from the matrix threads.
 	 */
-	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
-		return 0;
+	unsigned long base_size, delta_limit, src_copied, literal_added;
 
-	if (!src->cnt_data && diff_populate_filespec(src, 0))
-		return 0;
-	if (!dst->cnt_data && diff_populate_filespec(dst, 0))
+	if (!similarity_candidate(src, dst, minimum_score))
 		return 0;
 
+	base_size = ((src->size < dst->size) ? src->size : dst->size);
 	delta_limit = (unsigned long)
 		(base_size * (MAX_SCORE-minimum_score) / MAX_SCORE);
 	if (diffcore_count_changes(src, dst,
@@ -188,14 +210,7 @@ static int estimate_similarity(struct diff_filespec *src,
 				   &src_copied, &literal_added))
 		return 0;
 
-	/* How similar are they?
-	 * what percentage of material in dst are from source?
-	 */
-	if (!dst->size)
-		score = 0; /* should not happen */
-	else
-		score = (int)(src_copied * MAX_SCORE / max_size);
-	return score;
+	return similarity_score(src, dst, src_copied);
 }
 
 static void record_rename_pair(int dst_index, int src_index, int score)
@@ -490,6 +505,352 @@ static int find_renames(struct diff_score *mx, int dst_cnt, int minimum_score, i
 	return count;
 }
 
+/*
+ * Inexact rename detection fills a similarity matrix with one row of
+ * NUM_CANDIDATE_PER_DST best candidates for each destination that is
+ * still unmatched.  Once every candidate has its fingerprint, the rows
+ * are independent of each other, so both the fingerprinting and the
+ * rows are handed out to worker threads when there is enough work.
+ */
+struct rename_matrix {
+	struct diff_score *mx;
+	int *row_dst;		/* index in rename_dst for each row */
+	int nr_rows;
+	int minimum_score;
+	int skip_unmodified;
+	struct span_index *index;
+
+	struct diff_filespec **fingerprint;
+	int nr_fingerprint;
+
+	int nr_threads;
+	int next;		/* next work item to hand out */
+	int rows_done;
+	struct progress *progress;
+};
+
+/* Do not bother starting a thread for less than this many pairs */
+#define RENAME_PAIRS_PER_THREAD 256
+
+#ifndef NO_PTHREADS
+static pthread_mutex_t rename_mutex;
+static int rename_threaded;
+#define rename_lock()	do { \
+	if (rename_threaded) \
+		pthread_mutex_lock(&rename_mutex); \
+} while (0)
+#define rename_unlock()	do { \
+	if (rename_threaded) \
+		pthread_mutex_unlock(&rename_mutex); \
+} while (0)
+#else
+#define rename_lock()	do { } while (0)
+#define rename_unlock()	do { } while (0)
+#endif
+
+static int next_work_item(struct rename_matrix *rm, int nr)
+{
+	int k = -1;
+
+	rename_lock();
+	if (rm->next < nr)
+		k = rm->next++;
+	rename_unlock();
+	return k;
+}
+
+/*
+ * Reading the blob goes through the object store and the attribute
+ * machinery, neither of which is thread-safe; only the hashing and
+ * building the cache record are done outside the lock.
+ */
+static void fingerprint_one(struct diff_filespec *one)
+{
+	const void *buf;
+	unsigned long size;
+	int is_text;
+	void *record = NULL;
+
+	rename_lock();
+	if (diff_populate_filespec(one, 0)) {
+		rename_unlock();
+		return;
+	}
+	buf = one->data;
+	size = one->size;
+	is_text = !diff_filespec_is_binary(one);
+	rename_unlock();
+
+	one->cnt_data = diffcore_hash_chars(buf, size, is_text);
+	if (diff_similarity_cache && one->sha1_valid)
+		record = diffcore_similarity_record(one->sha1, buf, size,
+						    is_text, one->cnt_data);
+
+	rename_lock();
+	diffcore_cache_similarity_record(record);
+	diff_free_filespec_blob(one);
+	rename_unlock();
+}
+
+static void *fingerprint_worker(void *data)
+{
+	struct rename_matrix *rm = data;
+	int k;
+
+	while ((k = next_work_item(rm, rm->nr_fingerprint)) >= 0)
+		fingerprint_one(rm->fingerprint[k]);
+	return NULL;
+}
+
+static void fill_row(struct rename_matrix *rm, int row, unsigned long *copied)
+{
+	int i = rm->row_dst[row], j;
+	struct diff_filespec *two = rename_dst[i].two;
+	struct diff_score *m = &rm->mx[row * NUM_CANDIDATE_PER_DST];
+
+	for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+		m[j].dst = -1;
+
+	if (copied && two->cnt_data)
+		diffcore_span_copied(rm->index, two->cnt_data, copied);
+
+	for (j = 0; j < rename_src_nr; j++) {
+		struct diff_filespec *one = rename_src[j].p->one;
+		struct diff_score this_src;
+
+		if (rm->skip_unmodified &&
+		    diff_unmodified_pair(rename_src[j].p))
+			continue;
+
+		if (!copied) {
+			this_src.score = estimate_similarity(one, two,
+							     rm->minimum_score);
+		} else {
+			unsigned long src_copied = copied[j];
+
+			/* Sharing nothing, it cannot score */
+			if (!src_copied)
+				continue;
+			copied[j] = 0;
+			if (!similarity_candidate(one, two, rm->minimum_score))
+				this_src.score = 0;
+			else
+				this_src.score = similarity_score(one, two,
+								  src_copied);
+		}
+		this_src.name_score = basename_same(one, two);
+		this_src.dst = i;
+		this_src.src = j;
+		record_if_better(m, &this_src);
+	}
+}
+
+static void *matrix_worker(void *data)
+{
+	struct rename_matrix *rm = data;
+	unsigned long *copied = NULL;
+	int row;
+
+	if (rm->index)
+		copied = xcalloc(rename_src_nr, sizeof(*copied));
+	while ((row = next_work_item(rm, rm->nr_rows)) >= 0) {
+		fill_row(rm, row, copied);
+		rename_lock();
+		display_progress(rm->progress, ++rm->rows_done * rename_src_nr);
+		rename_unlock();
+	}
+	free(copied);
+	return NULL;
+}
+
+static void run_rename_workers(struct rename_matrix *rm, void *(*fn)(void *))
+{
+#ifndef NO_PTHREADS
+	pthread_t *threads;
+	int i, ret;
+#endif
+
+	rm->next = 0;
+#ifndef NO_PTHREADS
+	if (rm->nr_threads > 1) {
+		threads = xcalloc(rm->nr_threads, sizeof(*threads));
+		rename_threaded = 1;
+		pthread_mutex_init(&rename_mutex, NULL);
+		for (i = 0; i < rm->nr_threads; i++) {
+			ret = pthread_create(&threads[i], NULL, fn, rm);
+			if (ret)
+				die("unable to create thread: %s", strerror(ret));
+		}
+		for (i = 0; i < rm->nr_threads; i++)
+			pthread_join(threads[i], NULL);
+		pthread_mutex_destroy(&rename_mutex);
+		rename_threaded = 0;
+		free(threads);
+		return;
+	}
+#endif
+	fn(rm);
+}
+
+static int rename_thread_count(int nr_pairs)
+{
+#ifndef NO_PTHREADS
+	int nr = diff_rename_threads;
+
+	if (!nr)
+		nr = online_cpus();
+	if (nr > nr_pairs / RENAME_PAIRS_PER_THREAD)
+		nr = nr_pairs / RENAME_PAIRS_PER_THREAD;
+	return nr < 1 ? 1 : nr;
+#else
+	return 1;
+#endif
+}
+
+/*
+ * A fingerprint found in the similarity cache comes with the size of
+ * the blob, so the object store is not even asked about it.
+ */
+static int cached_fingerprint(struct diff_filespec *one)
+{
+	int binary;
+
+	if (!diff_similarity_cache || !one->sha1_valid)
+		return 0;
+	binary = diff_filespec_binary_attr(one);
+	one->cnt_data = diffcore_cached_hash_chars(one->sha1,
+						   binary < 0 ? -1 : !binary,
+						   &one->size);
+	return !!one->cnt_data;
+}
+
+static int usable_for_similarity(struct diff_filespec *one)
+{
+	/*
+	 * If we already have "cnt_data" filled in, we know it's
+	 * all good (avoid checking the size for zero, as that
+	 * is a possible size - we really should have a flag to
+	 * say whether the size is valid or not!)
+	 */
+	return S_ISREG(one->mode) &&
+		(one->cnt_data || cached_fingerprint(one) ||
+		 !diff_populate_filespec(one, 1));
+}
+
+static int ulong_cmp(const void *a_, const void *b_)
+{
+	unsigned long a = *(const unsigned long *)a_;
+	unsigned long b = *(const unsigned long *)b_;
+	return a < b ? -1 : a > b;
+}
+
+static int filespec_ptr_cmp(const void *a_, const void *b_)
+{
+	const struct diff_filespec *a = *(const struct diff_filespec **)a_;
+	const struct diff_filespec *b = *(const struct diff_filespec **)b_;
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * sizes[] is sorted; the closest sizes on either side of "size" are
+ * the only ones that need to be checked.
+ */
+static int has_size_partner(unsigned long size, unsigned long *sizes, int nr,
+			    int minimum_score)
+{
+	int lo = 0, hi = nr;
+
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		if (sizes[mi] < size)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return (lo < nr && sizes_compatible(size, sizes[lo], minimum_score)) ||
+		(lo && sizes_compatible(size, sizes[lo - 1], minimum_score));
+}
+
+/*
+ * Find the filespecs that need a fingerprint: regular files we can
+ * read that have at least one partner of a compatible size on the
+ * other side.  Anything else would be rejected by the size check in
+ * similarity_candidate() without ever looking at the contents.
+ */
+static void collect_fingerprints(struct rename_matrix *rm)
+{
+	struct diff_filespec **src, **dst, **list;
+	unsigned long *src_sizes, *dst_sizes;
+	int src_nr = 0, dst_nr = 0, nr = 0, i;
+
+	src = xmalloc(sizeof(*src) * rename_src_nr);
+	dst = xmalloc(sizeof(*dst) * rm->nr_rows);
+	for (i = 0; i < rename_src_nr; i++) {
+		if (rm->skip_unmodified &&
+		    diff_unmodified_pair(rename_src[i].p))
+			continue;
+		if (usable_for_similarity(rename_src[i].p->one))
+			src[src_nr++] = rename_src[i].p->one;
+	}
+	for (i = 0; i < rm->nr_rows; i++) {
+		struct diff_filespec *two = rename_dst[rm->row_dst[i]].two;
+		if (usable_for_similarity(two))
+			dst[dst_nr++] = two;
+	}
+
+	src_sizes = xmalloc(sizeof(*src_sizes) * (src_nr + 1));
+	dst_sizes = xmalloc(sizeof(*dst_sizes) * (dst_nr + 1));
+	for (i = 0; i < src_nr; i++)
+		src_sizes[i] = src[i]->size;
+	for (i = 0; i < dst_nr; i++)
+		dst_sizes[i] = dst[i]->size;
+	qsort(src_sizes, src_nr, sizeof(*src_sizes), ulong_cmp);
+	qsort(dst_sizes, dst_nr, sizeof(*dst_sizes), ulong_cmp);
+
+	list = xmalloc(sizeof(*list) * (src_nr + dst_nr + 1));
+	for (i = 0; i < src_nr; i++)
+		if (!src[i]->cnt_data &&
+		    has_size_partner(src[i]->size, dst_sizes, dst_nr,
+				     rm->minimum_score))
+			list[nr++] = src[i];
+	for (i = 0; i < dst_nr; i++)
+		if (!dst[i]->cnt_data &&
+		    has_size_partner(dst[i]->size, src_sizes, src_nr,
+				     rm->minimum_score))
+			list[nr++] = dst[i];
+
+	/* The same filespec must not be handed to two workers */
+	qsort(list, nr, sizeof(*list), filespec_ptr_cmp);
+	rm->nr_fingerprint = 0;
+	for (i = 0; i < nr; i++)
+		if (!i || list[i] != list[i - 1])
+			list[rm->nr_fingerprint++] = list[i];
+	rm->fingerprint = list;
+
+	free(src);
+	free(dst);
+	free(src_sizes);
+	free(dst_sizes);
+}
+
+static struct span_index *build_span_index(struct rename_matrix *rm)
+{
+	struct span_index *index;
+	void **count = xcalloc(rename_src_nr, sizeof(*count));
+	int i;
+
+	for (i = 0; i < rename_src_nr; i++) {
+		if (rm->skip_unmodified &&
+		    diff_unmodified_pair(rename_src[i].p))
+			continue;
+		if (S_ISREG(rename_src[i].p->one->mode))
+			count[i] = rename_src[i].p->one->cnt_data;
+	}
+	index = diffcore_span_index(count, rename_src_nr);
+	free(count);
+	return index;
+}
+
 void diffcore_rename(struct diff_options *options)
 {
 	int detect_rename = options->detect_rename;
@@ -497,9 +858,9 @@ void diffcore_rename(struct diff_options *options)
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
-	int i, j, rename_count, skip_unmodified = 0;
+	int i, rename_count, skip_unmodified = 0;
 	int num_create, dst_cnt;
-	struct progress *progress = NULL;
+	struct rename_matrix rm;
 
 	if (!minimum_score)
 		minimum_score = DEFAULT_RENAME_SCORE;
@@ -570,49 +931,36 @@ void diffcore_rename(struct diff_options *options)
 		break;
 	}
 
+	memset(&rm, 0, sizeof(rm));
+	rm.minimum_score = minimum_score;
+	rm.skip_unmodified = skip_unmodified;
+	rm.row_dst = xmalloc(sizeof(*rm.row_dst) * rename_dst_nr);
+	for (i = 0; i < rename_dst_nr; i++)
+		if (!rename_dst[i].pair) /* dealt with exact match already. */
+			rm.row_dst[rm.nr_rows++] = i;
+	dst_cnt = rm.nr_rows;
+	rm.nr_threads = rename_thread_count(dst_cnt * rename_src_nr);
+
 	if (options->show_rename_progress) {
-		progress = start_progress_delay(
+		rm.progress = start_progress_delay(
 				"Performing inexact rename detection",
-				rename_dst_nr * rename_src_nr, 50, 1);
+				dst_cnt * rename_src_nr, 50, 1);
 	}
 
-	mx = xcalloc(num_create * NUM_CANDIDATE_PER_DST, sizeof(*mx));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].two;
-		struct diff_score *m;
-
-		if (rename_dst[i].pair)
-			continue; /* dealt with exact match already. */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
+	collect_fingerprints(&rm);
+	run_rename_workers(&rm, fingerprint_worker);
+	free(rm.fingerprint);
 
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
+	if (diff_rename_prefilter)
+		rm.index = build_span_index(&rm);
 
-			this_src.score = estimate_similarity(one, two,
-							     minimum_score);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
-		}
-		dst_cnt++;
-		display_progress(progress, (i+1)*rename_src_nr);
-	}
-	stop_progress(&progress);
+	rm.mx = mx = xcalloc(dst_cnt * NUM_CANDIDATE_PER_DST, sizeof(*mx));
+	run_rename_workers(&rm, matrix_worker);
+	stop_progress(&rm.progress);
+	diffcore_free_span_index(rm.index);
+	free(rm.row_dst);
+	if (diff_similarity_cache)
+		diffcore_flush_similarity_cache();
 
 	/* cost matrix sorted by most to least similar pair */
 	qsort(mx, dst_cnt * NUM_CANDIDATE_PER_DST, sizeof(*mx), score_compare);
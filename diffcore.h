@@ -60,6 +60,7 @@ extern int diff_populate_filespec(struct diff_filespec *, int);
 extern void diff_free_filespec_data(struct diff_filespec *);
 extern void diff_free_filespec_blob(struct diff_filespec *);
 extern int diff_filespec_is_binary(struct diff_filespec *);
+extern int diff_filespec_binary_attr(struct diff_filespec *);
 
 struct diff_filepair {
 	struct diff_filespec *one;
@@ -128,5 +129,23 @@ extern int diffcore_count_changes(struct diff_filespec *src,
 				  unsigned long delta_limit,
 				  unsigned long *src_copied,
 				  unsigned long *literal_added);
+extern void *diffcore_hash_chars(const void *buf, unsigned long size, int is_text);
+
+struct span_index;
+extern struct span_index *diffcore_span_index(void **count, int nr);
+extern void diffcore_span_copied(struct span_index *, void *dst_count,
+				 unsigned long *copied);
+extern void diffcore_free_span_index(struct span_index *);
+
+extern void *diffcore_cached_hash_chars(const unsigned char *sha1, int is_text,
+					unsigned long *size);
+extern void *diffcore_similarity_record(const unsigned char *sha1, const void *buf,
+					unsigned long size, int is_text, void *count);
+extern void diffcore_cache_similarity_record(void *record);
+extern void diffcore_flush_similarity_cache(void);
+
+extern int diff_rename_threads;
+extern int diff_rename_prefilter;
+extern int diff_similarity_cache;
 
 #endif
@@ -37,6 +37,8 @@ size_t packed_git_window_size = DEFAULT_PACKED_GIT_WINDOW_SIZE;
 size_t packed_git_limit = DEFAULT_PACKED_GIT_LIMIT;
 size_t delta_base_cache_limit = 16 * 1024 * 1024;
 unsigned long big_file_threshold = 512 * 1024 * 1024;
+unsigned long big_diff_threshold;
+int contains_date_cutoff;
 const char *log_pack_access;
 const char *pager_program;
 int pager_use_color = 1;
@@ -63,6 +65,15 @@ struct startup_info *startup_info;
 /* Parallel index stat data preload? */
 int core_preload_index = 0;
 
+/* Threads to read the index with, 0 for one per CPU */
+int index_threads = 0;
+
+/* Record the offsets needed to read the index in parallel? */
+int index_record_offsets = 0;
+
+/* Name new objects with the collision-detecting SHA-1? */
+int detect_sha1_collisions;
+
 /* This is set by setup_git_dir_gently() and/or git_default_config() */
 char *git_work_tree_cfg;
 static char *work_tree;
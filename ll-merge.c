@@ -87,6 +87,8 @@ static int ll_xdl_merge(const struct ll_merge_driver *drv_unused,
 	xmp.level = XDL_MERGE_ZEALOUS;
 	xmp.favor = opts->variant;
 	xmp.xpp.flags = opts->xdl_opts;
+	if (xdiff_large_input(orig, src1) || xdiff_large_input(orig, src2))
+		xmp.xpp.flags |= XDF_LARGE_INPUT;
 	if (git_xmerge_style >= 0)
 		xmp.style = git_xmerge_style;
 	if (marker_size > 0)
@@ -156,12 +156,12 @@ void load_ref_decorations(int flags)
 	}
 }
 
-static void show_parents(struct commit *commit, int abbrev)
+static void show_parents(struct commit *commit, int abbrev, FILE *file)
 {
 	struct commit_list *p;
 	for (p = commit->parents; p ; p = p->next) {
 		struct commit *parent = p->item;
-		printf(" %s", find_unique_abbrev(parent->object.sha1, abbrev));
+		fprintf(file, " %s", find_unique_abbrev(parent->object.sha1, abbrev));
 	}
 }
 
@@ -175,7 +175,7 @@ void show_decorations(struct rev_info *opt, struct commit *commit)
 		decorate_get_color_opt(&opt->diffopt, DECORATION_NONE);
 
 	if (opt->show_source && commit->util)
-		printf("\t%s", (char *) commit->util);
+		fprintf(opt->diffopt.file, "\t%s", (char *) commit->util);
 	if (!opt->show_decorations)
 		return;
 	decoration = lookup_decoration(&name_decoration, &commit->object);
@@ -183,18 +183,18 @@ void show_decorations(struct rev_info *opt, struct commit *commit)
 		return;
 	prefix = " (";
 	while (decoration) {
-		printf("%s", prefix);
+		fprintf(opt->diffopt.file, "%s", prefix);
 		fputs(decorate_get_color_opt(&opt->diffopt, decoration->type),
-		      stdout);
+		      opt->diffopt.file);
 		if (decoration->type == DECORATION_REF_TAG)
-			fputs("tag: ", stdout);
-		printf("%s", decoration->name);
-		fputs(color_reset, stdout);
-		fputs(color_commit, stdout);
+			fputs("tag: ", opt->diffopt.file);
+		fprintf(opt->diffopt.file, "%s", decoration->name);
+		fputs(color_reset, opt->diffopt.file);
+		fputs(color_commit, opt->diffopt.file);
 		prefix = ", ";
 		decoration = decoration->next;
 	}
-	putchar(')');
+	putc(')', opt->diffopt.file);
 }
 
 /*
@@ -338,19 +338,20 @@ void log_write_email_headers(struct rev_info *opt, struct commit *commit,
 		subject = "Subject: ";
 	}
 
-	printf("From %s Mon Sep 17 00:00:00 2001\n", name);
+	fprintf(opt->diffopt.file, "From %s Mon Sep 17 00:00:00 2001\n", name);
 	graph_show_oneline(opt->graph);
 	if (opt->message_id) {
-		printf("Message-Id: <%s>\n", opt->message_id);
+		fprintf(opt->diffopt.file, "Message-Id: <%s>\n", opt->message_id);
 		graph_show_oneline(opt->graph);
 	}
 	if (opt->ref_message_ids && opt->ref_message_ids->nr > 0) {
 		int i, n;
 		n = opt->ref_message_ids->nr;
-		printf("In-Reply-To: <%s>\n", opt->ref_message_ids->items[n-1].string);
+		fprintf(opt->diffopt.file, "In-Reply-To: <%s>\n", opt->ref_message_ids->items[n-1].string);
 		for (i = 0; i < n; i++)
-			printf("%s<%s>\n", (i > 0 ? "\t" : "References: "),
-			       opt->ref_message_ids->items[i].string);
+			fprintf(opt->diffopt.file, "%s<%s>\n",
+				(i > 0 ? "\t" : "References: "),
+				opt->ref_message_ids->items[i].string);
 		graph_show_oneline(opt->graph);
 	}
 	if (opt->mime_boundary) {
@@ -411,15 +412,15 @@ void show_log(struct rev_info *opt)
 
 		if (!opt->graph)
 			put_revision_mark(opt, commit);
-		fputs(find_unique_abbrev(commit->object.sha1, abbrev_commit), stdout);
+		fputs(find_unique_abbrev(commit->object.sha1, abbrev_commit), opt->diffopt.file);
 		if (opt->print_parents)
-			show_parents(commit, abbrev_commit);
+			show_parents(commit, abbrev_commit, opt->diffopt.file);
 		show_decorations(opt, commit);
 		if (opt->graph && !graph_is_commit_finished(opt->graph)) {
-			putchar('\n');
+			putc('\n', opt->diffopt.file);
 			graph_show_remainder(opt->graph);
 		}
-		putchar(opt->diffopt.line_termination);
+		putc(opt->diffopt.line_termination, opt->diffopt.file);
 		return;
 	}
 
@@ -445,7 +446,7 @@ void show_log(struct rev_info *opt)
 		if (opt->diffopt.line_termination == '\n' &&
 		    !opt->missing_newline)
 			graph_show_padding(opt->graph);
-		putchar(opt->diffopt.line_termination);
+		putc(opt->diffopt.line_termination, opt->diffopt.file);
 	}
 	opt->shown_one = 1;
 
@@ -463,26 +464,26 @@ void show_log(struct rev_info *opt)
 		log_write_email_headers(opt, commit, &ctx.subject, &extra_headers,
 					&ctx.need_8bit_cte);
 	} else if (opt->commit_format != CMIT_FMT_USERFORMAT) {
-		fputs(diff_get_color_opt(&opt->diffopt, DIFF_COMMIT), stdout);
+		fputs(diff_get_color_opt(&opt->diffopt, DIFF_COMMIT), opt->diffopt.file);
 		if (opt->commit_format != CMIT_FMT_ONELINE)
-			fputs("commit ", stdout);
+			fputs("commit ", opt->diffopt.file);
 
 		if (!opt->graph)
 			put_revision_mark(opt, commit);
 		fputs(find_unique_abbrev(commit->object.sha1, abbrev_commit),
-		      stdout);
+		      opt->diffopt.file);
 		if (opt->print_parents)
-			show_parents(commit, abbrev_commit);
+			show_parents(commit, abbrev_commit, opt->diffopt.file);
 		if (parent)
-			printf(" (from %s)",
-			       find_unique_abbrev(parent->object.sha1,
-						  abbrev_commit));
+			fprintf(opt->diffopt.file, " (from %s)",
+				find_unique_abbrev(parent->object.sha1,
+						   abbrev_commit));
 		show_decorations(opt, commit);
-		printf("%s", diff_get_color_opt(&opt->diffopt, DIFF_RESET));
+		fprintf(opt->diffopt.file, "%s", diff_get_color_opt(&opt->diffopt, DIFF_RESET));
 		if (opt->commit_format == CMIT_FMT_ONELINE) {
-			putchar(' ');
+			putc(' ', opt->diffopt.file);
 		} else {
-			putchar('\n');
+			putc('\n', opt->diffopt.file);
 			graph_show_oneline(opt->graph);
 		}
 		if (opt->reflog_info) {
@@ -521,7 +522,7 @@ void show_log(struct rev_info *opt)
 	if (opt->add_signoff)
 		append_signoff(&msgbuf, opt->add_signoff);
 	if (opt->show_log_size) {
-		printf("log size %i\n", (int)msgbuf.len);
+		fprintf(opt->diffopt.file, "log size %i\n", (int)msgbuf.len);
 		graph_show_oneline(opt->graph);
 	}
 
@@ -537,11 +538,11 @@ void show_log(struct rev_info *opt)
 	if (opt->graph)
 		graph_show_commit_msg(opt->graph, &msgbuf);
 	else
-		fwrite(msgbuf.buf, sizeof(char), msgbuf.len, stdout);
+		fwrite(msgbuf.buf, sizeof(char), msgbuf.len, opt->diffopt.file);
 	if (opt->use_terminator) {
 		if (!opt->missing_newline)
 			graph_show_padding(opt->graph);
-		putchar('\n');
+		putc('\n', opt->diffopt.file);
 	}
 
 	strbuf_release(&msgbuf);
@@ -571,14 +572,14 @@ int log_tree_diff_flush(struct rev_info *opt)
 		    opt->commit_format != CMIT_FMT_ONELINE) {
 			int pch = DIFF_FORMAT_DIFFSTAT | DIFF_FORMAT_PATCH;
 			if ((pch & opt->diffopt.output_format) == pch)
-				printf("---");
+				fprintf(opt->diffopt.file, "---");
 			if (opt->diffopt.output_prefix) {
 				struct strbuf *msg = NULL;
 				msg = opt->diffopt.output_prefix(&opt->diffopt,
 					opt->diffopt.output_prefix_data);
-				fwrite(msg->buf, msg->len, 1, stdout);
+				fwrite(msg->buf, msg->len, 1, opt->diffopt.file);
 			}
-			putchar('\n');
+			putc('\n', opt->diffopt.file);
 		}
 	}
 	diff_flush(&opt->diffopt);
@@ -673,6 +674,317 @@ int log_tree_commit(struct rev_info *opt, struct commit *commit)
 		shown = 1;
 	}
 	opt->loginfo = NULL;
-	maybe_flush_or_die(stdout, "stdout");
+	maybe_flush_or_die(opt->diffopt.file, "stdout");
 	return shown;
 }
+
+#ifndef NO_PTHREADS
+#include "thread-utils.h"
+
+/*
+ * Threaded patch generation.  The main thread walks the history and
+ * writes everything but the xdiff output of each patch to a temporary
+ * file per commit; the patches themselves are left to worker threads
+ * (see diff_options.defer_patch).  Once all patches of a commit are
+ * done, its output is put together and written out, in order.
+ */
+struct patch_segment {
+	struct diff_deferred_patch *patch;
+	struct commit_output *output;
+	long offset;
+	struct strbuf text;
+	struct patch_segment *next, *next_todo;
+};
+
+struct commit_output {
+	FILE *buf, *dest;
+	int close_dest;
+	int pending;
+	struct patch_segment *segments, **segments_tail;
+	struct commit_output *next;
+};
+
+#define OUTPUTS_PER_THREAD 8
+#define PATCHES_PER_THREAD 32
+
+static int nr_log_threads;
+static pthread_t *log_threads;
+static pthread_mutex_t log_mutex;
+static pthread_cond_t cond_todo;
+static pthread_cond_t cond_done;
+static struct patch_segment *todo, **todo_tail = &todo;
+static int nr_todo, all_queued;
+static struct commit_output *outputs, **outputs_tail = &outputs;
+static struct commit_output *current_output;
+static int nr_outputs;
+static FILE **spare_files;
+static int nr_spare_files, alloc_spare_files;
+
+static FILE *get_temp_file(void)
+{
+	FILE *file;
+
+	if (nr_spare_files)
+		return spare_files[--nr_spare_files];
+	file = tmpfile();
+	if (!file)
+		die_errno("unable to create temporary file");
+	return file;
+}
+
+static void put_temp_file(FILE *file)
+{
+	rewind(file);
+	if (ftruncate(fileno(file), 0))
+		die_errno("unable to truncate temporary file");
+	ALLOC_GROW(spare_files, nr_spare_files + 1, alloc_spare_files);
+	spare_files[nr_spare_files++] = file;
+}
+
+/* Append what has been written to a temporary file to sb, and empty it */
+static void read_temp_file(FILE *file, struct strbuf *sb)
+{
+	long size;
+
+	if (fflush(file))
+		die_errno("unable to write temporary file");
+	size = ftell(file);
+	rewind(file);
+	if (size > 0 && strbuf_fread(sb, size, file) != size)
+		die_errno("unable to read temporary file");
+	rewind(file);
+	if (ftruncate(fileno(file), 0))
+		die_errno("unable to truncate temporary file");
+}
+
+static void *run_patches(void *unused)
+{
+	FILE *file = tmpfile();
+
+	if (!file)
+		die_errno("unable to create temporary file");
+
+	pthread_mutex_lock(&log_mutex);
+	for (;;) {
+		struct patch_segment *seg;
+
+		while (!todo && !all_queued)
+			pthread_cond_wait(&cond_todo, &log_mutex);
+		if (!todo)
+			break;
+		seg = todo;
+		todo = seg->next_todo;
+		if (!todo)
+			todo_tail = &todo;
+		nr_todo--;
+		pthread_mutex_unlock(&log_mutex);
+
+		diff_run_deferred_patch(seg->patch, file);
+		read_temp_file(file, &seg->text);
+
+		pthread_mutex_lock(&log_mutex);
+		seg->output->pending--;
+		pthread_cond_signal(&cond_done);
+	}
+	pthread_mutex_unlock(&log_mutex);
+	fclose(file);
+	return NULL;
+}
+
+static void queue_patch(struct diff_options *opt,
+			struct diff_deferred_patch *patch)
+{
+	struct commit_output *out = current_output;
+	struct patch_segment *seg = xcalloc(1, sizeof(*seg));
+
+	seg->patch = patch;
+	seg->output = out;
+	seg->offset = ftell(opt->file);
+	strbuf_init(&seg->text, 0);
+	*out->segments_tail = seg;
+	out->segments_tail = &seg->next;
+
+	pthread_mutex_lock(&log_mutex);
+	/* Do not let unprocessed blobs pile up in memory */
+	while (nr_todo >= nr_log_threads * PATCHES_PER_THREAD)
+		pthread_cond_wait(&cond_done, &log_mutex);
+	out->pending++;
+	*todo_tail = seg;
+	todo_tail = &seg->next_todo;
+	nr_todo++;
+	pthread_cond_signal(&cond_todo);
+	pthread_mutex_unlock(&log_mutex);
+}
+
+static void copy_temp_file(FILE *from, FILE *to, long size)
+{
+	char buf[8192];
+
+	while (size) {
+		size_t len = fread(buf, 1, size < sizeof(buf) ? size : sizeof(buf), from);
+		if (!len)
+			die_errno("unable to read temporary file");
+		fwrite(buf, 1, len, to);
+		size -= len;
+	}
+}
+
+static void write_output(struct commit_output *out)
+{
+	struct patch_segment *seg, *next;
+	long pos = 0, size;
+
+	if (fflush(out->buf))
+		die_errno("unable to write temporary file");
+	size = ftell(out->buf);
+	rewind(out->buf);
+	for (seg = out->segments; seg; seg = next) {
+		next = seg->next;
+		copy_temp_file(out->buf, out->dest, seg->offset - pos);
+		pos = seg->offset;
+		fwrite(seg->text.buf, 1, seg->text.len, out->dest);
+		strbuf_release(&seg->text);
+		free(seg);
+	}
+	copy_temp_file(out->buf, out->dest, size - pos);
+	put_temp_file(out->buf);
+	if (out->close_dest)
+		fclose(out->dest);
+	else
+		maybe_flush_or_die(out->dest, "stdout");
+	free(out);
+}
+
+/*
+ * Write out the commits whose patches are all done, waiting for the
+ * oldest one while more than "keep" commits are waiting.
+ */
+static void write_outputs(int keep)
+{
+	while (outputs) {
+		struct commit_output *out = outputs;
+		int pending;
+
+		pthread_mutex_lock(&log_mutex);
+		while (out->pending && nr_outputs > keep)
+			pthread_cond_wait(&cond_done, &log_mutex);
+		pending = out->pending;
+		pthread_mutex_unlock(&log_mutex);
+		if (pending)
+			break;
+		outputs = out->next;
+		if (!outputs)
+			outputs_tail = &outputs;
+		nr_outputs--;
+		write_output(out);
+	}
+}
+
+void log_tree_start_threads(struct rev_info *opt, int nr)
+{
+	int i;
+
+	if (nr == 0)
+		nr = online_cpus();
+	if (nr <= 1 ||
+	    !(opt->diffopt.output_format & DIFF_FORMAT_PATCH) ||
+	    opt->graph || opt->reflog_info || opt->combine_merges ||
+	    opt->early_output || opt->diffopt.output_prefix ||
+	    DIFF_OPT_TST(&opt->diffopt, ALLOW_EXTERNAL) ||
+	    DIFF_OPT_TST(&opt->diffopt, EXIT_WITH_STATUS))
+		return;
+
+	nr_log_threads = nr;
+	pthread_mutex_init(&log_mutex, NULL);
+	pthread_cond_init(&cond_todo, NULL);
+	pthread_cond_init(&cond_done, NULL);
+	log_threads = xcalloc(nr, sizeof(*log_threads));
+	for (i = 0; i < nr; i++) {
+		int err = pthread_create(&log_threads[i], NULL, run_patches, NULL);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+}
+
+void log_tree_begin_commit(struct rev_info *opt)
+{
+	struct commit_output *out;
+
+	if (!nr_log_threads)
+		return;
+	out = xcalloc(1, sizeof(*out));
+	out->dest = opt->diffopt.file;
+	out->buf = get_temp_file();
+	out->segments_tail = &out->segments;
+	current_output = out;
+	opt->diffopt.file = out->buf;
+	opt->diffopt.defer_patch = queue_patch;
+}
+
+void log_tree_end_commit(struct rev_info *opt, int close_file)
+{
+	struct commit_output *out = current_output;
+
+	if (!nr_log_threads) {
+		if (close_file) {
+			fclose(opt->diffopt.file);
+			opt->diffopt.file = stdout;
+		}
+		return;
+	}
+	out->close_dest = close_file;
+	opt->diffopt.file = close_file ? stdout : out->dest;
+	opt->diffopt.defer_patch = NULL;
+	current_output = NULL;
+
+	*outputs_tail = out;
+	outputs_tail = &out->next;
+	nr_outputs++;
+	write_outputs(nr_log_threads * OUTPUTS_PER_THREAD);
+}
+
+void log_tree_finish_threads(struct rev_info *opt)
+{
+	int i;
+
+	if (!nr_log_threads)
+		return;
+	write_outputs(0);
+
+	pthread_mutex_lock(&log_mutex);
+	all_queued = 1;
+	pthread_cond_broadcast(&cond_todo);
+	pthread_mutex_unlock(&log_mutex);
+	for (i = 0; i < nr_log_threads; i++)
+		pthread_join(log_threads[i], NULL);
+	free(log_threads);
+	log_threads = NULL;
+	nr_log_threads = 0;
+
+	pthread_mutex_destroy(&log_mutex);
+	pthread_cond_destroy(&cond_todo);
+	pthread_cond_destroy(&cond_done);
+	while (nr_spare_files)
+		fclose(spare_files[--nr_spare_files]);
+}
+#else
+void log_tree_start_threads(struct rev_info *opt, int nr)
+{
+}
+
+void log_tree_begin_commit(struct rev_info *opt)
+{
+}
+
+void log_tree_end_commit(struct rev_info *opt, int close_file)
+{
+	if (close_file) {
+		fclose(opt->diffopt.file);
+		opt->diffopt.file = stdout;
+	}
+}
+
+void log_tree_finish_threads(struct rev_info *opt)
+{
+}
+#endif
@@ -20,6 +20,19 @@ void log_write_email_headers(struct rev_info *opt, struct commit *commit,
 			     int *need_8bit_cte_p);
 void load_ref_decorations(int flags);
 
+/*
+ * Generate the patches of the commits shown with nr worker threads
+ * (0 means one per CPU).  The output for each commit must be written
+ * to opt->diffopt.file between log_tree_begin_commit() and
+ * log_tree_end_commit(); it reaches the file that was there before in
+ * order, once its patches are done.  With close_file, that file is
+ * closed afterwards.
+ */
+void log_tree_start_threads(struct rev_info *opt, int nr);
+void log_tree_begin_commit(struct rev_info *opt);
+void log_tree_end_commit(struct rev_info *opt, int close_file);
+void log_tree_finish_threads(struct rev_info *opt);
+
 #define FORMAT_PATCH_NAME_MAX 64
 void get_patch_filename(struct commit *commit, int nr, const char *suffix,
 			struct strbuf *buf);
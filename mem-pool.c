@@ -0,0 +1,133 @@
+/*
+ * Memory pools, for allocating many small objects that all go away
+ * together.
+ */
+
+#include "cache.h"
+#include "mem-pool.h"
+
+#define BLOCK_GROWTH_SIZE (1024 * 1024 - sizeof(struct mp_block))
+
+static struct mp_block *mem_pool_alloc_block(struct mem_pool *mem_pool,
+					     size_t block_alloc,
+					     struct mp_block *insert_after)
+{
+	struct mp_block *p;
+
+	mem_pool->pool_alloc += sizeof(struct mp_block) + block_alloc;
+	p = xmalloc(sizeof(struct mp_block) + block_alloc);
+
+	p->next_free = (char *)p->space;
+	p->end = p->next_free + block_alloc;
+
+	if (insert_after) {
+		p->next_block = insert_after->next_block;
+		insert_after->next_block = p;
+	} else {
+		p->next_block = mem_pool->mp_block;
+		mem_pool->mp_block = p;
+	}
+	return p;
+}
+
+void mem_pool_init(struct mem_pool **mem_pool, size_t initial_size)
+{
+	struct mem_pool *pool;
+
+	if (*mem_pool)
+		return;
+
+	pool = xcalloc(1, sizeof(*pool));
+	pool->block_alloc = BLOCK_GROWTH_SIZE;
+	if (initial_size > 0)
+		mem_pool_alloc_block(pool, initial_size, NULL);
+	*mem_pool = pool;
+}
+
+void mem_pool_discard(struct mem_pool *mem_pool)
+{
+	struct mp_block *block, *block_to_free;
+
+	if (!mem_pool)
+		return;
+	block = mem_pool->mp_block;
+	while (block) {
+		block_to_free = block;
+		block = block->next_block;
+		free(block_to_free);
+	}
+	free(mem_pool);
+}
+
+void *mem_pool_alloc(struct mem_pool *mem_pool, size_t len)
+{
+	struct mp_block *p = mem_pool->mp_block;
+	void *r;
+
+	/* round up to a 'uintmax_t' alignment */
+	if (len & (sizeof(uintmax_t) - 1))
+		len += sizeof(uintmax_t) - (len & (sizeof(uintmax_t) - 1));
+
+	/*
+	 * Only the first block is looked at; the ones behind it are
+	 * full, or were allocated for a single large object.
+	 */
+	if (!p || p->end - p->next_free < len) {
+		/*
+		 * A large object gets a block of its own, behind the
+		 * first one, so that the room left in the first block
+		 * is not wasted.
+		 */
+		if (len >= mem_pool->block_alloc / 2)
+			p = mem_pool_alloc_block(mem_pool, len, mem_pool->mp_block);
+		else
+			p = mem_pool_alloc_block(mem_pool, mem_pool->block_alloc, NULL);
+	}
+
+	r = p->next_free;
+	p->next_free += len;
+	return r;
+}
+
+void *mem_pool_calloc(struct mem_pool *mem_pool, size_t count, size_t size)
+{
+	size_t len = count * size;
+	void *r = mem_pool_alloc(mem_pool, len);
+	memset(r, 0, len);
+	return r;
+}
+
+void mem_pool_combine(struct mem_pool *dst, struct mem_pool *src)
+{
+	struct mp_block *p;
+
+	if (!src->mp_block)
+		return;
+
+	/*
+	 * Put the blocks of src behind the first block of dst, which
+	 * is the one allocations are made from.
+	 */
+	if (dst->mp_block) {
+		for (p = src->mp_block; p->next_block; p = p->next_block)
+			;
+		p->next_block = dst->mp_block->next_block;
+		dst->mp_block->next_block = src->mp_block;
+	} else {
+		dst->mp_block = src->mp_block;
+	}
+
+	dst->pool_alloc += src->pool_alloc;
+	src->pool_alloc = 0;
+	src->mp_block = NULL;
+}
+
+int mem_pool_contains(struct mem_pool *mem_pool, void *mem)
+{
+	struct mp_block *p;
+
+	for (p = mem_pool->mp_block; p; p = p->next_block)
+		if ((mem >= (void *)p->space) && (mem < (void *)p->end))
+			return 1;
+	return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef MEM_POOL_H
+#define MEM_POOL_H
+
+/*
+ * A memory pool hands out small allocations carved from large blocks,
+ * and releases them all at once when it is discarded.  Nothing
+ * allocated from a pool can be free()d on its own.
+ */
+
+struct mp_block {
+	struct mp_block *next_block;
+	char *next_free;
+	char *end;
+	uintmax_t space[FLEX_ARRAY]; /* more */
+};
+
+struct mem_pool {
+	struct mp_block *mp_block;
+
+	/*
+	 * The size of the blocks the pool grows by, not counting the
+	 * struct mp_block header.
+	 */
+	size_t block_alloc;
+
+	/* The total amount of memory allocated by the pool. */
+	size_t pool_alloc;
+};
+
+/*
+ * Allocate a new pool, with a first block of initial_size bytes if
+ * that is not zero.
+ */
+extern void mem_pool_init(struct mem_pool **mem_pool, size_t initial_size);
+
+/* Release the pool and everything allocated from it. */
+extern void mem_pool_discard(struct mem_pool *mem_pool);
+
+/*
+ * Allocate len bytes, aligned for any type; mem_pool_calloc() also
+ * zeroes them.
+ */
+extern void *mem_pool_alloc(struct mem_pool *pool, size_t len);
+extern void *mem_pool_calloc(struct mem_pool *pool, size_t count, size_t size);
+
+/*
+ * Move the blocks of src to dst, so that what was allocated from src
+ * lives as long as dst does.  src is left empty.
+ */
+extern void mem_pool_combine(struct mem_pool *dst, struct mem_pool *src);
+
+/* Does the memory pointed to by mem come from the pool? */
+extern int mem_pool_contains(struct mem_pool *mem_pool, void *mem);
+
+#endif
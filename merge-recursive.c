@@ -150,7 +150,7 @@ static int show(struct merge_options *o, int v)
 
 static void flush_output(struct merge_options *o)
 {
-	if (o->obuf.len) {
+	if (o->buffer_output < 2 && o->obuf.len) {
 		fputs(o->obuf.buf, stdout);
 		strbuf_reset(&o->obuf);
 	}
@@ -180,29 +180,31 @@ static void output(struct merge_options *o, int v, const char *fmt, ...)
 static void output_commit_title(struct merge_options *o, struct commit *commit)
 {
 	int i;
-	flush_output(o);
 	for (i = o->call_depth; i--;)
-		fputs("  ", stdout);
+		strbuf_addstr(&o->obuf, "  ");
 	if (commit->util)
-		printf("virtual %s\n", (char *)commit->util);
+		strbuf_addf(&o->obuf, "virtual %s\n", (char *)commit->util);
 	else {
-		printf("%s ", find_unique_abbrev(commit->object.sha1, DEFAULT_ABBREV));
+		strbuf_addf(&o->obuf, "%s ",
+			    find_unique_abbrev(commit->object.sha1, DEFAULT_ABBREV));
 		if (parse_commit(commit) != 0)
-			printf("(bad commit)\n");
+			strbuf_addstr(&o->obuf, "(bad commit)\n");
 		else {
 			const char *title;
 			int len = find_commit_subject(commit->buffer, &title);
 			if (len)
-				printf("%.*s\n", len, title);
+				strbuf_addf(&o->obuf, "%.*s\n", len, title);
 		}
 	}
+	flush_output(o);
 }
 
 static int add_cacheinfo(unsigned int mode, const unsigned char *sha1,
 		const char *path, int stage, int refresh, int options)
 {
 	struct cache_entry *ce;
-	ce = make_cache_entry(mode, sha1 ? sha1 : null_sha1, path, stage, refresh);
+	ce = make_cache_entry(&the_index, mode, sha1 ? sha1 : null_sha1, path,
+			      stage, refresh);
 	if (!ce)
 		return error("addinfo_cache failed for path '%s'", path);
 	return add_cache_entry(ce, options);
@@ -273,36 +275,89 @@ struct tree *write_tree_from_memory(struct merge_options *o)
 	return result;
 }
 
-static int save_files_dirs(const unsigned char *sha1,
-		const char *base, int baselen, const char *path,
-		unsigned int mode, int stage, void *context)
+/*
+ * Without a working tree, what would have been written there is
+ * remembered instead, so that conflicted paths can be resolved the
+ * same way in the merged tree.  A NULL sha1 marks a removed path.
+ */
+static void record_in_core_file(struct merge_options *o,
+				const unsigned char *sha1, unsigned mode,
+				const char *path)
 {
-	int len = strlen(path);
-	char *newpath = xmalloc(baselen + len + 1);
-	struct merge_options *o = context;
+	struct string_list_item *item;
+	struct cache_entry *ce = NULL;
 
-	memcpy(newpath, base, baselen);
-	memcpy(newpath + baselen, path, len);
-	newpath[baselen + len] = '\0';
+	if (sha1)
+		ce = make_transient_cache_entry(mode, sha1, path, 0);
+	item = string_list_insert(&o->in_core_files, path);
+	discard_cache_entry(item->util);
+	item->util = ce;
+}
 
-	if (S_ISDIR(mode))
-		string_list_insert(&o->current_directory_set, newpath);
-	else
-		string_list_insert(&o->current_file_set, newpath);
-	free(newpath);
+static int ce_name_cmp(const void *a_, const void *b_)
+{
+	const struct cache_entry *a = *(const struct cache_entry **)a_;
+	const struct cache_entry *b = *(const struct cache_entry **)b_;
+	return strcmp(a->name, b->name);
+}
+
+/*
+ * Write the result of an in-core merge: the merged entries of the
+ * index, and for the unmerged paths whatever would have been left in
+ * the working tree, which is our side unless something else was
+ * written there.
+ */
+static struct tree *write_in_core_tree(struct merge_options *o)
+{
+	struct cache_entry **cache;
+	struct cache_tree *it;
+	struct tree *result;
+	int i, nr = 0;
 
-	return (S_ISDIR(mode) ? READ_TREE_RECURSIVE : 0);
+	for (i = 0; i < active_nr; i++) {
+		struct cache_entry *ce = active_cache[i];
+		if (ce_stage(ce) == 2 &&
+		    !string_list_has_string(&o->in_core_files, ce->name))
+			record_in_core_file(o, ce->sha1, ce->ce_mode, ce->name);
+	}
+
+	cache = xmalloc((active_nr + o->in_core_files.nr) * sizeof(*cache));
+	for (i = 0; i < active_nr; i++)
+		if (!ce_stage(active_cache[i]))
+			cache[nr++] = active_cache[i];
+	for (i = 0; i < o->in_core_files.nr; i++) {
+		struct string_list_item *item = &o->in_core_files.items[i];
+		if (item->util && cache_name_pos(item->string,
+						 strlen(item->string)) < 0)
+			cache[nr++] = item->util;
+	}
+	qsort(cache, nr, sizeof(*cache), ce_name_cmp);
+
+	it = cache_tree();
+	if (cache_tree_update(it, cache, nr, 0, 0) < 0)
+		die("error building trees");
+	result = lookup_tree(it->sha1);
+	cache_tree_free(&it);
+	free(cache);
+	return result;
 }
 
-static int get_files_dirs(struct merge_options *o, struct tree *tree)
+/*
+ * Whether "path" names a file or a directory in either side of the
+ * merge, looked up on demand rather than by listing both whole trees.
+ */
+static int path_in_merged_trees(struct merge_options *o, const char *path)
 {
-	int n;
-	struct pathspec match_all;
-	init_pathspec(&match_all, NULL);
-	if (read_tree_recursive(tree, "", 0, 0, &match_all, save_files_dirs, o))
-		return 0;
-	n = o->current_file_set.nr + o->current_directory_set.nr;
-	return n;
+	unsigned char sha1[20];
+	unsigned mode;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(o->unique_path_trees); i++)
+		if (o->unique_path_trees[i] &&
+		    !get_tree_entry(o->unique_path_trees[i]->object.sha1,
+				    path, sha1, &mode))
+			return 1;
+	return 0;
 }
 
 /*
@@ -586,6 +641,10 @@ static int remove_file(struct merge_options *o, int clean,
 		if (remove_file_from_cache(path))
 			return -1;
 	}
+	if (update_working_directory && o->in_core) {
+		record_in_core_file(o, NULL, 0, path);
+		return 0;
+	}
 	if (update_working_directory) {
 		if (remove_path(path))
 			return -1;
@@ -606,8 +665,8 @@ static char *unique_path(struct merge_options *o, const char *path, const char *
 		if ('/' == *p)
 			*p = '_';
 	while (string_list_has_string(&o->current_file_set, newpath) ||
-	       string_list_has_string(&o->current_directory_set, newpath) ||
-	       lstat(newpath, &st) == 0)
+	       path_in_merged_trees(o, newpath) ||
+	       (!o->in_core && lstat(newpath, &st) == 0))
 		sprintf(p, "_%d", suffix++);
 
 	string_list_insert(&o->current_file_set, newpath);
@@ -631,6 +690,12 @@ static void flush_buffer(int fd, const char *buf, unsigned long size)
 	}
 }
 
+/* Whether paths are checked against the working tree */
+static int use_working_tree(struct merge_options *o)
+{
+	return !o->call_depth && !o->in_core;
+}
+
 static int dir_in_way(const char *path, int check_working_copy)
 {
 	int pos, pathlen = strlen(path);
@@ -679,9 +744,9 @@ static int was_tracked(const char *path)
 	return 0;
 }
 
-static int would_lose_untracked(const char *path)
+static int would_lose_untracked(struct merge_options *o, const char *path)
 {
-	return !was_tracked(path) && file_exists(path);
+	return !o->in_core && !was_tracked(path) && file_exists(path);
 }
 
 static int make_room_for_path(struct merge_options *o, const char *path)
@@ -722,7 +787,7 @@ static int make_room_for_path(struct merge_options *o, const char *path)
 	 * Do not unlink a file in the work tree if we are not
 	 * tracking it.
 	 */
-	if (would_lose_untracked(path))
+	if (would_lose_untracked(o, path))
 		return error("refusing to lose untracked file at '%s'",
 			     path);
 
@@ -746,6 +811,19 @@ static void update_file_flags(struct merge_options *o,
 	if (o->call_depth)
 		update_wd = 0;
 
+	if (update_wd && o->in_core) {
+		/* D/F conflict files in the way go, like in make_room_for_path() */
+		int i;
+		for (i = 0; i < o->df_conflict_file_set.nr; i++) {
+			const char *df_path = o->df_conflict_file_set.items[i].string;
+			if (!prefixcmp(path, df_path) &&
+			    path[strlen(df_path)] == '/')
+				record_in_core_file(o, NULL, 0, df_path);
+		}
+		record_in_core_file(o, sha, mode, path);
+		update_wd = 0;
+	}
+
 	if (update_wd) {
 		enum object_type type;
 		void *buf;
@@ -1019,7 +1097,7 @@ static void handle_change_delete(struct merge_options *o,
 				 const char *change, const char *change_past)
 {
 	char *renamed = NULL;
-	if (dir_in_way(path, !o->call_depth)) {
+	if (dir_in_way(path, use_working_tree(o))) {
 		renamed = unique_path(o, path, a_sha ? o->branch1 : o->branch2);
 	}
 
@@ -1137,7 +1215,7 @@ static void handle_file(struct merge_options *o,
 		remove_file(o, 0, rename->path, 0);
 		dst_name = unique_path(o, rename->path, cur_branch);
 	} else {
-		if (dir_in_way(rename->path, !o->call_depth)) {
+		if (dir_in_way(rename->path, use_working_tree(o))) {
 			dst_name = unique_path(o, rename->path, cur_branch);
 			output(o, 1, "%s is a directory in %s adding as %s instead",
 			       rename->path, other_branch, dst_name);
@@ -1226,8 +1304,8 @@ static void conflict_rename_rename_2to1(struct merge_options *o,
 	       a->path, c1->path, ci->branch1,
 	       b->path, c2->path, ci->branch2);
 
-	remove_file(o, 1, a->path, would_lose_untracked(a->path));
-	remove_file(o, 1, b->path, would_lose_untracked(b->path));
+	remove_file(o, 1, a->path, would_lose_untracked(o, a->path));
+	remove_file(o, 1, b->path, would_lose_untracked(o, b->path));
 
 	mfi_c1 = merge_file_special_markers(o, a, c1, &ci->ren1_other,
 					    o->branch1, c1->path,
@@ -1607,7 +1685,7 @@ static int merge_content(struct merge_options *o,
 			 o->branch2 == rename_conflict_info->branch1) ?
 			pair1->two->path : pair1->one->path;
 
-		if (dir_in_way(path, !o->call_depth))
+		if (dir_in_way(path, use_working_tree(o)))
 			df_conflict_remains = 1;
 	}
 	mfi = merge_file_special_markers(o, &one, &a, &b,
@@ -1627,7 +1705,7 @@ static int merge_content(struct merge_options *o,
 		path_renamed_outside_HEAD = !path2 || !strcmp(path, path2);
 		if (!path_renamed_outside_HEAD) {
 			add_cacheinfo(mfi.mode, mfi.sha, path,
-				      0, (!o->call_depth), 0);
+				      0, use_working_tree(o), 0);
 			return mfi.clean;
 		}
 	} else
@@ -1759,7 +1837,7 @@ static int process_entry(struct merge_options *o,
 			sha = b_sha;
 			conf = "directory/file";
 		}
-		if (dir_in_way(path, !o->call_depth)) {
+		if (dir_in_way(path, use_working_tree(o))) {
 			char *new_path = unique_path(o, path, add_branch);
 			clean_merge = 0;
 			output(o, 1, "CONFLICT (%s): There is a directory with name %s in %s. "
@@ -1813,7 +1891,7 @@ int merge_trees(struct merge_options *o,
 		return 1;
 	}
 
-	code = git_merge_trees(o->call_depth, common, head, merge);
+	code = git_merge_trees(o->call_depth || o->in_core, common, head, merge);
 
 	if (code != 0) {
 		if (show(o, 4) || o->call_depth)
@@ -1828,9 +1906,8 @@ int merge_trees(struct merge_options *o,
 		struct string_list *entries, *re_head, *re_merge;
 		int i;
 		string_list_clear(&o->current_file_set, 1);
-		string_list_clear(&o->current_directory_set, 1);
-		get_files_dirs(o, head);
-		get_files_dirs(o, merge);
+		o->unique_path_trees[0] = head;
+		o->unique_path_trees[1] = merge;
 
 		entries = get_unmerged();
 		record_df_conflict_files(o, entries);
@@ -1861,6 +1938,8 @@ int merge_trees(struct merge_options *o,
 
 	if (o->call_depth)
 		*result = write_tree_from_memory(o);
+	else if (o->in_core)
+		*result = write_in_core_tree(o);
 
 	return clean;
 }
@@ -1943,14 +2022,14 @@ int merge_recursive(struct merge_options *o,
 	}
 
 	discard_cache();
-	if (!o->call_depth)
+	if (!o->call_depth && !o->in_core)
 		read_cache();
 
 	o->ancestor = "merged common ancestors";
 	clean = merge_trees(o, h1->tree, h2->tree, merged_common_ancestors->tree,
 			    &mrtree);
 
-	if (o->call_depth) {
+	if (o->call_depth || o->in_core) {
 		*result = make_virtual_commit(mrtree, "merged tree");
 		commit_list_insert(h1, &(*result)->parents);
 		commit_list_insert(h2, &(*result)->parents->next);
@@ -1962,6 +2041,24 @@ int merge_recursive(struct merge_options *o,
 	return clean;
 }
 
+int merge_recursive_in_core(struct merge_options *o,
+			    struct commit *h1,
+			    struct commit *h2,
+			    struct commit_list *ca,
+			    struct tree **result)
+{
+	struct commit *merged;
+	int clean;
+
+	o->in_core = 1;
+	o->in_core_files.strdup_strings = 1;
+	discard_cache();
+	clean = merge_recursive(o, h1, h2, ca, &merged);
+	*result = merged->tree;
+	string_list_clear(&o->in_core_files, 1);
+	return clean;
+}
+
 static struct commit *get_ref(const unsigned char *sha1, const char *name)
 {
 	struct object *object;
@@ -2028,6 +2125,14 @@ static int merge_recursive_config(const char *var, const char *value, void *cb)
 		o->merge_rename_limit = git_config_int(var, value);
 		return 0;
 	}
+	switch (diff_rename_config(var, value)) {
+	case 0:
+		break;
+	case -1:
+		return -1;
+	default:
+		return 0;
+	}
 	return git_xmerge_config(var, value, cb);
 }
 
@@ -2048,8 +2153,6 @@ void init_merge_options(struct merge_options *o)
 	strbuf_init(&o->obuf, 0);
 	memset(&o->current_file_set, 0, sizeof(struct string_list));
 	o->current_file_set.strdup_strings = 1;
-	memset(&o->current_directory_set, 0, sizeof(struct string_list));
-	o->current_directory_set.strdup_strings = 1;
 	memset(&o->df_conflict_file_set, 0, sizeof(struct string_list));
 	o->df_conflict_file_set.strdup_strings = 1;
 }
@@ -13,8 +13,9 @@ struct merge_options {
 		MERGE_RECURSIVE_THEIRS
 	} recursive_variant;
 	const char *subtree_shift;
-	unsigned buffer_output : 1;
+	unsigned buffer_output : 2; /* 1: until the end, 2: left to the caller */
 	unsigned renormalize : 1;
+	unsigned in_core : 1;
 	long xdl_opts;
 	int verbosity;
 	int diff_rename_limit;
@@ -25,8 +26,9 @@ struct merge_options {
 	int call_depth;
 	struct strbuf obuf;
 	struct string_list current_file_set;
-	struct string_list current_directory_set;
+	struct tree *unique_path_trees[2];
 	struct string_list df_conflict_file_set;
+	struct string_list in_core_files;
 };
 
 /* merge_trees() but with recursive ancestor consolidation */
@@ -54,6 +56,20 @@ int merge_recursive_generic(struct merge_options *o,
 			    const unsigned char **ca,
 			    struct commit **result);
 
+/*
+ * merge_recursive() that neither reads nor updates the working tree and
+ * the index file, so that it also works in a bare repository.  The
+ * merged tree is written to the object database; conflicted paths get
+ * what a normal merge would have left in the working tree (e.g. the
+ * contents with conflict markers).  The unmerged entries are left in
+ * the in-core index for the caller to inspect.
+ */
+int merge_recursive_in_core(struct merge_options *o,
+			    struct commit *h1,
+			    struct commit *h2,
+			    struct commit_list *ancestors,
+			    struct tree **result);
+
 void init_merge_options(struct merge_options *o);
 struct tree *write_tree_from_memory(struct merge_options *o);
 
@@ -41,6 +41,36 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
+/*
+ * Objects unpacked but not yet hashed; they are hashed together
+ * once SHA1_BATCH_MAX of them, or VERIFY_BATCH_BYTES worth, are
+ * queued.
+ */
+#define VERIFY_BATCH_BYTES (8 * 1024 * 1024)
+
+struct verify_batch {
+	struct sha1_batch_entry entry[SHA1_BATCH_MAX];
+	struct idx_entry *idx[SHA1_BATCH_MAX];
+	int nr;
+	unsigned long size;
+};
+
+static int flush_verify_batch(struct packed_git *p, struct verify_batch *b)
+{
+	int i, err = 0;
+
+	git_SHA1_Batch(b->entry, b->nr);
+	for (i = 0; i < b->nr; i++) {
+		if (!err && hashcmp(b->entry[i].sha1, b->idx[i]->sha1))
+			err = error("packed %s from %s is corrupt",
+				    sha1_to_hex(b->idx[i]->sha1), p->pack_name);
+		free((void *)b->entry[i].buf);
+	}
+	b->nr = 0;
+	b->size = 0;
+	return err;
+}
+
 static int verify_packfile(struct packed_git *p,
 		struct pack_window **w_curs)
 {
@@ -52,6 +82,7 @@ static int verify_packfile(struct packed_git *p,
 	uint32_t nr_objects, i;
 	int err = 0;
 	struct idx_entry *entries;
+	struct verify_batch batch;
 
 	/* Note that the pack header checks are actually performed by
 	 * use_pack when it first opens the pack file.  If anything
@@ -97,6 +128,8 @@ static int verify_packfile(struct packed_git *p,
 	}
 	qsort(entries, nr_objects, sizeof(*entries), compare_entries);
 
+	batch.nr = 0;
+	batch.size = 0;
 	for (i = 0; i < nr_objects; i++) {
 		void *data;
 		enum object_type type;
@@ -119,14 +152,19 @@ static int verify_packfile(struct packed_git *p,
 				    (uintmax_t)entries[i].offset);
 			break;
 		}
-		if (check_sha1_signature(entries[i].sha1, data, size, typename(type))) {
-			err = error("packed %s from %s is corrupt",
-				    sha1_to_hex(entries[i].sha1), p->pack_name);
-			free(data);
-			break;
+		prepare_sha1_batch_entry(&batch.entry[batch.nr], data, size,
+					 typename(type));
+		batch.idx[batch.nr++] = &entries[i];
+		batch.size += size;
+		if (batch.nr == SHA1_BATCH_MAX || batch.size >= VERIFY_BATCH_BYTES) {
+			if (flush_verify_batch(p, &batch)) {
+				err = -1;
+				break;
+			}
 		}
-		free(data);
 	}
+	if (batch.nr && flush_verify_batch(p, &batch))
+		err = -1;
 	free(entries);
 
 	return err;
@@ -78,6 +78,30 @@ ssize_t safe_write(int fd, const void *buf, ssize_t n)
 	return nn;
 }
 
+/*
+ * Like safe_write(), but for a vector; iov is used as scratch space
+ * to step over whatever a short write has already sent.
+ */
+void safe_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt) {
+		ssize_t ret = xwritev(fd, iov, iovcnt);
+		if (ret < 0)
+			die_errno("write error");
+		if (!ret)
+			die("write error (disk full?)");
+		while (iovcnt && iov->iov_len <= ret) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+}
+
 /*
  * If we buffered things up above (we don't, but we should),
  * we'd flush it here
@@ -12,8 +12,41 @@
 #include "commit.h"
 #include "blob.h"
 #include "resolve-undo.h"
+#include "mem-pool.h"
+#include "thread-utils.h"
+#include "varint.h"
 
-static struct cache_entry *refresh_cache_entry(struct cache_entry *ce, int really);
+static struct cache_entry *refresh_cache_ent(struct index_state *istate,
+					     struct cache_entry *ce,
+					     unsigned int options, int *err);
+
+static struct mem_pool *find_mem_pool(struct index_state *istate)
+{
+	if (!istate->ce_mem_pool)
+		mem_pool_init(&istate->ce_mem_pool, 0);
+	return istate->ce_mem_pool;
+}
+
+struct cache_entry *make_empty_cache_entry(struct index_state *istate, size_t len)
+{
+	struct cache_entry *ce;
+
+	ce = mem_pool_calloc(find_mem_pool(istate), 1, cache_entry_size(len));
+	ce->mem_pool_allocated = 1;
+	return ce;
+}
+
+struct cache_entry *make_empty_transient_cache_entry(size_t len)
+{
+	return xcalloc(1, cache_entry_size(len));
+}
+
+void discard_cache_entry(struct cache_entry *ce)
+{
+	if (ce && ce->mem_pool_allocated)
+		return;
+	free(ce);
+}
 
 /* Index extensions.
  *
@@ -27,6 +60,19 @@ static struct cache_entry *refresh_cache_entry(struct cache_entry *ce, int reall
 #define CACHE_EXT(s) ( (s[0]<<24)|(s[1]<<16)|(s[2]<<8)|(s[3]) )
 #define CACHE_EXT_TREE 0x54524545	/* "TREE" */
 #define CACHE_EXT_RESOLVE_UNDO 0x52455543 /* "REUC" */
+#define CACHE_EXT_END_OF_INDEX_ENTRIES 0x454F4945 /* "EOIE" */
+#define CACHE_EXT_INDEX_ENTRY_OFFSET_TABLE 0x49454F54 /* "IEOT" */
+
+/* The EOIE extension sits right before the trailing SHA-1 */
+#define EOIE_SIZE (4 + 20)
+#define EOIE_SIZE_WITH_HEADER (4 + 4 + EOIE_SIZE)
+
+/*
+ * The offset table has one block for every IEOT_BLOCK_ENTRIES entries,
+ * and is only written for indexes that have at least two blocks.
+ */
+#define IEOT_VERSION 1
+#define IEOT_BLOCK_ENTRIES 10000
 
 struct index_state the_index;
 
@@ -50,7 +96,7 @@ void rename_index_entry_at(struct index_state *istate, int nr, const char *new_n
 	struct cache_entry *old = istate->cache[nr], *new;
 	int namelen = strlen(new_name);
 
-	new = xmalloc(cache_entry_size(namelen));
+	new = make_empty_cache_entry(istate, namelen);
 	copy_cache_entry(new, old);
 	new->ce_flags &= ~(CE_STATE_MASK | CE_NAMEMASK);
 	new->ce_flags |= (namelen >= CE_NAMEMASK ? CE_NAMEMASK : namelen);
@@ -541,7 +587,9 @@ static int different_name(struct cache_entry *ce, struct cache_entry *alias)
  * So we use the CE_ADDED flag to verify that the alias was an old
  * one before we accept it as
  */
-static struct cache_entry *create_alias_ce(struct cache_entry *ce, struct cache_entry *alias)
+static struct cache_entry *create_alias_ce(struct index_state *istate,
+					   struct cache_entry *ce,
+					   struct cache_entry *alias)
 {
 	int len;
 	struct cache_entry *new;
@@ -551,10 +599,10 @@ static struct cache_entry *create_alias_ce(struct cache_entry *ce, struct cache_
 
 	/* Ok, create the new entry using the name of the existing alias */
 	len = ce_namelen(alias);
-	new = xcalloc(1, cache_entry_size(len));
+	new = make_empty_cache_entry(istate, len);
 	memcpy(new->name, alias->name, len);
 	copy_cache_entry(new, ce);
-	free(ce);
+	discard_cache_entry(ce);
 	return new;
 }
 
@@ -568,7 +616,7 @@ static void record_intent_to_add(struct cache_entry *ce)
 
 int add_to_index(struct index_state *istate, const char *path, struct stat *st, int flags)
 {
-	int size, namelen, was_same;
+	int namelen, was_same;
 	mode_t st_mode = st->st_mode;
 	struct cache_entry *ce, *alias;
 	unsigned ce_option = CE_MATCH_IGNORE_VALID|CE_MATCH_IGNORE_SKIP_WORKTREE|CE_MATCH_RACY_IS_DIRTY;
@@ -586,8 +634,7 @@ int add_to_index(struct index_state *istate, const char *path, struct stat *st,
 		while (namelen && path[namelen-1] == '/')
 			namelen--;
 	}
-	size = cache_entry_size(namelen);
-	ce = xcalloc(1, size);
+	ce = make_empty_cache_entry(istate, namelen);
 	memcpy(ce->name, path, namelen);
 	ce->ce_flags = namelen;
 	if (!intent_only)
@@ -634,7 +681,7 @@ int add_to_index(struct index_state *istate, const char *path, struct stat *st,
 	alias = index_name_exists(istate, ce->name, ce_namelen(ce), ignore_case);
 	if (alias && !ce_stage(alias) && !ie_match_stat(istate, alias, st, ce_option)) {
 		/* Nothing changed, really */
-		free(ce);
+		discard_cache_entry(ce);
 		if (!S_ISGITLINK(alias->ce_mode))
 			ce_mark_uptodate(alias);
 		alias->ce_flags |= CE_ADDED;
@@ -647,7 +694,7 @@ int add_to_index(struct index_state *istate, const char *path, struct stat *st,
 		record_intent_to_add(ce);
 
 	if (ignore_case && alias && different_name(ce, alias))
-		ce = create_alias_ce(ce, alias);
+		ce = create_alias_ce(istate, ce, alias);
 	ce->ce_flags |= CE_ADDED;
 
 	/* It was suspected to be racily clean, but it turns out to be Ok */
@@ -673,11 +720,11 @@ int add_file_to_index(struct index_state *istate, const char *path, int flags)
 	return add_to_index(istate, path, &st, flags);
 }
 
-struct cache_entry *make_cache_entry(unsigned int mode,
-		const unsigned char *sha1, const char *path, int stage,
-		int refresh)
+struct cache_entry *make_cache_entry(struct index_state *istate,
+		unsigned int mode, const unsigned char *sha1,
+		const char *path, int stage, int refresh)
 {
-	int size, len;
+	int len;
 	struct cache_entry *ce;
 
 	if (!verify_path(path)) {
@@ -686,8 +733,7 @@ struct cache_entry *make_cache_entry(unsigned int mode,
 	}
 
 	len = strlen(path);
-	size = cache_entry_size(len);
-	ce = xcalloc(1, size);
+	ce = make_empty_cache_entry(istate, len);
 
 	hashcpy(ce->sha1, sha1);
 	memcpy(ce->name, path, len);
@@ -695,7 +741,29 @@ struct cache_entry *make_cache_entry(unsigned int mode,
 	ce->ce_mode = create_ce_mode(mode);
 
 	if (refresh)
-		return refresh_cache_entry(ce, 0);
+		return refresh_cache_ent(istate, ce, 0, NULL);
+
+	return ce;
+}
+
+struct cache_entry *make_transient_cache_entry(unsigned int mode,
+		const unsigned char *sha1, const char *path, int stage)
+{
+	int len;
+	struct cache_entry *ce;
+
+	if (!verify_path(path)) {
+		error("Invalid path '%s'", path);
+		return NULL;
+	}
+
+	len = strlen(path);
+	ce = make_empty_transient_cache_entry(len);
+
+	hashcpy(ce->sha1, sha1);
+	memcpy(ce->name, path, len);
+	ce->ce_flags = create_ce_flags(len, stage);
+	ce->ce_mode = create_ce_mode(mode);
 
 	return ce;
 }
@@ -1063,8 +1131,9 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 	}
 
 	size = ce_size(ce);
-	updated = xmalloc(size);
+	updated = mem_pool_alloc(find_mem_pool(istate), size);
 	memcpy(updated, ce, size);
+	updated->mem_pool_allocated = 1;
 	fill_stat_cache_info(updated, &st);
 	/*
 	 * If ignore_valid is not set, we should leave CE_VALID bit
@@ -1155,20 +1224,23 @@ int refresh_index(struct index_state *istate, unsigned int flags, const char **p
 	return has_errors;
 }
 
-static struct cache_entry *refresh_cache_entry(struct cache_entry *ce, int really)
+static int verify_hdr_version(struct cache_header *hdr)
 {
-	return refresh_cache_ent(&the_index, ce, really, NULL);
+	unsigned int hdr_version;
+
+	if (hdr->hdr_signature != htonl(CACHE_SIGNATURE))
+		return error("bad signature");
+	hdr_version = ntohl(hdr->hdr_version);
+	if (hdr_version < INDEX_FORMAT_LB || INDEX_FORMAT_UB < hdr_version)
+		return error("bad index version %d", hdr_version);
+	return 0;
 }
 
-static int verify_hdr(struct cache_header *hdr, unsigned long size)
+static int verify_hdr_checksum(struct cache_header *hdr, unsigned long size)
 {
 	git_SHA_CTX c;
 	unsigned char sha1[20];
 
-	if (hdr->hdr_signature != htonl(CACHE_SIGNATURE))
-		return error("bad signature");
-	if (hdr->hdr_version != htonl(2) && hdr->hdr_version != htonl(3))
-		return error("bad index version");
 	git_SHA1_Init(&c);
 	git_SHA1_Update(&c, hdr, size - 20);
 	git_SHA1_Final(sha1, &c);
@@ -1187,6 +1259,10 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_RESOLVE_UNDO:
 		istate->resolve_undo = resolve_undo_read(data, sz);
 		break;
+	case CACHE_EXT_END_OF_INDEX_ENTRIES:
+	case CACHE_EXT_INDEX_ENTRY_OFFSET_TABLE:
+		/* only used by read_index_from() to find its way around */
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error("index uses %.4s extension, which we do not understand",
@@ -1202,29 +1278,29 @@ int read_index(struct index_state *istate)
 	return read_index_from(istate, get_index_file());
 }
 
-static void convert_from_disk(struct ondisk_cache_entry *ondisk, struct cache_entry *ce)
+/*
+ * Make a cache entry out of the on-disk one, and tell how many bytes
+ * it took on disk.  In an index of version 4 the path is stored as
+ * the number of bytes to drop from the end of the previous path,
+ * followed by what to append to the rest; previous_ce is NULL for the
+ * first entry of a block, whose path is stored in full.
+ */
+static struct cache_entry *create_from_disk(struct mem_pool *pool,
+					    unsigned int version,
+					    struct ondisk_cache_entry *ondisk,
+					    unsigned long *ent_size,
+					    const struct cache_entry *previous_ce)
 {
-	size_t len;
+	struct cache_entry *ce;
+	size_t len, copy_len = 0;
 	const char *name;
+	unsigned int flags;
 
-	ce->ce_ctime.sec = ntohl(ondisk->ctime.sec);
-	ce->ce_mtime.sec = ntohl(ondisk->mtime.sec);
-	ce->ce_ctime.nsec = ntohl(ondisk->ctime.nsec);
-	ce->ce_mtime.nsec = ntohl(ondisk->mtime.nsec);
-	ce->ce_dev   = ntohl(ondisk->dev);
-	ce->ce_ino   = ntohl(ondisk->ino);
-	ce->ce_mode  = ntohl(ondisk->mode);
-	ce->ce_uid   = ntohl(ondisk->uid);
-	ce->ce_gid   = ntohl(ondisk->gid);
-	ce->ce_size  = ntohl(ondisk->size);
 	/* On-disk flags are just 16 bits */
-	ce->ce_flags = ntohs(ondisk->flags);
+	flags = ntohs(ondisk->flags);
+	len = flags & CE_NAMEMASK;
 
-	hashcpy(ce->sha1, ondisk->sha1);
-
-	len = ce->ce_flags & CE_NAMEMASK;
-
-	if (ce->ce_flags & CE_EXTENDED) {
+	if (flags & CE_EXTENDED) {
 		struct ondisk_cache_entry_extended *ondisk2;
 		int extended_flags;
 		ondisk2 = (struct ondisk_cache_entry_extended *)ondisk;
@@ -1232,19 +1308,62 @@ static void convert_from_disk(struct ondisk_cache_entry *ondisk, struct cache_en
 		/* We do not yet understand any bit out of CE_EXTENDED_FLAGS */
 		if (extended_flags & ~CE_EXTENDED_FLAGS)
 			die("Unknown index entry format %08x", extended_flags);
-		ce->ce_flags |= extended_flags;
+		flags |= extended_flags;
 		name = ondisk2->name;
 	}
 	else
 		name = ondisk->name;
 
-	if (len == CE_NAMEMASK)
+	if (version == 4) {
+		const unsigned char *cp = (const unsigned char *)name;
+		size_t strip_len;
+
+		strip_len = decode_varint(&cp);
+		if (previous_ce) {
+			if (ce_namelen(previous_ce) < strip_len)
+				die("malformed name field in the index, near path '%s'",
+				    previous_ce->name);
+			copy_len = ce_namelen(previous_ce) - strip_len;
+		}
+		name = (const char *)cp;
+		len = copy_len + strlen(name);
+		/* the length in the flags is that of the whole path */
+		flags = (flags & ~CE_NAMEMASK) |
+			(len < CE_NAMEMASK ? len : CE_NAMEMASK);
+	} else if (len == CE_NAMEMASK) {
 		len = strlen(name);
+	}
+
+	ce = mem_pool_alloc(pool, cache_entry_size(len));
+	ce->ce_ctime.sec = ntohl(ondisk->ctime.sec);
+	ce->ce_mtime.sec = ntohl(ondisk->mtime.sec);
+	ce->ce_ctime.nsec = ntohl(ondisk->ctime.nsec);
+	ce->ce_mtime.nsec = ntohl(ondisk->mtime.nsec);
+	ce->ce_dev   = ntohl(ondisk->dev);
+	ce->ce_ino   = ntohl(ondisk->ino);
+	ce->ce_mode  = ntohl(ondisk->mode);
+	ce->ce_uid   = ntohl(ondisk->uid);
+	ce->ce_gid   = ntohl(ondisk->gid);
+	ce->ce_size  = ntohl(ondisk->size);
+	ce->ce_flags = flags;
+	ce->mem_pool_allocated = 1;
+
+	hashcpy(ce->sha1, ondisk->sha1);
+
 	/*
 	 * NEEDSWORK: If the original index is crafted, this copy could
 	 * go unchecked.
 	 */
-	memcpy(ce->name, name, len + 1);
+	if (version == 4) {
+		if (copy_len)
+			memcpy(ce->name, previous_ce->name, copy_len);
+		memcpy(ce->name + copy_len, name, len - copy_len + 1);
+		*ent_size = (name - (const char *)ondisk) + len - copy_len + 1;
+	} else {
+		memcpy(ce->name, name, len + 1);
+		*ent_size = ondisk_ce_size(ce);
+	}
+	return ce;
 }
 
 static inline size_t estimate_cache_size(size_t ondisk_size, unsigned int entries)
@@ -1261,12 +1380,367 @@ static inline size_t estimate_cache_size(size_t ondisk_size, unsigned int entrie
 	return ondisk_size + entries*per_entry;
 }
 
+/*
+ * Convert the nr entries found at src_offset in the mapped index into
+ * istate->cache[first] and on, allocating them from pool.  Returns the
+ * offset just past the last of them.
+ */
+static unsigned long load_cache_entries(struct index_state *istate,
+					struct mem_pool *pool, int first, int nr,
+					const char *mmap, unsigned long src_offset)
+{
+	struct cache_entry *previous_ce = NULL;
+	int i;
+
+	for (i = first; i < first + nr; i++) {
+		struct ondisk_cache_entry *disk_ce;
+		struct cache_entry *ce;
+		unsigned long consumed;
+
+		disk_ce = (struct ondisk_cache_entry *)(mmap + src_offset);
+		ce = create_from_disk(pool, istate->version, disk_ce, &consumed,
+				      previous_ce);
+		set_index_entry(istate, i, ce);
+
+		src_offset += consumed;
+		previous_ce = ce;
+	}
+	return src_offset;
+}
+
+static int read_index_extensions(struct index_state *istate, const char *mmap,
+				 size_t mmap_size, unsigned long src_offset)
+{
+	while (src_offset <= mmap_size - 20 - 8) {
+		/* After an array of active_nr index entries,
+		 * there can be arbitrary number of extended
+		 * sections, each of which is prefixed with
+		 * extension name (4-byte) and section length
+		 * in 4-byte network byte order.
+		 */
+		uint32_t extsize;
+		memcpy(&extsize, mmap + src_offset + 4, 4);
+		extsize = ntohl(extsize);
+		if (read_index_extension(istate, mmap + src_offset,
+					 (void *)(mmap + src_offset + 8),
+					 extsize) < 0)
+			return -1;
+		src_offset += 8;
+		src_offset += extsize;
+	}
+	return 0;
+}
+
+#ifndef NO_PTHREADS
+/*
+ * Returns the offset of the first extension as recorded by the EOIE
+ * extension, or 0 if there is no usable EOIE extension.
+ */
+static unsigned long read_eoie_extension(const char *mmap, size_t mmap_size)
+{
+	const char *eoie, *index;
+	unsigned long offset, src_offset, eoie_offset;
+	uint32_t extsize;
+	unsigned char sha1[20];
+	git_SHA_CTX c;
+
+	if (mmap_size < sizeof(struct cache_header) + EOIE_SIZE_WITH_HEADER + 20)
+		return 0;
+	eoie_offset = mmap_size - EOIE_SIZE_WITH_HEADER - 20;
+	eoie = mmap + eoie_offset;
+	if (CACHE_EXT(eoie) != CACHE_EXT_END_OF_INDEX_ENTRIES)
+		return 0;
+	memcpy(&extsize, eoie + 4, 4);
+	if (ntohl(extsize) != EOIE_SIZE)
+		return 0;
+	index = eoie + 8;
+
+	memcpy(&extsize, index, 4);
+	offset = ntohl(extsize);
+	if (offset < sizeof(struct cache_header) || offset > eoie_offset)
+		return 0;
+	index += 4;
+
+	/*
+	 * The extension headers between the end of the entries and the
+	 * EOIE extension must chain up to it exactly, and hash to what
+	 * was recorded.
+	 */
+	git_SHA1_Init(&c);
+	src_offset = offset;
+	while (src_offset + 8 <= eoie_offset) {
+		git_SHA1_Update(&c, mmap + src_offset, 8);
+		memcpy(&extsize, mmap + src_offset + 4, 4);
+		src_offset += 8;
+		src_offset += ntohl(extsize);
+	}
+	if (src_offset != eoie_offset)
+		return 0;
+	git_SHA1_Final(sha1, &c);
+	if (hashcmp(sha1, (const unsigned char *)index))
+		return 0;
+	return offset;
+}
+
+struct index_entry_offset {
+	unsigned long offset;
+	int nr;
+};
+
+struct index_entry_offset_table {
+	int nr;
+	struct index_entry_offset entries[FLEX_ARRAY];
+};
+
+/*
+ * Find the IEOT extension among the ones starting at src_offset,
+ * and return its table if it accounts for all the entries between
+ * the header and src_offset, or NULL.
+ */
+static struct index_entry_offset_table *read_ieot_extension(const char *mmap,
+							    size_t mmap_size,
+							    unsigned long src_offset,
+							    unsigned int cache_nr)
+{
+	struct index_entry_offset_table *ieot;
+	unsigned long entries_end = src_offset, expect;
+	unsigned int total;
+	const char *index = NULL;
+	uint32_t extsize = 0, val;
+	int i, nr;
+
+	while (src_offset <= mmap_size - 20 - 8) {
+		memcpy(&extsize, mmap + src_offset + 4, 4);
+		extsize = ntohl(extsize);
+		if (CACHE_EXT((mmap + src_offset)) == CACHE_EXT_INDEX_ENTRY_OFFSET_TABLE) {
+			index = mmap + src_offset + 8;
+			break;
+		}
+		src_offset += 8;
+		src_offset += extsize;
+	}
+	if (!index || extsize < 4 || (extsize - 4) % 8)
+		return NULL;
+	memcpy(&val, index, 4);
+	if (ntohl(val) != IEOT_VERSION)
+		return NULL;
+	index += 4;
+
+	nr = (extsize - 4) / 8;
+	if (!nr)
+		return NULL;
+	ieot = xmalloc(sizeof(*ieot) + nr * sizeof(struct index_entry_offset));
+	ieot->nr = nr;
+	expect = sizeof(struct cache_header);
+	total = 0;
+	for (i = 0; i < nr; i++) {
+		struct index_entry_offset *e = &ieot->entries[i];
+
+		memcpy(&val, index, 4);
+		e->offset = ntohl(val);
+		memcpy(&val, index + 4, 4);
+		e->nr = ntohl(val);
+		index += 8;
+
+		if (i ? e->offset < expect : e->offset != expect)
+			break;
+		if (e->offset >= entries_end || e->nr <= 0 ||
+		    cache_nr - total < e->nr)
+			break;
+		total += e->nr;
+		/* each entry takes at least this many bytes */
+		expect = e->offset + e->nr * ondisk_cache_entry_size(1);
+	}
+	if (i < nr || total != cache_nr) {
+		free(ieot);
+		return NULL;
+	}
+	return ieot;
+}
+
+struct checksum_thread_data {
+	pthread_t pthread;
+	struct cache_header *hdr;
+	unsigned long size;
+	int ret;
+};
+
+static void *checksum_thread(void *_data)
+{
+	struct checksum_thread_data *p = _data;
+
+	p->ret = verify_hdr_checksum(p->hdr, p->size);
+	return NULL;
+}
+
+struct extension_thread_data {
+	pthread_t pthread;
+	struct index_state *istate;
+	const char *mmap;
+	size_t mmap_size;
+	unsigned long offset;
+	int ret;
+};
+
+static void *extension_thread(void *_data)
+{
+	struct extension_thread_data *p = _data;
+
+	p->ret = read_index_extensions(p->istate, p->mmap, p->mmap_size, p->offset);
+	return NULL;
+}
+
+struct load_entries_thread_data {
+	pthread_t pthread;
+	struct index_state *istate;
+	struct mem_pool *ce_mem_pool;
+	const char *mmap;
+	struct index_entry_offset_table *ieot;
+	int block, nr_blocks, first;
+	unsigned long entries_end;
+	int ret;
+};
+
+static void *load_entries_thread(void *_data)
+{
+	struct load_entries_thread_data *p = _data;
+	struct index_entry_offset_table *ieot = p->ieot;
+	int i, first = p->first;
+
+	for (i = p->block; i < p->block + p->nr_blocks; i++) {
+		unsigned long end;
+
+		end = load_cache_entries(p->istate, p->ce_mem_pool, first,
+					 ieot->entries[i].nr, p->mmap,
+					 ieot->entries[i].offset);
+		first += ieot->entries[i].nr;
+		if (end != (i + 1 < ieot->nr ?
+			    ieot->entries[i + 1].offset : p->entries_end))
+			p->ret = -1;
+	}
+	return NULL;
+}
+
+static int load_cache_entries_threaded(struct index_state *istate,
+				       const char *mmap, unsigned long entries_end,
+				       struct index_entry_offset_table *ieot,
+				       int nr_threads)
+{
+	struct load_entries_thread_data *data;
+	int i, block, first, blocks_per_thread, ret = 0;
+
+	if (nr_threads > ieot->nr)
+		nr_threads = ieot->nr;
+	blocks_per_thread = DIV_ROUND_UP(ieot->nr, nr_threads);
+	nr_threads = DIV_ROUND_UP(ieot->nr, blocks_per_thread);
+	data = xcalloc(nr_threads, sizeof(*data));
+
+	block = first = 0;
+	for (i = 0; i < nr_threads; i++) {
+		struct load_entries_thread_data *p = data + i;
+		unsigned long end;
+		int j, nr = 0;
+
+		p->istate = istate;
+		p->mmap = mmap;
+		p->ieot = ieot;
+		p->entries_end = entries_end;
+		p->block = block;
+		p->nr_blocks = blocks_per_thread;
+		if (p->nr_blocks > ieot->nr - block)
+			p->nr_blocks = ieot->nr - block;
+		p->first = first;
+
+		for (j = block; j < block + p->nr_blocks; j++)
+			nr += ieot->entries[j].nr;
+		block += p->nr_blocks;
+		first += nr;
+		end = block < ieot->nr ? ieot->entries[block].offset : entries_end;
+		mem_pool_init(&p->ce_mem_pool,
+			      estimate_cache_size(end - ieot->entries[p->block].offset, nr));
+
+		if (pthread_create(&p->pthread, NULL, load_entries_thread, p))
+			die("unable to create index loading thread");
+	}
+
+	mem_pool_init(&istate->ce_mem_pool, 0);
+	for (i = 0; i < nr_threads; i++) {
+		struct load_entries_thread_data *p = data + i;
+
+		if (pthread_join(p->pthread, NULL))
+			die("unable to join index loading thread");
+		if (p->ret < 0)
+			ret = error("index entries do not match the offset table");
+		mem_pool_combine(istate->ce_mem_pool, p->ce_mem_pool);
+		mem_pool_discard(p->ce_mem_pool);
+	}
+	free(data);
+	return ret;
+}
+
+/*
+ * Read the entries and extensions of an index that records where its
+ * extensions begin, verifying its checksum, parsing the extensions
+ * and converting the entries on separate threads.  Returns 0 if the
+ * index records no such thing and has to be read serially, 1 when it
+ * has been read, and -1 if it is corrupt.
+ */
+static int read_index_threaded(struct index_state *istate, const char *mmap,
+			       size_t mmap_size, int nr_threads)
+{
+	struct checksum_thread_data checksum;
+	struct extension_thread_data ext;
+	struct index_entry_offset_table *ieot;
+	unsigned long extension_offset;
+	int ret = 0;
+
+	extension_offset = read_eoie_extension(mmap, mmap_size);
+	if (!extension_offset)
+		return 0;
+
+	checksum.hdr = (struct cache_header *)mmap;
+	checksum.size = mmap_size;
+	if (pthread_create(&checksum.pthread, NULL, checksum_thread, &checksum))
+		die("unable to create index checksum thread");
+
+	ext.istate = istate;
+	ext.mmap = mmap;
+	ext.mmap_size = mmap_size;
+	ext.offset = extension_offset;
+	if (pthread_create(&ext.pthread, NULL, extension_thread, &ext))
+		die("unable to create index extension thread");
+
+	ieot = read_ieot_extension(mmap, mmap_size, extension_offset,
+				   istate->cache_nr);
+	if (ieot) {
+		ret = load_cache_entries_threaded(istate, mmap, extension_offset,
+						  ieot, nr_threads);
+		free(ieot);
+	} else {
+		mem_pool_init(&istate->ce_mem_pool,
+			      estimate_cache_size(extension_offset, istate->cache_nr));
+		if (load_cache_entries(istate, istate->ce_mem_pool, 0,
+				       istate->cache_nr, mmap,
+				       sizeof(struct cache_header)) != extension_offset)
+			ret = error("index entries do not end where recorded");
+	}
+
+	if (pthread_join(ext.pthread, NULL))
+		die("unable to join index extension thread");
+	if (pthread_join(checksum.pthread, NULL))
+		die("unable to join index checksum thread");
+	if (ret < 0 || ext.ret < 0 || checksum.ret < 0)
+		return -1;
+	return 1;
+}
+#endif
+
 /* remember to discard_cache() before reading a different cache! */
 int read_index_from(struct index_state *istate, const char *path)
 {
-	int fd, i;
+	int fd, nr_threads;
 	struct stat st;
-	unsigned long src_offset, dst_offset;
+	unsigned long src_offset;
 	struct cache_header *hdr;
 	void *mmap;
 	size_t mmap_size;
@@ -1299,57 +1773,51 @@ int read_index_from(struct index_state *istate, const char *path)
 		die_errno("unable to map index file");
 
 	hdr = mmap;
-	if (verify_hdr(hdr, mmap_size) < 0)
+	if (verify_hdr_version(hdr) < 0)
 		goto unmap;
 
+	istate->version = ntohl(hdr->hdr_version);
 	istate->cache_nr = ntohl(hdr->hdr_entries);
 	istate->cache_alloc = alloc_nr(istate->cache_nr);
 	istate->cache = xcalloc(istate->cache_alloc, sizeof(struct cache_entry *));
-
-	/*
-	 * The disk format is actually larger than the in-memory format,
-	 * due to space for nsec etc, so even though the in-memory one
-	 * has room for a few  more flags, we can allocate using the same
-	 * index size
-	 */
-	istate->alloc = xmalloc(estimate_cache_size(mmap_size, istate->cache_nr));
 	istate->initialized = 1;
 
-	src_offset = sizeof(*hdr);
-	dst_offset = 0;
-	for (i = 0; i < istate->cache_nr; i++) {
-		struct ondisk_cache_entry *disk_ce;
-		struct cache_entry *ce;
+	nr_threads = 1;
+#ifndef NO_PTHREADS
+	nr_threads = index_threads ? index_threads : online_cpus();
+	if (nr_threads > 1) {
+		switch (read_index_threaded(istate, mmap, mmap_size, nr_threads)) {
+		case -1:
+			goto unmap;
+		case 0:
+			nr_threads = 1;
+			break;
+		}
+	}
+#endif
 
-		disk_ce = (struct ondisk_cache_entry *)((char *)mmap + src_offset);
-		ce = (struct cache_entry *)((char *)istate->alloc + dst_offset);
-		convert_from_disk(disk_ce, ce);
-		set_index_entry(istate, i, ce);
+	if (nr_threads <= 1) {
+		if (verify_hdr_checksum(hdr, mmap_size) < 0)
+			goto unmap;
 
-		src_offset += ondisk_ce_size(ce);
-		dst_offset += ce_size(ce);
+		/*
+		 * The disk format is actually larger than the in-memory
+		 * format, due to space for nsec etc, so even though the
+		 * in-memory one has room for a few  more flags, a first
+		 * block of the pool of the same size as the index holds
+		 * all the entries
+		 */
+		mem_pool_init(&istate->ce_mem_pool,
+			      estimate_cache_size(mmap_size, istate->cache_nr));
+		src_offset = load_cache_entries(istate, istate->ce_mem_pool,
+						0, istate->cache_nr, mmap,
+						sizeof(*hdr));
+		if (read_index_extensions(istate, mmap, mmap_size, src_offset) < 0)
+			goto unmap;
 	}
 	istate->timestamp.sec = st.st_mtime;
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 
-	while (src_offset <= mmap_size - 20 - 8) {
-		/* After an array of active_nr index entries,
-		 * there can be arbitrary number of extended
-		 * sections, each of which is prefixed with
-		 * extension name (4-byte) and section length
-		 * in 4-byte network byte order.
-		 */
-		uint32_t extsize;
-		memcpy(&extsize, (char *)mmap + src_offset + 4, 4);
-		extsize = ntohl(extsize);
-		if (read_index_extension(istate,
-					 (const char *) mmap + src_offset,
-					 (char *) mmap + src_offset + 8,
-					 extsize) < 0)
-			goto unmap;
-		src_offset += 8;
-		src_offset += extsize;
-	}
 	munmap(mmap, mmap_size);
 	return istate->cache_nr;
 
@@ -1361,7 +1829,7 @@ unmap:
 
 int is_index_unborn(struct index_state *istate)
 {
-	return (!istate->cache_nr && !istate->alloc && !istate->timestamp.sec);
+	return (!istate->cache_nr && !istate->ce_mem_pool && !istate->timestamp.sec);
 }
 
 int discard_index(struct index_state *istate)
@@ -1374,8 +1842,8 @@ int discard_index(struct index_state *istate)
 	istate->name_hash_initialized = 0;
 	free_hash(&istate->name_hash);
 	cache_tree_free(&(istate->cache_tree));
-	free(istate->alloc);
-	istate->alloc = NULL;
+	mem_pool_discard(istate->ce_mem_pool);
+	istate->ce_mem_pool = NULL;
 	istate->initialized = 0;
 
 	/* no need to throw away allocated active_cache */
@@ -1430,11 +1898,16 @@ static int ce_write(git_SHA_CTX *context, int fd, void *data, unsigned int len)
 	return 0;
 }
 
-static int write_index_ext_header(git_SHA_CTX *context, int fd,
+static int write_index_ext_header(git_SHA_CTX *context,
+				  git_SHA_CTX *eoie_context, int fd,
 				  unsigned int ext, unsigned int sz)
 {
 	ext = htonl(ext);
 	sz = htonl(sz);
+	if (eoie_context) {
+		git_SHA1_Update(eoie_context, &ext, 4);
+		git_SHA1_Update(eoie_context, &sz, 4);
+	}
 	return ((ce_write(context, fd, &ext, 4) < 0) ||
 		(ce_write(context, fd, &sz, 4) < 0)) ? -1 : 0;
 }
@@ -1510,12 +1983,36 @@ static void ce_smudge_racily_clean_entry(struct cache_entry *ce)
 	}
 }
 
-static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce)
+/*
+ * Write out ce, with its path compressed against previous_name for an
+ * index of version 4, and tell how many bytes it took.
+ */
+static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce,
+			  struct strbuf *previous_name, unsigned long *ent_size)
 {
-	int size = ondisk_ce_size(ce);
-	struct ondisk_cache_entry *ondisk = xcalloc(1, size);
+	int size;
+	struct ondisk_cache_entry *ondisk;
 	char *name;
 	int result;
+	size_t len = ce_namelen(ce), common = 0;
+	unsigned char to_remove_vi[16];
+	int prefix_size = 0;
+
+	if (!previous_name) {
+		size = ondisk_ce_size(ce);
+	} else {
+		while (common < len && common < previous_name->len &&
+		       ce->name[common] == previous_name->buf[common])
+			common++;
+		prefix_size = encode_varint(previous_name->len - common,
+					    to_remove_vi);
+		if (ce->ce_flags & CE_EXTENDED)
+			size = offsetof(struct ondisk_cache_entry_extended, name);
+		else
+			size = offsetof(struct ondisk_cache_entry, name);
+		size += prefix_size + len - common + 1;
+	}
+	ondisk = xcalloc(1, size);
 
 	ondisk->ctime.sec = htonl(ce->ce_ctime.sec);
 	ondisk->mtime.sec = htonl(ce->ce_mtime.sec);
@@ -1537,10 +2034,19 @@ static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce)
 	}
 	else
 		name = ondisk->name;
-	memcpy(name, ce->name, ce_namelen(ce));
+
+	if (!previous_name) {
+		memcpy(name, ce->name, len);
+	} else {
+		memcpy(name, to_remove_vi, prefix_size);
+		memcpy(name + prefix_size, ce->name + common, len - common);
+		strbuf_setlen(previous_name, common);
+		strbuf_add(previous_name, ce->name + common, len - common);
+	}
 
 	result = ce_write(c, fd, ondisk, size);
 	free(ondisk);
+	*ent_size = size;
 	return result;
 }
 
@@ -1569,14 +2075,37 @@ void update_index_if_able(struct index_state *istate, struct lock_file *lockfile
 		rollback_lock_file(lockfile);
 }
 
+static void write_ieot_extension(struct strbuf *sb, unsigned long *offsets,
+				 int nr_offsets, int nr_entries)
+{
+	uint32_t val;
+	int i;
+
+	val = htonl(IEOT_VERSION);
+	strbuf_add(sb, &val, 4);
+	for (i = 0; i < nr_offsets; i++) {
+		val = htonl(offsets[i]);
+		strbuf_add(sb, &val, 4);
+		if (nr_entries > IEOT_BLOCK_ENTRIES)
+			val = htonl(IEOT_BLOCK_ENTRIES);
+		else
+			val = htonl(nr_entries);
+		strbuf_add(sb, &val, 4);
+		nr_entries -= IEOT_BLOCK_ENTRIES;
+	}
+}
+
 int write_index(struct index_state *istate, int newfd)
 {
-	git_SHA_CTX c;
+	git_SHA_CTX c, eoie_c, *eoie = NULL;
 	struct cache_header hdr;
-	int i, err, removed, extended;
+	int i, err, removed, extended, nr_written;
 	struct cache_entry **cache = istate->cache;
 	int entries = istate->cache_nr;
 	struct stat st;
+	unsigned long offset, *block_offsets = NULL;
+	int nr_blocks = 0, alloc_blocks = 0;
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
 
 	for (i = removed = extended = 0; i < entries; i++) {
 		if (cache[i]->ce_flags & CE_REMOVE)
@@ -1590,31 +2119,82 @@ int write_index(struct index_state *istate, int newfd)
 		}
 	}
 
-	hdr.hdr_signature = htonl(CACHE_SIGNATURE);
+	if (istate->version < INDEX_FORMAT_LB || INDEX_FORMAT_UB < istate->version)
+		istate->version = INDEX_FORMAT_LB;
 	/* for extended format, increase version so older git won't try to read it */
-	hdr.hdr_version = htonl(extended ? 3 : 2);
+	if (istate->version < 4)
+		istate->version = extended ? 3 : 2;
+
+	hdr.hdr_signature = htonl(CACHE_SIGNATURE);
+	hdr.hdr_version = htonl(istate->version);
 	hdr.hdr_entries = htonl(entries - removed);
 
+	if (index_record_offsets &&
+	    entries - removed >= 2 * IEOT_BLOCK_ENTRIES) {
+		git_SHA1_Init(&eoie_c);
+		eoie = &eoie_c;
+	}
+
 	git_SHA1_Init(&c);
 	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0)
 		return -1;
 
-	for (i = 0; i < entries; i++) {
+	previous_name = (istate->version == 4) ? &previous_name_buf : NULL;
+	offset = sizeof(hdr);
+	for (i = nr_written = 0; i < entries; i++) {
 		struct cache_entry *ce = cache[i];
+		unsigned long size;
+
 		if (ce->ce_flags & CE_REMOVE)
 			continue;
 		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
 			ce_smudge_racily_clean_entry(ce);
-		if (ce_write_entry(&c, newfd, ce) < 0)
+		if (eoie && !(nr_written % IEOT_BLOCK_ENTRIES)) {
+			ALLOC_GROW(block_offsets, nr_blocks + 1, alloc_blocks);
+			block_offsets[nr_blocks++] = offset;
+			/*
+			 * A block has to be readable on its own, so its
+			 * first path shares nothing with the one before.
+			 */
+			if (previous_name)
+				memset(previous_name->buf, 0, previous_name->len);
+		}
+		if (ce_write_entry(&c, newfd, ce, previous_name, &size) < 0) {
+			free(block_offsets);
+			strbuf_release(&previous_name_buf);
 			return -1;
+		}
+		offset += size;
+		nr_written++;
 	}
+	strbuf_release(&previous_name_buf);
+
+	/* The offsets are recorded in 32 bits */
+	if (eoie && offset > 0xffffffffUL)
+		eoie = NULL;
 
 	/* Write extension data here */
+	if (eoie) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_ieot_extension(&sb, block_offsets, nr_blocks, nr_written);
+		err = write_index_ext_header(&c, eoie, newfd,
+					     CACHE_EXT_INDEX_ENTRY_OFFSET_TABLE,
+					     sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err) {
+			free(block_offsets);
+			return -1;
+		}
+	}
+	free(block_offsets);
 	if (istate->cache_tree) {
 		struct strbuf sb = STRBUF_INIT;
 
 		cache_tree_write(&sb, istate->cache_tree);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_TREE, sb.len) < 0
+		err = write_index_ext_header(&c, eoie, newfd, CACHE_EXT_TREE,
+					     sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
@@ -1624,13 +2204,27 @@ int write_index(struct index_state *istate, int newfd)
 		struct strbuf sb = STRBUF_INIT;
 
 		resolve_undo_write(&sb, istate->resolve_undo);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_RESOLVE_UNDO,
-					     sb.len) < 0
+		err = write_index_ext_header(&c, eoie, newfd,
+					     CACHE_EXT_RESOLVE_UNDO, sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
 			return -1;
 	}
+	/* This one has to come last, right before the checksum */
+	if (eoie) {
+		unsigned char sha1[20];
+		uint32_t val = htonl(offset);
+
+		git_SHA1_Final(sha1, eoie);
+		err = write_index_ext_header(&c, NULL, newfd,
+					     CACHE_EXT_END_OF_INDEX_ENTRIES,
+					     EOIE_SIZE) < 0
+			|| ce_write(&c, newfd, &val, 4) < 0
+			|| ce_write(&c, newfd, sha1, 20) < 0;
+		if (err)
+			return -1;
+	}
 
 	if (ce_flush(&c, newfd) || fstat(newfd, &st))
 		return -1;
@@ -1655,14 +2249,13 @@ int read_index_unmerged(struct index_state *istate)
 	for (i = 0; i < istate->cache_nr; i++) {
 		struct cache_entry *ce = istate->cache[i];
 		struct cache_entry *new_ce;
-		int size, len;
+		int len;
 
 		if (!ce_stage(ce))
 			continue;
 		unmerged = 1;
 		len = strlen(ce->name);
-		size = cache_entry_size(len);
-		new_ce = xcalloc(1, size);
+		new_ce = make_empty_cache_entry(istate, len);
 		memcpy(new_ce->name, ce->name, len);
 		new_ce->ce_flags = create_ce_flags(len, 0) | CE_CONFLICTED;
 		new_ce->ce_mode = ce->ce_mode;
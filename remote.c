@@ -2,6 +2,7 @@
 #include "remote.h"
 #include "refs.h"
 #include "commit.h"
+#include "prio-queue.h"
 #include "diff.h"
 #include "revision.h"
 #include "dir.h"
@@ -1448,8 +1449,9 @@ int ref_newer(const unsigned char *new_sha1, const unsigned char *old_sha1)
 {
 	struct object *o;
 	struct commit *old, *new;
-	struct commit_list *list, *used;
-	int found = 0;
+	struct prio_queue queue = { compare_commits_by_commit_date };
+	struct commit_list *used;
+	int i, found = 0;
 
 	/* Both new and old must be commit-ish and new is descendant of
 	 * old.  Otherwise we require --force.
@@ -1467,17 +1469,21 @@ int ref_newer(const unsigned char *new_sha1, const unsigned char *old_sha1)
 	if (parse_commit(new) < 0)
 		return 0;
 
-	used = list = NULL;
-	commit_list_insert(new, &list);
-	while (list) {
-		new = pop_most_recent_commit(&list, TMP_MARK);
+	used = NULL;
+	prio_queue_put(&queue, new);
+	while (queue.nr) {
+		new = pop_most_recent_commit(&queue, TMP_MARK);
 		commit_list_insert(new, &used);
 		if (new == old) {
 			found = 1;
 			break;
 		}
 	}
-	unmark_and_free(list, TMP_MARK);
+	for (i = 0; i < queue.nr; i++) {
+		struct commit *commit = queue.array[i].data;
+		commit->object.flags &= ~TMP_MARK;
+	}
+	clear_prio_queue(&queue);
 	unmark_and_free(used, TMP_MARK);
 	return found;
 }
@@ -13,6 +13,7 @@
 #include "decorate.h"
 #include "log-tree.h"
 #include "string-list.h"
+#include "prio-queue.h"
 
 volatile show_early_output_fn_t show_early_output;
 
@@ -298,12 +299,12 @@ static struct commit *handle_commit(struct rev_info *revs, struct object *object
 	die("%s is unknown object", name);
 }
 
-static int everybody_uninteresting(struct commit_list *orig)
+static int everybody_uninteresting(struct prio_queue *queue)
 {
-	struct commit_list *list = orig;
-	while (list) {
-		struct commit *commit = list->item;
-		list = list->next;
+	int i;
+
+	for (i = 0; i < queue->nr; i++) {
+		struct commit *commit = queue->array[i].data;
 		if (commit->object.flags & UNINTERESTING)
 			continue;
 		return 0;
@@ -504,8 +505,13 @@ static void commit_list_insert_by_date_cached(struct commit *p, struct commit_li
 		*cache = new_entry;
 }
 
+/*
+ * Queue the parents of a commit to be walked, either on the date
+ * ordered list, or, when one is given, in the priority queue.
+ */
 static int add_parents_to_list(struct rev_info *revs, struct commit *commit,
-		    struct commit_list **list, struct commit_list **cache_ptr)
+		    struct commit_list **list, struct commit_list **cache_ptr,
+		    struct prio_queue *queue)
 {
 	struct commit_list *parent = commit->parents;
 	unsigned left_flag;
@@ -540,7 +546,10 @@ static int add_parents_to_list(struct rev_info *revs, struct commit *commit,
 			if (p->object.flags & SEEN)
 				continue;
 			p->object.flags |= SEEN;
-			commit_list_insert_by_date_cached(p, list, cached_base, cache_ptr);
+			if (queue)
+				prio_queue_put(queue, p);
+			else
+				commit_list_insert_by_date_cached(p, list, cached_base, cache_ptr);
 		}
 		return 0;
 	}
@@ -567,7 +576,10 @@ static int add_parents_to_list(struct rev_info *revs, struct commit *commit,
 		p->object.flags |= left_flag;
 		if (!(p->object.flags & SEEN)) {
 			p->object.flags |= SEEN;
-			commit_list_insert_by_date_cached(p, list, cached_base, cache_ptr);
+			if (queue)
+				prio_queue_put(queue, p);
+			else
+				commit_list_insert_by_date_cached(p, list, cached_base, cache_ptr);
 		}
 		if (revs->first_parent_only)
 			break;
@@ -666,19 +678,21 @@ static void cherry_pick_list(struct commit_list *list, struct rev_info *revs)
 /* How many extra uninteresting commits we want to see.. */
 #define SLOP 5
 
-static int still_interesting(struct commit_list *src, unsigned long date, int slop)
+static int still_interesting(struct prio_queue *src, unsigned long date, int slop)
 {
+	struct commit *next = prio_queue_peek(src);
+
 	/*
 	 * No source list at all? We're definitely done..
 	 */
-	if (!src)
+	if (!next)
 		return 0;
 
 	/*
 	 * Does the destination list contain entries with a date
 	 * before the source list? Definitely _not_ done.
 	 */
-	if (date < src->item->date)
+	if (date < next->date)
 		return SLOP;
 
 	/*
@@ -804,10 +818,12 @@ static int limit_list(struct rev_info *revs)
 {
 	int slop = SLOP;
 	unsigned long date = ~0ul;
-	struct commit_list *list = revs->commits;
+	struct prio_queue queue = { compare_commits_by_commit_date };
+	struct commit_list *list;
 	struct commit_list *newlist = NULL;
 	struct commit_list **p = &newlist;
 	struct commit_list *bottom = NULL;
+	struct commit *commit;
 
 	if (revs->ancestry_path) {
 		bottom = collect_bottom_commits(revs);
@@ -815,29 +831,32 @@ static int limit_list(struct rev_info *revs)
 			die("--ancestry-path given but there are no bottom commits");
 	}
 
-	while (list) {
-		struct commit_list *entry = list;
-		struct commit *commit = list->item;
+	for (list = revs->commits; list; list = list->next)
+		prio_queue_put(&queue, list->item);
+	free_commit_list(revs->commits);
+	revs->commits = NULL;
+
+	while ((commit = prio_queue_get(&queue)) != NULL) {
 		struct object *obj = &commit->object;
 		show_early_output_fn_t show;
 
-		list = list->next;
-		free(entry);
-
 		if (revs->max_age != -1 && (commit->date < revs->max_age))
 			obj->flags |= UNINTERESTING;
-		if (add_parents_to_list(revs, commit, &list, NULL) < 0)
+		if (add_parents_to_list(revs, commit, NULL, NULL, &queue) < 0) {
+			clear_prio_queue(&queue);
 			return -1;
+		}
 		if (obj->flags & UNINTERESTING) {
 			mark_parents_uninteresting(commit);
 			if (revs->show_all)
 				p = &commit_list_insert(commit, p)->next;
-			slop = still_interesting(list, date, slop);
+			slop = still_interesting(&queue, date, slop);
 			if (slop)
 				continue;
 			/* If showing all, add the whole pending list to the end */
 			if (revs->show_all)
-				*p = list;
+				while ((commit = prio_queue_get(&queue)) != NULL)
+					p = &commit_list_insert(commit, p)->next;
 			break;
 		}
 		if (revs->min_age != -1 && (commit->date > revs->min_age))
@@ -852,6 +871,8 @@ static int limit_list(struct rev_info *revs)
 		show(revs, newlist);
 		show_early_output = NULL;
 	}
+	clear_prio_queue(&queue);
+
 	if (revs->cherry_pick || revs->cherry_mark)
 		cherry_pick_list(newlist, revs);
 
@@ -2077,7 +2098,7 @@ static enum rewrite_result rewrite_one(struct rev_info *revs, struct commit **pp
 	for (;;) {
 		struct commit *p = *pp;
 		if (!revs->limited)
-			if (add_parents_to_list(revs, p, &revs->commits, &cache) < 0)
+			if (add_parents_to_list(revs, p, &revs->commits, &cache, NULL) < 0)
 				return rewrite_one_error;
 		if (p->parents && p->parents->next)
 			return rewrite_one_ok;
@@ -2201,7 +2222,7 @@ static struct commit *get_revision_1(struct rev_info *revs)
 			if (revs->max_age != -1 &&
 			    (commit->date < revs->max_age))
 				continue;
-			if (add_parents_to_list(revs, commit, &revs->commits, NULL) < 0)
+			if (add_parents_to_list(revs, commit, &revs->commits, NULL, NULL) < 0)
 				die("Failed to traverse parents of commit %s",
 				    sha1_to_hex(commit->object.sha1));
 		}
@@ -2418,6 +2439,6 @@ void put_revision_mark(const struct rev_info *revs, const struct commit *commit)
 	char *mark = get_revision_mark(revs, commit);
 	if (!strlen(mark))
 		return;
-	fputs(mark, stdout);
-	putchar(' ');
+	fputs(mark, revs->diffopt.file);
+	putc(' ', revs->diffopt.file);
 }
@@ -11,13 +11,13 @@
 #include "pack.h"
 #include "blob.h"
 #include "commit.h"
-#include "run-command.h"
 #include "tag.h"
 #include "tree.h"
 #include "tree-walk.h"
 #include "refs.h"
 #include "pack-revindex.h"
 #include "sha1-lookup.h"
+#include "bulk-checkin.h"
 
 #ifndef O_NOATIME
 #if defined(__linux__) && (defined(__i386__) || defined(__PPC__))
@@ -449,6 +449,11 @@ static unsigned int pack_open_fds;
 static unsigned int pack_max_fds;
 static size_t peak_pack_mapped;
 static size_t pack_mapped;
+static unsigned int delta_base_cache_hits;
+static unsigned int delta_base_cache_misses;
+static unsigned int delta_base_cache_evictions;
+static size_t peak_delta_base_cached;
+static size_t delta_base_cached;
 struct packed_git *packed_git;
 
 void pack_report(void)
@@ -470,6 +475,18 @@ void pack_report(void)
 		pack_mmap_calls,
 		pack_open_windows, peak_pack_open_windows,
 		sz_fmt(pack_mapped), sz_fmt(peak_pack_mapped));
+	fprintf(stderr,
+		"pack_report: core.deltaBaseCacheLimit = %10" SZ_FMT "\n"
+		"pack_report: delta_base_cached        = "
+			"%10" SZ_FMT " / %10" SZ_FMT "\n"
+		"pack_report: delta_base_cache hits    = %10u\n"
+		"pack_report: delta_base_cache misses  = %10u\n"
+		"pack_report: delta_base_cache evicted = %10u\n",
+		sz_fmt(delta_base_cache_limit),
+		sz_fmt(delta_base_cached), sz_fmt(peak_delta_base_cached),
+		delta_base_cache_hits,
+		delta_base_cache_misses,
+		delta_base_cache_evictions);
 }
 
 static int check_packed_git_idx(const char *path,  struct packed_git *p)
@@ -1467,11 +1484,11 @@ unsigned long get_size_from_delta(struct packed_git *p,
 	return get_delta_hdr_size(&data, delta_head+sizeof(delta_head));
 }
 
-static off_t get_delta_base(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t *curpos,
-				    enum object_type type,
-				    off_t delta_obj_offset)
+off_t get_delta_base(struct packed_git *p,
+		     struct pack_window **w_curs,
+		     off_t *curpos,
+		     enum object_type type,
+		     off_t delta_obj_offset)
 {
 	unsigned char *base_info = use_pack(p, w_curs, *curpos, NULL);
 	off_t base_offset;
@@ -1610,10 +1627,10 @@ static int packed_object_info(struct packed_git *p, off_t obj_offset,
 	return type;
 }
 
-static void *unpack_compressed_entry(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t curpos,
-				    unsigned long size)
+void *unpack_compressed_entry(struct packed_git *p,
+			      struct pack_window **w_curs,
+			      off_t curpos,
+			      unsigned long size)
 {
 	int st;
 	git_zstream stream;
@@ -1642,23 +1659,31 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	return buffer;
 }
 
-#define MAX_DELTA_CACHE (256)
-
-static size_t delta_base_cached;
-
-static struct delta_base_cache_lru_list {
-	struct delta_base_cache_lru_list *prev;
-	struct delta_base_cache_lru_list *next;
-} delta_base_cache_lru = { &delta_base_cache_lru, &delta_base_cache_lru };
-
-static struct delta_base_cache_entry {
-	struct delta_base_cache_lru_list lru;
+/*
+ * Recently used delta bases, so that walking a delta chain again (as
+ * "log -p" or "blame" do for every revision of a file) does not have
+ * to inflate and patch the whole chain from scratch.
+ *
+ * The entries live in a hash table keyed by pack and offset that grows
+ * with the number of entries, and on a ring swept by a CLOCK hand for
+ * eviction once core.deltaBaseCacheLimit bytes are cached.  A hit gives
+ * an entry another round on the clock; trees and commits get two, as
+ * they are the bases of many more objects than a blob typically is.
+ */
+struct delta_base_cache_entry {
+	struct delta_base_cache_entry *hash_next;
+	struct delta_base_cache_entry *clock_prev, *clock_next;
 	void *data;
 	struct packed_git *p;
 	off_t base_offset;
 	unsigned long size;
 	enum object_type type;
-} delta_base_cache[MAX_DELTA_CACHE];
+	unsigned chances;
+};
+
+static struct delta_base_cache_entry **delta_base_cache;
+static unsigned int delta_base_cache_size, delta_base_cache_nr;
+static struct delta_base_cache_entry *delta_base_cache_hand;
 
 static unsigned long pack_entry_hash(struct packed_git *p, off_t base_offset)
 {
@@ -1666,93 +1691,156 @@ static unsigned long pack_entry_hash(struct packed_git *p, off_t base_offset)
 
 	hash = (unsigned long)p + (unsigned long)base_offset;
 	hash += (hash >> 8) + (hash >> 16);
-	return hash % MAX_DELTA_CACHE;
+	return hash & (delta_base_cache_size - 1);
+}
+
+static struct delta_base_cache_entry **find_delta_base_cache(struct packed_git *p,
+							     off_t base_offset)
+{
+	struct delta_base_cache_entry **pos;
+
+	if (!delta_base_cache_nr)
+		return NULL;
+	pos = &delta_base_cache[pack_entry_hash(p, base_offset)];
+	for (; *pos; pos = &(*pos)->hash_next)
+		if ((*pos)->p == p && (*pos)->base_offset == base_offset)
+			return pos;
+	return NULL;
+}
+
+static void grow_delta_base_cache(void)
+{
+	struct delta_base_cache_entry **old = delta_base_cache;
+	unsigned int i, old_size = delta_base_cache_size;
+
+	delta_base_cache_size = old_size ? old_size * 2 : 256;
+	delta_base_cache = xcalloc(delta_base_cache_size, sizeof(*delta_base_cache));
+	for (i = 0; i < old_size; i++) {
+		struct delta_base_cache_entry *ent = old[i], *next;
+		for (; ent; ent = next) {
+			unsigned long hash = pack_entry_hash(ent->p, ent->base_offset);
+			next = ent->hash_next;
+			ent->hash_next = delta_base_cache[hash];
+			delta_base_cache[hash] = ent;
+		}
+	}
+	free(old);
+}
+
+/* Unlink the entry at *pos and hand its data over to the caller */
+static void *detach_delta_base_cache(struct delta_base_cache_entry **pos)
+{
+	struct delta_base_cache_entry *ent = *pos;
+	void *data = ent->data;
+
+	*pos = ent->hash_next;
+	if (ent->clock_next == ent)
+		delta_base_cache_hand = NULL;
+	else {
+		if (delta_base_cache_hand == ent)
+			delta_base_cache_hand = ent->clock_next;
+		ent->clock_next->clock_prev = ent->clock_prev;
+		ent->clock_prev->clock_next = ent->clock_next;
+	}
+	delta_base_cached -= ent->size;
+	delta_base_cache_nr--;
+	free(ent);
+	return data;
 }
 
 static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
-	return (ent->data && ent->p == p && ent->base_offset == base_offset);
+	return !!find_delta_base_cache(p, base_offset);
 }
 
-static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
+void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
 	unsigned long *base_size, enum object_type *type, int keep_cache)
 {
-	void *ret;
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
+	struct delta_base_cache_entry **pos, *ent;
 
-	ret = ent->data;
-	if (!ret || ent->p != p || ent->base_offset != base_offset)
+	pos = find_delta_base_cache(p, base_offset);
+	if (!pos) {
+		delta_base_cache_misses++;
 		return unpack_entry(p, base_offset, type, base_size);
-
-	if (!keep_cache) {
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
-	} else {
-		ret = xmemdupz(ent->data, ent->size);
 	}
+
+	delta_base_cache_hits++;
+	ent = *pos;
 	*type = ent->type;
 	*base_size = ent->size;
-	return ret;
+	if (!keep_cache)
+		return detach_delta_base_cache(pos);
+
+	ent->chances = ent->type == OBJ_BLOB ? 1 : 2;
+	return xmemdupz(ent->data, ent->size);
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+static void evict_delta_base_cache(void)
 {
-	if (ent->data) {
-		free(ent->data);
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
+	struct delta_base_cache_entry *ent;
+
+	while (delta_base_cached > delta_base_cache_limit &&
+	       (ent = delta_base_cache_hand)) {
+		if (ent->chances) {
+			ent->chances--;
+			delta_base_cache_hand = ent->clock_next;
+			continue;
+		}
+		free(detach_delta_base_cache(find_delta_base_cache(ent->p,
+							ent->base_offset)));
+		delta_base_cache_evictions++;
 	}
 }
 
 void clear_delta_base_cache(void)
 {
-	unsigned long p;
-	for (p = 0; p < MAX_DELTA_CACHE; p++)
-		release_delta_base_cache(&delta_base_cache[p]);
+	while (delta_base_cache_hand) {
+		struct delta_base_cache_entry *ent = delta_base_cache_hand;
+		free(detach_delta_base_cache(find_delta_base_cache(ent->p,
+							ent->base_offset)));
+	}
 }
 
-static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
+void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
-	struct delta_base_cache_lru_list *lru;
+	struct delta_base_cache_entry **pos, *ent;
+	unsigned long hash;
 
-	release_delta_base_cache(ent);
-	delta_base_cached += base_size;
+	pos = find_delta_base_cache(p, base_offset);
+	if (pos)
+		free(detach_delta_base_cache(pos));
 
-	for (lru = delta_base_cache_lru.next;
-	     delta_base_cached > delta_base_cache_limit
-	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
-		struct delta_base_cache_entry *f = (void *)lru;
-		if (f->type == OBJ_BLOB)
-			release_delta_base_cache(f);
-	}
-	for (lru = delta_base_cache_lru.next;
-	     delta_base_cached > delta_base_cache_limit
-	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
-		struct delta_base_cache_entry *f = (void *)lru;
-		release_delta_base_cache(f);
-	}
+	delta_base_cached += base_size;
+	evict_delta_base_cache();
 
+	if (delta_base_cache_nr >= delta_base_cache_size)
+		grow_delta_base_cache();
+	ent = xmalloc(sizeof(*ent));
 	ent->p = p;
 	ent->base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	ent->lru.next = &delta_base_cache_lru;
-	ent->lru.prev = delta_base_cache_lru.prev;
-	delta_base_cache_lru.prev->next = &ent->lru;
-	delta_base_cache_lru.prev = &ent->lru;
+	ent->chances = 0;
+
+	hash = pack_entry_hash(p, base_offset);
+	ent->hash_next = delta_base_cache[hash];
+	delta_base_cache[hash] = ent;
+	delta_base_cache_nr++;
+
+	/* New entries go right behind the hand, i.e. last in line */
+	if (!delta_base_cache_hand) {
+		ent->clock_next = ent->clock_prev = ent;
+		delta_base_cache_hand = ent;
+	} else {
+		ent->clock_next = delta_base_cache_hand;
+		ent->clock_prev = delta_base_cache_hand->clock_prev;
+		ent->clock_prev->clock_next = ent;
+		delta_base_cache_hand->clock_prev = ent;
+	}
+	if (peak_delta_base_cached < delta_base_cached)
+		peak_delta_base_cached = delta_base_cached;
 }
 
 static void *read_object(const unsigned char *sha1, enum object_type *type,
@@ -2313,20 +2401,56 @@ void *read_object_with_reference(const unsigned char *sha1,
 	}
 }
 
+/*
+ * With GIT_TEST_SHA1DC_SELF_TEST set, collision detection finds every
+ * object to be half of a collision, so that the tests can see how one
+ * is dealt with without having to carry a real pair.
+ */
+static int sha1dc_self_test(void)
+{
+	static int self_test = -1;
+
+	if (self_test < 0)
+		self_test = !!getenv("GIT_TEST_SHA1DC_SELF_TEST");
+	return self_test;
+}
+
+/*
+ * Name an object from its header and contents.  Objects that came from
+ * elsewhere are refused if they are half of a colliding pair.
+ */
+static void sha1_object_name(const char *hdr, int hdrlen, const void *buf,
+			     unsigned long len, unsigned char *sha1)
+{
+	if (detect_sha1_collisions) {
+		git_SHA1DC_CTX c;
+
+		git_SHA1DC_Init(&c);
+		c.self_test = sha1dc_self_test();
+		git_SHA1DC_Update(&c, hdr, hdrlen);
+		git_SHA1DC_Update(&c, buf, len);
+		if (git_SHA1DC_Final(sha1, &c))
+			die("object %s is part of a SHA-1 collision attack",
+			    sha1_to_hex(sha1));
+	} else {
+		git_SHA_CTX c;
+
+		git_SHA1_Init(&c);
+		git_SHA1_Update(&c, hdr, hdrlen);
+		git_SHA1_Update(&c, buf, len);
+		git_SHA1_Final(sha1, &c);
+	}
+}
+
 static void write_sha1_file_prepare(const void *buf, unsigned long len,
                                     const char *type, unsigned char *sha1,
                                     char *hdr, int *hdrlen)
 {
-	git_SHA_CTX c;
-
 	/* Generate the header */
 	*hdrlen = sprintf(hdr, "%s %lu", type, len)+1;
 
 	/* Sha1.. */
-	git_SHA1_Init(&c);
-	git_SHA1_Update(&c, hdr, *hdrlen);
-	git_SHA1_Update(&c, buf, len);
-	git_SHA1_Final(sha1, &c);
+	sha1_object_name(hdr, *hdrlen, buf, len, sha1);
 }
 
 /*
@@ -2391,6 +2515,29 @@ int hash_sha1_file(const void *buf, unsigned long len, const char *type,
 	return 0;
 }
 
+void prepare_sha1_batch_entry(struct sha1_batch_entry *e, const void *buf,
+			      unsigned long len, const char *type)
+{
+	e->buf = buf;
+	e->len = len;
+	e->hdrlen = sprintf(e->hdr, "%s %lu", type, len) + 1;
+}
+
+void git_SHA1_Batch(struct sha1_batch_entry *e, int nr)
+{
+	int i;
+
+#ifdef platform_SHA1_Batch
+	if (!detect_sha1_collisions) {
+		platform_SHA1_Batch(e, nr);
+		return;
+	}
+#endif
+	for (i = 0; i < nr; i++)
+		sha1_object_name(e[i].hdr, e[i].hdrlen, e[i].buf, e[i].len,
+				 e[i].sha1);
+}
+
 /* Finalize a file on disk, and close it. */
 static void close_sha1_file(int fd)
 {
@@ -2679,82 +2826,19 @@ static int index_core(unsigned char *sha1, int fd, size_t size,
 }
 
 /*
- * This creates one packfile per large blob, because the caller
- * immediately wants the result sha1, and fast-import can report the
- * object name via marks mechanism only by closing the created
- * packfile.
- *
- * This also bypasses the usual "convert-to-git" dance, and that is on
+ * This bypasses the usual "convert-to-git" dance, and that is on
  * purpose. We could write a streaming version of the converting
- * functions and insert that before feeding the data to fast-import
- * (or equivalent in-core API described above), but the primary
- * motivation for trying to stream from the working tree file and to
- * avoid mmaping it in core is to deal with large binary blobs, and
- * by definition they do _not_ want to get any conversion.
+ * functions and insert that before feeding the data to the bulk
+ * checkin machinery, but the primary motivation for trying to
+ * stream from the working tree file and to avoid mmaping it in core
+ * is to deal with large binary blobs, and by definition they do
+ * _not_ want to get any conversion.
  */
 static int index_stream(unsigned char *sha1, int fd, size_t size,
 			enum object_type type, const char *path,
 			unsigned flags)
 {
-	struct child_process fast_import;
-	char export_marks[512];
-	const char *argv[] = { "fast-import", "--quiet", export_marks, NULL };
-	char tmpfile[512];
-	char fast_import_cmd[512];
-	char buf[512];
-	int len, tmpfd;
-
-	strcpy(tmpfile, git_path("hashstream_XXXXXX"));
-	tmpfd = git_mkstemp_mode(tmpfile, 0600);
-	if (tmpfd < 0)
-		die_errno("cannot create tempfile: %s", tmpfile);
-	if (close(tmpfd))
-		die_errno("cannot close tempfile: %s", tmpfile);
-	sprintf(export_marks, "--export-marks=%s", tmpfile);
-
-	memset(&fast_import, 0, sizeof(fast_import));
-	fast_import.in = -1;
-	fast_import.argv = argv;
-	fast_import.git_cmd = 1;
-	if (start_command(&fast_import))
-		die_errno("index-stream: git fast-import failed");
-
-	len = sprintf(fast_import_cmd, "blob\nmark :1\ndata %lu\n",
-		      (unsigned long) size);
-	write_or_whine(fast_import.in, fast_import_cmd, len,
-		       "index-stream: feeding fast-import");
-	while (size) {
-		char buf[10240];
-		size_t sz = size < sizeof(buf) ? size : sizeof(buf);
-		ssize_t actual;
-
-		actual = read_in_full(fd, buf, sz);
-		if (actual < 0)
-			die_errno("index-stream: reading input");
-		if (write_in_full(fast_import.in, buf, actual) != actual)
-			die_errno("index-stream: feeding fast-import");
-		size -= actual;
-	}
-	if (close(fast_import.in))
-		die_errno("index-stream: closing fast-import");
-	if (finish_command(&fast_import))
-		die_errno("index-stream: finishing fast-import");
-
-	tmpfd = open(tmpfile, O_RDONLY);
-	if (tmpfd < 0)
-		die_errno("index-stream: cannot open fast-import mark");
-	len = read(tmpfd, buf, sizeof(buf));
-	if (len < 0)
-		die_errno("index-stream: reading fast-import mark");
-	if (close(tmpfd) < 0)
-		die_errno("index-stream: closing fast-import mark");
-	if (unlink(tmpfile))
-		die_errno("index-stream: unlinking fast-import mark");
-	if (len != 44 ||
-	    memcmp(":1 ", buf, 3) ||
-	    get_sha1_hex(buf + 3, sha1))
-		die_errno("index-stream: unexpected fast-import mark: <%s>", buf);
-	return 0;
+	return index_bulk_checkin(sha1, fd, size, type, path, flags);
 }
 
 int index_fd(unsigned char *sha1, int fd, struct stat *st,
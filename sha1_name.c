@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "tag.h"
 #include "commit.h"
+#include "prio-queue.h"
 #include "tree.h"
 #include "blob.h"
 #include "tree-walk.h"
@@ -706,7 +707,8 @@ static int handle_one_ref(const char *path,
 static int get_sha1_oneline(const char *prefix, unsigned char *sha1,
 			    struct commit_list *list)
 {
-	struct commit_list *backup = NULL, *l;
+	struct prio_queue queue = { compare_commits_by_commit_date };
+	struct commit_list *l;
 	int found = 0;
 	regex_t regex;
 
@@ -721,16 +723,16 @@ static int get_sha1_oneline(const char *prefix, unsigned char *sha1,
 
 	for (l = list; l; l = l->next) {
 		l->item->object.flags |= ONELINE_SEEN;
-		commit_list_insert(l->item, &backup);
+		prio_queue_put(&queue, l->item);
 	}
-	while (list) {
+	while (queue.nr) {
 		char *p, *to_free = NULL;
 		struct commit *commit;
 		enum object_type type;
 		unsigned long size;
 		int matches;
 
-		commit = pop_most_recent_commit(&list, ONELINE_SEEN);
+		commit = pop_most_recent_commit(&queue, ONELINE_SEEN);
 		if (!parse_object(commit->object.sha1))
 			continue;
 		if (commit->buffer)
@@ -753,10 +755,10 @@ static int get_sha1_oneline(const char *prefix, unsigned char *sha1,
 		}
 	}
 	regfree(&regex);
-	free_commit_list(list);
-	for (l = backup; l; l = l->next)
+	clear_prio_queue(&queue);
+	for (l = list; l; l = l->next)
 		clear_commit_marks(l->item, ONELINE_SEEN);
-	free_commit_list(backup);
+	free_commit_list(list);
 	return found ? 0 : -1;
 }
 
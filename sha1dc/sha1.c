@@ -0,0 +1,529 @@
+/*
+ * SHA1 with collision detection, following Marc Stevens'
+ * "Counter-cryptanalysis" (CRYPTO 2013).
+ *
+ * The practical attacks on SHA1 build a pair of blocks whose message
+ * difference is fixed by one of a small set of "disturbance vectors":
+ * the expanded message differs by a sum of local collisions, and at
+ * some step of the compression the two computations are in the same
+ * state.  For every block we hash, and every such vector, we take our
+ * own state at that step, apply the message difference the vector
+ * implies, and recompute the other block from there, backwards to the
+ * chaining value it must have started from and forwards to the one it
+ * ends in.  If that is our own output, the block we were given is half
+ * of a collision.
+ *
+ * Nothing about the other block is assumed beyond the message
+ * difference and the shared state, so no attack that follows one of
+ * these vectors can slip through; the price is a recompression per
+ * vector for every block.
+ */
+
+/* this is only to get definitions for memcpy(), ntohl() and htonl() */
+#include "../git-compat-util.h"
+
+#include "sha1.h"
+
+#define ROL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+#define F1(b, c, d)	(((c ^ d) & b) ^ d)
+#define F2(b, c, d)	(b ^ c ^ d)
+#define F3(b, c, d)	((b & c) + (d & (b ^ c)))
+
+#define get_be32(p)	( \
+	(*((unsigned char *)(p) + 0) << 24) | \
+	(*((unsigned char *)(p) + 1) << 16) | \
+	(*((unsigned char *)(p) + 2) <<  8) | \
+	(*((unsigned char *)(p) + 3) <<  0) )
+#define put_be32(p, v)	do { \
+	unsigned int __v = (v); \
+	*((unsigned char *)(p) + 0) = __v >> 24; \
+	*((unsigned char *)(p) + 1) = __v >> 16; \
+	*((unsigned char *)(p) + 2) = __v >>  8; \
+	*((unsigned char *)(p) + 3) = __v >>  0; } while (0)
+
+/*
+ * A disturbance vector of type I(K,b) has a single bit b set in word
+ * K+15 of a window of sixteen otherwise empty expanded message words;
+ * type II(K,b) additionally has bit b+31 set in words K+1 and K+3.
+ * These are the vectors of the attacks published so far, and the step
+ * at which the colliding computations share their state.
+ */
+static struct dv_info {
+	int type, K, b, check;
+	uint32_t dm[80];	/* message difference in each step */
+} dvs[] = {
+	{ 1, 43, 0, 58 }, { 1, 44, 0, 58 }, { 1, 45, 0, 58 }, { 1, 46, 0, 58 },
+	{ 1, 46, 2, 58 }, { 1, 47, 0, 58 }, { 1, 47, 2, 58 }, { 1, 48, 0, 58 },
+	{ 1, 48, 2, 58 }, { 1, 49, 0, 58 }, { 1, 49, 2, 58 }, { 1, 50, 0, 65 },
+	{ 1, 50, 2, 65 }, { 1, 51, 0, 65 }, { 1, 51, 2, 65 }, { 1, 52, 0, 65 },
+	{ 2, 45, 0, 58 }, { 2, 46, 0, 58 }, { 2, 46, 2, 58 }, { 2, 47, 0, 58 },
+	{ 2, 48, 0, 58 }, { 2, 49, 0, 58 }, { 2, 49, 2, 58 }, { 2, 50, 0, 65 },
+	{ 2, 50, 2, 65 }, { 2, 51, 0, 65 }, { 2, 51, 2, 65 }, { 2, 52, 0, 65 },
+	{ 2, 53, 0, 65 }, { 2, 54, 0, 65 }, { 2, 55, 0, 65 }, { 2, 56, 0, 65 },
+};
+
+/*
+ * With no message difference at all, the "other" block is our own and
+ * always collides with it; checking these instead of the real vectors
+ * lets the tests see a collision being found without shipping one.
+ */
+static struct dv_info self_test_dvs[] = {
+	{ 0, 0, 0, 58 }, { 0, 0, 0, 65 },
+};
+
+static inline uint32_t rol(uint32_t x, int n)
+{
+	n &= 31;
+	return n ? ROL(x, n) : x;
+}
+
+/* One step of the other block, and one step undone; m is its message */
+#define STEP_FORWARD(fn, k, m) do { \
+	temp = ROL(a, 5) + fn(b, c, d) + e + (k) + (m); \
+	e = d; d = c; c = ROL(b, 30); b = a; a = temp; } while (0)
+#define STEP_BACK(fn, k, m) do { \
+	temp = b; \
+	b = ROL(c, 2); c = d; d = e; \
+	e = a - ROL(temp, 5) - fn(b, c, d) - (k) - (m); \
+	a = temp; } while (0)
+
+/*
+ * Recompute the other block from the state ours was in before the step
+ * "check": backwards to the chaining value it would have to start from,
+ * left in ihv[], and forwards to the state it ends in, left in a to e.
+ * A[t] is the word our block computed in step t, M(t) the message word
+ * of the other block in step t, and zero a zero of the type a to e,
+ * temp and ihv[] have, so the same code serves for vectors.
+ */
+#define RECOMPRESS(check, A, M, zero) do { \
+	int t; \
+	a = A[(check) - 1] + (zero); \
+	b = A[(check) - 2] + (zero); \
+	c = ROL(A[(check) - 3], 30) + (zero); \
+	d = ROL(A[(check) - 4], 30) + (zero); \
+	e = ROL(A[(check) - 5], 30) + (zero); \
+	for (t = (check) - 1; t >= 60; t--) \
+		STEP_BACK(F2, 0xca62c1d6, M(t)); \
+	for (; t >= 40; t--) \
+		STEP_BACK(F3, 0x8f1bbcdc, M(t)); \
+	for (; t >= 20; t--) \
+		STEP_BACK(F2, 0x6ed9eba1, M(t)); \
+	for (; t >= 0; t--) \
+		STEP_BACK(F1, 0x5a827999, M(t)); \
+	ihv[0] = a; ihv[1] = b; ihv[2] = c; ihv[3] = d; ihv[4] = e; \
+	a = A[(check) - 1] + (zero); \
+	b = A[(check) - 2] + (zero); \
+	c = ROL(A[(check) - 3], 30) + (zero); \
+	d = ROL(A[(check) - 4], 30) + (zero); \
+	e = ROL(A[(check) - 5], 30) + (zero); \
+	for (t = (check); t < 60; t++) \
+		STEP_FORWARD(F3, 0x8f1bbcdc, M(t)); \
+	for (; t < 80; t++) \
+		STEP_FORWARD(F2, 0xca62c1d6, M(t)); \
+} while (0)
+
+/* Does the chaining value the other block ends in equal ours? */
+#define SAME_OUTPUT(ihvout) \
+	((ihv[0] + a == (ihvout)[0]) & (ihv[1] + b == (ihvout)[1]) & \
+	 (ihv[2] + c == (ihvout)[2]) & (ihv[3] + d == (ihvout)[3]) & \
+	 (ihv[4] + e == (ihvout)[4]))
+
+#if defined(__GNUC__) && !defined(SHA1DC_NO_VECTORS)
+/*
+ * The recompressions for different vectors do the same thing to
+ * different data, so with a compiler that has vector types we do
+ * several at once, one vector in each lane.  The vectors of a group
+ * share their check step; four lanes are what every x86-64 and most
+ * other 64-bit processors can do at once, and eight are used where
+ * AVX2 is available.
+ */
+#define DV_GROUP_LANES 8
+typedef uint32_t dv_vec4 __attribute__((vector_size(16)));
+typedef uint32_t dv_vec8 __attribute__((vector_size(32)));
+
+struct dv_group {
+	int check, nr;
+	union {
+		dv_vec4 lanes4[2];
+		dv_vec8 lanes8;
+	} dm[80];
+};
+
+static struct dv_group dv_groups[ARRAY_SIZE(dvs) / DV_GROUP_LANES + 2];
+static struct dv_group self_test_groups[ARRAY_SIZE(self_test_dvs)];
+
+/*
+ * Put the nr vectors in dv into groups, returning how many there are.
+ * A short group repeats its last vector in the lanes it does not use.
+ */
+static int prepare_dv_groups(const struct dv_info *dv, int nr_dv,
+			     struct dv_group *groups)
+{
+	static const int check[] = { 58, 65 };
+	int member[ARRAY_SIZE(dvs)];
+	int i, n, nr, lane, t, nr_groups = 0;
+
+	for (i = 0; i < ARRAY_SIZE(check); i++) {
+		for (n = nr = 0; n < nr_dv; n++)
+			if (dv[n].check == check[i])
+				member[nr++] = n;
+		for (n = 0; n < nr; n += DV_GROUP_LANES) {
+			struct dv_group *group = &groups[nr_groups++];
+
+			group->check = check[i];
+			group->nr = nr - n < DV_GROUP_LANES ? nr - n : DV_GROUP_LANES;
+			for (lane = 0; lane < DV_GROUP_LANES; lane++) {
+				const struct dv_info *info =
+					&dv[member[n + (lane < group->nr ? lane : group->nr - 1)]];
+				for (t = 0; t < 80; t++)
+					group->dm[t].lanes4[lane / 4][lane % 4] = info->dm[t];
+			}
+		}
+	}
+	return nr_groups;
+}
+
+/*
+ * Does the block with the expanded message W collide with the one that
+ * differs from it as one of the vectors of the group says?  A[t] is the
+ * word our block computed in step t, and ihvout its chaining value
+ * after the block.
+ */
+static int dv_group_collides(const struct dv_group *group, const uint32_t *W,
+			     const uint32_t *A, const uint32_t *ihvout)
+{
+	dv_vec4 a, b, c, d, e, temp, ihv[5], same, zero = { 0 };
+	int half, lane;
+
+	for (half = 0; half * 4 < group->nr; half++) {
+#define DV_MESSAGE(t) (W[t] ^ group->dm[t].lanes4[half])
+		RECOMPRESS(group->check, A, DV_MESSAGE, zero);
+#undef DV_MESSAGE
+		same = SAME_OUTPUT(ihvout);
+		for (lane = 0; lane < 4; lane++)
+			if (same[lane])
+				return 1;
+	}
+	return 0;
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8))
+#define HAVE_DV_GROUP_AVX2
+static int cpu_has_avx2;
+
+static __attribute__((target("avx2")))
+int dv_group_collides_avx2(const struct dv_group *group, const uint32_t *W,
+			   const uint32_t *A, const uint32_t *ihvout)
+{
+	dv_vec8 a, b, c, d, e, temp, ihv[5], same, zero = { 0 };
+	int lane;
+
+#define DV_MESSAGE(t) (W[t] ^ group->dm[t].lanes8)
+	RECOMPRESS(group->check, A, DV_MESSAGE, zero);
+#undef DV_MESSAGE
+	same = SAME_OUTPUT(ihvout);
+	for (lane = 0; lane < DV_GROUP_LANES; lane++)
+		if (same[lane])
+			return 1;
+	return 0;
+}
+#endif
+#else
+/*
+ * Does the block with the expanded message W collide with the one that
+ * differs from it as the vector says?  A[t] is the word our block
+ * computed in step t, and ihvout its chaining value after the block.
+ */
+static int dv_collides(const struct dv_info *info, const uint32_t *W,
+		       const uint32_t *A, const uint32_t *ihvout)
+{
+	uint32_t a, b, c, d, e, temp, ihv[5];
+
+#define DV_MESSAGE(t) (W[t] ^ info->dm[t])
+	RECOMPRESS(info->check, A, DV_MESSAGE, 0);
+#undef DV_MESSAGE
+	return SAME_OUTPUT(ihvout);
+}
+#endif
+
+/* The vectors to check blocks against, and their groups */
+static struct dv_set {
+	const struct dv_info *dv;
+	int nr;
+#ifdef DV_GROUP_LANES
+	struct dv_group *group;
+	int nr_groups;
+#endif
+} real_dvs = {
+	dvs, ARRAY_SIZE(dvs),
+#ifdef DV_GROUP_LANES
+	dv_groups
+#endif
+}, self_test = {
+	self_test_dvs, ARRAY_SIZE(self_test_dvs),
+#ifdef DV_GROUP_LANES
+	self_test_groups
+#endif
+};
+
+/*
+ * Expand each vector from its window to all 80 steps, forwards and
+ * backwards through the message expansion, and derive the message
+ * difference: a disturbance in bit j of step i is corrected by bit j+5
+ * of step i+1, bit j of step i+2 and bit j+30 of steps i+3 to i+5.
+ */
+static void prepare_dvs(void)
+{
+	static int prepared;
+	uint32_t w[85], *dv = w + 5;
+	int i, n;
+
+	if (prepared)
+		return;
+	for (n = 0; n < ARRAY_SIZE(dvs); n++) {
+		struct dv_info *info = &dvs[n];
+		int K = info->K;
+
+		memset(w, 0, sizeof(w));
+		dv[K + 15] = rol(1, info->b);
+		if (info->type == 2)
+			dv[K + 1] = dv[K + 3] = rol(1, info->b + 31);
+		for (i = K + 16; i < 80; i++)
+			dv[i] = rol(dv[i-3] ^ dv[i-8] ^ dv[i-14] ^ dv[i-16], 1);
+		for (i = K - 1; i >= -5; i--)
+			dv[i] = rol(dv[i+16], 31) ^ dv[i+13] ^ dv[i+8] ^ dv[i+2];
+
+		for (i = 0; i < 80; i++)
+			info->dm[i] = dv[i] ^ rol(dv[i-1], 5) ^ dv[i-2] ^
+				rol(dv[i-3] ^ dv[i-4] ^ dv[i-5], 30);
+	}
+#ifdef DV_GROUP_LANES
+	real_dvs.nr_groups = prepare_dv_groups(dvs, ARRAY_SIZE(dvs), dv_groups);
+	self_test.nr_groups = prepare_dv_groups(self_test_dvs,
+						ARRAY_SIZE(self_test_dvs),
+						self_test_groups);
+#endif
+#ifdef HAVE_DV_GROUP_AVX2
+	cpu_has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+	prepared = 1;
+}
+
+/* Check a block against every vector of the set */
+static int block_collides(const struct dv_set *set, const uint32_t *W,
+			  const uint32_t *A, const uint32_t *ihvout)
+{
+	int n;
+
+#if defined(HAVE_DV_GROUP_AVX2)
+	if (cpu_has_avx2) {
+		for (n = 0; n < set->nr_groups; n++)
+			if (dv_group_collides_avx2(&set->group[n], W, A, ihvout))
+				return 1;
+		return 0;
+	}
+#endif
+#if defined(DV_GROUP_LANES)
+	for (n = 0; n < set->nr_groups; n++)
+		if (dv_group_collides(&set->group[n], W, A, ihvout))
+			return 1;
+#else
+	for (n = 0; n < set->nr; n++)
+		if (dv_collides(&set->dv[n], W, A, ihvout))
+			return 1;
+#endif
+	return 0;
+}
+
+#define SHA_SRC(t)	(W[t] = get_be32((const unsigned char *)block + (t) * 4))
+#define SHA_MIX(t)	(W[t] = ROL(W[(t)-3] ^ W[(t)-8] ^ W[(t)-14] ^ W[(t)-16], 1))
+
+/*
+ * The message words are all kept, and from the third round on so is
+ * the word each step computes: both are needed to check the block.
+ */
+#define SHA_ROUND(t, input, fn, constant, A, B, C, D, E) do { \
+	E += input(t) + ROL(A, 5) + fn(B, C, D) + (constant); \
+	B = ROL(B, 30); } while (0)
+#define SHA_ROUND_SAVE(t, input, fn, constant, A, B, C, D, E) do { \
+	SHA_ROUND(t, input, fn, constant, A, B, C, D, E); \
+	A_[t] = E; } while (0)
+
+#define T_0_15(t, A, B, C, D, E)  SHA_ROUND(t, SHA_SRC, F1, 0x5a827999, A, B, C, D, E)
+#define T_16_19(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, F1, 0x5a827999, A, B, C, D, E)
+#define T_20_39(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, F2, 0x6ed9eba1, A, B, C, D, E)
+#define T_40_59(t, A, B, C, D, E) SHA_ROUND_SAVE(t, SHA_MIX, F3, 0x8f1bbcdc, A, B, C, D, E)
+#define T_60_79(t, A, B, C, D, E) SHA_ROUND_SAVE(t, SHA_MIX, F2, 0xca62c1d6, A, B, C, D, E)
+
+static void SHA1DC_Block(SHA1DC_CTX *ctx, const void *block)
+{
+	uint32_t W[80], A_[80];
+	uint32_t A, B, C, D, E;
+
+	A = ctx->H[0];
+	B = ctx->H[1];
+	C = ctx->H[2];
+	D = ctx->H[3];
+	E = ctx->H[4];
+
+	/* Round 1 - iterations 0-16 take their input from the block */
+	T_0_15( 0, A, B, C, D, E);
+	T_0_15( 1, E, A, B, C, D);
+	T_0_15( 2, D, E, A, B, C);
+	T_0_15( 3, C, D, E, A, B);
+	T_0_15( 4, B, C, D, E, A);
+	T_0_15( 5, A, B, C, D, E);
+	T_0_15( 6, E, A, B, C, D);
+	T_0_15( 7, D, E, A, B, C);
+	T_0_15( 8, C, D, E, A, B);
+	T_0_15( 9, B, C, D, E, A);
+	T_0_15(10, A, B, C, D, E);
+	T_0_15(11, E, A, B, C, D);
+	T_0_15(12, D, E, A, B, C);
+	T_0_15(13, C, D, E, A, B);
+	T_0_15(14, B, C, D, E, A);
+	T_0_15(15, A, B, C, D, E);
+
+	/* Round 1 - tail */
+	T_16_19(16, E, A, B, C, D);
+	T_16_19(17, D, E, A, B, C);
+	T_16_19(18, C, D, E, A, B);
+	T_16_19(19, B, C, D, E, A);
+
+	/* Round 2 */
+	T_20_39(20, A, B, C, D, E);
+	T_20_39(21, E, A, B, C, D);
+	T_20_39(22, D, E, A, B, C);
+	T_20_39(23, C, D, E, A, B);
+	T_20_39(24, B, C, D, E, A);
+	T_20_39(25, A, B, C, D, E);
+	T_20_39(26, E, A, B, C, D);
+	T_20_39(27, D, E, A, B, C);
+	T_20_39(28, C, D, E, A, B);
+	T_20_39(29, B, C, D, E, A);
+	T_20_39(30, A, B, C, D, E);
+	T_20_39(31, E, A, B, C, D);
+	T_20_39(32, D, E, A, B, C);
+	T_20_39(33, C, D, E, A, B);
+	T_20_39(34, B, C, D, E, A);
+	T_20_39(35, A, B, C, D, E);
+	T_20_39(36, E, A, B, C, D);
+	T_20_39(37, D, E, A, B, C);
+	T_20_39(38, C, D, E, A, B);
+	T_20_39(39, B, C, D, E, A);
+
+	/* Round 3 */
+	T_40_59(40, A, B, C, D, E);
+	T_40_59(41, E, A, B, C, D);
+	T_40_59(42, D, E, A, B, C);
+	T_40_59(43, C, D, E, A, B);
+	T_40_59(44, B, C, D, E, A);
+	T_40_59(45, A, B, C, D, E);
+	T_40_59(46, E, A, B, C, D);
+	T_40_59(47, D, E, A, B, C);
+	T_40_59(48, C, D, E, A, B);
+	T_40_59(49, B, C, D, E, A);
+	T_40_59(50, A, B, C, D, E);
+	T_40_59(51, E, A, B, C, D);
+	T_40_59(52, D, E, A, B, C);
+	T_40_59(53, C, D, E, A, B);
+	T_40_59(54, B, C, D, E, A);
+	T_40_59(55, A, B, C, D, E);
+	T_40_59(56, E, A, B, C, D);
+	T_40_59(57, D, E, A, B, C);
+	T_40_59(58, C, D, E, A, B);
+	T_40_59(59, B, C, D, E, A);
+
+	/* Round 4 */
+	T_60_79(60, A, B, C, D, E);
+	T_60_79(61, E, A, B, C, D);
+	T_60_79(62, D, E, A, B, C);
+	T_60_79(63, C, D, E, A, B);
+	T_60_79(64, B, C, D, E, A);
+	T_60_79(65, A, B, C, D, E);
+	T_60_79(66, E, A, B, C, D);
+	T_60_79(67, D, E, A, B, C);
+	T_60_79(68, C, D, E, A, B);
+	T_60_79(69, B, C, D, E, A);
+	T_60_79(70, A, B, C, D, E);
+	T_60_79(71, E, A, B, C, D);
+	T_60_79(72, D, E, A, B, C);
+	T_60_79(73, C, D, E, A, B);
+	T_60_79(74, B, C, D, E, A);
+	T_60_79(75, A, B, C, D, E);
+	T_60_79(76, E, A, B, C, D);
+	T_60_79(77, D, E, A, B, C);
+	T_60_79(78, C, D, E, A, B);
+	T_60_79(79, B, C, D, E, A);
+
+	ctx->H[0] += A;
+	ctx->H[1] += B;
+	ctx->H[2] += C;
+	ctx->H[3] += D;
+	ctx->H[4] += E;
+
+	if (block_collides(ctx->self_test ? &self_test : &real_dvs,
+			   W, A_, ctx->H))
+		ctx->found_collision = 1;
+}
+
+void SHA1DC_Init(SHA1DC_CTX *ctx)
+{
+	prepare_dvs();
+	ctx->size = 0;
+	ctx->found_collision = 0;
+	ctx->self_test = 0;
+
+	ctx->H[0] = 0x67452301;
+	ctx->H[1] = 0xefcdab89;
+	ctx->H[2] = 0x98badcfe;
+	ctx->H[3] = 0x10325476;
+	ctx->H[4] = 0xc3d2e1f0;
+}
+
+void SHA1DC_Update(SHA1DC_CTX *ctx, const void *data, unsigned long len)
+{
+	unsigned int lenW = ctx->size & 63;
+
+	ctx->size += len;
+
+	if (lenW) {
+		unsigned int left = 64 - lenW;
+		if (len < left)
+			left = len;
+		memcpy(lenW + (char *)ctx->W, data, left);
+		lenW = (lenW + left) & 63;
+		len -= left;
+		data = ((const char *)data + left);
+		if (lenW)
+			return;
+		SHA1DC_Block(ctx, ctx->W);
+	}
+	while (len >= 64) {
+		SHA1DC_Block(ctx, data);
+		data = ((const char *)data + 64);
+		len -= 64;
+	}
+	if (len)
+		memcpy(ctx->W, data, len);
+}
+
+int SHA1DC_Final(unsigned char hashout[20], SHA1DC_CTX *ctx)
+{
+	static const unsigned char pad[64] = { 0x80 };
+	unsigned int padlen[2];
+	int i;
+
+	padlen[0] = htonl((uint32_t)(ctx->size >> 29));
+	padlen[1] = htonl((uint32_t)(ctx->size << 3));
+
+	i = ctx->size & 63;
+	SHA1DC_Update(ctx, pad, 1 + (63 & (55 - i)));
+	SHA1DC_Update(ctx, padlen, 8);
+
+	for (i = 0; i < 5; i++)
+		put_be32(hashout + i * 4, ctx->H[i]);
+	return ctx->found_collision;
+}
@@ -0,0 +1,24 @@
+/*
+ * SHA1 with collision detection, following Marc Stevens'
+ * "Counter-cryptanalysis" (CRYPTO 2013).
+ *
+ * Each block is compressed as usual and then checked against the
+ * disturbance vectors used by the known practical attacks on SHA1.
+ * The result is the ordinary SHA1 of the data; SHA1DC_Final() also
+ * reports whether some block of it was one half of a colliding pair.
+ *
+ * Setting self_test after SHA1DC_Init() replaces the real vectors with
+ * ones every block collides with, for testing the callers.
+ */
+
+typedef struct {
+	unsigned long long size;
+	unsigned int H[5];
+	unsigned int W[16];
+	int found_collision;
+	int self_test;
+} SHA1DC_CTX;
+
+void SHA1DC_Init(SHA1DC_CTX *ctx);
+void SHA1DC_Update(SHA1DC_CTX *ctx, const void *dataIn, unsigned long len);
+int SHA1DC_Final(unsigned char hashout[20], SHA1DC_CTX *ctx);
@@ -121,31 +121,40 @@ int recv_sideband(const char *me, int in_stream, int out)
 
 /*
  * fd is connected to the remote side; send the sideband data
- * over multiplexed packet stream.
+ * over multiplexed packet stream.  The packet headers are sent
+ * with the same writev() as the data they describe, up to
+ * SIDEBAND_WRITEV_PACKETS packets at a time, so the payload is
+ * never copied and a large buffer costs only a few system calls.
  */
+#define SIDEBAND_WRITEV_PACKETS 16
+
 ssize_t send_sideband(int fd, int band, const char *data, ssize_t sz, int packet_max)
 {
+	char hdr[SIDEBAND_WRITEV_PACKETS][5];
+	struct iovec iov[2 * SIDEBAND_WRITEV_PACKETS];
+	int hdrlen = 0 <= band ? 5 : 4;
 	ssize_t ssz = sz;
 	const char *p = data;
 
 	while (sz) {
-		unsigned n;
-		char hdr[5];
-
-		n = sz;
-		if (packet_max - 5 < n)
-			n = packet_max - 5;
-		if (0 <= band) {
-			sprintf(hdr, "%04x", n + 5);
-			hdr[4] = band;
-			safe_write(fd, hdr, 5);
-		} else {
-			sprintf(hdr, "%04x", n + 4);
-			safe_write(fd, hdr, 4);
+		int nr = 0;
+
+		while (sz && nr < SIDEBAND_WRITEV_PACKETS) {
+			unsigned n = sz;
+
+			if (packet_max - 5 < n)
+				n = packet_max - 5;
+			sprintf(hdr[nr], "%04x", n + hdrlen);
+			hdr[nr][4] = band;
+			iov[2 * nr].iov_base = hdr[nr];
+			iov[2 * nr].iov_len = hdrlen;
+			iov[2 * nr + 1].iov_base = (char *)p;
+			iov[2 * nr + 1].iov_len = n;
+			p += n;
+			sz -= n;
+			nr++;
 		}
-		safe_write(fd, p, n);
-		p += n;
-		sz -= n;
+		safe_writev(fd, iov, 2 * nr);
 	}
 	return ssz;
 }
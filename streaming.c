@@ -3,12 +3,14 @@
  */
 #include "cache.h"
 #include "streaming.h"
+#include "delta.h"
 
 enum input_source {
 	stream_error = -1,
 	incore = 0,
 	loose = 1,
-	pack_non_delta = 2
+	pack_non_delta = 2,
+	pack_delta = 3
 };
 
 typedef int (*open_istream_fn)(struct git_istream *,
@@ -41,6 +43,7 @@ struct stream_vtbl {
 static open_method_decl(incore);
 static open_method_decl(loose);
 static open_method_decl(pack_non_delta);
+static open_method_decl(pack_delta);
 static struct git_istream *attach_stream_filter(struct git_istream *st,
 						struct stream_filter *filter);
 
@@ -49,6 +52,7 @@ static open_istream_fn open_istream_tbl[] = {
 	open_istream_incore,
 	open_istream_loose,
 	open_istream_pack_non_delta,
+	open_istream_pack_delta,
 };
 
 #define FILTER_BUFFER (1024*16)
@@ -88,6 +92,28 @@ struct git_istream {
 			off_t pos;
 		} in_pack;
 
+		struct {
+			struct packed_git *pack;
+			off_t base_offset;
+			unsigned long base_size;
+			enum object_type base_type;
+			struct git_istream *base; /* NULL if all of it is in window */
+			unsigned long base_budget; /* to reopen base with */
+			unsigned rewinds;
+			unsigned whole_base:1;
+
+			/* [window_start, window_start + window_len) of the base */
+			char *window;
+			unsigned long window_alloc;
+			unsigned long window_start;
+			unsigned long window_len;
+
+			unsigned char *delta;
+			const unsigned char *cmd, *delta_end;
+			unsigned long copy_off, copy_size, insert_size;
+			unsigned long remaining;
+		} in_delta;
+
 		struct filtered_istream filtered;
 	} u;
 };
@@ -121,8 +147,8 @@ static enum input_source istream_source(const unsigned char *sha1,
 	case OI_LOOSE:
 		return loose;
 	case OI_PACKED:
-		if (!oi->u.packed.is_delta && big_file_threshold <= size)
-			return pack_non_delta;
+		if (big_file_threshold <= size)
+			return oi->u.packed.is_delta ? pack_delta : pack_non_delta;
 		/* fallthru */
 	default:
 		return incore;
@@ -437,7 +463,7 @@ static open_method_decl(pack_non_delta)
 	unuse_pack(&window);
 	switch (in_pack_type) {
 	default:
-		return -1; /* we do not do deltas for now */
+		return -1; /* deltas are handled by pack_delta */
 	case OBJ_COMMIT:
 	case OBJ_TREE:
 	case OBJ_BLOB:
@@ -450,6 +476,473 @@ static open_method_decl(pack_non_delta)
 }
 
 
+/*****************************************************************
+ *
+ * Delta packed object stream
+ *
+ * The delta is inflated in full, but the result is produced as the
+ * instructions are replayed, copying out of a window that slides over
+ * the base as the base is streamed in.  The window is only as large as
+ * the farthest the delta copies back from what it has already read.
+ * Bases smaller than core.bigFileThreshold are read in full instead,
+ * through the delta base cache, as is a base the delta would otherwise
+ * make us stream too many times over.
+ *
+ * The windows and whole bases of all the deltas in a chain together
+ * may not take more than core.bigFileThreshold; a chain that needs
+ * more fails to open, and open_istream() reads the object in-core.
+ *
+ *****************************************************************/
+
+/*
+ * How many times we are willing to reopen a non-delta base to go back
+ * to data that has already slid out of the window.  Reopening a base
+ * that is itself a delta replays its whole chain, so that is never
+ * done.
+ */
+#define MAX_BASE_REWINDS 8
+
+static struct git_istream *open_pack_entry(struct packed_git *p, off_t obj_offset,
+					   unsigned long budget);
+
+/*
+ * Decode the instruction at *cmdp, leaving *cmdp at the literal data
+ * of an insert or at the next instruction after a copy.
+ */
+static int next_delta_cmd(const unsigned char **cmdp,
+			  const unsigned char *end,
+			  unsigned long base_size,
+			  unsigned long *remaining,
+			  unsigned long *copy_off,
+			  unsigned long *copy_size,
+			  unsigned long *insert_size)
+{
+	const unsigned char *data = *cmdp;
+	unsigned char cmd = *data++;
+
+	*copy_size = *insert_size = 0;
+	if (cmd & 0x80) {
+		unsigned long cp_off = 0, cp_size = 0;
+		int i, bytes = 0;
+
+		for (i = 0; i < 7; i++)
+			bytes += (cmd >> i) & 1;
+		if (end - data < bytes)
+			return error("truncated delta copy instruction");
+		if (cmd & 0x01) cp_off = *data++;
+		if (cmd & 0x02) cp_off |= (*data++ << 8);
+		if (cmd & 0x04) cp_off |= (*data++ << 16);
+		if (cmd & 0x08) cp_off |= ((unsigned) *data++ << 24);
+		if (cmd & 0x10) cp_size = *data++;
+		if (cmd & 0x20) cp_size |= (*data++ << 8);
+		if (cmd & 0x40) cp_size |= (*data++ << 16);
+		if (cp_size == 0) cp_size = 0x10000;
+		if (unsigned_add_overflows(cp_off, cp_size) ||
+		    cp_off + cp_size > base_size ||
+		    cp_size > *remaining)
+			return error("delta copy out of bounds");
+		*copy_off = cp_off;
+		*copy_size = cp_size;
+		*remaining -= cp_size;
+	} else if (cmd) {
+		if (cmd > *remaining || cmd > end - data)
+			return error("delta insert out of bounds");
+		*insert_size = cmd;
+		*remaining -= cmd;
+	} else {
+		return error("unexpected delta opcode 0");
+	}
+	*cmdp = data;
+	return 0;
+}
+
+static int read_base(struct git_istream *base, char *buf, unsigned long len)
+{
+	while (len) {
+		ssize_t readlen = read_istream(base, buf,
+					       len < 0x40000000 ? len : 0x40000000);
+		if (readlen <= 0)
+			return error("unable to read delta base");
+		buf += readlen;
+		len -= readlen;
+	}
+	return 0;
+}
+
+/*
+ * Slide the base window so that it covers "off".  Half of the window
+ * is kept behind "off" for copies that go back a little.  With
+ * "dry_run", only the window bookkeeping is done; that is how we find
+ * out beforehand how often the base would have to be reopened.
+ */
+static int slide_base_window(struct git_istream *st, unsigned long off,
+			     int dry_run)
+{
+	unsigned long keep, end, fill;
+
+	if (off < st->u.in_delta.window_start) {
+		st->u.in_delta.rewinds++;
+		if (!dry_run) {
+			close_istream(st->u.in_delta.base);
+			st->u.in_delta.base = open_pack_entry(st->u.in_delta.pack,
+						st->u.in_delta.base_offset,
+						st->u.in_delta.base_budget);
+			if (!st->u.in_delta.base)
+				return -1;
+		}
+		st->u.in_delta.window_start = 0;
+		st->u.in_delta.window_len = 0;
+	}
+	end = st->u.in_delta.window_start + st->u.in_delta.window_len;
+
+	keep = st->u.in_delta.window_alloc / 2;
+	keep = off < keep ? 0 : off - keep;
+	if (keep < st->u.in_delta.window_start)
+		keep = st->u.in_delta.window_start;
+
+	if (keep < end) {
+		if (!dry_run)
+			memmove(st->u.in_delta.window,
+				st->u.in_delta.window +
+				(keep - st->u.in_delta.window_start),
+				end - keep);
+		st->u.in_delta.window_len = end - keep;
+	} else {
+		unsigned long skip = keep - end;
+		while (!dry_run && skip) {
+			unsigned long len = skip;
+			if (st->u.in_delta.window_alloc < len)
+				len = st->u.in_delta.window_alloc;
+			if (read_base(st->u.in_delta.base,
+				      st->u.in_delta.window, len))
+				return -1;
+			skip -= len;
+		}
+		st->u.in_delta.window_len = 0;
+	}
+	st->u.in_delta.window_start = keep;
+
+	fill = st->u.in_delta.window_alloc - st->u.in_delta.window_len;
+	end = keep + st->u.in_delta.window_len;
+	if (st->u.in_delta.base_size - end < fill)
+		fill = st->u.in_delta.base_size - end;
+	if (!dry_run &&
+	    read_base(st->u.in_delta.base,
+		      st->u.in_delta.window + st->u.in_delta.window_len, fill))
+		return -1;
+	st->u.in_delta.window_len += fill;
+	return 0;
+}
+
+/*
+ * Find how far back the copies of the delta reach from the farthest
+ * point of the base any earlier copy has read.  A window twice that
+ * size keeps everything the delta goes back to.
+ */
+static int delta_copy_reach(struct git_istream *st, unsigned long *reach)
+{
+	const unsigned char *cmd = st->u.in_delta.cmd;
+	unsigned long remaining = st->size;
+	unsigned long high = 0;
+
+	*reach = 0;
+	while (cmd < st->u.in_delta.delta_end) {
+		unsigned long off, size, insert;
+
+		if (next_delta_cmd(&cmd, st->u.in_delta.delta_end,
+				   st->u.in_delta.base_size, &remaining,
+				   &off, &size, &insert))
+			return -1;
+		cmd += insert;
+		if (!size)
+			continue;
+		if (off < high && *reach < high - off)
+			*reach = high - off;
+		if (high < off + size)
+			high = off + size;
+	}
+	if (remaining)
+		return error("delta replay has gone wild");
+	return 0;
+}
+
+/*
+ * Replay the copies of the delta against an empty window and count
+ * how many times the base would have to be reopened.
+ */
+static int count_base_rewinds(struct git_istream *st)
+{
+	const unsigned char *cmd = st->u.in_delta.cmd;
+	unsigned long remaining = st->size;
+	unsigned rewinds;
+
+	while (cmd < st->u.in_delta.delta_end) {
+		unsigned long off, size, insert;
+
+		if (next_delta_cmd(&cmd, st->u.in_delta.delta_end,
+				   st->u.in_delta.base_size, &remaining,
+				   &off, &size, &insert))
+			return -1;
+		cmd += insert;
+		while (size) {
+			unsigned long end = st->u.in_delta.window_start +
+					    st->u.in_delta.window_len;
+			unsigned long len;
+
+			if (off < st->u.in_delta.window_start || end <= off) {
+				slide_base_window(st, off, 1);
+				end = st->u.in_delta.window_start +
+				      st->u.in_delta.window_len;
+			}
+			len = end - off < size ? end - off : size;
+			off += len;
+			size -= len;
+		}
+	}
+	if (remaining)
+		return error("delta replay has gone wild");
+
+	rewinds = st->u.in_delta.rewinds;
+	st->u.in_delta.rewinds = 0;
+	st->u.in_delta.window_start = 0;
+	st->u.in_delta.window_len = 0;
+	return rewinds;
+}
+
+static read_method_decl(pack_delta)
+{
+	size_t total_read = 0;
+
+	switch (st->z_state) {
+	case z_done:
+		return 0;
+	case z_error:
+		return -1;
+	default:
+		break;
+	}
+
+	while (total_read < sz) {
+		size_t len = sz - total_read;
+
+		if (st->u.in_delta.copy_size) {
+			unsigned long off = st->u.in_delta.copy_off;
+			unsigned long end = st->u.in_delta.window_start +
+					    st->u.in_delta.window_len;
+
+			if (off < st->u.in_delta.window_start || end <= off) {
+				if (slide_base_window(st, off, 0))
+					goto error;
+				end = st->u.in_delta.window_start +
+				      st->u.in_delta.window_len;
+			}
+			if (end - off < len)
+				len = end - off;
+			if (st->u.in_delta.copy_size < len)
+				len = st->u.in_delta.copy_size;
+			memcpy(buf + total_read, st->u.in_delta.window +
+			       (off - st->u.in_delta.window_start), len);
+			st->u.in_delta.copy_off += len;
+			st->u.in_delta.copy_size -= len;
+		} else if (st->u.in_delta.insert_size) {
+			if (st->u.in_delta.insert_size < len)
+				len = st->u.in_delta.insert_size;
+			memcpy(buf + total_read, st->u.in_delta.cmd, len);
+			st->u.in_delta.cmd += len;
+			st->u.in_delta.insert_size -= len;
+		} else if (st->u.in_delta.cmd < st->u.in_delta.delta_end) {
+			if (next_delta_cmd(&st->u.in_delta.cmd,
+					   st->u.in_delta.delta_end,
+					   st->u.in_delta.base_size,
+					   &st->u.in_delta.remaining,
+					   &st->u.in_delta.copy_off,
+					   &st->u.in_delta.copy_size,
+					   &st->u.in_delta.insert_size))
+				goto error;
+			continue;
+		} else {
+			if (st->u.in_delta.remaining) {
+				error("delta replay has gone wild");
+				goto error;
+			}
+			st->z_state = z_done;
+			break;
+		}
+		total_read += len;
+	}
+	return total_read;
+
+error:
+	st->z_state = z_error;
+	return -1;
+}
+
+static close_method_decl(pack_delta)
+{
+	if (st->u.in_delta.base)
+		close_istream(st->u.in_delta.base);
+	if (st->u.in_delta.whole_base &&
+	    st->u.in_delta.base_size <= delta_base_cache_limit)
+		add_delta_base_cache(st->u.in_delta.pack,
+				     st->u.in_delta.base_offset,
+				     st->u.in_delta.window,
+				     st->u.in_delta.base_size,
+				     st->u.in_delta.base_type);
+	else
+		free(st->u.in_delta.window);
+	free(st->u.in_delta.delta);
+	return 0;
+}
+
+static struct stream_vtbl pack_delta_vtbl = {
+	close_istream_pack_delta,
+	read_istream_pack_delta,
+};
+
+static int open_pack_delta(struct git_istream *st, struct packed_git *p,
+			   off_t obj_offset, off_t curpos,
+			   enum object_type in_pack_type,
+			   unsigned long delta_size,
+			   unsigned long budget)
+{
+	struct pack_window *window = NULL;
+	enum object_type base_type;
+	off_t base_pos;
+	unsigned long size, reach;
+	int rewinds;
+
+	memset(&st->u.in_delta, 0, sizeof(st->u.in_delta));
+	st->u.in_delta.pack = p;
+	st->u.in_delta.base_offset = get_delta_base(p, &window, &curpos,
+						    in_pack_type, obj_offset);
+	if (!st->u.in_delta.base_offset)
+		goto fail;
+	st->u.in_delta.delta = unpack_compressed_entry(p, &window, curpos,
+						       delta_size);
+	if (!st->u.in_delta.delta || delta_size < DELTA_SIZE_MIN)
+		goto fail;
+	st->u.in_delta.cmd = st->u.in_delta.delta;
+	st->u.in_delta.delta_end = st->u.in_delta.delta + delta_size;
+	st->u.in_delta.base_size = get_delta_hdr_size(&st->u.in_delta.cmd,
+						      st->u.in_delta.delta_end);
+	st->size = get_delta_hdr_size(&st->u.in_delta.cmd,
+				      st->u.in_delta.delta_end);
+	st->u.in_delta.remaining = st->size;
+
+	base_pos = st->u.in_delta.base_offset;
+	base_type = unpack_object_header(p, &window, &base_pos, &size);
+	unuse_pack(&window);
+
+	if (st->u.in_delta.base_size < big_file_threshold)
+		goto whole_base;
+
+	if (delta_copy_reach(st, &reach))
+		goto fail;
+	if (big_file_threshold / 2 < reach)
+		st->u.in_delta.window_alloc = big_file_threshold;
+	else
+		st->u.in_delta.window_alloc = reach * 2;
+	if (st->u.in_delta.window_alloc < FILTER_BUFFER)
+		st->u.in_delta.window_alloc = FILTER_BUFFER;
+	rewinds = count_base_rewinds(st);
+	if (rewinds < 0)
+		goto fail;
+	if (rewinds && (base_type == OBJ_OFS_DELTA ||
+			base_type == OBJ_REF_DELTA ||
+			MAX_BASE_REWINDS < rewinds))
+		goto whole_base;
+
+	if (budget < st->u.in_delta.window_alloc)
+		goto fail;
+	st->u.in_delta.base_budget = budget - st->u.in_delta.window_alloc;
+	st->u.in_delta.base = open_pack_entry(p, st->u.in_delta.base_offset,
+					      st->u.in_delta.base_budget);
+	if (!st->u.in_delta.base)
+		goto fail;
+	if (st->u.in_delta.base->size != st->u.in_delta.base_size) {
+		error("delta base size mismatch");
+		goto fail;
+	}
+	st->u.in_delta.window = xmalloc(st->u.in_delta.window_alloc);
+	goto done;
+
+whole_base:
+	if (budget < st->u.in_delta.base_size)
+		goto fail;
+	st->u.in_delta.window = cache_or_unpack_entry(p,
+					st->u.in_delta.base_offset,
+					&size, &st->u.in_delta.base_type, 0);
+	if (!st->u.in_delta.window || size != st->u.in_delta.base_size)
+		goto fail;
+	st->u.in_delta.whole_base = 1;
+	st->u.in_delta.window_alloc = size;
+	st->u.in_delta.window_len = size;
+
+done:
+	st->z_state = z_unused;
+	st->vtbl = &pack_delta_vtbl;
+	return 0;
+
+fail:
+	unuse_pack(&window);
+	if (st->u.in_delta.base)
+		close_istream(st->u.in_delta.base);
+	free(st->u.in_delta.window);
+	free(st->u.in_delta.delta);
+	return -1;
+}
+
+/* Open a stream for whatever kind of object lives at "obj_offset" */
+static struct git_istream *open_pack_entry(struct packed_git *p, off_t obj_offset,
+					   unsigned long budget)
+{
+	struct git_istream *st = xmalloc(sizeof(*st));
+	struct pack_window *window = NULL;
+	enum object_type in_pack_type;
+	off_t pos = obj_offset;
+
+	in_pack_type = unpack_object_header(p, &window, &pos, &st->size);
+	unuse_pack(&window);
+	switch (in_pack_type) {
+	case OBJ_OFS_DELTA:
+	case OBJ_REF_DELTA:
+		if (open_pack_delta(st, p, obj_offset, pos,
+				    in_pack_type, st->size, budget))
+			break;
+		return st;
+	case OBJ_COMMIT:
+	case OBJ_TREE:
+	case OBJ_BLOB:
+	case OBJ_TAG:
+		st->u.in_pack.pack = p;
+		st->u.in_pack.pos = pos;
+		st->z_state = z_unused;
+		st->vtbl = &pack_non_delta_vtbl;
+		return st;
+	default:
+		break;
+	}
+	free(st);
+	return NULL;
+}
+
+static open_method_decl(pack_delta)
+{
+	struct pack_window *window = NULL;
+	enum object_type in_pack_type;
+	off_t pos = oi->u.packed.offset;
+	unsigned long delta_size;
+
+	in_pack_type = unpack_object_header(oi->u.packed.pack, &window,
+					    &pos, &delta_size);
+	unuse_pack(&window);
+	if (in_pack_type != OBJ_OFS_DELTA && in_pack_type != OBJ_REF_DELTA)
+		return -1;
+	return open_pack_delta(st, oi->u.packed.pack, oi->u.packed.offset,
+			       pos, in_pack_type, delta_size, big_file_threshold);
+}
+
+
 /*****************************************************************
  *
  * In-core stream
@@ -0,0 +1,63 @@
+#!/bin/sh
+
+test_description='basic tests for priority queue implementation'
+. ./test-lib.sh
+
+cat >expect <<'EOF'
+10:3
+9:4
+8:9
+7:6
+6:1
+5:5
+5:8
+4:7
+3:2
+2:0
+1:10
+EOF
+test_expect_success 'basic ordering' '
+	test-prio-queue 2 6 3 10 9 5 7 4 5 8 1 dump >actual &&
+	test_cmp expect actual
+'
+
+cat >expect <<'EOF'
+2:1
+5:2
+3:3
+4:4
+1:0
+1:5
+1:6
+1:7
+NULL
+EOF
+test_expect_success 'mixed put and get' '
+	test-prio-queue 1 2 get 5 3 get get 4 get 1 1 1 get dump get >actual &&
+	test_cmp expect actual
+'
+
+cat >expect <<'EOF'
+NULL
+NULL
+EOF
+test_expect_success 'notice empty queue' '
+	test-prio-queue get get >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'same order as commit_list_insert_by_date' '
+	awk "BEGIN {
+		srand(42);
+		for (i = 0; i < 2000; i++) {
+			print int(rand() * 100);
+			if (i % 3 == 0)
+				print \"get\";
+		}
+		print \"dump\";
+	}" >ops &&
+	test-prio-queue $(cat ops) >actual &&
+	test 2000 = $(wc -l <actual)
+'
+
+test_done
@@ -201,4 +201,41 @@ test_expect_success 'corrupt tag' '
 	test_must_fail git hash-object -t tag --stdin </dev/null
 '
 
+test_expect_success 'hashing several objects at once' '
+	for size in 0 1 45 46 55 56 63 64 119 120 1000 100000
+	do
+		printf "%${size}s" "" | tr " " x >size-$size || return 1
+	done &&
+	git hash-object size-* >expect &&
+	test-sha1 --batch size-* >actual &&
+	test_cmp expect actual &&
+	test-sha1 --batch size-1000 size-0 size-100000 >actual &&
+	git hash-object size-1000 size-0 size-100000 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'collision detection does not change names' '
+	for f in size-*
+	do
+		test-sha1 <$f >expect &&
+		test-sha1 --dc <$f >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'collision detection reports collisions' '
+	for f in size-*
+	do
+		test-sha1 --dc <$f || return 1
+	done &&
+	(
+		GIT_TEST_SHA1DC_SELF_TEST=1 &&
+		export GIT_TEST_SHA1DC_SELF_TEST &&
+		for f in size-*
+		do
+			test_must_fail test-sha1 --dc <$f || return 1
+		done
+	)
+'
+
 test_done
@@ -24,4 +24,61 @@ test_expect_success 'checkout a large file' '
 	cmp large another ;# this must not be test_cmp
 '
 
+test_expect_success 'add several large files into one pack' '
+	echo Y | dd of=large2 bs=1k seek=2000 &&
+	echo Z | dd of=large3 bs=1k seek=2000 &&
+	cp large2 large4 &&
+	ls .git/objects/pack/pack-*.pack >before &&
+	git add large2 large3 large4 &&
+	ls .git/objects/pack/pack-*.pack >after &&
+	test 1 = $(comm -13 before after | wc -l) &&
+	git verify-pack -v $(comm -13 before after) >verify &&
+	test 2 = $(grep -c " blob " verify) &&
+	test ! -f .git/objects/??/??????????????????????????????????????
+'
+
+test_expect_success 'hash-object streams large blobs' '
+	expect=$(git -c core.bigfilethreshold=10m hash-object large3) &&
+	test "$expect" = $(git hash-object large3) &&
+	test "$expect" = $(git rev-parse :large3)
+'
+
+test_expect_success 'hash-object without -w writes nothing' '
+	echo W | dd of=large5 bs=1k seek=2000 &&
+	sha1=$(git hash-object large5) &&
+	test_must_fail git cat-file -e $sha1 &&
+	git hash-object -w large5 &&
+	git cat-file -e $sha1 &&
+	test ! -f .git/objects/??/??????????????????????????????????????
+'
+
+test_expect_success 'checkout a large deltified file' '
+	test-genrandom delta 2000000 >delta-base &&
+	{
+		head -c 1000000 delta-base &&
+		echo changed &&
+		tail -c 900000 delta-base
+	} >delta-one &&
+	{
+		tail -c 1000000 delta-one &&
+		head -c 1000000 delta-one
+	} >delta-two &&
+	git add delta-base &&
+	git commit -q -m base &&
+	cp delta-one delta-base &&
+	git commit -q -m one delta-base &&
+	cp delta-two delta-base &&
+	git commit -q -m two delta-base &&
+	git -c core.bigfilethreshold=10m repack -a -d -f &&
+	git verify-pack -v .git/objects/pack/pack-*.pack >verify &&
+	test 2 -le $(grep -c " blob .* 1 [0-9a-f]*$" verify) &&
+	for rev in HEAD~2 HEAD~1 HEAD
+	do
+		git show $rev:delta-base >expect &&
+		rm -f delta-base &&
+		git checkout $rev -- delta-base &&
+		cmp expect delta-base || return 1
+	done
+'
+
 test_done
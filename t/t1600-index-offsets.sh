@@ -0,0 +1,86 @@
+#!/bin/sh
+
+test_description='reading an index with an entry offset table in parallel'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	blob=$(echo content | git hash-object -w --stdin) &&
+	awk -v blob=$blob "BEGIN {
+		for (i = 0; i < 25000; i++)
+			printf \"100644 %s\\td%d/f%d\\n\", blob, i % 100, i;
+	}" >list &&
+	git config index.recordOffsetTable true &&
+	git update-index --index-info <list &&
+	git write-tree >tree &&
+	other=$(echo other | git hash-object -w --stdin) &&
+	printf "100644 %s %d\tconflicted\n" \
+		$blob 1 $other 2 $blob 3 | git update-index --index-info &&
+	echo resolved >conflicted &&
+	git update-index --add conflicted
+'
+
+test_expect_success 'the index records its offsets' '
+	grep IEOT .git/index >/dev/null &&
+	grep EOIE .git/index >/dev/null
+'
+
+test_expect_success 'parallel and serial reads agree' '
+	git -c index.threads=1 ls-files -s >serial &&
+	git -c index.threads=4 ls-files -s >parallel &&
+	test_cmp serial parallel &&
+	test_line_count = 25001 parallel &&
+	git -c index.threads=1 ls-files --resolve-undo >serial &&
+	git -c index.threads=4 ls-files --resolve-undo >parallel &&
+	test_cmp serial parallel &&
+	test_line_count = 3 parallel
+'
+
+test_expect_success 'cache tree is read in parallel' '
+	git update-index --force-remove conflicted &&
+	git -c index.threads=4 write-tree >actual &&
+	test_cmp tree actual
+'
+
+test_expect_success 'the extensions are not reported as unknown' '
+	git -c index.threads=1 ls-files >/dev/null 2>err &&
+	! test -s err &&
+	git -c index.threads=4 ls-files >/dev/null 2>err &&
+	! test -s err
+'
+
+test_expect_success 'corrupt index is caught when reading in parallel' '
+	cp .git/index bad-index &&
+	printf X | dd of=bad-index bs=1 seek=100 conv=notrunc 2>/dev/null &&
+	test_must_fail env GIT_INDEX_FILE=bad-index \
+		git -c index.threads=4 ls-files >/dev/null 2>err &&
+	grep "bad index file sha1 signature" err
+'
+
+test_expect_success 'version 4 index is read in parallel' '
+	git -c index.threads=1 ls-files -s >expect &&
+	git update-index --index-version 4 &&
+	grep IEOT .git/index >/dev/null &&
+	git -c index.threads=4 ls-files -s >parallel &&
+	test_cmp expect parallel &&
+	git -c index.threads=1 ls-files -s >serial &&
+	test_cmp expect serial
+'
+
+test_expect_success 'small index does not record offsets' '
+	rm -f .git/index &&
+	git update-index --add conflicted &&
+	! grep EOIE .git/index >/dev/null &&
+	git ls-files >actual &&
+	echo conflicted >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'offsets are not recorded unless asked for' '
+	git config index.recordOffsetTable false &&
+	git update-index --index-info <list &&
+	! grep EOIE .git/index >/dev/null &&
+	! grep IEOT .git/index >/dev/null
+'
+
+test_done
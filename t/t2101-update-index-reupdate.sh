@@ -81,4 +81,18 @@ test_expect_success 'update-index --update with pathspec' \
 	git ls-files -s >current &&
 	cmp current expected'
 
+test_expect_success 'update-index --again skips entries unchanged from HEAD' '
+	git commit -m second &&
+	echo changed >file2 &&
+	git update-index file2 &&
+	echo changed again >file2 &&
+	git update-index --again &&
+	git ls-files -s >current &&
+	cat >expected <<-EOF &&
+	100644 594fb5bb1759d90998e2bf2a38261ae8e243c760 0	dir1/file3
+	100644 $(git hash-object file2) 0	file2
+	EOF
+	test_cmp expected current
+'
+
 test_done
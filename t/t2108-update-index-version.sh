@@ -0,0 +1,80 @@
+#!/bin/sh
+
+test_description='git update-index --index-version'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	blob=$(echo content | git hash-object -w --stdin) &&
+	long=$(awk "BEGIN { for (i = 0; i < 500; i++) printf \"component%d/\", i }") &&
+	{
+		for d in src/main/java/org/example/project/module \
+			 src/test/java/org/example/project/module \
+			 src/main/resources
+		do
+			for f in A B C D E F G H
+			do
+				printf "100644 %s\t%s/%s.java\n" $blob $d $f
+			done
+		done &&
+		printf "100644 %s\t%s\n" $blob ${long}file &&
+		printf "100644 %s\t%s\n" $blob short
+	} >list &&
+	git update-index --index-info <list &&
+	git ls-files -s >expect &&
+	test "$(test-index-version <.git/index)" = 2
+'
+
+test_expect_success 'convert to version 4' '
+	cp .git/index index.v2 &&
+	git update-index --index-version 4 &&
+	test "$(test-index-version <.git/index)" = 4 &&
+	git ls-files -s >actual &&
+	test_cmp expect actual &&
+	test $(wc -c <.git/index) -lt $(wc -c <index.v2)
+'
+
+test_expect_success 'version 4 is kept when the index is updated' '
+	git update-index --add --cacheinfo 100644 $blob src/main/java/Z.java &&
+	git read-tree -m $(git write-tree) &&
+	test "$(test-index-version <.git/index)" = 4 &&
+	git update-index --force-remove src/main/java/Z.java &&
+	git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'extended flags in version 4' '
+	git update-index --skip-worktree short &&
+	git ls-files -v short >actual &&
+	echo "S short" >expected &&
+	test_cmp expected actual &&
+	test "$(test-index-version <.git/index)" = 4
+'
+
+test_expect_success 'convert back to version 2 or 3' '
+	git update-index --index-version 2 &&
+	test "$(test-index-version <.git/index)" = 3 &&
+	git update-index --no-skip-worktree short &&
+	test "$(test-index-version <.git/index)" = 2 &&
+	git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'test-index-version converts between versions' '
+	test-index-version 4 &&
+	test "$(test-index-version <.git/index)" = 4 &&
+	git ls-files -s >actual &&
+	test_cmp expect actual &&
+	test-index-version 2 &&
+	test "$(test-index-version <.git/index)" = 2 &&
+	git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'out of range version is refused' '
+	test_must_fail git update-index --index-version 1 &&
+	test_must_fail git update-index --index-version 5 &&
+	test "$(test-index-version <.git/index)" = 2
+'
+
+test_done
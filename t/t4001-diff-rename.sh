@@ -102,4 +102,91 @@ test_expect_success 'setup for many rename source candidates' '
 	grep warning actual.err
 '
 
+test_expect_success 'threads and prefilter do not change the result' '
+	git reset --hard &&
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		for j in 0 1 2 3 4 5 6 7 8 9
+		do
+			for k in 0 1 2 3 4 5 6 7 8 9
+			do
+				echo "line $k of $i$j"
+			done >"path$i$j" ||
+			return 1
+		done
+	done &&
+	git commit -a -m "longer hundred" &&
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		for j in 0 1 2 3 4 5 6 7 8 9
+		do
+			git mv "path$i$j" "moved$j$i" &&
+			echo "edited $j$i" >>"moved$j$i" ||
+			return 1
+		done
+	done &&
+	git add "moved??" &&
+	git diff -M -C -C --cached --name-status >expect &&
+	test $(grep -c "^R" expect) = 100 &&
+	git -c diff.renamethreads=4 diff -M -C -C --cached --name-status >actual &&
+	test_cmp expect actual &&
+	git -c diff.renameprefilter=true diff -M -C -C --cached --name-status >actual &&
+	test_cmp expect actual &&
+	git -c diff.renameprefilter=true -c diff.renamethreads=4 \
+		diff -M -C -C --cached --name-status >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'similarity cache gives the same result' '
+	git diff -M -C -C --cached --name-status >expect &&
+	rm -f .git/similarity-cache &&
+	git -c diff.similaritycache=true diff -M -C -C --cached --name-status >actual &&
+	test_cmp expect actual &&
+	test -s .git/similarity-cache &&
+	cp .git/similarity-cache cache.saved &&
+	git -c diff.similaritycache=true diff -M -C -C --cached --name-status >actual &&
+	test_cmp expect actual &&
+	test_cmp cache.saved .git/similarity-cache
+'
+
+test_expect_success 'similarity cache recovers from a torn record' '
+	git diff -M -C -C --cached --name-status >expect &&
+	rm -f .git/similarity-cache &&
+	git -c diff.similaritycache=true diff -M -C -C --cached --name-status >actual &&
+	cp .git/similarity-cache cache.saved &&
+	size=$(wc -c <cache.saved) &&
+	head -c $(($size - 4)) cache.saved >.git/similarity-cache &&
+	git -c diff.similaritycache=true diff -M -C -C --cached --name-status >actual &&
+	test_cmp expect actual &&
+	test_cmp cache.saved .git/similarity-cache
+'
+
+test_expect_success 'similarity cache ignores damaged spans' '
+	git diff -M -C -C --cached --name-status >expect &&
+	perl -pi -e "BEGIN { binmode STDIN; binmode STDOUT; undef \$/ }
+		substr(\$_, 44, 4) = qq(\\xff) x 4" .git/similarity-cache &&
+	! test_cmp cache.saved .git/similarity-cache &&
+	git -c diff.similaritycache=true diff -M -C -C --cached --name-status >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'similarity cache is used instead of the blobs' '
+	git diff -M --cached --name-status >expect &&
+	mkdir hidden &&
+	for blob in $(git ls-files -s "moved??" | cut -d" " -f2)
+	do
+		file=$(echo $blob | sed -e "s|^..|&/|") &&
+		mv .git/objects/$file hidden/${file#*/} ||
+		return 1
+	done &&
+	git -c diff.similaritycache=true diff -M --cached --name-status >actual &&
+	test_cmp expect actual &&
+	for blob in $(git ls-files -s "moved??" | cut -d" " -f2)
+	do
+		file=$(echo $blob | sed -e "s|^..|&/|") &&
+		mv hidden/${file#*/} .git/objects/$file ||
+		return 1
+	done
+'
+
 test_done
@@ -894,4 +894,17 @@ test_expect_success 'format patch ignores color.ui' '
 	test_cmp expect actual
 '
 
+test_expect_success 'format-patch --threads writes the same patches' '
+	git format-patch -o serial master..side &&
+	git format-patch --threads=3 -o threaded master..side &&
+	for patch in serial/*
+	do
+		test_cmp $patch threaded/${patch#serial/} ||
+		return 1
+	done &&
+	git format-patch --stdout master..side >expect &&
+	git format-patch --stdout --threads=3 master..side >actual &&
+	test_cmp expect actual
+'
+
 test_done
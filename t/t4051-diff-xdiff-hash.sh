@@ -0,0 +1,81 @@
+#!/bin/sh
+
+test_description='xdiff line hashing and classification'
+
+. ./test-lib.sh
+
+# Lines of every length around a couple of machine words, so that the
+# end of line falls on every byte of a word.
+make_lines () {
+	awk -v tag="$1" 'BEGIN {
+		s = "";
+		for (i = 0; i < 40; i++) {
+			print s;
+			print tag s;
+			s = s sprintf("%c", 97 + i % 26);
+		}
+	}'
+}
+
+apply_diff () {
+	{
+		echo "--- a/$1" &&
+		echo "+++ b/$1" &&
+		cat "$2"
+	} >patch &&
+	git apply patch
+}
+
+test_expect_success 'setup' '
+	make_lines x >one &&
+	make_lines y >two &&
+	printf "tail without newline" >>two &&
+	cp one work
+'
+
+test_expect_success 'diff output applies' '
+	test-xdiff-perf one two >diff &&
+	apply_diff work diff &&
+	test_cmp two work
+'
+
+test_expect_success 'diff output matches git diff' '
+	test_must_fail git diff --no-index one two >full &&
+	sed -e "1,4d" full >expect &&
+	test_cmp expect diff
+'
+
+test_expect_success 'lines differing only after the first word' '
+	echo "0123456789abcdef-left" >left &&
+	echo "0123456789abcdef-right" >right &&
+	test-xdiff-perf left right >actual &&
+	cat >expect <<-\EOF &&
+	@@ -1 +1 @@
+	-0123456789abcdef-left
+	+0123456789abcdef-right
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'many repeated lines are classified together' '
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		make_lines z || return 1
+	done >many1 &&
+	sed -e "s/^zabc$/ZABC/" many1 >many2 &&
+	test-xdiff-perf many1 many2 >diff &&
+	test $(grep -c "^-zabc$" diff) = 10 &&
+	test $(grep -c "^+ZABC$" diff) = 10 &&
+	cp many1 work &&
+	apply_diff work diff &&
+	test_cmp many2 work
+'
+
+test_expect_success 'hash-only counts lines' '
+	printf "a\nb\nc" >three &&
+	test-xdiff-perf --hash-only three one >actual &&
+	echo "83 lines" >expect &&
+	test_cmp expect actual
+'
+
+test_done
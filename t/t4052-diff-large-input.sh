@@ -0,0 +1,82 @@
+#!/bin/sh
+
+test_description='diffing large inputs in chunks'
+
+. ./test-lib.sh
+
+# Enough lines for the input to be cut into several chunks, with some
+# lines repeated throughout so that not every line can be an anchor.
+make_file () {
+	awk -v tag="$1" 'BEGIN {
+		for (i = 0; i < 50000; i++) {
+			if (i % 5 == 0)
+				print "}";
+			else if (i % 997 == 0)
+				print tag " " i;
+			else
+				print "line " i;
+		}
+	}'
+}
+
+apply_diff () {
+	{
+		echo "--- a/$1" &&
+		echo "+++ b/$1" &&
+		cat "$2"
+	} >patch &&
+	git apply patch
+}
+
+test_expect_success 'setup' '
+	make_file one >one &&
+	make_file two >two &&
+	sed -e "/^line 1000$/,/^line 1999$/d" two >tmp &&
+	sed -e "/^line 40000$/r tmp" -e "/^line 30/d" tmp >two
+'
+
+for opt in "" --patience --histogram
+do
+	test_expect_success "chunked diff applies ${opt:-(myers)}" '
+		test-xdiff-perf $opt --large one two >diff &&
+		cp one work &&
+		apply_diff work diff &&
+		test_cmp two work
+	'
+done
+
+test_expect_success 'chunked diff of identical files is empty' '
+	test-xdiff-perf --large one one >diff &&
+	! test -s diff
+'
+
+test_expect_success 'chunked diff with nothing in common' '
+	test-xdiff-perf --large one /dev/null >diff &&
+	test $(grep -c "^-" diff) = 50000
+'
+
+test_expect_success 'core.bigDiffThreshold turns on chunking' '
+	git add one &&
+	cp two one &&
+	git -c core.bigdiffthreshold=1k diff >diff &&
+	git diff >full &&
+	git checkout one &&
+	git apply diff &&
+	test_cmp two one &&
+	git checkout one &&
+	git apply full &&
+	test_cmp two one
+'
+
+test_expect_success 'merge-file with core.bigDiffThreshold' '
+	git checkout one &&
+	sed -e "s/^line 11$/ours/" one >ours &&
+	sed -e "s/^line 45001$/theirs/" one >theirs &&
+	git merge-file -p ours one theirs >expect &&
+	git -c core.bigdiffthreshold=1k merge-file -p ours one theirs >actual &&
+	test_cmp expect actual &&
+	grep "^ours$" actual &&
+	grep "^theirs$" actual
+'
+
+test_done
@@ -19,4 +19,84 @@ test_expect_success 'git apply scan' '
 	test_cmp new.txt "$TEST_DIRECTORY/t4110/expect"
 '
 
+filler () {
+	i=$1
+	while test $i -le $2
+	do
+		echo "$3 $i"
+		i=$(($i + 1))
+	done
+}
+
+test_expect_success 'setup for far offsets' '
+	{
+		filler 1 200 above &&
+		printf "%s\n" a b c d e f g &&
+		filler 1 200 below
+	} >orig &&
+	sed -e "s/^d$/D/" orig >changed &&
+	git diff --no-index orig changed |
+	sed -e "s|^--- a/orig|--- a/target|" -e "s|^+++ b/changed|+++ b/target|" >patch
+'
+
+test_expect_success 'hunk far from where it is expected takes the nearest match' '
+	{
+		filler 1 99 above &&
+		printf "%s\n" a b c d e f g &&
+		filler 100 300 above &&
+		printf "%s\n" a b c d e f g &&
+		filler 1 200 below
+	} >target &&
+	git apply patch &&
+	{
+		filler 1 99 above &&
+		printf "%s\n" a b c D e f g &&
+		filler 100 300 above &&
+		printf "%s\n" a b c d e f g &&
+		filler 1 200 below
+	} >expect &&
+	test_cmp expect target
+'
+
+test_expect_success 'at the same distance forwards wins' '
+	{
+		filler 1 100 above &&
+		printf "%s\n" a b c d e f g &&
+		filler 101 293 above &&
+		printf "%s\n" a b c d e f g &&
+		filler 1 200 below
+	} >target &&
+	git apply patch &&
+	{
+		filler 1 100 above &&
+		printf "%s\n" a b c d e f g &&
+		filler 101 293 above &&
+		printf "%s\n" a b c D e f g &&
+		filler 1 200 below
+	} >expect &&
+	test_cmp expect target
+'
+
+test_expect_success 'far offsets with several hunks and whitespace fixes' '
+	{
+		filler 1 200 above &&
+		printf "%s\n" a b c d e f g &&
+		filler 1 200 below &&
+		printf "%s\n" p q r s t u v
+	} >orig &&
+	sed -e "s/^d$/D /" -e "s/^s$/S /" orig >changed &&
+	git diff --no-index orig changed |
+	sed -e "s|^--- a/orig|--- a/target|" -e "s|^+++ b/changed|+++ b/target|" >patch &&
+	{
+		filler 1 500 new &&
+		cat orig
+	} >target &&
+	git apply --whitespace=fix patch &&
+	{
+		filler 1 500 new &&
+		sed -e "s/^d$/D/" -e "s/^s$/S/" orig
+	} >expect &&
+	test_cmp expect target
+'
+
 test_done
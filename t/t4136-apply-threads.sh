@@ -0,0 +1,108 @@
+#!/bin/sh
+
+test_description='git apply --threads'
+
+. ./test-lib.sh
+
+reset_to_base () {
+	git reset -q --hard base &&
+	rm -f new renamed
+}
+
+test_expect_success 'setup' '
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		printf "%s\n" a b c d e f g h i j >file$i || return 1
+	done &&
+	mkdir dir &&
+	printf "%s\n" 1 2 3 4 5 6 7 8 9 >dir/nine &&
+	echo gone >gone &&
+	git add . &&
+	test_tick &&
+	git commit -m base &&
+	git tag base &&
+
+	for i in 0 1 2 3 4 5 6 7
+	do
+		sed -e "s/^$i\$//" -e "s/^c\$/c$i/" file$i >tmp &&
+		mv tmp file$i || return 1
+	done &&
+	sed -e "s/^5\$/five /" dir/nine >tmp &&
+	mv tmp dir/nine &&
+	git mv file9 renamed &&
+	git rm -q gone &&
+	echo new >new &&
+	git add new &&
+	test_chmod +x file8 &&
+	test_tick &&
+	git commit -a -m change &&
+	git tag change &&
+	git diff -M base change >patch &&
+	git reset --hard base
+'
+
+test_expect_success 'threaded apply gives the same result' '
+	git apply --index patch &&
+	git ls-files -s >expect &&
+	git diff --exit-code change &&
+	reset_to_base &&
+	git apply --index --threads=4 patch &&
+	git ls-files -s >actual &&
+	test_cmp expect actual &&
+	git diff --exit-code change
+'
+
+test_expect_success 'threaded apply --cached' '
+	reset_to_base &&
+	git apply --cached --threads=4 patch &&
+	git diff --cached --exit-code change &&
+	git diff --exit-code base -- file0
+'
+
+test_expect_success 'apply.threads applies to git am' '
+	reset_to_base &&
+	git format-patch -1 --stdout -M change >mbox &&
+	git -c apply.threads=0 am mbox &&
+	git diff --exit-code change
+'
+
+test_expect_success 'patches to the same path are applied in order' '
+	reset_to_base &&
+	sed -e "s/^a\$/A/" file8 >tmp &&
+	mv tmp file8 &&
+	git diff >first &&
+	git commit -q -a -m first &&
+	sed -e "s/^b\$/B/" file8 >tmp &&
+	mv tmp file8 &&
+	git diff >second &&
+	reset_to_base &&
+	cat first second >both &&
+	git apply --threads=4 both patch &&
+	printf "%s\n" A B c d e f g h i j >expect &&
+	test_cmp expect file8
+'
+
+test_expect_success 'errors are the same as without threads' '
+	reset_to_base &&
+	echo conflict >file2 &&
+	echo conflict >dir/nine &&
+	test_must_fail git apply --threads=1 patch 2>expect &&
+	test_must_fail git apply --threads=4 patch 2>actual &&
+	test_cmp expect actual &&
+	git diff --exit-code base -- file0 file1
+'
+
+test_expect_success 'whitespace warnings are the same as without threads' '
+	reset_to_base &&
+	git apply --whitespace=warn --threads=1 patch 2>expect &&
+	grep "trailing whitespace" expect &&
+	reset_to_base &&
+	git apply --whitespace=warn --threads=4 patch 2>actual &&
+	test_cmp expect actual &&
+	reset_to_base &&
+	test_must_fail git apply --whitespace=error --threads=4 patch 2>actual &&
+	grep "trailing whitespace" actual &&
+	git diff --exit-code
+'
+
+test_done
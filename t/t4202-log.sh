@@ -516,4 +516,14 @@ test_expect_success 'show added path under "--follow -M"' '
 	)
 '
 
+test_expect_success 'log --threads gives the same output' '
+	for opts in "-p" "-p --stat -M" "-p -m" "-p -w --word-diff" "-p --color"
+	do
+		git log $opts >expect &&
+		git log --threads=3 $opts >actual &&
+		test_cmp expect actual ||
+		return 1
+	done
+'
+
 test_done
@@ -0,0 +1,152 @@
+#!/bin/sh
+
+test_description='git merge-tree --write-tree'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	printf "%s\n" 1 2 3 4 5 >numbers &&
+	echo hello >greeting &&
+	echo keep >unchanged &&
+	git add numbers greeting unchanged &&
+	test_tick &&
+	git commit -m base &&
+	git tag base &&
+
+	git checkout -b side1 &&
+	printf "%s\n" 1 2 three 4 5 >numbers &&
+	git mv greeting salutation &&
+	test_tick &&
+	git commit -a -m side1 &&
+
+	git checkout -b side2 base &&
+	printf "%s\n" 1 2 3 4 five >numbers &&
+	echo hi >greeting &&
+	echo new >added &&
+	git add added &&
+	test_tick &&
+	git commit -a -m side2 &&
+
+	git checkout -b side3 base &&
+	printf "%s\n" 1 2 drei 4 5 >numbers &&
+	git rm greeting &&
+	test_tick &&
+	git commit -a -m side3 &&
+
+	git clone --bare . bare.git
+'
+
+test_expect_success 'clean merge gives the tree of a real merge' '
+	git checkout -b real side1 &&
+	git merge side2 &&
+	git rev-parse real^{tree} >expect &&
+	git merge-tree --write-tree side1 side2 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clean merge in a bare repository' '
+	git rev-parse real^{tree} >expect &&
+	git --git-dir=bare.git merge-tree --write-tree side1 side2 >actual &&
+	test_cmp expect actual &&
+	! test -f bare.git/index
+'
+
+test_expect_success 'conflicts are listed, with markers in the tree' '
+	test_must_fail git --git-dir=bare.git merge-tree --write-tree \
+		side1 side3 >out &&
+	tree=$(sed -n 1p out) &&
+	sed -n "2,/^$/p" out >conflicts &&
+	cat >expect <<-EOF &&
+	100644 $(git rev-parse base:numbers) 1	numbers
+	100644 $(git rev-parse side1:numbers) 2	numbers
+	100644 $(git rev-parse side3:numbers) 3	numbers
+	100644 $(git rev-parse side1:salutation) 2	salutation
+
+	EOF
+	test_cmp expect conflicts &&
+	grep "CONFLICT (content): Merge conflict in numbers" out &&
+	grep "CONFLICT (rename/delete)" out &&
+	git --git-dir=bare.git cat-file -p $tree:numbers >numbers.merged &&
+	printf "%s\n" 1 2 "<<<<<<< side1" three ======= drei \
+		">>>>>>> side3" 4 5 >expect &&
+	test_cmp expect numbers.merged &&
+	git --git-dir=bare.git ls-tree --name-only $tree >names &&
+	printf "%s\n" numbers salutation unchanged >expect &&
+	test_cmp expect names
+'
+
+test_expect_success '--no-messages and --messages' '
+	test_must_fail git merge-tree --write-tree --no-messages \
+		side1 side3 >actual &&
+	! grep CONFLICT actual &&
+	git merge-tree --write-tree --messages side1 side2 >actual &&
+	grep "Auto-merging numbers" actual
+'
+
+test_expect_success 'index and working tree are left alone' '
+	git checkout -f side1 &&
+	echo dirty >numbers &&
+	git add numbers &&
+	echo dirtier >numbers &&
+	echo untracked >added &&
+	git ls-files -s >index.before &&
+	git merge-tree --write-tree side1 side2 >/dev/null &&
+	git ls-files -s >index.after &&
+	test_cmp index.before index.after &&
+	echo dirtier >expect &&
+	test_cmp expect numbers &&
+	echo untracked >expect &&
+	test_cmp expect added &&
+	git reset --hard &&
+	rm -f added
+'
+
+test_expect_success 'criss-cross merge uses a virtual merge base' '
+	git checkout -b cross1 base &&
+	printf "%s\n" one 2 3 4 5 >numbers &&
+	git commit -a -m cross1 &&
+	git checkout -b cross2 base &&
+	printf "%s\n" 1 2 3 4 5 6 >numbers &&
+	git commit -a -m cross2 &&
+	git checkout -b cross3 cross1 &&
+	git merge cross2 &&
+	git checkout -b cross4 cross2 &&
+	git merge cross1 &&
+	echo more >>greeting &&
+	git commit -a -m cross4 &&
+	git checkout -b cross-real cross3 &&
+	git merge cross4 &&
+	git rev-parse cross-real^{tree} >expect &&
+	git merge-tree --write-tree cross3 cross4 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--merge-base picks the merge base' '
+	git merge-tree --write-tree --merge-base=side2 side2 side1 >actual &&
+	git rev-parse side1^{tree} >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'several --merge-base are used in the order given' '
+	git checkout -b order-base base &&
+	echo base >order &&
+	git add order &&
+	git commit -m order-base &&
+	for b in first second ours theirs
+	do
+		git checkout -b order-$b order-base &&
+		echo $b >order &&
+		git commit -a -m order-$b || return 1
+	done &&
+	test_must_fail git merge-tree --write-tree --no-messages \
+		--merge-base=order-first --merge-base=order-second \
+		order-ours order-theirs >out &&
+	blob=$(sed -n "s/^100644 \([0-9a-f]*\) 1	order$/\1/p" out) &&
+	git cat-file blob $blob >virtual-base &&
+	grep -A1 "^<<<<<<< " virtual-base >actual &&
+	sed -n 2p actual >first &&
+	echo first >expect &&
+	test_cmp expect first
+'
+
+test_done
@@ -396,6 +396,41 @@ test_expect_success 'verify resulting packs' '
 	git verify-pack test-11-*.pack
 '
 
+test_expect_success 'threaded delta search respects --depth' '
+	git config --unset pack.packSizeLimit &&
+	test-genrandom "seed threads" 8192 >base &&
+	for i in 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19
+	do
+		{ cat base && echo "$i" && test-genrandom "$i" 100; } >file_$i &&
+		git hash-object -w file_$i || return 1
+	done >threads-list &&
+	packname_12=$(git pack-objects --threads=4 --window=4 --depth=2 \
+		test-12 <threads-list) &&
+	git verify-pack -v test-12-$packname_12.idx >verify &&
+	! grep "^chain length = [3-9]" verify
+'
+
+test_expect_success 'transfer.detectCollisions checks received objects' '
+	rm -rf dc &&
+	git init dc &&
+	(
+		cd dc &&
+		git index-pack --stdin <../test-1-${packname_1}.pack &&
+		rm -f .git/objects/pack/* &&
+		GIT_TEST_SHA1DC_SELF_TEST=1 &&
+		export GIT_TEST_SHA1DC_SELF_TEST &&
+		git index-pack --stdin <../test-1-${packname_1}.pack &&
+		rm -f .git/objects/pack/* &&
+		git config transfer.detectCollisions true &&
+		test_must_fail git index-pack --stdin \
+			<../test-1-${packname_1}.pack 2>err &&
+		grep "SHA-1 collision attack" err &&
+		test_must_fail git unpack-objects \
+			<../test-1-${packname_1}.pack 2>err &&
+		grep "SHA-1 collision attack" err
+	)
+'
+
 #
 # WARNING!
 #
@@ -248,4 +248,44 @@ test_expect_success 'clone shallow object count' '
 	grep "^count: 52" count.shallow
 '
 
+test_expect_success 'clone with a small uploadpack.bufferSize' '
+	test_when_finished "git config --unset uploadpack.bufferSize" &&
+	git config uploadpack.bufferSize 1 &&
+	git clone "file://$(pwd)" small-buffer &&
+	(
+		cd small-buffer &&
+		git fsck --full
+	)
+'
+
+test_expect_success 'upload-pack without side-band sends the whole pack' '
+	printf "0032want %s\n00000009done\n0000" \
+		$(git rev-parse HEAD) >input &&
+	git upload-pack . <input >output &&
+	perl -0777 -pe "s/^.*?PACK/PACK/s" <output >no-sideband.pack &&
+	git index-pack -o no-sideband.idx no-sideband.pack &&
+	git show-index <no-sideband.idx >objects &&
+	git rev-list --objects HEAD >expect &&
+	test_line_count = $(wc -l <expect) objects
+'
+
+test_expect_success 'upload-pack leaves the pack short when rev-list fails' '
+	git init broken-shallow &&
+	(
+		cd broken-shallow &&
+		test_commit parent &&
+		missing=0123456789012345678901234567890123456789 &&
+		tree=$(printf "040000 tree $missing\tdir\n" |
+		       git mktree --missing) &&
+		commit=$(echo broken | git commit-tree $tree -p HEAD) &&
+		git update-ref HEAD $commit &&
+		printf "0032want %s\n000cdeepen 100000009done\n0000" \
+			$(git rev-parse HEAD) >input &&
+		test_must_fail git upload-pack . <input >output &&
+		perl -0777 -ne "print \$1 if /(PACK.*)/s" <output >short.pack &&
+		test -s short.pack &&
+		test_must_fail git index-pack -o short.idx short.pack
+	)
+'
+
 test_done
@@ -230,4 +230,26 @@ test_expect_success 'criss-cross merge-base for octopus-step' '
 	test_cmp expected.sorted actual.sorted
 '
 
+test_expect_success 'merge-base --batch' '
+	git tag >batch.tags &&
+	for base in $(cat batch.tags)
+	do
+		for tip in $(cat batch.tags)
+		do
+			echo "$base $tip" >>batch.pairs &&
+			git rev-list --left-right --count $base...$tip >batch.counts &&
+			bases=$(git merge-base --all $base $tip | sort) &&
+			printf "%s\t%s\n" "$(cat batch.counts)" "$(echo $bases)" >>batch.expect ||
+			return 1
+		done
+	done &&
+	git merge-base --all --batch <batch.pairs >batch.output &&
+	while read left right bases
+	do
+		printf "%s\t%s\t%s\n" $left $right \
+			"$(echo $(for b in $bases; do echo $b; done | sort))"
+	done <batch.output >batch.actual &&
+	test_cmp batch.expect batch.actual
+'
+
 test_done
@@ -171,4 +171,58 @@ check_describe "test2-lightweight-*" --tags --match="test2-*"
 
 check_describe "test2-lightweight-*" --long --tags --match="test2-*" HEAD^
 
+describe_all () {
+	for rev in HEAD HEAD^ A B c D e test1-lightweight
+	do
+		git describe --tags $rev &&
+		git describe $rev ||
+		return 1
+	done
+}
+
+test_expect_success 'describe.index gives the same answers' '
+	describe_all >expect.noindex &&
+	git config describe.index true &&
+	describe_all >actual.first &&
+	ls .git/describe-index >index-files &&
+	test_line_count = 2 index-files &&
+	describe_all >actual.second &&
+	test_cmp expect.noindex actual.first &&
+	test_cmp expect.noindex actual.second
+'
+
+test_expect_success 'describe.index keeps the answers for each set of options' '
+	cp -R .git/describe-index saved-index &&
+	describe_all >actual &&
+	test_cmp expect.noindex actual &&
+	for f in $(cat index-files)
+	do
+		test_cmp saved-index/$f .git/describe-index/$f || return 1
+	done
+'
+
+test_expect_success 'describe.index extends answers to new commits' '
+	echo >>file &&
+	test_tick &&
+	git commit -a -m "on top of index" &&
+	describe_all >actual &&
+	git -c describe.index=false describe --tags HEAD >expect.head &&
+	git describe --tags HEAD >actual.head &&
+	test_cmp expect.head actual.head &&
+	git -c describe.index=false describe HEAD~2 >expect.old &&
+	git describe HEAD~2 >actual.old &&
+	test_cmp expect.old actual.old
+'
+
+test_expect_success 'describe.index notices new tags' '
+	git tag -a -m newer newer-annotated HEAD^ &&
+	git -c describe.index=false describe HEAD >expect &&
+	git describe HEAD >actual &&
+	test_cmp expect actual &&
+	git tag -d newer-annotated &&
+	git -c describe.index=false describe HEAD >expect &&
+	git describe HEAD >actual &&
+	test_cmp expect actual
+'
+
 test_done
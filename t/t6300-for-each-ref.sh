@@ -456,4 +456,55 @@ test_atom refs/tags/signed-long contents "subject line
 body contents
 $sig"
 
+test_expect_success 'setup for --contains' '
+	git checkout -b contains-side master &&
+	test_commit contains-one &&
+	git branch contains-old &&
+	test_commit contains-two &&
+	git checkout master
+'
+
+cat >expected <<\EOF
+refs/heads/contains-side
+refs/tags/contains-two
+EOF
+
+test_expect_success '--contains only shows refs that contain the commit' '
+	git for-each-ref --format="%(refname)" --contains contains-two >actual &&
+	test_cmp expected actual
+'
+
+cat >expected <<\EOF
+refs/heads/contains-old
+refs/heads/contains-side
+refs/tags/contains-one
+refs/tags/contains-two
+EOF
+
+test_expect_success '--contains with patterns' '
+	git for-each-ref --format="%(refname)" --contains contains-one \
+		refs/heads/contains-* refs/tags/contains-* >actual &&
+	test_cmp expected actual
+'
+
+cat >expected <<\EOF
+refs/heads/contains-side
+refs/heads/contains-skewed
+EOF
+
+test_expect_success '--contains is exact when commit dates are skewed' '
+	git checkout -b contains-skewed contains-two &&
+	echo skewed >skewed &&
+	git add skewed &&
+	GIT_COMMITTER_DATE="100000000 +0000" git commit -m skewed &&
+	git checkout master &&
+	git for-each-ref --format="%(refname)" --contains contains-two \
+		refs/heads/ >actual &&
+	test_cmp expected actual &&
+	git -c core.containsDateCutoff=true for-each-ref \
+		--format="%(refname)" --contains contains-two \
+		refs/heads/contains-skewed >actual &&
+	test_line_count = 0 actual
+'
+
 test_done
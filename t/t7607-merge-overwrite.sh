@@ -59,6 +59,29 @@ test_expect_success 'will not overwrite staged changes' '
 	test_cmp important c2.c
 '
 
+test_expect_success 'will not overwrite staged changes in untouched directory' '
+	git reset --hard sub -- &&
+	test_commit sub-a a.c &&
+	git reset --hard sub -- &&
+	test_commit sub-b b.c &&
+	cp important sub/f &&
+	git add sub/f &&
+	test_must_fail git merge sub-a &&
+	test_path_is_missing .git/MERGE_HEAD &&
+	git show :sub/f >staged &&
+	test_cmp important staged
+'
+
+test_expect_success 'untouched directory keeps its index entries' '
+	git reset --hard sub-b &&
+	git merge sub-a &&
+	git diff-files --exit-code &&
+	git ls-files -s sub sub2 >actual &&
+	git ls-tree -r sub sub sub2 |
+	sed -e "s/ blob / /" -e "s/	/ 0	/" >expect &&
+	test_cmp expect actual
+'
+
 test_expect_success 'will not overwrite removed file' '
 	git reset --hard c1 &&
 	git rm c1.c &&
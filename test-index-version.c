@@ -1,10 +1,33 @@
 #include "cache.h"
 
+static const char usage_str[] = "test-index-version [<version>]";
+
 int main(int argc, const char **argv)
 {
 	struct cache_header hdr;
 	int version;
 
+	if (argc == 2) {
+		static struct lock_file lock;
+		int fd;
+
+		version = atoi(argv[1]);
+		if (version < INDEX_FORMAT_LB || INDEX_FORMAT_UB < version)
+			die("index version %s not in range: %d..%d",
+			    argv[1], INDEX_FORMAT_LB, INDEX_FORMAT_UB);
+		setup_git_directory();
+		fd = hold_locked_index(&lock, 1);
+		if (read_cache() < 0)
+			die("unable to read index file");
+		the_index.version = version;
+		if (write_cache(fd, active_cache, active_nr) ||
+		    commit_locked_index(&lock))
+			die("unable to write new index file");
+		return 0;
+	}
+	if (argc != 1)
+		usage(usage_str);
+
 	memset(&hdr,0,sizeof(hdr));
 	if (read(0, &hdr, sizeof(hdr)) != sizeof(hdr))
 		return 0;
@@ -0,0 +1,57 @@
+#include "cache.h"
+#include "commit.h"
+#include "prio-queue.h"
+
+/*
+ * Feed the same commits to a prio_queue and to a list kept with
+ * commit_list_insert_by_date(), and check that both give them back
+ * in the same order.  The arguments are commit dates to put, "get"
+ * to take one commit out, or "dump" to take out all that are left.
+ */
+static int nr_commits;
+
+static void show(struct commit *commit)
+{
+	if (!commit)
+		printf("NULL\n");
+	else
+		printf("%lu:%d\n", commit->date, (int)(intptr_t)commit->util);
+}
+
+static struct commit *get(struct prio_queue *queue, struct commit_list **list)
+{
+	struct commit *commit = prio_queue_get(queue);
+	struct commit *expect = *list ? pop_commit(list) : NULL;
+
+	if (commit != expect)
+		die("prio_queue gave %lu:%d, commit list gave %lu:%d",
+		    commit ? commit->date : 0,
+		    commit ? (int)(intptr_t)commit->util : -1,
+		    expect ? expect->date : 0,
+		    expect ? (int)(intptr_t)expect->util : -1);
+	return commit;
+}
+
+int main(int argc, char **argv)
+{
+	struct prio_queue queue = { compare_commits_by_commit_date };
+	struct commit_list *list = NULL;
+
+	while (*++argv) {
+		if (!strcmp(*argv, "get")) {
+			show(get(&queue, &list));
+		} else if (!strcmp(*argv, "dump")) {
+			struct commit *commit;
+			while ((commit = get(&queue, &list)))
+				show(commit);
+		} else {
+			struct commit *commit = xcalloc(1, sizeof(*commit));
+			commit->date = strtoul(*argv, NULL, 10);
+			commit->util = (void *)(intptr_t)nr_commits++;
+			prio_queue_put(&queue, commit);
+			commit_list_insert_by_date(commit, &list);
+		}
+	}
+	clear_prio_queue(&queue);
+	return 0;
+}
@@ -1,11 +1,125 @@
 #include "cache.h"
+#include "blob.h"
+
+static const char usage_str[] =
+	"test-sha1 [--dc] [<megabytes>] | --batch <file>... | --bench <size> <count>";
+
+/* Name the files as blobs, SHA1_BATCH_MAX at a time */
+static int batch(int ac, char **av)
+{
+	struct sha1_batch_entry e[SHA1_BATCH_MAX];
+	struct strbuf buf[SHA1_BATCH_MAX];
+	int i, j, nr;
+
+	for (i = 0; i < SHA1_BATCH_MAX; i++)
+		strbuf_init(&buf[i], 0);
+	for (i = 0; i < ac; i += nr) {
+		nr = ac - i < SHA1_BATCH_MAX ? ac - i : SHA1_BATCH_MAX;
+		for (j = 0; j < nr; j++) {
+			strbuf_reset(&buf[j]);
+			if (strbuf_read_file(&buf[j], av[i + j], 0) < 0)
+				die_errno("cannot read '%s'", av[i + j]);
+			prepare_sha1_batch_entry(&e[j], buf[j].buf, buf[j].len,
+						 blob_type);
+		}
+		git_SHA1_Batch(e, nr);
+		for (j = 0; j < nr; j++)
+			puts(sha1_to_hex(e[j].sha1));
+	}
+	return 0;
+}
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_usec - start->tv_usec) / 1e6;
+}
+
+/*
+ * Hash count messages of size bytes one at a time, then in batches,
+ * then with collision detection, and report the throughput of each.
+ */
+static int bench(unsigned long size, int count)
+{
+	struct sha1_batch_entry e[SHA1_BATCH_MAX];
+	unsigned char (*one)[20] = xmalloc(count * 20);
+	unsigned char (*many)[20] = xmalloc(count * 20);
+	char *data = xmalloc(size + count);
+	struct timeval start;
+	double one_sec, batch_sec, dc_sec, mb;
+	int i, j, nr;
+
+	for (i = 0; i < size + count; i++)
+		data[i] = i * 7 + (i >> 8);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < count; i++)
+		hash_sha1_file(data + i, size, blob_type, one[i]);
+	one_sec = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < count; i += nr) {
+		nr = count - i < SHA1_BATCH_MAX ? count - i : SHA1_BATCH_MAX;
+		for (j = 0; j < nr; j++)
+			prepare_sha1_batch_entry(&e[j], data + i + j, size,
+						 blob_type);
+		git_SHA1_Batch(e, nr);
+		for (j = 0; j < nr; j++)
+			hashcpy(many[i + j], e[j].sha1);
+	}
+	batch_sec = elapsed(&start);
+
+	for (i = 0; i < count; i++)
+		if (hashcmp(one[i], many[i]))
+			die("batch hash of message %d differs", i);
+
+	detect_sha1_collisions = 1;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < count; i++)
+		hash_sha1_file(data + i, size, blob_type, many[i]);
+	dc_sec = elapsed(&start);
+	detect_sha1_collisions = 0;
+
+	for (i = 0; i < count; i++)
+		if (hashcmp(one[i], many[i]))
+			die("collision-detecting hash of message %d differs", i);
+
+	mb = (double)size * count / (1024 * 1024);
+	printf("%lu bytes x %d: one at a time %.1f MB/s, batched %.1f MB/s, "
+	       "collision-detecting %.1f MB/s\n",
+	       size, count,
+	       one_sec > 0 ? mb / one_sec : 0,
+	       batch_sec > 0 ? mb / batch_sec : 0,
+	       dc_sec > 0 ? mb / dc_sec : 0);
+	free(one);
+	free(many);
+	free(data);
+	return 0;
+}
 
 int main(int ac, char **av)
 {
 	git_SHA_CTX ctx;
+	git_SHA1DC_CTX dc_ctx;
 	unsigned char sha1[20];
 	unsigned bufsz = 8192;
 	char *buffer;
+	int dc = 0;
+
+	if (ac >= 2 && !strcmp(av[1], "--batch"))
+		return batch(ac - 2, av + 2);
+	if (ac == 4 && !strcmp(av[1], "--bench"))
+		return bench(strtoul(av[2], NULL, 10), atoi(av[3]));
+	if (ac >= 2 && !strcmp(av[1], "--dc")) {
+		dc = 1;
+		ac--;
+		av++;
+	}
+	if (ac > 2 || (ac == 2 && av[1][0] == '-'))
+		usage(usage_str);
 
 	if (ac == 2)
 		bufsz = strtoul(av[1], NULL, 10) * 1024 * 1024;
@@ -21,6 +135,8 @@ int main(int ac, char **av)
 	}
 
 	git_SHA1_Init(&ctx);
+	git_SHA1DC_Init(&dc_ctx);
+	dc_ctx.self_test = !!getenv("GIT_TEST_SHA1DC_SELF_TEST");
 
 	while (1) {
 		ssize_t sz, this_sz;
@@ -39,9 +155,15 @@ int main(int ac, char **av)
 		}
 		if (this_sz == 0)
 			break;
-		git_SHA1_Update(&ctx, buffer, this_sz);
+		if (dc)
+			git_SHA1DC_Update(&dc_ctx, buffer, this_sz);
+		else
+			git_SHA1_Update(&ctx, buffer, this_sz);
 	}
-	git_SHA1_Final(sha1, &ctx);
+	if (!dc)
+		git_SHA1_Final(sha1, &ctx);
+	else if (git_SHA1DC_Final(sha1, &dc_ctx))
+		die("collision detected in %s", sha1_to_hex(sha1));
 	puts(sha1_to_hex(sha1));
 	exit(0);
 }
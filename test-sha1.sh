@@ -3,25 +3,38 @@
 dd if=/dev/zero bs=1048576 count=100 2>/dev/null |
 /usr/bin/time ./test-sha1 >/dev/null
 
+dd if=/dev/zero bs=1048576 count=100 2>/dev/null |
+/usr/bin/time ./test-sha1 --dc >/dev/null
+
+# Throughput of hashing objects one at a time, several at once, and
+# with collision detection
+for size in 100 1000 10000 1000000
+do
+	./test-sha1 --bench $size $((100000000 / $size)) || exit
+done
+
 while read expect cnt pfx
 do
 	case "$expect" in '#'*) continue ;; esac
-	actual=`
-		{
-			test -z "$pfx" || echo "$pfx"
-			dd if=/dev/zero bs=1048576 count=$cnt 2>/dev/null |
-			perl -pe 'y/\000/g/'
-		} | ./test-sha1 $cnt
-	`
-	if test "$expect" = "$actual"
-	then
-		echo "OK: $expect $cnt $pfx"
-	else
-		echo >&2 "OOPS: $cnt"
-		echo >&2 "expect: $expect"
-		echo >&2 "actual: $actual"
-		exit 1
-	fi
+	for dc in "" --dc
+	do
+		actual=`
+			{
+				test -z "$pfx" || echo "$pfx"
+				dd if=/dev/zero bs=1048576 count=$cnt 2>/dev/null |
+				perl -pe 'y/\000/g/'
+			} | ./test-sha1 $dc $cnt
+		`
+		if test "$expect" = "$actual"
+		then
+			echo "OK: $expect $cnt $pfx $dc"
+		else
+			echo >&2 "OOPS: $cnt $dc"
+			echo >&2 "expect: $expect"
+			echo >&2 "actual: $actual"
+			exit 1
+		fi
+	done
 done <<EOF
 da39a3ee5e6b4b0d3255bfef95601890afd80709 0
 3f786850e387550fdab836ed7e6dc881de23001b 0 a
@@ -0,0 +1,183 @@
+/*
+ * test-sideband: time the ways upload-pack can move pack data from
+ * the pack-objects pipe to a client connected over a socket.
+ */
+
+#include "cache.h"
+#include "pkt-line.h"
+#include "sideband.h"
+#include "run-command.h"
+
+static const char usage_str[] = "test-sideband <megabytes> [<buffer-size>]";
+
+/* pack-objects writes its output 8k at a time */
+#define PRODUCER_CHUNK 8192
+
+static unsigned long total;
+
+static int produce(int in, int out, void *data)
+{
+	char buf[PRODUCER_CHUNK];
+	unsigned long left = total;
+	int i;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i * 7 + (i >> 8);
+	while (left) {
+		size_t n = left < sizeof(buf) ? left : sizeof(buf);
+		if (write_in_full(out, buf, n) < 0)
+			die_errno("producer");
+		left -= n;
+	}
+	close(out);
+	return 0;
+}
+
+static int consume(int in, int out, void *data)
+{
+	char buf[65536];
+	unsigned long *got = data;
+	ssize_t n;
+
+	while ((n = xread(in, buf, sizeof(buf))) > 0)
+		*got += n;
+	close(in);
+	return n < 0;
+}
+
+#define PACKETS(n) (((n) + LARGE_PACKET_MAX - 6) / (LARGE_PACKET_MAX - 5))
+
+/* What send_sideband() used to do: one write for each header and payload */
+static void send_two_writes(int fd, const char *p, ssize_t sz)
+{
+	while (sz) {
+		unsigned n = sz;
+		char hdr[5];
+
+		if (LARGE_PACKET_MAX - 5 < n)
+			n = LARGE_PACKET_MAX - 5;
+		sprintf(hdr, "%04x", n + 5);
+		hdr[4] = 1;
+		safe_write(fd, hdr, 5);
+		safe_write(fd, p, n);
+		p += n;
+		sz -= n;
+	}
+}
+
+enum mode {
+	TWO_WRITES,
+	WRITEV,
+	COPY,
+	SPLICE
+};
+
+static const char *mode_name[] = {
+	"side-band, write() per header and payload",
+	"side-band, writev()",
+	"no side-band, read() and write()",
+	"no side-band, splice()"
+};
+
+static double run(enum mode mode, unsigned long bufsize)
+{
+	struct async producer, consumer;
+	struct timeval start, end;
+	unsigned long got = 0, headers = 0;
+	char *buf = xmalloc(bufsize);
+	int sv[2], unavailable = 0;
+	ssize_t n;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		die_errno("socketpair");
+
+	gettimeofday(&start, NULL);
+	memset(&producer, 0, sizeof(producer));
+	producer.proc = produce;
+	producer.out = -1;
+	if (start_async(&producer))
+		die("unable to start producer");
+#ifdef F_SETPIPE_SZ
+	if (mode != TWO_WRITES)
+		fcntl(producer.out, F_SETPIPE_SZ, bufsize);
+#endif
+	memset(&consumer, 0, sizeof(consumer));
+	consumer.proc = consume;
+	consumer.data = &got;
+	consumer.in = sv[1];
+	if (start_async(&consumer))
+		die("unable to start consumer");
+
+	while (1) {
+		switch (mode) {
+		case TWO_WRITES:
+			n = xread(producer.out, buf, PRODUCER_CHUNK);
+			if (0 < n) {
+				send_two_writes(sv[0], buf, n);
+				headers += PACKETS(n) * 5;
+			}
+			break;
+		case WRITEV:
+			n = xread(producer.out, buf, bufsize);
+			if (0 < n) {
+				send_sideband(sv[0], 1, buf, n, LARGE_PACKET_MAX);
+				headers += PACKETS(n) * 5;
+			}
+			break;
+		case COPY:
+			n = xread(producer.out, buf, bufsize);
+			if (0 < n && write_in_full(sv[0], buf, n) < 0)
+				die_errno("write");
+			break;
+		case SPLICE:
+			n = xsplice(producer.out, sv[0], bufsize);
+			break;
+		}
+		if (n <= 0)
+			break;
+	}
+	if (n < 0 && mode == SPLICE && (errno == EINVAL || errno == ENOSYS)) {
+		unavailable = 1;
+		n = 0;
+	}
+	if (n < 0)
+		die_errno("%s", mode_name[mode]);
+	close(sv[0]);
+	close(producer.out);
+	if (finish_async(&producer) || finish_async(&consumer))
+		die("%s: transfer failed", mode_name[mode]);
+	gettimeofday(&end, NULL);
+	free(buf);
+
+	if (unavailable)
+		return -1;
+	if (got - headers != total)
+		die("%s: sent %lu bytes, received %lu", mode_name[mode],
+		    total, got - headers);
+	return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+}
+
+int main(int ac, char **av)
+{
+	unsigned long bufsize = 1024 * 1024;
+	int mode;
+
+	if (ac < 2 || ac > 3)
+		usage(usage_str);
+	total = strtoul(av[1], NULL, 10) * 1024 * 1024;
+	if (ac == 3)
+		bufsize = strtoul(av[2], NULL, 10);
+	if (!total || bufsize < LARGE_PACKET_MAX)
+		usage(usage_str);
+
+	for (mode = TWO_WRITES; mode <= SPLICE; mode++) {
+		double sec = run(mode, bufsize);
+
+		if (sec < 0)
+			printf("%-45s unavailable\n", mode_name[mode]);
+		else
+			printf("%-45s %.1f MB/s\n", mode_name[mode],
+			       sec > 0 ? total / (1024 * 1024) / sec : 0);
+	}
+	return 0;
+}
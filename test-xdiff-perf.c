@@ -0,0 +1,121 @@
+/*
+ * test-xdiff-perf: run xdiff on two files, to check what it produces
+ * and to time it on inputs too large for the test suite.
+ */
+
+#include "cache.h"
+#include "xdiff-interface.h"
+#include "xdiff/xtypes.h"
+#include "xdiff/xutils.h"
+
+static const char usage_str[] =
+	"test-xdiff-perf [--patience | --histogram] [--large]\n"
+	"                [-w | -b | --ignore-space-at-eol]\n"
+	"                [--repeat=<n>] [--hash-only] <file1> <file2>";
+
+static int quiet;
+
+static int emit(void *priv, mmbuffer_t *mb, int nbuf)
+{
+	int i;
+
+	if (quiet)
+		return 0;
+	for (i = 0; i < nbuf; i++)
+		if (mb[i].size && fwrite(mb[i].ptr, mb[i].size, 1, stdout) != 1)
+			return -1;
+	return 0;
+}
+
+/* Hash every line, the way xdl_prepare_ctx() does before classifying */
+static unsigned long hash_lines(mmfile_t *mf, long flags, long *nrec)
+{
+	char const *cur = mf->ptr, *top = mf->ptr + mf->size;
+	unsigned long sum = 0;
+
+	while (cur < top) {
+		sum += xdl_hash_record(&cur, top, flags);
+		(*nrec)++;
+	}
+	return sum;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	mmfile_t mf1, mf2;
+	xpparam_t xpp;
+	xdemitconf_t xecfg;
+	xdemitcb_t ecb;
+	int i, repeat = 1, hash_only = 0;
+	double start;
+
+	memset(&xpp, 0, sizeof(xpp));
+	memset(&xecfg, 0, sizeof(xecfg));
+	xecfg.ctxlen = 3;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		const char *arg = argv[i];
+		if (!strcmp(arg, "--patience"))
+			xpp.flags |= XDF_PATIENCE_DIFF;
+		else if (!strcmp(arg, "--histogram"))
+			xpp.flags |= XDF_HISTOGRAM_DIFF;
+		else if (!strcmp(arg, "--large"))
+			xpp.flags |= XDF_LARGE_INPUT;
+		else if (!strcmp(arg, "-w"))
+			xpp.flags |= XDF_IGNORE_WHITESPACE;
+		else if (!strcmp(arg, "-b"))
+			xpp.flags |= XDF_IGNORE_WHITESPACE_CHANGE;
+		else if (!strcmp(arg, "--ignore-space-at-eol"))
+			xpp.flags |= XDF_IGNORE_WHITESPACE_AT_EOL;
+		else if (!prefixcmp(arg, "--repeat="))
+			repeat = atoi(arg + 9);
+		else if (!strcmp(arg, "--hash-only"))
+			hash_only = 1;
+		else
+			usage(usage_str);
+	}
+	if (argc - i != 2 || repeat < 1)
+		usage(usage_str);
+
+	if (read_mmfile(&mf1, argv[i]) < 0)
+		die_errno("unable to read '%s'", argv[i]);
+	if (read_mmfile(&mf2, argv[i + 1]) < 0)
+		die_errno("unable to read '%s'", argv[i + 1]);
+
+	if (hash_only) {
+		unsigned long sum = 0;
+		long nrec = 0;
+
+		start = now();
+		for (i = 0; i < repeat; i++) {
+			nrec = 0;
+			sum += hash_lines(&mf1, xpp.flags, &nrec);
+			sum += hash_lines(&mf2, xpp.flags, &nrec);
+		}
+		printf("%ld lines\n", nrec);
+		fprintf(stderr, "hashed %d times in %.3f seconds (%lx)\n",
+			repeat, now() - start, sum);
+		return 0;
+	}
+
+	ecb.outf = emit;
+	ecb.priv = NULL;
+	start = now();
+	for (i = 0; i < repeat; i++) {
+		if (xdi_diff(&mf1, &mf2, &xpp, &xecfg, &ecb) < 0)
+			die("unable to generate diff");
+		quiet = 1;
+	}
+	if (repeat > 1)
+		fprintf(stderr, "diffed %d times in %.3f seconds\n",
+			repeat, now() - start);
+	return 0;
+}
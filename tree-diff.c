@@ -8,6 +8,20 @@
 
 static void show_entry(struct diff_options *opt, const char *prefix,
 		       struct tree_desc *desc, struct strbuf *base);
+static int diff_subtree(const unsigned char *old, const unsigned char *new,
+			struct strbuf *base, struct diff_options *opt);
+
+/*
+ * Two entries whose raw bytes (mode, name and object name) are the
+ * same need not be decoded and compared field by field.
+ */
+static int same_raw_entry(struct tree_desc *t1, struct tree_desc *t2)
+{
+	unsigned long len1 = t1->entry.sha1 + 20 - (const unsigned char *)t1->buffer;
+	unsigned long len2 = t2->entry.sha1 + 20 - (const unsigned char *)t2->buffer;
+
+	return len1 == len2 && !memcmp(t1->buffer, t2->buffer, len1);
+}
 
 static int compare_tree_entry(struct tree_desc *t1, struct tree_desc *t2,
 			      struct strbuf *base, struct diff_options *opt)
@@ -52,7 +66,7 @@ static int compare_tree_entry(struct tree_desc *t1, struct tree_desc *t2,
 				    sha1, sha2, base->buf, 0, 0);
 		}
 		strbuf_addch(base, '/');
-		diff_tree_sha1(sha1, sha2, base->buf, opt);
+		diff_subtree(sha1, sha2, base, opt);
 	} else {
 		opt->change(opt, mode1, mode2, sha1, sha2, base->buf, 0, 0);
 	}
@@ -127,40 +141,43 @@ static void skip_uninteresting(struct tree_desc *t, struct strbuf *base,
 	}
 }
 
-int diff_tree(struct tree_desc *t1, struct tree_desc *t2,
-	      const char *base_str, struct diff_options *opt)
+/*
+ * Walk two trees in parallel.  The path of the entries being compared
+ * is built in "base", which is shared by the whole recursion: every
+ * level appends its part and trims it off again when done, so that no
+ * path is allocated.  Callbacks that want to keep a path must copy it.
+ */
+static int diff_tree_base(struct tree_desc *t1, struct tree_desc *t2,
+			  struct strbuf *base, struct diff_options *opt)
 {
-	struct strbuf base;
-	int baselen = strlen(base_str);
 	int t1_match = 0, t2_match = 0;
-
-	/* Enable recursion indefinitely */
-	opt->pathspec.recursive = DIFF_OPT_TST(opt, RECURSIVE);
-	opt->pathspec.max_depth = -1;
-
-	strbuf_init(&base, PATH_MAX);
-	strbuf_add(&base, base_str, baselen);
+	int copies_harder = DIFF_OPT_TST(opt, FIND_COPIES_HARDER);
 
 	for (;;) {
 		if (diff_can_quit_early(opt))
 			break;
 		if (opt->pathspec.nr) {
-			skip_uninteresting(t1, &base, opt, &t1_match);
-			skip_uninteresting(t2, &base, opt, &t2_match);
+			skip_uninteresting(t1, base, opt, &t1_match);
+			skip_uninteresting(t2, base, opt, &t2_match);
 		}
 		if (!t1->size) {
 			if (!t2->size)
 				break;
-			show_entry(opt, "+", t2, &base);
+			show_entry(opt, "+", t2, base);
 			update_tree_entry(t2);
 			continue;
 		}
 		if (!t2->size) {
-			show_entry(opt, "-", t1, &base);
+			show_entry(opt, "-", t1, base);
 			update_tree_entry(t1);
 			continue;
 		}
-		switch (compare_tree_entry(t1, t2, &base, opt)) {
+		if (!copies_harder && same_raw_entry(t1, t2)) {
+			update_tree_entry(t1);
+			update_tree_entry(t2);
+			continue;
+		}
+		switch (compare_tree_entry(t1, t2, base, opt)) {
 		case -1:
 			update_tree_entry(t1);
 			continue;
@@ -173,9 +190,53 @@ int diff_tree(struct tree_desc *t1, struct tree_desc *t2,
 		}
 		die("git diff-tree: internal error");
 	}
+	return 0;
+}
+
+static void *read_subtree(const unsigned char *sha1, unsigned long *size)
+{
+	enum object_type type;
+	void *tree = read_sha1_file(sha1, &type, size);
 
+	if (!tree || type != OBJ_TREE)
+		die("corrupt tree sha %s", sha1_to_hex(sha1));
+	return tree;
+}
+
+/* Recurse into a pair of subtrees whose path is already in "base" */
+static int diff_subtree(const unsigned char *old, const unsigned char *new,
+			struct strbuf *base, struct diff_options *opt)
+{
+	void *tree1, *tree2;
+	struct tree_desc t1, t2;
+	unsigned long size1, size2;
+	int retval;
+
+	tree1 = read_subtree(old, &size1);
+	tree2 = read_subtree(new, &size2);
+	init_tree_desc(&t1, tree1, size1);
+	init_tree_desc(&t2, tree2, size2);
+	retval = diff_tree_base(&t1, &t2, base, opt);
+	free(tree1);
+	free(tree2);
+	return retval;
+}
+
+int diff_tree(struct tree_desc *t1, struct tree_desc *t2,
+	      const char *base_str, struct diff_options *opt)
+{
+	struct strbuf base;
+	int retval;
+
+	/* Enable recursion indefinitely */
+	opt->pathspec.recursive = DIFF_OPT_TST(opt, RECURSIVE);
+	opt->pathspec.max_depth = -1;
+
+	strbuf_init(&base, PATH_MAX);
+	strbuf_addstr(&base, base_str);
+	retval = diff_tree_base(t1, t2, &base, opt);
 	strbuf_release(&base);
-	return 0;
+	return retval;
 }
 
 /*
@@ -272,6 +333,10 @@ int diff_tree_sha1(const unsigned char *old, const unsigned char *new, const cha
 	unsigned long size1, size2;
 	int retval;
 
+	/* Identical trees cannot differ; do not even read them */
+	if (!DIFF_OPT_TST(opt, FIND_COPIES_HARDER) && !hashcmp(old, new))
+		return 0;
+
 	tree1 = read_object_with_reference(old, tree_type, &size1, NULL);
 	if (!tree1)
 		die("unable to read source tree (%s)", sha1_to_hex(old));
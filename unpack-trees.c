@@ -8,6 +8,7 @@
 #include "progress.h"
 #include "refs.h"
 #include "attr.h"
+#include "mem-pool.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -106,7 +107,8 @@ static void add_entry(struct unpack_trees_options *o, struct cache_entry *ce,
 	unsigned int set, unsigned int clear)
 {
 	unsigned int size = ce_size(ce);
-	struct cache_entry *new = xmalloc(size);
+	struct cache_entry *new = make_empty_cache_entry(&o->result,
+							 ce_namelen(ce));
 
 	clear |= CE_HASHED | CE_UNHASHED;
 
@@ -115,6 +117,7 @@ static void add_entry(struct unpack_trees_options *o, struct cache_entry *ce,
 
 	memcpy(new, ce, size);
 	new->next = NULL;
+	new->mem_pool_allocated = 1;
 	new->ce_flags = (new->ce_flags & ~clear) | set;
 	add_index_entry(&o->result, new, ADD_CACHE_OK_TO_ADD|ADD_CACHE_OK_TO_REPLACE);
 }
@@ -529,7 +532,7 @@ static int ce_in_traverse_path(const struct cache_entry *ce,
 static struct cache_entry *create_ce_entry(const struct traverse_info *info, const struct name_entry *n, int stage)
 {
 	int len = traverse_path_len(info, n);
-	struct cache_entry *ce = xcalloc(1, cache_entry_size(len));
+	struct cache_entry *ce = make_empty_transient_cache_entry(len);
 
 	ce->ce_mode = create_ce_mode(n->mode);
 	ce->ce_flags = create_ce_flags(len, stage);
@@ -582,12 +585,25 @@ static int unpack_nondirectories(int n, unsigned long mask,
 		src[i + o->merge] = create_ce_entry(info, names + i, stage);
 	}
 
-	if (o->merge)
-		return call_unpack_fn(src, o);
+	/*
+	 * The entries made from the trees are only looked at; what goes
+	 * into the result is copied by add_entry().
+	 */
+	if (o->merge) {
+		int ret = call_unpack_fn(src, o);
+
+		for (i = 0; i < n; i++)
+			if (src[i + 1] != o->df_conflict_entry)
+				discard_cache_entry(src[i + 1]);
+		return ret;
+	}
 
 	for (i = 0; i < n; i++)
-		if (src[i] && src[i] != o->df_conflict_entry)
+		if (src[i] && src[i] != o->df_conflict_entry) {
 			add_entry(o, src[i], 0, 0);
+			discard_cache_entry(src[i]);
+			src[i] = NULL;
+		}
 	return 0;
 }
 
@@ -718,6 +734,93 @@ static void debug_unpack_callback(int n,
 		debug_name_entry(i, names + i);
 }
 
+/*
+ * Add everything below the tree "sha1" at "base" to the result, the way
+ * merged_entry() does for paths that are new to the index.
+ */
+static void add_unchanged_tree(struct unpack_trees_options *o,
+			       const unsigned char *sha1, struct strbuf *base)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	void *buf = fill_tree_descriptor(&desc, sha1);
+	size_t baselen = base->len;
+
+	while (tree_entry(&desc, &entry)) {
+		strbuf_add(base, entry.path, tree_entry_len(entry.path, entry.sha1));
+		if (S_ISDIR(entry.mode)) {
+			strbuf_addch(base, '/');
+			add_unchanged_tree(o, entry.sha1, base);
+		} else {
+			struct cache_entry *ce;
+
+			ce = make_empty_cache_entry(&o->result, base->len);
+			ce->ce_mode = create_ce_mode(entry.mode);
+			ce->ce_flags = create_ce_flags(base->len, 0) |
+				CE_UPDATE | CE_ADDED | CE_NEW_SKIP_WORKTREE;
+			hashcpy(ce->sha1, entry.sha1);
+			memcpy(ce->name, base->buf, base->len);
+			add_index_entry(&o->result, ce,
+					ADD_CACHE_OK_TO_ADD|ADD_CACHE_OK_TO_REPLACE);
+		}
+		strbuf_setlen(base, baselen);
+	}
+	free(buf);
+}
+
+/*
+ * A three-way merge of a directory that is the same tree in all
+ * inputs can only keep that tree.  Take it wholesale instead of
+ * merging it entry by entry, either from the index when the
+ * cache-tree says the index has exactly that tree there, or straight
+ * from the tree when the index has nothing there and need not be
+ * checked against the working tree.
+ *
+ * Returns 1 if the directory was taken care of, 0 if it has to be
+ * traversed.
+ */
+static int unpack_unchanged_tree(int n, unsigned long mask,
+				 struct name_entry *names,
+				 struct traverse_info *info)
+{
+	struct unpack_trees_options *o = info->data;
+	struct index_state *index = o->src_index;
+	struct strbuf base = STRBUF_INIT;
+	int i, pos, matches;
+
+	if (o->fn != threeway_merge || !o->skip_sparse_checkout ||
+	    info->conflicts || mask != (1ul << n) - 1)
+		return 0;
+	for (i = 1; i < n; i++)
+		if (hashcmp(names[0].sha1, names[i].sha1))
+			return 0;
+
+	strbuf_grow(&base, traverse_path_len(info, names) + 1);
+	make_traverse_path(base.buf, info, names);
+	strbuf_setlen(&base, traverse_path_len(info, names));
+	strbuf_addch(&base, '/');
+
+	pos = index_name_pos(index, base.buf, base.len);
+	if (pos < 0)
+		pos = -1 - pos;
+	matches = cache_tree_matches_traversal(index->cache_tree, names, info);
+	if (matches) {
+		for (i = pos; i < pos + matches; i++) {
+			add_entry(o, index->cache[i], 0, CE_STAGEMASK);
+			mark_ce_used(index->cache[i], o);
+		}
+	} else if (o->index_only &&
+		   (index->cache_nr <= pos ||
+		    prefixcmp(index->cache[pos]->name, base.buf))) {
+		add_unchanged_tree(o, names[0].sha1, &base);
+	} else {
+		strbuf_release(&base);
+		return 0;
+	}
+	strbuf_release(&base);
+	return 1;
+}
+
 static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, struct name_entry *names, struct traverse_info *info)
 {
 	struct cache_entry *src[MAX_UNPACK_TREES + 1] = { NULL, };
@@ -806,6 +909,10 @@ static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, str
 			}
 		}
 
+		if (o->merge && !conflicts && dirmask == mask &&
+		    unpack_unchanged_tree(n, mask, names, info))
+			return mask;
+
 		if (traverse_trees_recursive(n, dirmask, conflicts,
 					     names, info) < 0)
 			return -1;
@@ -1020,6 +1127,7 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	o->result.initialized = 1;
 	o->result.timestamp.sec = o->src_index->timestamp.sec;
 	o->result.timestamp.nsec = o->src_index->timestamp.nsec;
+	o->result.version = o->src_index->version;
 	o->merge_size = len;
 	mark_all_ce_unused(o->src_index);
 
@@ -1030,7 +1138,7 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		mark_new_skip_worktree(o->el, o->src_index, 0, CE_NEW_SKIP_WORKTREE);
 
 	if (!dfc)
-		dfc = xcalloc(1, cache_entry_size(0));
+		dfc = make_empty_transient_cache_entry(0);
 	o->df_conflict_entry = dfc;
 
 	if (len) {
@@ -1123,8 +1231,23 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 
 	o->src_index = NULL;
 	ret = check_updates(o) ? (-2) : 0;
-	if (o->dst_index)
+	if (o->dst_index) {
+		/*
+		 * The caller may still hold entries of the index we
+		 * replace, so they live on in the pool of the result.
+		 */
+		struct mem_pool *old = o->dst_index->ce_mem_pool;
+
+		if (old && o->result.ce_mem_pool) {
+			mem_pool_combine(o->result.ce_mem_pool, old);
+			mem_pool_discard(old);
+		} else if (old) {
+			o->result.ce_mem_pool = old;
+		}
 		*o->dst_index = o->result;
+	} else {
+		discard_index(&o->result);
+	}
 
 done:
 	free_excludes(&el);
@@ -43,6 +43,8 @@ static int use_sideband;
 static int debug_fd;
 static int advertise_refs;
 static int stateless_rpc;
+/* how much pack data we read from pack-objects at a time */
+static unsigned long pack_buffer_size = 1024 * 1024;
 
 static void reset_timeout(void)
 {
@@ -71,6 +73,43 @@ static ssize_t send_client_data(int fd, const char *data, ssize_t sz)
 	return safe_write(fd, data, sz);
 }
 
+/*
+ * Without a sideband the pack data goes to the client as-is, so
+ * let the kernel move it straight from the pack-objects pipe to
+ * our output.  The last byte in the pipe is never spliced; it is
+ * left for the code below to read and hold back, and the byte that
+ * code held back last time is sent first.  Once pack-objects has
+ * hung up we leave the rest to that code as well.
+ * Returns the number of bytes moved, 0 if the caller should read
+ * the data itself this time, or -1 if splicing is not possible.
+ */
+static ssize_t splice_pack_data(int in, int revents, int *buffered)
+{
+#ifndef HAVE_SPLICE
+	return -1;
+#else
+	int avail;
+	ssize_t sz;
+
+	if ((revents & POLLHUP) || ioctl(in, FIONREAD, &avail) < 0 || avail < 2)
+		return 0;
+	if (0 <= *buffered) {
+		char c = *buffered;
+		if (send_client_data(1, &c, 1) < 0)
+			return -1;
+		*buffered = -1;
+	}
+	if (pack_buffer_size < --avail)
+		avail = pack_buffer_size;
+	sz = xsplice(in, 1, avail);
+	if (sz < 0 && (errno == EINVAL || errno == ENOSYS))
+		return -1;
+	if (sz < 0)
+		die_errno("git upload-pack: splice");
+	return sz;
+#endif
+}
+
 static FILE *pack_pipe = NULL;
 static void show_commit(struct commit *commit, void *data)
 {
@@ -139,10 +178,11 @@ static void create_pack_file(void)
 	struct async rev_list;
 	struct child_process pack_objects;
 	int create_full_pack = (nr_our_refs == want_obj.nr && !have_obj.nr);
-	char data[8193], progress[128];
+	char *data, progress[128];
 	char abort_msg[] = "aborting due to possible repository "
 		"corruption on the remote side.";
 	int buffered = -1;
+	int use_splice = !use_sideband;
 	ssize_t sz;
 	const char *argv[10];
 	int arg = 0;
@@ -174,6 +214,11 @@ static void create_pack_file(void)
 
 	if (start_command(&pack_objects))
 		die("git upload-pack: unable to fork git-pack-objects");
+#ifdef F_SETPIPE_SZ
+	/* let pack-objects get ahead of us by a whole buffer */
+	fcntl(pack_objects.out, F_SETPIPE_SZ, pack_buffer_size);
+#endif
+	data = xmalloc(pack_buffer_size + 1);
 
 	if (shallow_nr) {
 		memset(&rev_list, 0, sizeof(rev_list));
@@ -265,29 +310,35 @@ static void create_pack_file(void)
 			 */
 			char *cp = data;
 			ssize_t outsz = 0;
+			if (use_splice) {
+				sz = splice_pack_data(pack_objects.out,
+						      pfd[pu].revents,
+						      &buffered);
+				if (0 < sz)
+					continue;
+				if (sz < 0)
+					use_splice = 0;
+			}
 			if (0 <= buffered) {
 				*cp++ = buffered;
 				outsz++;
 			}
 			sz = xread(pack_objects.out, cp,
-				  sizeof(data) - outsz);
+				  pack_buffer_size + 1 - outsz);
 			if (0 < sz)
 				;
 			else if (sz == 0) {
+				/* the byte we hold waits for the checks below */
 				close(pack_objects.out);
 				pack_objects.out = -1;
+				continue;
 			}
 			else
 				goto fail;
 			sz += outsz;
-			if (1 < sz) {
-				buffered = data[sz-1] & 0xFF;
-				sz--;
-			}
-			else
-				buffered = -1;
-			sz = send_client_data(1, data, sz);
-			if (sz < 0)
+			buffered = data[sz-1] & 0xFF;
+			sz--;
+			if (sz && send_client_data(1, data, sz) < 0)
 				goto fail;
 		}
 	}
@@ -305,10 +356,10 @@ static void create_pack_file(void)
 		sz = send_client_data(1, data, 1);
 		if (sz < 0)
 			goto fail;
-		fprintf(stderr, "flushed.\n");
 	}
 	if (use_sideband)
 		packet_flush(1);
+	free(data);
 	return;
 
  fail:
@@ -778,6 +829,16 @@ static void upload_pack(void)
 	}
 }
 
+static int upload_pack_config(const char *var, const char *value, void *unused)
+{
+	if (!strcmp(var, "uploadpack.buffersize")) {
+		pack_buffer_size = git_config_ulong(var, value);
+		if (pack_buffer_size < LARGE_PACKET_MAX)
+			pack_buffer_size = LARGE_PACKET_MAX;
+	}
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	char *dir;
@@ -825,6 +886,7 @@ int main(int argc, char **argv)
 
 	if (!enter_repo(dir, strict))
 		die("'%s' does not appear to be a git repository", dir);
+	git_config(upload_pack_config, NULL);
 	if (is_repository_shallow())
 		die("attempt to fetch/clone from a shallow repository");
 	if (getenv("GIT_DEBUG_SEND_PACK"))
@@ -0,0 +1,17 @@
+#ifndef VARINT_H
+#define VARINT_H
+
+#include "git-compat-util.h"
+
+/*
+ * Variable length integers, seven bits to a byte with the high bit
+ * set on all but the last, the same encoding as the base offset of an
+ * OFS_DELTA in a pack.  encode_varint() returns the number of bytes it
+ * wrote to buf (at most 16), or would have written if buf is NULL.
+ * decode_varint() advances *bufp past what it read, and returns 0
+ * without advancing it if the value does not fit.
+ */
+extern int encode_varint(uintmax_t, unsigned char *);
+extern uintmax_t decode_varint(const unsigned char **);
+
+#endif /* VARINT_H */
@@ -141,6 +141,45 @@ ssize_t xwrite(int fd, const void *buf, size_t len)
 	}
 }
 
+/*
+ * xwritev() is the same as writev(), but it automatically restarts writev()
+ * operations with a recoverable error (EAGAIN and EINTR). Like xwrite(), it
+ * DOES NOT GUARANTEE that all of the vectors are written.
+ */
+ssize_t xwritev(int fd, const struct iovec *iov, int iovcnt)
+{
+	ssize_t nr;
+	while (1) {
+		nr = writev(fd, iov, iovcnt);
+		if ((nr < 0) && (errno == EAGAIN || errno == EINTR))
+			continue;
+		return nr;
+	}
+}
+
+/*
+ * xsplice() moves up to "len" bytes from the pipe "in" to "out" inside
+ * the kernel, restarting on EAGAIN and EINTR.  Where splice() is not
+ * available, or cannot be used on these file descriptors, it returns -1
+ * with errno set to EINVAL or ENOSYS and the caller should fall back to
+ * read() and write().
+ */
+ssize_t xsplice(int in, int out, size_t len)
+{
+#ifdef HAVE_SPLICE
+	ssize_t nr;
+	while (1) {
+		nr = splice(in, NULL, out, NULL, len, SPLICE_F_MOVE);
+		if ((nr < 0) && (errno == EAGAIN || errno == EINTR))
+			continue;
+		return nr;
+	}
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 ssize_t read_in_full(int fd, void *buf, size_t count)
 {
 	char *p = buf;
@@ -0,0 +1,389 @@
+/*
+ * SHA-1 for x86-64 processors.
+ *
+ * One message at a time is hashed with the SHA extensions (SHA-NI)
+ * when the processor has them.  Several messages at once are hashed
+ * with AVX2, eight lanes of 32 bits each running the rounds of their
+ * own message.  Which of these the processor can do is found out with
+ * CPUID the first time it matters; everything else is left to the
+ * block-sha1 code.
+ */
+
+#include "../cache.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define TARGET_SHA_NI __attribute__((target("sha,sse4.1,ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+static int cpu_has_sha_ni = -1;
+static int cpu_has_avx2;
+
+static void detect_cpu(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	int sse41 = 0, ssse3 = 0, ymm_state = 0;
+
+	cpu_has_sha_ni = 0;
+	cpu_has_avx2 = 0;
+	if (__get_cpuid_max(0, NULL) < 7)
+		return;
+
+	__cpuid(1, eax, ebx, ecx, edx);
+	ssse3 = (ecx >> 9) & 1;
+	sse41 = (ecx >> 19) & 1;
+	if ((ecx >> 27) & 1) {
+		/* OSXSAVE: ask the OS whether it saves the YMM registers */
+		unsigned int xcr0_lo, xcr0_hi;
+		__asm__ volatile("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+		ymm_state = (xcr0_lo & 6) == 6;
+	}
+
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	cpu_has_sha_ni = ((ebx >> 29) & 1) && sse41 && ssse3;
+	cpu_has_avx2 = ((ebx >> 5) & 1) && ymm_state;
+}
+
+static inline int use_sha_ni(void)
+{
+	if (cpu_has_sha_ni < 0)
+		detect_cpu();
+	return cpu_has_sha_ni;
+}
+
+static inline int use_avx2(void)
+{
+	if (cpu_has_sha_ni < 0)
+		detect_cpu();
+	return cpu_has_avx2;
+}
+
+/*
+ * Four rounds, numbered 4*g to 4*g+3, with the round function f.  The
+ * message words of the next groups are computed alongside, four at a
+ * time in msg[], the words of group g being in msg[g % 4].
+ */
+#define SHA_NI_GROUP(g, f) do { \
+	if ((g) == 0) \
+		e[0] = _mm_add_epi32(e[0], msg[0]); \
+	else \
+		e[(g) % 2] = _mm_sha1nexte_epu32(e[(g) % 2], msg[(g) % 4]); \
+	e[((g) + 1) % 2] = abcd; \
+	if (3 <= (g) && (g) <= 18) \
+		msg[((g) + 1) % 4] = _mm_sha1msg2_epu32(msg[((g) + 1) % 4], \
+							msg[(g) % 4]); \
+	abcd = _mm_sha1rnds4_epu32(abcd, e[(g) % 2], (f)); \
+	if (1 <= (g) && (g) <= 16) \
+		msg[((g) + 3) % 4] = _mm_sha1msg1_epu32(msg[((g) + 3) % 4], \
+							msg[(g) % 4]); \
+	if (2 <= (g) && (g) <= 17) \
+		msg[((g) + 2) % 4] = _mm_xor_si128(msg[((g) + 2) % 4], \
+						   msg[(g) % 4]); \
+} while (0)
+
+static TARGET_SHA_NI void sha_ni_blocks(unsigned int *H,
+					const unsigned char *data,
+					unsigned long nr)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL,
+					     0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e_save, e[2], msg[4];
+	int i;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)H), 0x1b);
+	e[0] = _mm_set_epi32(H[4], 0, 0, 0);
+
+	while (nr--) {
+		abcd_save = abcd;
+		e_save = e[0];
+
+		for (i = 0; i < 4; i++)
+			msg[i] = _mm_shuffle_epi8(
+				_mm_loadu_si128((const __m128i *)(data + 16 * i)),
+				bswap);
+
+		SHA_NI_GROUP(0, 0);
+		SHA_NI_GROUP(1, 0);
+		SHA_NI_GROUP(2, 0);
+		SHA_NI_GROUP(3, 0);
+		SHA_NI_GROUP(4, 0);
+		SHA_NI_GROUP(5, 1);
+		SHA_NI_GROUP(6, 1);
+		SHA_NI_GROUP(7, 1);
+		SHA_NI_GROUP(8, 1);
+		SHA_NI_GROUP(9, 1);
+		SHA_NI_GROUP(10, 2);
+		SHA_NI_GROUP(11, 2);
+		SHA_NI_GROUP(12, 2);
+		SHA_NI_GROUP(13, 2);
+		SHA_NI_GROUP(14, 2);
+		SHA_NI_GROUP(15, 3);
+		SHA_NI_GROUP(16, 3);
+		SHA_NI_GROUP(17, 3);
+		SHA_NI_GROUP(18, 3);
+		SHA_NI_GROUP(19, 3);
+
+		e[0] = _mm_sha1nexte_epu32(e[0], e_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+		data += 64;
+	}
+
+	_mm_storeu_si128((__m128i *)H, _mm_shuffle_epi32(abcd, 0x1b));
+	H[4] = _mm_extract_epi32(e[0], 3);
+}
+
+void x86_SHA1_Update(blk_SHA_CTX *ctx, const void *data, unsigned long len)
+{
+	unsigned int lenW = ctx->size & 63;
+
+	if (!use_sha_ni()) {
+		blk_SHA1_Update(ctx, data, len);
+		return;
+	}
+
+	ctx->size += len;
+
+	/* Read the data into W and process blocks as they get full */
+	if (lenW) {
+		unsigned int left = 64 - lenW;
+		if (len < left)
+			left = len;
+		memcpy(lenW + (char *)ctx->W, data, left);
+		lenW = (lenW + left) & 63;
+		len -= left;
+		data = ((const char *)data + left);
+		if (lenW)
+			return;
+		sha_ni_blocks(ctx->H, (const unsigned char *)ctx->W, 1);
+	}
+	if (len >= 64) {
+		sha_ni_blocks(ctx->H, data, len / 64);
+		data = ((const char *)data + (len & ~63UL));
+		len &= 63;
+	}
+	if (len)
+		memcpy(ctx->W, data, len);
+}
+
+void x86_SHA1_Final(unsigned char hashout[20], blk_SHA_CTX *ctx)
+{
+	static const unsigned char pad[64] = { 0x80 };
+	unsigned int padlen[2];
+	int i;
+
+	if (!use_sha_ni()) {
+		blk_SHA1_Final(hashout, ctx);
+		return;
+	}
+
+	/* Pad with a binary 1 (ie 0x80), then zeroes, then length */
+	padlen[0] = htonl((uint32_t)(ctx->size >> 29));
+	padlen[1] = htonl((uint32_t)(ctx->size << 3));
+
+	i = ctx->size & 63;
+	x86_SHA1_Update(ctx, pad, 1 + (63 & (55 - i)));
+	x86_SHA1_Update(ctx, padlen, 8);
+
+	/* Output hash */
+	for (i = 0; i < 5; i++) {
+		uint32_t h = htonl(ctx->H[i]);
+		memcpy(hashout + i * 4, &h, 4);
+	}
+}
+
+/*
+ * A message of a batch, as seen by one lane: the header, the buffer
+ * and then the padding, cut into blocks of 64 bytes.
+ */
+struct sha1_lane {
+	const unsigned char *hdr, *buf;
+	unsigned long hdrlen, total, nr_blocks;
+	unsigned char scratch[64];
+};
+
+static const unsigned char *lane_block(struct sha1_lane *lane, unsigned long nr)
+{
+	unsigned long start = nr * 64, end = start + 64, from, to;
+	unsigned char *block = lane->scratch;
+
+	/* most blocks are entirely within the buffer */
+	if (lane->hdrlen <= start && end <= lane->total)
+		return lane->buf + (start - lane->hdrlen);
+
+	memset(block, 0, 64);
+	if (start < lane->hdrlen) {
+		to = lane->hdrlen < end ? lane->hdrlen : end;
+		memcpy(block, lane->hdr + start, to - start);
+	}
+	from = lane->hdrlen > start ? lane->hdrlen : start;
+	to = lane->total < end ? lane->total : end;
+	if (from < to)
+		memcpy(block + (from - start), lane->buf + (from - lane->hdrlen),
+		       to - from);
+	if (start <= lane->total && lane->total < end)
+		block[lane->total - start] = 0x80;
+	if (nr == lane->nr_blocks - 1) {
+		uint32_t bits;
+		bits = htonl((uint32_t)(lane->total >> 29));
+		memcpy(block + 56, &bits, 4);
+		bits = htonl((uint32_t)(lane->total << 3));
+		memcpy(block + 60, &bits, 4);
+	}
+	return block;
+}
+
+#define MB_ROL(x, n) _mm256_or_si256(_mm256_slli_epi32((x), (n)), \
+				     _mm256_srli_epi32((x), 32 - (n)))
+
+#define MB_W(t) (w[(t) & 15] = MB_ROL(_mm256_xor_si256( \
+	_mm256_xor_si256(w[((t) - 3) & 15], w[((t) - 8) & 15]), \
+	_mm256_xor_si256(w[((t) - 14) & 15], w[(t) & 15])), 1))
+
+#define MB_ROUND(f, k, wt) do { \
+	__m256i temp = _mm256_add_epi32( \
+		_mm256_add_epi32(MB_ROL(a, 5), (f)), \
+		_mm256_add_epi32(_mm256_add_epi32(e, (k)), (wt))); \
+	e = d; d = c; c = MB_ROL(b, 30); b = a; a = temp; \
+} while (0)
+
+#define MB_F0 _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)))
+#define MB_F1 _mm256_xor_si256(_mm256_xor_si256(b, c), d)
+#define MB_F2 _mm256_or_si256(_mm256_and_si256(b, c), \
+			      _mm256_and_si256(d, _mm256_or_si256(b, c)))
+
+static TARGET_AVX2 void avx2_batch(struct sha1_batch_entry *entry, int nr)
+{
+	static const unsigned char zero_block[64];
+	const __m256i bswap = _mm256_set_epi8(
+		12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+		12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	const __m256i k0 = _mm256_set1_epi32(0x5a827999);
+	const __m256i k1 = _mm256_set1_epi32(0x6ed9eba1);
+	const __m256i k2 = _mm256_set1_epi32(0x8f1bbcdc);
+	const __m256i k3 = _mm256_set1_epi32(0xca62c1d6);
+	struct sha1_lane lane[8];
+	unsigned long i, max_blocks = 0;
+	__m256i h[5];
+	uint32_t out[5][8];
+	int l, t;
+
+	for (l = 0; l < nr; l++) {
+		lane[l].hdr = (const unsigned char *)entry[l].hdr;
+		lane[l].hdrlen = entry[l].hdrlen;
+		lane[l].buf = entry[l].buf;
+		lane[l].total = entry[l].hdrlen + entry[l].len;
+		lane[l].nr_blocks = (lane[l].total + 8) / 64 + 1;
+		if (max_blocks < lane[l].nr_blocks)
+			max_blocks = lane[l].nr_blocks;
+	}
+
+	h[0] = _mm256_set1_epi32(0x67452301);
+	h[1] = _mm256_set1_epi32(0xefcdab89);
+	h[2] = _mm256_set1_epi32(0x98badcfe);
+	h[3] = _mm256_set1_epi32(0x10325476);
+	h[4] = _mm256_set1_epi32(0xc3d2e1f0);
+
+	for (i = 0; i < max_blocks; i++) {
+		const unsigned char *p[8];
+		int32_t active[8];
+		__m256i w[16], a, b, c, d, e, mask;
+
+		for (l = 0; l < 8; l++) {
+			if (l < nr && i < lane[l].nr_blocks) {
+				p[l] = lane_block(&lane[l], i);
+				active[l] = -1;
+			} else {
+				p[l] = zero_block;
+				active[l] = 0;
+			}
+		}
+		for (t = 0; t < 16; t++) {
+			int32_t word[8];
+			for (l = 0; l < 8; l++)
+				memcpy(&word[l], p[l] + 4 * t, 4);
+			w[t] = _mm256_shuffle_epi8(
+				_mm256_loadu_si256((const __m256i *)word), bswap);
+		}
+
+		a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+		for (t = 0; t < 16; t++)
+			MB_ROUND(MB_F0, k0, w[t]);
+		for (; t < 20; t++)
+			MB_ROUND(MB_F0, k0, MB_W(t));
+		for (; t < 40; t++)
+			MB_ROUND(MB_F1, k1, MB_W(t));
+		for (; t < 60; t++)
+			MB_ROUND(MB_F2, k2, MB_W(t));
+		for (; t < 80; t++)
+			MB_ROUND(MB_F1, k3, MB_W(t));
+
+		/* lanes whose message has ended keep their hash */
+		mask = _mm256_loadu_si256((const __m256i *)active);
+		h[0] = _mm256_blendv_epi8(h[0], _mm256_add_epi32(h[0], a), mask);
+		h[1] = _mm256_blendv_epi8(h[1], _mm256_add_epi32(h[1], b), mask);
+		h[2] = _mm256_blendv_epi8(h[2], _mm256_add_epi32(h[2], c), mask);
+		h[3] = _mm256_blendv_epi8(h[3], _mm256_add_epi32(h[3], d), mask);
+		h[4] = _mm256_blendv_epi8(h[4], _mm256_add_epi32(h[4], e), mask);
+	}
+
+	for (t = 0; t < 5; t++)
+		_mm256_storeu_si256((__m256i *)out[t], h[t]);
+	for (l = 0; l < nr; l++)
+		for (t = 0; t < 5; t++) {
+			uint32_t v = htonl(out[t][l]);
+			memcpy(entry[l].sha1 + 4 * t, &v, 4);
+		}
+}
+
+void x86_SHA1_Batch(struct sha1_batch_entry *entry, int nr)
+{
+	int i;
+
+	if (use_avx2() && !use_sha_ni()) {
+		for (i = 0; i + 1 < nr; i += 8)
+			avx2_batch(entry + i, nr - i < 8 ? nr - i : 8);
+		if (i == nr)
+			return;
+		entry += i;
+		nr -= i;
+	}
+	for (i = 0; i < nr; i++) {
+		blk_SHA_CTX c;
+
+		blk_SHA1_Init(&c);
+		x86_SHA1_Update(&c, entry[i].hdr, entry[i].hdrlen);
+		x86_SHA1_Update(&c, entry[i].buf, entry[i].len);
+		x86_SHA1_Final(entry[i].sha1, &c);
+	}
+}
+
+#else
+
+void x86_SHA1_Update(blk_SHA_CTX *ctx, const void *data, unsigned long len)
+{
+	blk_SHA1_Update(ctx, data, len);
+}
+
+void x86_SHA1_Final(unsigned char hashout[20], blk_SHA_CTX *ctx)
+{
+	blk_SHA1_Final(hashout, ctx);
+}
+
+void x86_SHA1_Batch(struct sha1_batch_entry *entry, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		blk_SHA_CTX c;
+
+		blk_SHA1_Init(&c);
+		blk_SHA1_Update(&c, entry[i].hdr, entry[i].hdrlen);
+		blk_SHA1_Update(&c, entry[i].buf, entry[i].len);
+		blk_SHA1_Final(entry[i].sha1, &c);
+	}
+}
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ * SHA-1 for x86-64 processors, using the SHA extensions to hash one
+ * message and AVX2 to hash several messages at once, when the
+ * processor has them.  The context is that of block-sha1, which does
+ * the work on processors that have neither.
+ */
+#include "../block-sha1/sha1.h"
+
+struct sha1_batch_entry;
+
+void x86_SHA1_Update(blk_SHA_CTX *ctx, const void *dataIn, unsigned long len);
+void x86_SHA1_Final(unsigned char hashout[20], blk_SHA_CTX *ctx);
+void x86_SHA1_Batch(struct sha1_batch_entry *, int nr);
+
+#undef git_SHA1_Update
+#undef git_SHA1_Final
+#define git_SHA1_Update	x86_SHA1_Update
+#define git_SHA1_Final	x86_SHA1_Final
+#define platform_SHA1_Batch	x86_SHA1_Batch
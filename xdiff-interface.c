@@ -126,6 +126,17 @@ static void trim_common_tail(mmfile_t *a, mmfile_t *b, long ctx)
 	b->size -= trimmed - recovered;
 }
 
+/*
+ * Inputs larger than core.bigDiffThreshold are split into chunks at
+ * lines unique to both sides, and each chunk is diffed on its own.
+ */
+int xdiff_large_input(mmfile_t *mf1, mmfile_t *mf2)
+{
+	return big_diff_threshold &&
+		(big_diff_threshold <= mf1->size ||
+		 big_diff_threshold <= mf2->size);
+}
+
 int xdi_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdemitconf_t const *xecfg, xdemitcb_t *xecb)
 {
 	mmfile_t a = *mf1;
@@ -133,6 +144,12 @@ int xdi_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdemitconf_t co
 
 	trim_common_tail(&a, &b, xecfg->ctxlen);
 
+	if (xdiff_large_input(&a, &b)) {
+		xpparam_t large = *xpp;
+
+		large.flags |= XDF_LARGE_INPUT;
+		return xdl_diff(&a, &b, &large, xecfg, xecb);
+	}
 	return xdl_diff(&a, &b, xpp, xecfg, xecb);
 }
 
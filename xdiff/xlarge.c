@@ -0,0 +1,231 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003-2009 Davide Libenzi, Johannes E. Schindelin
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+#include "xinclude.h"
+
+/*
+ * Diffing huge inputs in one go costs memory proportional to the whole
+ * files in every algorithm, and the Myers algorithm gives up on finding
+ * a good diff once its cost limit is hit.  In "large input" mode we
+ * instead look for lines that are unique in both files, take the
+ * longest sequence of them that appears in the same order on both sides
+ * (like patience diff does), and use some of them as anchors to cut the
+ * files into chunks of about XDL_LARGE_CHUNK lines.  The anchors are
+ * common lines, so each pair of chunks can be diffed on its own with the
+ * requested algorithm, and the changes found simply add up.
+ */
+
+#define XDL_LARGE_CHUNK (1 << 14)
+
+#define POS_NONE (-1)
+#define POS_MANY (-2)
+
+struct anchors {
+	long nr;
+	long *line1, *line2;
+};
+
+static void note_position(long *pos, unsigned long c, long line) {
+	if (pos[c] == POS_NONE)
+		pos[c] = line;
+	else
+		pos[c] = POS_MANY;
+}
+
+/*
+ * Collect the lines that are unique in both files, in the order of the
+ * first file, and keep the longest subsequence that is also ordered in
+ * the second one.
+ */
+static int find_anchors(xdfenv_t *env, struct anchors *anchors) {
+	xdfile_t *xdf1 = &env->xdf1, *xdf2 = &env->xdf2;
+	long i, nclass = 0, nr = 0, longest = 0;
+	long *pos1 = NULL, *pos2 = NULL, *tail = NULL, *prev = NULL;
+	long *line1 = NULL, *line2 = NULL;
+	int ret = -1;
+
+	for (i = 0; i < xdf1->nrec; i++)
+		if (nclass <= (long) xdf1->recs[i]->ha)
+			nclass = xdf1->recs[i]->ha + 1;
+	for (i = 0; i < xdf2->nrec; i++)
+		if (nclass <= (long) xdf2->recs[i]->ha)
+			nclass = xdf2->recs[i]->ha + 1;
+
+	if (!(pos1 = (long *) xdl_malloc((nclass + 1) * sizeof(long))) ||
+	    !(pos2 = (long *) xdl_malloc((nclass + 1) * sizeof(long))))
+		goto out;
+	for (i = 0; i < nclass; i++)
+		pos1[i] = pos2[i] = POS_NONE;
+	for (i = xdf1->dstart; i <= xdf1->dend; i++)
+		note_position(pos1, xdf1->recs[i]->ha, i);
+	for (i = xdf2->dstart; i <= xdf2->dend; i++)
+		note_position(pos2, xdf2->recs[i]->ha, i);
+
+	for (i = xdf1->dstart; i <= xdf1->dend; i++) {
+		unsigned long c = xdf1->recs[i]->ha;
+		if (pos1[c] == i && 0 <= pos2[c])
+			nr++;
+	}
+	if (!nr) {
+		ret = 0;
+		goto out;
+	}
+
+	if (!(line1 = (long *) xdl_malloc(nr * sizeof(long))) ||
+	    !(line2 = (long *) xdl_malloc(nr * sizeof(long))) ||
+	    !(tail = (long *) xdl_malloc(nr * sizeof(long))) ||
+	    !(prev = (long *) xdl_malloc(nr * sizeof(long))))
+		goto out;
+
+	/*
+	 * Patience sorting: tail[k] is the candidate with the smallest
+	 * line in the second file that ends an increasing sequence of
+	 * length k + 1.
+	 */
+	nr = 0;
+	for (i = xdf1->dstart; i <= xdf1->dend; i++) {
+		unsigned long c = xdf1->recs[i]->ha;
+		long lo = 0, hi = longest;
+
+		if (pos1[c] != i || pos2[c] < 0)
+			continue;
+		line1[nr] = i;
+		line2[nr] = pos2[c];
+		while (lo < hi) {
+			long mi = (lo + hi) / 2;
+			if (line2[tail[mi]] < line2[nr])
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+		prev[nr] = lo ? tail[lo - 1] : -1;
+		tail[lo] = nr;
+		if (lo == longest)
+			longest++;
+		nr++;
+	}
+
+	/* Walk the longest sequence back, compacting it in place */
+	anchors->nr = longest;
+	for (i = tail[longest - 1]; 0 <= i; i = prev[i]) {
+		longest--;
+		tail[longest] = i;
+	}
+	for (i = 0; i < anchors->nr; i++) {
+		prev[i] = line2[tail[i]];
+		tail[i] = line1[tail[i]];
+	}
+	anchors->line1 = tail;
+	anchors->line2 = prev;
+	tail = prev = NULL;
+	ret = 0;
+
+out:
+	xdl_free(pos1);
+	xdl_free(pos2);
+	xdl_free(line1);
+	xdl_free(line2);
+	xdl_free(tail);
+	xdl_free(prev);
+	return ret;
+}
+
+/* Diff lines [s1, e1) against [s2, e2), counting from 0 */
+static int diff_chunk(xdfenv_t *env, xpparam_t const *xpp,
+		      long s1, long e1, long s2, long e2) {
+	if (s1 == e1) {
+		for (; s2 < e2; s2++)
+			env->xdf2.rchg[s2] = 1;
+		return 0;
+	}
+	if (s2 == e2) {
+		for (; s1 < e1; s1++)
+			env->xdf1.rchg[s1] = 1;
+		return 0;
+	}
+	return xdl_fall_back_diff(env, xpp, s1 + 1, e1 - s1, s2 + 1, e2 - s2);
+}
+
+int xdl_do_large_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		      xdfenv_t *env) {
+	xpparam_t prep, sub;
+	struct anchors anchors;
+	long i, s1, s2, cut;
+
+	/*
+	 * The whole files are only classified, so that unique lines can
+	 * be found; each chunk is then diffed with the algorithm that
+	 * was asked for.
+	 */
+	prep.flags = xpp->flags & ~(XDF_LARGE_INPUT | XDF_PATIENCE_DIFF |
+				    XDF_HISTOGRAM_DIFF);
+	sub.flags = xpp->flags & ~XDF_LARGE_INPUT;
+
+	if (xdl_prepare_env(mf1, mf2, &prep, env) < 0)
+		return -1;
+
+	memset(&anchors, 0, sizeof(anchors));
+	if (find_anchors(env, &anchors) < 0) {
+		xdl_free_env(env);
+		return -1;
+	}
+
+	/*
+	 * Cut at the last anchor that keeps both sides of a chunk within
+	 * XDL_LARGE_CHUNK lines, or at the first one past it if there is
+	 * no such anchor.
+	 */
+	s1 = env->xdf1.dstart;
+	s2 = env->xdf2.dstart;
+	cut = -1;
+	for (i = 0; i <= anchors.nr; i++) {
+		if (i < anchors.nr &&
+		    anchors.line1[i] - s1 < XDL_LARGE_CHUNK &&
+		    anchors.line2[i] - s2 < XDL_LARGE_CHUNK) {
+			cut = i;
+			continue;
+		}
+		if (cut < 0 && i < anchors.nr)
+			cut = i;
+		if (0 <= cut) {
+			if (diff_chunk(env, &sub, s1, anchors.line1[cut],
+				       s2, anchors.line2[cut]) < 0)
+				goto fail;
+			s1 = anchors.line1[cut] + 1;
+			s2 = anchors.line2[cut] + 1;
+			i = cut;
+			cut = -1;
+		}
+	}
+	if (diff_chunk(env, &sub, s1, env->xdf1.dend + 1,
+		       s2, env->xdf2.dend + 1) < 0)
+		goto fail;
+
+	xdl_free(anchors.line1);
+	xdl_free(anchors.line2);
+	return 0;
+
+fail:
+	xdl_free(anchors.line1);
+	xdl_free(anchors.line2);
+	xdl_free_env(env);
+	return -1;
+}
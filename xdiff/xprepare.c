@@ -31,7 +31,6 @@
 
 
 typedef struct s_xdlclass {
-	struct s_xdlclass *next;
 	unsigned long ha;
 	char const *line;
 	long size;
@@ -39,10 +38,20 @@ typedef struct s_xdlclass {
 	long len1, len2;
 } xdlclass_t;
 
+/*
+ * The classes live in an open-addressed table.  Each slot caches the
+ * full hash of its class, so probing past a slot rarely needs to look
+ * at the class, let alone compare lines.
+ */
+typedef struct s_xdlclassslot {
+	unsigned long ha;
+	xdlclass_t *rcrec;
+} xdlclassslot_t;
+
 typedef struct s_xdlclassifier {
 	unsigned int hbits;
 	long hsize;
-	xdlclass_t **rchash;
+	xdlclassslot_t *rchash;
 	chastore_t ncha;
 	xdlclass_t **rcrecs;
 	long alloc;
@@ -71,19 +80,20 @@ static int xdl_optimize_ctxs(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xdf2
 static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags) {
 	cf->flags = flags;
 
-	cf->hbits = xdl_hashbits((unsigned int) size);
+	/* Keep the table at most half full */
+	cf->hbits = xdl_hashbits((unsigned int) size) + 1;
 	cf->hsize = 1 << cf->hbits;
 
 	if (xdl_cha_init(&cf->ncha, sizeof(xdlclass_t), size / 4 + 1) < 0) {
 
 		return -1;
 	}
-	if (!(cf->rchash = (xdlclass_t **) xdl_malloc(cf->hsize * sizeof(xdlclass_t *)))) {
+	if (!(cf->rchash = (xdlclassslot_t *) xdl_malloc(cf->hsize * sizeof(xdlclassslot_t)))) {
 
 		xdl_cha_free(&cf->ncha);
 		return -1;
 	}
-	memset(cf->rchash, 0, cf->hsize * sizeof(xdlclass_t *));
+	memset(cf->rchash, 0, cf->hsize * sizeof(xdlclassslot_t));
 
 	cf->alloc = size;
 	if (!(cf->rcrecs = (xdlclass_t **) xdl_malloc(cf->alloc * sizeof(xdlclass_t *)))) {
@@ -107,20 +117,52 @@ static void xdl_free_classifier(xdlclassifier_t *cf) {
 }
 
 
+static int xdl_grow_classifier(xdlclassifier_t *cf) {
+	unsigned int hbits = cf->hbits + 1;
+	long i, hi, hsize = 1L << hbits;
+	xdlclassslot_t *rchash;
+
+	if (!(rchash = (xdlclassslot_t *) xdl_malloc(hsize * sizeof(xdlclassslot_t))))
+		return -1;
+	memset(rchash, 0, hsize * sizeof(xdlclassslot_t));
+
+	for (i = 0; i < cf->hsize; i++) {
+		if (!cf->rchash[i].rcrec)
+			continue;
+		hi = (long) XDL_HASHLONG(cf->rchash[i].ha, hbits);
+		while (rchash[hi].rcrec)
+			hi = (hi + 1) & (hsize - 1);
+		rchash[hi] = cf->rchash[i];
+	}
+
+	xdl_free(cf->rchash);
+	cf->rchash = rchash;
+	cf->hbits = hbits;
+	cf->hsize = hsize;
+
+	return 0;
+}
+
+
 static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t **rhash,
 			       unsigned int hbits, xrecord_t *rec) {
 	long hi;
 	char const *line;
 	xdlclass_t *rcrec;
 	xdlclass_t **rcrecs;
+	xdlclassslot_t *slot;
 
 	line = rec->ptr;
 	hi = (long) XDL_HASHLONG(rec->ha, cf->hbits);
-	for (rcrec = cf->rchash[hi]; rcrec; rcrec = rcrec->next)
-		if (rcrec->ha == rec->ha &&
-				xdl_recmatch(rcrec->line, rcrec->size,
-					rec->ptr, rec->size, cf->flags))
+	for (;; hi = (hi + 1) & (cf->hsize - 1)) {
+		slot = &cf->rchash[hi];
+		rcrec = slot->rcrec;
+		if (!rcrec ||
+		    (slot->ha == rec->ha &&
+		     xdl_recmatch(rcrec->line, rcrec->size,
+				  rec->ptr, rec->size, cf->flags)))
 			break;
+	}
 
 	if (!rcrec) {
 		if (!(rcrec = xdl_cha_alloc(&cf->ncha))) {
@@ -141,8 +183,10 @@ static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t
 		rcrec->size = rec->size;
 		rcrec->ha = rec->ha;
 		rcrec->len1 = rcrec->len2 = 0;
-		rcrec->next = cf->rchash[hi];
-		cf->rchash[hi] = rcrec;
+		slot->ha = rec->ha;
+		slot->rcrec = rcrec;
+		if (cf->count * 2 > cf->hsize && xdl_grow_classifier(cf) < 0)
+			return -1;
 	}
 
 	(pass == 1) ? rcrec->len1++ : rcrec->len2++;
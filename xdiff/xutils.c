@@ -277,6 +277,84 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 }
 
 
+#ifdef XDL_FAST_HASH
+
+#define REPEAT_BYTE(x)	((~0ul / 0xff) * (x))
+
+#define ONEBYTES	REPEAT_BYTE(0x01)
+#define NEWLINEBYTES	REPEAT_BYTE(0x0a)
+#define HIGHBITS	REPEAT_BYTE(0x80)
+
+/*
+ * Set the high bit of the bytes of "a" that are zero.  A byte above a
+ * zero byte may be flagged by mistake because of the borrow, but on a
+ * little-endian machine the lowest flagged byte, which is the first
+ * one in memory, is always right.
+ */
+static inline unsigned long has_zero(unsigned long a) {
+	return ((a - ONEBYTES) & ~a) & HIGHBITS;
+}
+
+static inline long first_flagged_byte(unsigned long mask) {
+#if defined(__GNUC__)
+	return __builtin_ctzl(mask) >> 3;
+#else
+	long n = 0;
+
+	while (!(mask & 0x80)) {
+		mask >>= 8;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/*
+ * Hash a machine word at a time, looking for the end of the line in
+ * all of its bytes at once.  The hash is only ever compared with other
+ * hashes computed the same way, so it does not need to match the
+ * byte-wise one below.
+ */
+unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
+	unsigned long ha = 5381, a = 0, mask = 0;
+	char const *ptr = *data;
+	long n;
+
+	if (flags & XDF_WHITESPACE_FLAGS)
+		return xdl_hash_record_with_whitespace(data, top, flags);
+
+	for (;;) {
+		if (top - ptr < (long) sizeof(unsigned long))
+			break;
+		a = *(const unsigned long *) ptr;
+		mask = has_zero(a ^ NEWLINEBYTES);
+		if (mask)
+			break;
+		ha = (ha + a) * 11;
+		ptr += sizeof(unsigned long);
+	}
+
+	if (mask) {
+		n = first_flagged_byte(mask);
+	} else {
+		/*
+		 * Less than a word is left before the end of the buffer,
+		 * which may be the end of a mapping; read it byte by byte.
+		 */
+		a = 0;
+		for (n = 0; ptr + n < top && ptr[n] != '\n'; n++)
+			a |= (unsigned long) (unsigned char) ptr[n] << (8 * n);
+	}
+	if (n)
+		ha = (ha + (a & ((1ul << (8 * n)) - 1))) * 11 + n;
+	ptr += n;
+	*data = ptr < top ? ptr + 1: ptr;
+
+	return ha;
+}
+
+#else
+
 unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
 	unsigned long ha = 5381;
 	char const *ptr = *data;
@@ -293,6 +371,8 @@ unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
 	return ha;
 }
 
+#endif
+
 
 unsigned int xdl_hashbits(unsigned int size) {
 	unsigned int val = 1, bits = 0;